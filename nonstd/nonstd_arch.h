@@ -12,6 +12,12 @@
 #define NONSTD_ARCH_API 
 #endif
 
+// clock_gettime() and CLOCK_MONOTONIC are POSIX, which strict C modes 
+// (-std=c99, -std=c11) hide unless asked for before the first system header.
+#if !defined(_WIN32) && defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
 #include <stdint.h>
 
 
@@ -25,6 +31,7 @@
 	Very low-overhead high resolution timer.
 	The units aren't guaranteed to be any particular thing
 	(use cpu_time_to_sec() to convert a difference of times to seconds).
+	This is the TSC on x86-64 and the generic timer (cntvct_el0) on aarch64.
 */
 static uint64_t
 read_cpu_timer(void) 
@@ -32,16 +39,30 @@ read_cpu_timer(void)
 #if   defined(__x86_64__)
 	return __builtin_ia32_rdtsc(); 
 #elif defined (__aarch64__)
-	return __builtin_readcyclecounter();
+	uint64_t t;
+	__asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
 #else
 	return 0;
 #endif 
 }
 
 
+/*
+	Returns the frequency of read_cpu_timer() in counts per second.
+
+	The first call works out the frequency: from cntfrq_el0 on aarch64, and 
+	on x86-64 from CPUID (leaf 0x15, or the hypervisor's timing leaf) or the
+	kernel if they know it. Failing that, it estimates from CPUID leaf 0x16 
+	or a 5ms calibration against the OS timer, and calls made after the 
+	first second re-measure it once over that longer interval. 
+	So the value may change (slightly) once, early on.
+*/
+NONSTD_ARCH_API double get_cpu_timer_freq(void);
+
 /* 
 	Converts a difference of values from read_cpu_timer() to (approx) seconds. 
-	Will block for 100ms the first time it's called!!!
+	May block for up to 5ms the first time it's called (see above).
 */
 NONSTD_ARCH_API double cpu_time_to_sec(uint64_t cpu_time_elapsed) ;
 
@@ -49,7 +70,7 @@ NONSTD_ARCH_API double cpu_time_to_sec(uint64_t cpu_time_elapsed) ;
 	Return wall-clock time in seconds. 
 	What point is defined as "zero" time is undefined,
 	so differences are meaningful but not an individual time. 
-	Uses cpu_time_to_sec, so be aware of the one time 100ms block.
+	Uses read_cpu_timer, so be aware of the possible 5ms block on first use.
 */
 NONSTD_ARCH_API double get_wtime(void); 
 
@@ -60,11 +81,174 @@ NONSTD_ARCH_API double get_wtime(void);
 NONSTD_ARCH_API uint64_t get_os_timer_freq(void);
 
 /*
-	Query the current OS time. Zero reference time is not guaranteed to be any particular thing
+	Query the current OS time, from a monotonic clock (it doesn't jump when the 
+	system time is changed). Nanoseconds on unix-likes. Zero reference time is 
+	not guaranteed to be any particular thing.
 */
 NONSTD_ARCH_API uint64_t read_os_timer(void);
 
 
+/*
+	Hardware performance counters (Linux only).
+
+	perf_counters_open opens a group of counters (the PERFCTR_* list below)
+	for the calling thread, counting user-space events only. It returns how
+	many of them it could open: zero if perf isn't available (other OSes, no
+	PMU in a VM, perf_event_paranoid too strict, ...). Counters that didn't 
+	open just read as zero, so you can use the results unconditionally;
+	perf_counters_available tells you which ones are real.
+
+	perf_counters_read fills values[PERFCTR_COUNT] with the counts since the
+	counters were opened (so take differences). It uses the rdpmc 
+	instruction when the kernel allows it for every hardware counter in the
+	group (x86-64), which is much cheaper than the read() system call 
+	otherwise used. Counts are scaled up if the kernel had to multiplex the
+	counters. Software counters (page faults) are kept out of the group and
+	always cost a read() each, since rdpmc can't see them.
+
+	A PerfCounters belongs to the thread that opened it.
+*/
+enum {
+	PERFCTR_CYCLES,
+	PERFCTR_INSTRUCTIONS,
+	PERFCTR_L1D_MISSES,
+	PERFCTR_CACHE_MISSES,   // last level cache
+	PERFCTR_BRANCH_MISSES,
+	PERFCTR_PAGE_FAULTS,
+	PERFCTR_COUNT
+};
+
+typedef struct {
+	int n;                      // how many counters are open
+	int fd[PERFCTR_COUNT];      // -1 if not open, fd[leader] leads the group
+	int leader;
+	int use_rdpmc;
+	unsigned solo;              // bit i: fd[i] is a software counter outside the group
+	uint64_t id[PERFCTR_COUNT];
+	void *page[PERFCTR_COUNT];  // mmapped perf_event_mmap_page, for rdpmc
+} PerfCounters;
+
+NONSTD_ARCH_API int  perf_counters_open(PerfCounters *pc);
+NONSTD_ARCH_API void perf_counters_read(PerfCounters *pc, uint64_t values[PERFCTR_COUNT]);
+NONSTD_ARCH_API void perf_counters_close(PerfCounters *pc);
+NONSTD_ARCH_API int  perf_counters_available(PerfCounters *pc, int counter);
+NONSTD_ARCH_API const char *perf_counter_name(int counter);
+
+/*
+	Instrumenting block profiler.
+
+	Put PROFILE_BLOCK("name") at the top of a scope (or PROFILE_FUNCTION at the
+	top of a function) and the time spent until the end of that scope gets 
+	attributed to "name". Blocks nest: each anchor (name) tracks
+	- exclusive time: time in the block, minus time in profiled blocks inside it
+	- inclusive time: time in the block including its children (recursion is
+	  handled, a block that calls itself isn't counted twice)
+	- hit count
+	- bytes: PROFILE_BANDWIDTH("name", bytes) is PROFILE_BLOCK that also adds
+	  `bytes` to the anchor's byte count, so the report can show throughput.
+
+	The profiler is compiled in only if NONSTD_PROFILER is defined (before
+	including this file); otherwise these macros expand to nothing. The
+	automatic scope end relies on the cleanup attribute, so with compilers 
+	other than gcc and clang the macros always expand to nothing (you can 
+	still call profile_block_begin/end manually).
+
+	Usage:
+		profile_begin();
+		run_the_program();
+		profile_print_report(); // or profile_report() to get the text
+
+	profile_begin() zeros the counters and starts the total-time clock.
+	profile_report() writes the report into `buf` like snprintf does (and 
+	returns the length it needs).
+
+	Anchors register themselves the first time they're hit, in a table of
+	PROFILE_MAX_ANCHORS names. Each thread keeps its own counters (no locks
+	or atomics on the hot path), and the report merges them: the times are 
+	summed over threads, so percentages of the total (wall clock) time can 
+	add up to more than 100% in multithreaded programs. profile_merge gives 
+	you the merged numbers directly, indexed by anchor. Call profile_begin 
+	and profile_merge while no other threads are inside profiled blocks.
+
+	Blocking queue waits (see BlockingConcurrentQueue) are profiled 
+	automatically, so pipeline stalls show up in reports and traces.
+
+	profile_use_counters(1) makes each thread open hardware performance 
+	counters (see above) the next time it enters a block, and blocks then 
+	also accumulate the counters' exclusive deltas. The report adds IPC and
+	miss counts (per KB for bandwidth blocks, per hit otherwise). Reading 
+	the counters on every block costs extra time (a lot without rdpmc).
+*/
+#ifndef PROFILE_MAX_ANCHORS
+#define PROFILE_MAX_ANCHORS 1024
+#endif
+#ifndef PROFILE_MAX_THREADS
+#define PROFILE_MAX_THREADS 256
+#endif
+
+typedef struct {
+	uint64_t exclusive;
+	uint64_t inclusive;
+	uint64_t hits;
+	uint64_t bytes;
+	uint64_t counters[PERFCTR_COUNT]; // exclusive, only with profile_use_counters
+	const char *name;
+} ProfileAnchor;
+
+typedef struct {
+	uint64_t start;
+	uint64_t old_inclusive;
+	uint32_t anchor;
+	uint32_t parent;
+	int counting;
+	uint64_t counters[PERFCTR_COUNT];
+} ProfileBlock;
+
+NONSTD_ARCH_API ProfileBlock profile_block_begin(uint32_t *anchor, const char *name, uint64_t bytes);
+NONSTD_ARCH_API void         profile_block_end(ProfileBlock *b);
+
+NONSTD_ARCH_API void    profile_begin(void);
+NONSTD_ARCH_API int64_t profile_report(char *buf, int64_t bufsz);
+NONSTD_ARCH_API void    profile_print_report(void);
+NONSTD_ARCH_API ProfileAnchor *profile_merge(int *count);
+NONSTD_ARCH_API void    profile_use_counters(int enable);
+
+/*
+	Tracing. Between profile_trace_begin() and profile_trace_end(), every 
+	profiled block that ends also gets logged, with its start and end time,
+	into a ring buffer owned by the thread (the newest PROFILE_TRACE_EVENTS
+	per thread are kept, no locks). profile_trace_json merges them into 
+	Chrome's trace event JSON format, which chrome://tracing and Perfetto 
+	(ui.perfetto.dev) can open, writing into `buf` like snprintf does. 
+	With nonstd_base.h, profile_trace_write_file does that straight to a file.
+
+	Call profile_trace_begin while no other threads are inside profiled
+	blocks (e.g. before starting them). profile_trace_json can run while 
+	the other threads keep going, but events logged meanwhile may be torn 
+	(it's best to call profile_trace_end and join them first).
+*/
+#ifndef PROFILE_TRACE_EVENTS
+#define PROFILE_TRACE_EVENTS (1<<16) // power of 2
+#endif
+
+NONSTD_ARCH_API void    profile_trace_begin(void);
+NONSTD_ARCH_API void    profile_trace_end(void);
+NONSTD_ARCH_API int64_t profile_trace_json(char *buf, int64_t bufsz);
+
+#if defined(NONSTD_PROFILER) && (defined(__GNUC__) || defined(__clang__))
+#define PROFILE_CONCAT_(a,b) a ## b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_(a,b)
+#define PROFILE_BANDWIDTH(name, bytes) \
+	static uint32_t PROFILE_CONCAT(profile_anchor_, __LINE__) = 0; \
+	ProfileBlock PROFILE_CONCAT(profile_block_, __LINE__) __attribute__((cleanup(profile_block_end))) = \
+		profile_block_begin(&PROFILE_CONCAT(profile_anchor_, __LINE__), (name), (bytes))
+#else
+#define PROFILE_BANDWIDTH(name, bytes)
+#endif
+
+#define PROFILE_BLOCK(name) PROFILE_BANDWIDTH(name, 0)
+#define PROFILE_FUNCTION PROFILE_BLOCK(__func__)
+
 
 /* 
    ============================================================================
@@ -117,6 +301,63 @@ NONSTD_ARCH_API void queue_pop_commit(uint32_t *q);
 NONSTD_ARCH_API int  queue_mpop(uint32_t *q, int exp, uint32_t *save);
 NONSTD_ARCH_API int  queue_mpop_commit(uint32_t *q, uint32_t save);
 
+/*
+	Wide variant of the above queue. The head and tail are packed into the
+	32-bit halves of a uint64_t (rather than 16-bit halves of a uint32_t),
+	so the queue can have up to 2^31 slots (i.e. exp <= 31) instead of 2^15.
+	Usage is otherwise identical.
+*/
+NONSTD_ARCH_API int64_t queue64_push(uint64_t *q, int exp);
+NONSTD_ARCH_API void    queue64_push_commit(uint64_t *q);
+
+NONSTD_ARCH_API int64_t queue64_pop(uint64_t *q, int exp);
+NONSTD_ARCH_API void    queue64_pop_commit(uint64_t *q);
+
+NONSTD_ARCH_API int64_t queue64_mpop(uint64_t *q, int exp, uint64_t *save);
+NONSTD_ARCH_API int     queue64_mpop_commit(uint64_t *q, uint64_t save);
+
+/*
+	Batched versions of the above queues: reserve up to `n` slots with a 
+	single atomic load, and commit them with a single atomic operation.
+	The return value is the index of the first slot, and `*count` is set to
+	the number of slots actually reserved (between 1 and `n`). Returns -1
+	and sets `*count` to zero if no slots are available.
+
+	The reserved slots are contiguous modulo the queue size, i.e. the i-th
+	slot of the batch is at index (first + i) & ((1 << exp) - 1), so a batch
+	may wrap around the end of the slot array. Pass the same count to the
+	commit function that was returned by the reserve function.
+*/
+NONSTD_ARCH_API int  queue_push_n(uint32_t *q, int exp, int n, int *count);
+NONSTD_ARCH_API void queue_push_commit_n(uint32_t *q, int count);
+
+NONSTD_ARCH_API int  queue_pop_n(uint32_t *q, int exp, int n, int *count);
+NONSTD_ARCH_API void queue_pop_commit_n(uint32_t *q, int count);
+
+NONSTD_ARCH_API int  queue_mpop_n(uint32_t *q, int exp, int n, int *count, uint32_t *save);
+NONSTD_ARCH_API int  queue_mpop_commit_n(uint32_t *q, uint32_t save, int count);
+
+NONSTD_ARCH_API int64_t queue64_push_n(uint64_t *q, int exp, int64_t n, int64_t *count);
+NONSTD_ARCH_API void    queue64_push_commit_n(uint64_t *q, int64_t count);
+
+NONSTD_ARCH_API int64_t queue64_pop_n(uint64_t *q, int exp, int64_t n, int64_t *count);
+NONSTD_ARCH_API void    queue64_pop_commit_n(uint64_t *q, int64_t count);
+
+NONSTD_ARCH_API int64_t queue64_mpop_n(uint64_t *q, int exp, int64_t n, int64_t *count, uint64_t *save);
+NONSTD_ARCH_API int     queue64_mpop_commit_n(uint64_t *q, uint64_t save, int64_t count);
+
+
+/*
+	Timeouts and cancellation.
+
+	The blocking primitives below (events, semaphores, and the blocking queue)
+	have *_timeout variants which take a relative timeout in seconds, and can
+	be cancelled, which wakes every thread waiting on them. The waits return
+	one of these codes when they don't succeed (timeouts are measured on a
+	monotonic clock):
+*/
+#define SYNC_TIMED_OUT (-1)
+#define SYNC_CANCELLED (-2)
 
 /*
 	Manual-reset event.
@@ -124,11 +365,59 @@ NONSTD_ARCH_API int  queue_mpop_commit(uint32_t *q, uint32_t save);
 	- No system call on wait if event already posted.
 	- Reset does not wake sleepers, it's just a relaxed atomic store
 	  (so don't rely on reset for any type of syncrhonization).
+	- event_wait returns 1 once the event is posted, or SYNC_CANCELLED if the
+	  event was cancelled (and not posted). event_wait_timeout can also
+	  return SYNC_TIMED_OUT.
+	- Reset also clears the cancellation.
 */
-NONSTD_ARCH_API void event_wait(uint32_t *event);
+NONSTD_ARCH_API int  event_wait(uint32_t *event);
+NONSTD_ARCH_API int  event_wait_timeout(uint32_t *event, double timeout_sec);
 NONSTD_ARCH_API void event_post(uint32_t *event);
+NONSTD_ARCH_API void event_cancel(uint32_t *event);
 NONSTD_ARCH_API void event_reset(uint32_t *event);
 
+/*
+	Reusable barrier.
+
+	Blocks until `nthreads` threads have called barrier_wait, then releases
+	them all, and is immediately ready for the next round (no reset needed,
+	unlike an event). Exactly one thread per round gets a return value of 1, 
+	the others get 0 - handy for doing serial work between parallel steps.
+	
+	Waiting threads spin for a short while (rounds are often short) and then
+	sleep on a futex. No system call is made on release if nobody is asleep.
+
+	Barrier b = BARRIER_INITIALIZER(nthreads);
+*/
+typedef struct {
+	uint32_t arrived;
+	uint32_t generation; // top bit: somebody is asleep
+	uint32_t nthreads;
+} Barrier;
+
+#define BARRIER_INITIALIZER(n) (Barrier){.nthreads=(n)}
+
+NONSTD_ARCH_API int barrier_wait(Barrier *b);
+
+/*
+	Countdown latch. Single use: once the count reaches zero it stays open.
+
+	latch_wait blocks until the count reaches zero (spins briefly, then sleeps
+	on a futex). latch_count_down subtracts `n`, and the call that takes it
+	to zero wakes the waiters (if any). latch_try_wait checks without blocking.
+
+	Latch l = LATCH_INITIALIZER(count); // count < 2^31
+*/
+typedef struct {
+	uint32_t count; // top bit: somebody is asleep
+} Latch;
+
+#define LATCH_INITIALIZER(n) (Latch){.count=(n)}
+
+NONSTD_ARCH_API void latch_count_down(Latch *l, uint32_t n);
+NONSTD_ARCH_API void latch_wait(Latch *l);
+NONSTD_ARCH_API int  latch_try_wait(Latch *l);
+
 /*
 	Unfair blocking semaphore.
 
@@ -139,9 +428,31 @@ NONSTD_ARCH_API void event_reset(uint32_t *event);
 	there's no thundering herd effect.
 
 	Note: the maximum supported value for `sem` is INT32_MAX, not UINT32_MAX.
+
+	semaphore_cancel sets the top bit (SEMAPHORE_CANCELLED) and wakes all 
+	waiters. A cancelled semaphore never blocks: waits still succeed while 
+	the count is above zero, and return SYNC_CANCELLED once it's exhausted.
+	To un-cancel, re-initialize the semaphore.
+
+	semaphore_wait returns 1 on success, or SYNC_CANCELLED.
+	semaphore_wait_timeout can also return SYNC_TIMED_OUT.
 */
-NONSTD_ARCH_API void semaphore_wait(uint32_t *sem);
+#define SEMAPHORE_CANCELLED 0x80000000u
+
+NONSTD_ARCH_API int  semaphore_wait(uint32_t *sem);
+NONSTD_ARCH_API int  semaphore_wait_timeout(uint32_t *sem, double timeout_sec);
 NONSTD_ARCH_API void semaphore_post(uint32_t *sem);
+NONSTD_ARCH_API void semaphore_cancel(uint32_t *sem);
+
+/*
+	Take or release several units of the semaphore at once.
+	semaphore_wait_n blocks until at least one unit is available, then takes
+	as many as it can (up to `n`) in one atomic operation, and returns the
+	number it took (zero means the semaphore was cancelled). 
+	semaphore_post_n releases `n` units and wakes up to `n` waiters.
+*/
+NONSTD_ARCH_API uint32_t semaphore_wait_n(uint32_t *sem, uint32_t n);
+NONSTD_ARCH_API void     semaphore_post_n(uint32_t *sem, uint32_t n);
 
 /*
 	Blocking concurrent queue (multi-producer, multi-consumer)
@@ -178,6 +489,92 @@ NONSTD_ARCH_API void blocking_queue_push_commit(BlockingConcurrentQueue *q);
 NONSTD_ARCH_API int  blocking_queue_pop(BlockingConcurrentQueue *q);
 NONSTD_ARCH_API void blocking_queue_pop_commit(BlockingConcurrentQueue *q);
 
+/*
+	Batched versions: block until at least one slot is available, then 
+	reserve up to `n` of them. Returns the index of the first slot and sets
+	`*count` to the number reserved (see queue_push_n for how the slots are
+	laid out). Commit with the same count. The semaphores and the queue are
+	each touched once per batch rather than once per entry.
+*/
+NONSTD_ARCH_API int  blocking_queue_push_n(BlockingConcurrentQueue *q, int n, int *count);
+NONSTD_ARCH_API void blocking_queue_push_commit_n(BlockingConcurrentQueue *q, int count);
+
+NONSTD_ARCH_API int  blocking_queue_pop_n(BlockingConcurrentQueue *q, int n, int *count);
+NONSTD_ARCH_API void blocking_queue_pop_commit_n(BlockingConcurrentQueue *q, int count);
+
+/*
+	Timed versions of the reserve functions, which return SYNC_TIMED_OUT if
+	no slot became available in time.
+
+	blocking_queue_cancel is for shutting down: it wakes every thread blocked
+	on the queue. After cancellation, pushes fail immediately, and pops keep
+	returning the entries that are still in the queue until it's empty. 
+	All reserve functions then return SYNC_CANCELLED (and set *count to 0) 
+	instead of blocking.
+*/
+NONSTD_ARCH_API int  blocking_queue_push_timeout(BlockingConcurrentQueue *q, double timeout_sec);
+NONSTD_ARCH_API int  blocking_queue_pop_timeout(BlockingConcurrentQueue *q, double timeout_sec);
+NONSTD_ARCH_API void blocking_queue_cancel(BlockingConcurrentQueue *q);
+
+/*
+	Single-producer, single-consumer ring buffer.
+
+	Unlike the queues above, which pack head and tail into one word, the 
+	producer and consumer indices live on separate cache lines, so the two
+	threads only share a line when one of them actually needs to observe 
+	the other's progress. Each side also keeps a private copy of the other
+	side's index and only reloads it when the copy says the ring is full 
+	(or empty). The indices are free-running, so all 2^exp slots are usable.
+
+	The ring owns its element storage. spsc_ring_init takes a buffer of 
+	elem_size << exp bytes; with nonstd_base.h, spsc_ring_create (or the 
+	typed SPSC_RING_CREATE macro) allocates the ring and its storage in an 
+	Arena instead.
+
+	Usage (producer):
+		uint32_t first;
+		int n = spsc_ring_push_reserve(r, want, &first);
+		for (int i = 0; i < n; i++) *(T*)spsc_ring_slot(r, first+i) = ...;
+		spsc_ring_push_commit(r, n);   // publishes all n at once
+
+	reserve returns how many slots (0 to n) were reserved; they may wrap 
+	around the end of the storage, so always go through spsc_ring_slot.
+	The consumer side is symmetrical. spsc_ring_push/spsc_ring_pop copy a
+	single element in or out, returning 0 if the ring is full/empty.
+*/
+typedef struct {
+	// producer's cache line
+	_Alignas(64) uint32_t head;
+	uint32_t cached_tail;
+
+	// consumer's cache line
+	_Alignas(64) uint32_t tail;
+	uint32_t cached_head;
+
+	// read-only after init
+	_Alignas(64) uint32_t mask;
+	int32_t elem_size;
+	unsigned char *mem;
+} SpscRing;
+
+NONSTD_ARCH_API void spsc_ring_init(SpscRing *r, void *mem, int elem_size, int exp);
+
+NONSTD_ARCH_API int  spsc_ring_push_reserve(SpscRing *r, int n, uint32_t *first);
+NONSTD_ARCH_API void spsc_ring_push_commit(SpscRing *r, int n);
+NONSTD_ARCH_API int  spsc_ring_pop_reserve(SpscRing *r, int n, uint32_t *first);
+NONSTD_ARCH_API void spsc_ring_pop_commit(SpscRing *r, int n);
+
+NONSTD_ARCH_API int  spsc_ring_push(SpscRing *r, const void *elem);
+NONSTD_ARCH_API int  spsc_ring_pop(SpscRing *r, void *elem);
+
+static inline void *
+spsc_ring_slot(SpscRing *r, uint32_t pos) 
+{ 
+	return r->mem + (uint64_t)(pos & r->mask) * r->elem_size; 
+}
+
+#define SPSC_RING_SLOT(ring, type, pos) ((type*)spsc_ring_slot((ring), (pos)))
+
 #endif
 /* 
    ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -293,9 +690,228 @@ queue_mpop_commit(uint32_t *q, uint32_t save)
 	return __atomic_compare_exchange_n(q, &save, save+0x10000, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
 }
 
+NONSTD_ARCH_API int64_t
+queue64_push(uint64_t *q, int exp)
+{
+	uint64_t r = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	uint64_t mask = (1ull << exp) - 1;
+	int64_t head = r     & mask;
+	int64_t tail = r>>32 & mask;
+	int64_t next = (head + 1u) & mask;
+	if (r & 0x80000000) {  // avoid overflow on commit
+		__atomic_and_fetch(q, ~0x80000000ull, __ATOMIC_RELEASE);
+	}
+	return next == tail ? -1 : head;
+}
+
+NONSTD_ARCH_API void
+queue64_push_commit(uint64_t *q)
+{
+	__atomic_add_fetch(q, 1, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int64_t
+queue64_pop(uint64_t *q, int exp)
+{
+	uint64_t r = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	uint64_t mask = (1ull << exp) - 1;
+	int64_t head = r     & mask;
+	int64_t tail = r>>32 & mask;
+	return head == tail ? -1 : tail;
+}
+
+NONSTD_ARCH_API void
+queue64_pop_commit(uint64_t *q)
+{
+	__atomic_add_fetch(q, 0x100000000ull, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int64_t
+queue64_mpop(uint64_t *q, int exp, uint64_t *save)
+{
+	uint64_t r = *save = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	uint64_t mask = (1ull << exp) - 1;
+	int64_t head = r     & mask;
+	int64_t tail = r>>32 & mask;
+	return head == tail ? -1 : tail;
+}
+
+NONSTD_ARCH_API int
+queue64_mpop_commit(uint64_t *q, uint64_t save)
+{
+	return __atomic_compare_exchange_n(q, &save, save+0x100000000ull, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+NONSTD_ARCH_API int
+queue_push_n(uint32_t *q, int exp, int n, int *count)
+{
+	uint32_t r = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	int mask = (1u << exp) - 1;
+	int head = r     & mask;
+	int tail = r>>16 & mask;
+	int free = (tail - head - 1) & mask;
+	if (r & 0x8000) {  // avoid overflow on commit (count <= mask, so one clear suffices)
+		__atomic_and_fetch(q, ~0x8000, __ATOMIC_RELEASE);
+	}
+	*count = free < n ? free : n;
+	return *count ? head : -1;
+}
+
+NONSTD_ARCH_API void
+queue_push_commit_n(uint32_t *q, int count)
+{
+	__atomic_add_fetch(q, (uint32_t)count, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int
+queue_pop_n(uint32_t *q, int exp, int n, int *count)
+{
+	uint32_t r = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	int mask = (1u << exp) - 1;
+	int head = r     & mask;
+	int tail = r>>16 & mask;
+	int avail = (head - tail) & mask;
+	*count = avail < n ? avail : n;
+	return *count ? tail : -1;
+}
+
+NONSTD_ARCH_API void
+queue_pop_commit_n(uint32_t *q, int count)
+{
+	__atomic_add_fetch(q, (uint32_t)count << 16, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int
+queue_mpop_n(uint32_t *q, int exp, int n, int *count, uint32_t *save)
+{
+	uint32_t r = *save = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	int mask = (1u << exp) - 1;
+	int head = r     & mask;
+	int tail = r>>16 & mask;
+	int avail = (head - tail) & mask;
+	*count = avail < n ? avail : n;
+	return *count ? tail : -1;
+}
+
+NONSTD_ARCH_API int
+queue_mpop_commit_n(uint32_t *q, uint32_t save, int count)
+{
+	return __atomic_compare_exchange_n(q, &save, save+((uint32_t)count << 16), 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+NONSTD_ARCH_API int64_t
+queue64_push_n(uint64_t *q, int exp, int64_t n, int64_t *count)
+{
+	uint64_t r = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	uint64_t mask = (1ull << exp) - 1;
+	int64_t head = r     & mask;
+	int64_t tail = r>>32 & mask;
+	int64_t free = (tail - head - 1) & mask;
+	if (r & 0x80000000) {  // avoid overflow on commit (count <= mask, so one clear suffices)
+		__atomic_and_fetch(q, ~0x80000000ull, __ATOMIC_RELEASE);
+	}
+	*count = free < n ? free : n;
+	return *count ? head : -1;
+}
+
+NONSTD_ARCH_API void
+queue64_push_commit_n(uint64_t *q, int64_t count)
+{
+	__atomic_add_fetch(q, (uint64_t)count, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int64_t
+queue64_pop_n(uint64_t *q, int exp, int64_t n, int64_t *count)
+{
+	uint64_t r = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	uint64_t mask = (1ull << exp) - 1;
+	int64_t head = r     & mask;
+	int64_t tail = r>>32 & mask;
+	int64_t avail = (head - tail) & mask;
+	*count = avail < n ? avail : n;
+	return *count ? tail : -1;
+}
+
+NONSTD_ARCH_API void
+queue64_pop_commit_n(uint64_t *q, int64_t count)
+{
+	__atomic_add_fetch(q, (uint64_t)count << 32, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int64_t
+queue64_mpop_n(uint64_t *q, int exp, int64_t n, int64_t *count, uint64_t *save)
+{
+	uint64_t r = *save = __atomic_load_n(q, __ATOMIC_ACQUIRE);
+	uint64_t mask = (1ull << exp) - 1;
+	int64_t head = r     & mask;
+	int64_t tail = r>>32 & mask;
+	int64_t avail = (head - tail) & mask;
+	*count = avail < n ? avail : n;
+	return *count ? tail : -1;
+}
+
+NONSTD_ARCH_API int
+queue64_mpop_commit_n(uint64_t *q, uint64_t save, int64_t count)
+{
+	return __atomic_compare_exchange_n(q, &save, save+((uint64_t)count << 32), 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// MONOTONIC CLOCK for timed waits. Deadlines are absolute struct timespecs
+// on this clock.
+//
+#include <time.h>
+#include <errno.h>
+#if defined(_WIN32)
+#include <windows.h>
+static void monotonic_now(struct timespec *t)
+{
+	LARGE_INTEGER c = {0}, f = {0};
+	QueryPerformanceCounter(&c);
+	QueryPerformanceFrequency(&f);
+	t->tv_sec  = c.QuadPart / f.QuadPart;
+	t->tv_nsec = (c.QuadPart % f.QuadPart) * 1000000000ll / f.QuadPart;
+}
+#elif defined(__linux__) || defined(__unix__) || defined(__unix) || defined(__APPLE__)
+static void monotonic_now(struct timespec *t) { clock_gettime(CLOCK_MONOTONIC, t); }
+#else
+static void monotonic_now(struct timespec *t) { timespec_get(t, TIME_UTC); }
+#endif
+
+static void
+deadline_from_timeout(struct timespec *deadline, double timeout_sec)
+{
+	monotonic_now(deadline);
+	if (!(timeout_sec > 0)) return;         // also catches NaN
+	if (timeout_sec > 1e9) timeout_sec = 1e9; // ~30 years is forever enough
+	int64_t ns = (int64_t)((timeout_sec - (int64_t)timeout_sec) * 1e9) + deadline->tv_nsec;
+	deadline->tv_sec += (int64_t)timeout_sec + ns / 1000000000;
+	deadline->tv_nsec = ns % 1000000000;
+}
+
+#if !defined(__linux__) && !defined(__FreeBSD__)
+// Computes the time remaining until the deadline. Returns 0 if it has passed.
+// Only for the futexes below that take a relative timeout (Linux and 
+// FreeBSD wait until the deadline itself).
+static int
+deadline_remaining(struct timespec *remaining, struct timespec *deadline)
+{
+	struct timespec now;
+	monotonic_now(&now);
+	int64_t ns = (int64_t)(deadline->tv_sec - now.tv_sec) * 1000000000 + (deadline->tv_nsec - now.tv_nsec);
+	if (ns <= 0) return 0;
+	remaining->tv_sec  = ns / 1000000000;
+	remaining->tv_nsec = ns % 1000000000;
+	return 1;
+}
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 // FUTEXES are highly os-specifc, so they get their own section
 //
+// futex_wait_until returns 0 if it gave up because the deadline passed, 
+// and 1 otherwise (woken up, spurious wakeup, or value didn't match).
+//
 #include <limits.h>
 #if defined(__linux__) 
 // LINUX
@@ -305,12 +921,26 @@ queue_mpop_commit(uint32_t *q, uint32_t save)
 static void futex_wait(uint32_t *f, uint32_t expected) { syscall(SYS_futex, f, FUTEX_WAIT, expected, 0, 0, 0); }
 static void futex_wake_one(uint32_t *f) { syscall(SYS_futex, f, FUTEX_WAKE, 1, 0, 0, 0); }
 static void futex_wake_all(uint32_t *f) { syscall(SYS_futex, f, FUTEX_WAKE, INT_MAX, 0, 0, 0); }
+static void futex_wake_n(uint32_t *f, uint32_t n) { syscall(SYS_futex, f, FUTEX_WAKE, n < INT_MAX ? n : INT_MAX, 0, 0, 0); }
+static int  futex_wait_until(uint32_t *f, uint32_t expected, struct timespec *deadline) 
+{
+	// FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout
+	long r = syscall(SYS_futex, f, FUTEX_WAIT_BITSET, expected, deadline, 0, FUTEX_BITSET_MATCH_ANY);
+	return !(r == -1 && errno == ETIMEDOUT);
+}
 #elif defined(__OPENBSD__) 
 // OPENBSD
 #include <sys/futex.h>
 static void futex_wait(uint32_t *f, uint32_t expected) { futex(f, FUTEX_WAIT, expected, 0, 0); }
 static void futex_wake_one(uint32_t *f) { futex(f, FUTEX_WAKE, 1, 0, 0); }
 static void futex_wake_all(uint32_t *f) { futex(f, FUTEX_WAKE, INT_MAX, 0, 0); }
+static void futex_wake_n(uint32_t *f, uint32_t n) { futex(f, FUTEX_WAKE, n < INT_MAX ? n : INT_MAX, 0, 0); }
+static int  futex_wait_until(uint32_t *f, uint32_t expected, struct timespec *deadline) 
+{
+	struct timespec rel;
+	if (!deadline_remaining(&rel, deadline)) return 0;
+	return !(futex(f, FUTEX_WAIT, expected, &rel, 0) == -1 && errno == ETIMEDOUT);
+}
 #elif defined(__FreeBSD__) 
 // FREEBSD
 #include <sys/types.h>
@@ -318,6 +948,12 @@ static void futex_wake_all(uint32_t *f) { futex(f, FUTEX_WAKE, INT_MAX, 0, 0); }
 static void futex_wait(uint32_t *f, uint32_t expected) { _umtx_op(f, UMTX_OP_WAIT_UINT, expected, 0, 0); }
 static void futex_wake_one(uint32_t *f) { _umtx_op(f, UMTX_OP_WAKE, 1, 0, 0); }
 static void futex_wake_all(uint32_t *f) { _umtx_op(f, UMTX_OP_WAKE, INT_MAX, 0, 0); }
+static void futex_wake_n(uint32_t *f, uint32_t n) { _umtx_op(f, UMTX_OP_WAKE, n < INT_MAX ? n : INT_MAX, 0, 0); }
+static int  futex_wait_until(uint32_t *f, uint32_t expected, struct timespec *deadline) 
+{
+	struct _umtx_time t = {._timeout = *deadline, ._flags = UMTX_ABSTIME, ._clockid = CLOCK_MONOTONIC};
+	return !(_umtx_op(f, UMTX_OP_WAIT_UINT, expected, (void*)sizeof(t), &t) == -1 && errno == ETIMEDOUT);
+}
 #elif defined (_WIN32) 
 // WINDOWS
 #ifdef _MSC_VER
@@ -329,12 +965,27 @@ __declspec(dllimport) long __stdcall RtlWakeAddressSingle(void *);
 static void futex_wait(uint32_t *f, uint32_t expected) { RtlWaitOnAddress(f, &expected, sizeof(*f), 0); }
 static void futex_wake_one(uint32_t *f) { RtlWakeAddressSingle(f); }
 static void futex_wake_all(uint32_t *f) { RtlWakeAddressAll(f); }
+static void futex_wake_n(uint32_t *f, uint32_t n) { if (n == 1) RtlWakeAddressSingle(f); else RtlWakeAddressAll(f); }
+static int  futex_wait_until(uint32_t *f, uint32_t expected, struct timespec *deadline) 
+{
+	struct timespec rel;
+	if (!deadline_remaining(&rel, deadline)) return 0;
+	int64_t t = -((int64_t)rel.tv_sec * 10000000 + rel.tv_nsec / 100); // relative, 100ns units
+	return RtlWaitOnAddress(f, &expected, sizeof(*f), &t) != 0x102; // STATUS_TIMEOUT
+}
 #else 
 // UNSUPPORTED PLATFORM 
 // no-op (hopefully the use case will fall back on a spin lock)
 static void futex_wait(uint32_t *f, uint32_t expected) { SPIN_LOOP_HINT(); }
 static void futex_wake_one(uint32_t *f) { }
 static void futex_wake_all(uint32_t *f) { }
+static void futex_wake_n(uint32_t *f, uint32_t n) { }
+static int  futex_wait_until(uint32_t *f, uint32_t expected, struct timespec *deadline) 
+{
+	SPIN_LOOP_HINT();
+	struct timespec rel;
+	return deadline_remaining(&rel, deadline);
+}
 #endif
 
 
@@ -351,18 +1002,35 @@ static void futex_wake_all(uint32_t *f) { }
 #endif
 
 
-NONSTD_ARCH_API void 
-event_wait(uint32_t *event)
+// 1-bit set: there are waiters
+// 2-bit set: the event has been posted
+// 4-bit set: the event has been cancelled
+static int
+event_wait_until(uint32_t *event, struct timespec *deadline)
 {
-	// 1-bit set: there are waiters
-	// 2-bit set: the event has been posted
 	while(1) {
 		uint32_t v = __atomic_or_fetch(event, 0x1, __ATOMIC_ACQUIRE);
-		if (v & 0x02) break;
-		futex_wait(event, v);
+		if (v & 0x02) return 1;
+		if (v & 0x04) return SYNC_CANCELLED;
+		if (!deadline) futex_wait(event, v);
+		else if (!futex_wait_until(event, v, deadline)) return SYNC_TIMED_OUT;
 	}
 }
 
+NONSTD_ARCH_API int 
+event_wait(uint32_t *event)
+{
+	return event_wait_until(event, 0);
+}
+
+NONSTD_ARCH_API int 
+event_wait_timeout(uint32_t *event, double timeout_sec)
+{
+	struct timespec deadline;
+	deadline_from_timeout(&deadline, timeout_sec);
+	return event_wait_until(event, &deadline);
+}
+
 NONSTD_ARCH_API void 
 event_post(uint32_t *event)
 {
@@ -371,6 +1039,13 @@ event_post(uint32_t *event)
 
 }
 
+NONSTD_ARCH_API void 
+event_cancel(uint32_t *event)
+{
+	uint32_t v = __atomic_fetch_or(event, 0x4, __ATOMIC_RELEASE);
+	if (v & 0x1) futex_wake_all(event);
+}
+
 NONSTD_ARCH_API void 
 event_reset(uint32_t *event)
 {
@@ -378,36 +1053,198 @@ event_reset(uint32_t *event)
 }
 
 
+// How many times barrier and latch waiters poll before going to sleep.
+#define SYNC_SPIN_COUNT 2000
+#define SYNC_SLEEPERS   0x80000000u
+
+NONSTD_ARCH_API int 
+barrier_wait(Barrier *b)
+{
+	// must be read before we arrive, or the round could end under our feet
+	uint32_t gen = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) & ~SYNC_SLEEPERS;
+
+	if (__atomic_add_fetch(&b->arrived, 1, __ATOMIC_ACQ_REL) == b->nthreads) {
+		// last to arrive: everyone else is waiting on the generation, so it's
+		// safe to reset the count before releasing them
+		__atomic_store_n(&b->arrived, 0, __ATOMIC_RELAXED);
+		uint32_t old = __atomic_exchange_n(&b->generation, (gen+1) & ~SYNC_SLEEPERS, __ATOMIC_RELEASE);
+		if (old & SYNC_SLEEPERS) futex_wake_all(&b->generation);
+		return 1;
+	}
+
+	for (int i = 0; i < SYNC_SPIN_COUNT; i++) {
+		if ((__atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) & ~SYNC_SLEEPERS) != gen) return 0;
+		SPIN_LOOP_HINT();
+	}
+
+	uint32_t v = gen;
+	while (1) {
+		// flag that we're going to sleep; fails if the generation moved on
+		if (!(v & SYNC_SLEEPERS) &&
+		    !__atomic_compare_exchange_n(&b->generation, &v, v | SYNC_SLEEPERS, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			if ((v & ~SYNC_SLEEPERS) != gen) return 0;
+			continue;
+		}
+		futex_wait(&b->generation, gen | SYNC_SLEEPERS);
+		v = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE);
+		if ((v & ~SYNC_SLEEPERS) != gen) return 0;
+	}
+}
+
+NONSTD_ARCH_API void 
+latch_count_down(Latch *l, uint32_t n)
+{
+	uint32_t v = __atomic_sub_fetch(&l->count, n, __ATOMIC_RELEASE);
+	assert((v & ~SYNC_SLEEPERS) < INT32_MAX); // counted down too far
+	if (v == SYNC_SLEEPERS) futex_wake_all(&l->count);
+}
+
+NONSTD_ARCH_API int 
+latch_try_wait(Latch *l)
+{
+	return (__atomic_load_n(&l->count, __ATOMIC_ACQUIRE) & ~SYNC_SLEEPERS) == 0;
+}
+
 NONSTD_ARCH_API void 
-semaphore_wait(uint32_t *sem)
+latch_wait(Latch *l)
+{
+	for (int i = 0; i < SYNC_SPIN_COUNT; i++) {
+		if (latch_try_wait(l)) return;
+		SPIN_LOOP_HINT();
+	}
+	while (1) {
+		uint32_t v = __atomic_or_fetch(&l->count, SYNC_SLEEPERS, __ATOMIC_ACQUIRE);
+		if (v == SYNC_SLEEPERS) return;
+		futex_wait(&l->count, v);
+	}
+}
+
+
+// Takes between 1 and n units from the semaphore. Returns the number taken, 
+// or SYNC_TIMED_OUT / SYNC_CANCELLED. A null deadline means wait forever.
+static int64_t
+semaphore_take(uint32_t *sem, uint32_t n, struct timespec *deadline)
 {
-	uint32_t v = 1;
-	while(!__atomic_compare_exchange_n(sem, &v, v-1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
-		if(v == 0) {
-			futex_wait(sem, v);
-			v = 1;
+	uint32_t v = __atomic_load_n(sem, __ATOMIC_RELAXED);
+	while(1) {
+		uint32_t count = v & ~SEMAPHORE_CANCELLED;
+		if(count == 0) {
+			if(v & SEMAPHORE_CANCELLED) return SYNC_CANCELLED;
+			if(!deadline) futex_wait(sem, v);
+			else if(!futex_wait_until(sem, v, deadline)) return SYNC_TIMED_OUT;
+			v = __atomic_load_n(sem, __ATOMIC_RELAXED);
+			continue;
 		}
+		uint32_t take = count < n ? count : n;
+		if(__atomic_compare_exchange_n(sem, &v, v-take, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return take;
 	}
 }
 
+NONSTD_ARCH_API int 
+semaphore_wait(uint32_t *sem)
+{
+	return semaphore_take(sem, 1, 0) > 0 ? 1 : SYNC_CANCELLED;
+}
+
+NONSTD_ARCH_API int 
+semaphore_wait_timeout(uint32_t *sem, double timeout_sec)
+{
+	struct timespec deadline;
+	deadline_from_timeout(&deadline, timeout_sec);
+	int64_t r = semaphore_take(sem, 1, &deadline);
+	return r > 0 ? 1 : r;
+}
+
 NONSTD_ARCH_API void 
 semaphore_post(uint32_t *sem)
 {
 	uint32_t v = __atomic_fetch_add(sem, 1, __ATOMIC_RELEASE);
-	assert(v < INT32_MAX);
+	assert((v & ~SEMAPHORE_CANCELLED) < INT32_MAX);
 	//if (v == 0) futex_wake_one(sem); // <-- bug
 	//TODO(performance): no syscall if no waiters
 	futex_wake_one(sem);
 }
 
+NONSTD_ARCH_API uint32_t
+semaphore_wait_n(uint32_t *sem, uint32_t n)
+{
+	int64_t r = semaphore_take(sem, n, 0);
+	return r > 0 ? r : 0;
+}
+
+NONSTD_ARCH_API void 
+semaphore_post_n(uint32_t *sem, uint32_t n)
+{
+	uint32_t v = __atomic_fetch_add(sem, n, __ATOMIC_RELEASE);
+	assert((v & ~SEMAPHORE_CANCELLED) + n <= INT32_MAX);
+	futex_wake_n(sem, n);
+}
+
+NONSTD_ARCH_API void 
+semaphore_cancel(uint32_t *sem)
+{
+	__atomic_fetch_or(sem, SEMAPHORE_CANCELLED, __ATOMIC_RELEASE);
+	futex_wake_all(sem);
+}
+
+// Waits for up to `n` of the slots counted by `wait_sem`, and then for access
+// to the queue. Returns the number of slots, or SYNC_TIMED_OUT/SYNC_CANCELLED.
+static int64_t
+blocking_queue_wait(BlockingConcurrentQueue *q, uint32_t *wait_sem, int n, struct timespec *deadline)
+{
+	int64_t got = semaphore_take(wait_sem, n, deadline);
+	if (got < 0) return got;
+
+	if (semaphore_take(&q->access_semaphore, 1, deadline) < 0) {
+		// timed out (the access semaphore is never cancelled): give the slots back
+		semaphore_post_n(wait_sem, got);
+		return SYNC_TIMED_OUT;
+	}
+	return got;
+}
+
+// Common body of all the blocking queue reserve functions. `wait_sem` is the
+// semaphore counting the slots we want.
+static int
+blocking_queue_reserve(BlockingConcurrentQueue *q, uint32_t *wait_sem, int n, int *count, struct timespec *deadline)
+{
+	*count = 0;
+	if(wait_sem == &q->producer_slots && (__atomic_load_n(wait_sem, __ATOMIC_RELAXED) & SEMAPHORE_CANCELLED))
+		return SYNC_CANCELLED;
+
+	int64_t got;
+	if (wait_sem == &q->producer_slots) {
+		PROFILE_BLOCK("blocking_queue_push wait");
+		got = blocking_queue_wait(q, wait_sem, n, deadline);
+	} else {
+		PROFILE_BLOCK("blocking_queue_pop wait");
+		got = blocking_queue_wait(q, wait_sem, n, deadline);
+	}
+	if (got < 0) return got;
+
+	int i = -1, avail = 0;
+	if (wait_sem == &q->producer_slots) i = queue_push_n(&q->q, q->exp, got, &avail);
+	else                                i = queue_pop_n(&q->q, q->exp, got, &avail);
+	assert(i >= 0 && avail == got);
+	*count = got;
+	return i;
+}
+
 NONSTD_ARCH_API int  
 blocking_queue_push(BlockingConcurrentQueue *q)
 {
-	semaphore_wait(&q->producer_slots);
-	semaphore_wait(&q->access_semaphore);
-	int i = queue_push(&q->q, q->exp);
-	assert(i >= 0);
-	return i;
+	int count;
+	return blocking_queue_reserve(q, &q->producer_slots, 1, &count, 0);
+}
+
+NONSTD_ARCH_API int  
+blocking_queue_push_timeout(BlockingConcurrentQueue *q, double timeout_sec)
+{
+	int count;
+	struct timespec deadline;
+	deadline_from_timeout(&deadline, timeout_sec);
+	return blocking_queue_reserve(q, &q->producer_slots, 1, &count, &deadline);
 }
 
 NONSTD_ARCH_API void 
@@ -421,11 +1258,17 @@ blocking_queue_push_commit(BlockingConcurrentQueue *q)
 NONSTD_ARCH_API int  
 blocking_queue_pop(BlockingConcurrentQueue *q)
 {
-	semaphore_wait(&q->consumer_slots);
-	semaphore_wait(&q->access_semaphore);
-	int i = queue_pop(&q->q, q->exp);
-	assert(i >= 0);
-	return i;
+	int count;
+	return blocking_queue_reserve(q, &q->consumer_slots, 1, &count, 0);
+}
+
+NONSTD_ARCH_API int  
+blocking_queue_pop_timeout(BlockingConcurrentQueue *q, double timeout_sec)
+{
+	int count;
+	struct timespec deadline;
+	deadline_from_timeout(&deadline, timeout_sec);
+	return blocking_queue_reserve(q, &q->consumer_slots, 1, &count, &deadline);
 }
 
 NONSTD_ARCH_API void 
@@ -436,6 +1279,107 @@ blocking_queue_pop_commit(BlockingConcurrentQueue *q)
 	semaphore_post(&q->producer_slots);
 }
 
+NONSTD_ARCH_API int  
+blocking_queue_push_n(BlockingConcurrentQueue *q, int n, int *count)
+{
+	return blocking_queue_reserve(q, &q->producer_slots, n, count, 0);
+}
+
+NONSTD_ARCH_API void 
+blocking_queue_push_commit_n(BlockingConcurrentQueue *q, int count)
+{
+	queue_push_commit_n(&q->q, count);
+	semaphore_post(&q->access_semaphore);
+	semaphore_post_n(&q->consumer_slots, count);
+}
+
+NONSTD_ARCH_API int  
+blocking_queue_pop_n(BlockingConcurrentQueue *q, int n, int *count)
+{
+	return blocking_queue_reserve(q, &q->consumer_slots, n, count, 0);
+}
+
+NONSTD_ARCH_API void 
+blocking_queue_pop_commit_n(BlockingConcurrentQueue *q, int count)
+{
+	queue_pop_commit_n(&q->q, count);
+	semaphore_post(&q->access_semaphore);
+	semaphore_post_n(&q->producer_slots, count);
+}
+
+NONSTD_ARCH_API void 
+blocking_queue_cancel(BlockingConcurrentQueue *q)
+{
+	semaphore_cancel(&q->producer_slots);
+	semaphore_cancel(&q->consumer_slots);
+}
+
+#include <string.h> // memcpy
+NONSTD_ARCH_API void 
+spsc_ring_init(SpscRing *r, void *mem, int elem_size, int exp)
+{
+	assert(exp >= 0 && exp < 31);
+	*r = (SpscRing){.mask = (1u << exp) - 1, .elem_size = elem_size, .mem = mem};
+}
+
+NONSTD_ARCH_API int
+spsc_ring_push_reserve(SpscRing *r, int n, uint32_t *first)
+{
+	uint32_t head = r->head; // only we write it
+	uint32_t free = r->mask + 1 - (head - r->cached_tail);
+	if (free < (uint32_t)n) {
+		r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		free = r->mask + 1 - (head - r->cached_tail);
+	}
+	*first = head;
+	return free < (uint32_t)n ? (int)free : n;
+}
+
+NONSTD_ARCH_API void
+spsc_ring_push_commit(SpscRing *r, int n)
+{
+	__atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int
+spsc_ring_pop_reserve(SpscRing *r, int n, uint32_t *first)
+{
+	uint32_t tail = r->tail; // only we write it
+	uint32_t avail = r->cached_head - tail;
+	if (avail < (uint32_t)n) {
+		r->cached_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		avail = r->cached_head - tail;
+	}
+	*first = tail;
+	return avail < (uint32_t)n ? (int)avail : n;
+}
+
+NONSTD_ARCH_API void
+spsc_ring_pop_commit(SpscRing *r, int n)
+{
+	__atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int
+spsc_ring_push(SpscRing *r, const void *elem)
+{
+	uint32_t pos;
+	if (!spsc_ring_push_reserve(r, 1, &pos)) return 0;
+	memcpy(spsc_ring_slot(r, pos), elem, r->elem_size);
+	spsc_ring_push_commit(r, 1);
+	return 1;
+}
+
+NONSTD_ARCH_API int
+spsc_ring_pop(SpscRing *r, void *elem)
+{
+	uint32_t pos;
+	if (!spsc_ring_pop_reserve(r, 1, &pos)) return 0;
+	memcpy(elem, spsc_ring_slot(r, pos), r->elem_size);
+	spsc_ring_pop_commit(r, 1);
+	return 1;
+}
+
 
 /* 
    ........................................
@@ -443,17 +1387,16 @@ blocking_queue_pop_commit(BlockingConcurrentQueue *q)
    ........................................
 */
 #if defined(__linux__) || defined(__unix__) || defined(__unix) || defined(__APPLE__)
-#include <sys/time.h> // gettimeofday
 NONSTD_ARCH_API uint64_t
 get_os_timer_freq(void) {
-	return 1000000ull;
+	return 1000000000ull;
 }
 
 NONSTD_ARCH_API uint64_t 
 read_os_timer(void) {
-	struct timeval tval;
-	gettimeofday(&tval, 0);
-	return (uint64_t)tval.tv_sec * get_os_timer_freq() + (uint64_t)tval.tv_usec;
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
 }
 
 
@@ -483,41 +1426,639 @@ read_os_timer(void)
 {
 	LARGE_INTEGER now = {0};
 	QueryPerformanceCounter(&now);
-	uint64_t wtime = now.QuadPart;
+	return now.QuadPart;
 }
 #endif
 
-NONSTD_ARCH_API double 
-cpu_time_to_sec(uint64_t cpu_time_elapsed) 
+
+/* 
+   ........................................
+		CPU TIMER FREQUENCY
+   ........................................
+*/
+#if defined(__x86_64__)
+// Same as issue_cpuid in numerics_x86.h, but that one is a global symbol 
+// emitted by the numerics implementation, so we keep a private copy.
+static void
+arch_cpuid(unsigned registers[4], unsigned eax, unsigned ecx)
 {
-	static int b = 0;
-	static uint64_t cpu_freq = 0;
-	static double cpu_freq_fp = 0.0;
-
-	if(once_enter(&b)) {
-		uint64_t start_cpu = read_cpu_timer();
-		uint64_t start_os  = read_os_timer();
-		uint64_t elapsed_os = 0;
-		while(elapsed_os < 100000) { // 100ms, not 1 full second!
-			elapsed_os = read_os_timer()-start_os;
+	__asm__ __volatile__ ("cpuid" 
+		: "=a"(registers[0]), "=b"(registers[1]), "=c"(registers[2]), "=d"(registers[3]) 
+		: "a"(eax), "c"(ecx));
+}
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+static uint64_t
+read_kernel_tsc_khz(void)
+{
+	// only exported by some kernels, but free when it's there
+	int fd = open("/sys/devices/system/cpu/cpu0/tsc_freq_khz", O_RDONLY);
+	if (fd < 0) return 0;
+	char buf[32] = {0};
+	ssize_t n = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	uint64_t khz = 0;
+	for (ssize_t i = 0; i < n && buf[i] >= '0' && buf[i] <= '9'; i++) khz = khz*10 + (buf[i]-'0');
+	return khz;
+}
+#endif
+
+// Asks the hardware, hypervisor, or kernel what the cpu timer frequency is. 
+// Returns 0 if nobody knows. *exact is cleared if the answer is only nominal.
+static uint64_t
+query_cpu_timer_freq(int *exact)
+{
+	*exact = 1;
+#if defined(__x86_64__)
+	unsigned r[4];
+	arch_cpuid(r, 0, 0);
+	unsigned max_leaf = r[0];
+	int intel = r[1] == 0x756e6547 && r[3] == 0x49656e69 && r[2] == 0x6c65746e; // "GenuineIntel"
+
+	if (intel && max_leaf >= 0x15) {
+		arch_cpuid(r, 0x15, 0); // TSC/crystal ratio is ebx/eax, crystal Hz in ecx
+		if (r[0] && r[1] && r[2]) return (uint64_t)r[2] * r[1] / r[0];
+	}
+
+	arch_cpuid(r, 1, 0);
+	if (r[2] & (1u << 31)) { // running under a hypervisor
+		arch_cpuid(r, 0x40000000, 0);
+		if (r[0] >= 0x40000010) {
+			arch_cpuid(r, 0x40000010, 0); // timing leaf: TSC kHz in eax
+			if (r[0]) return r[0] * 1000ull;
 		}
-		uint64_t end_cpu = read_cpu_timer();
-		uint64_t elapsed_cpu = end_cpu - start_cpu;
+	}
 
-		cpu_freq = 1000000ull * elapsed_cpu / elapsed_os;
-		cpu_freq_fp = cpu_freq;
+#if defined(__linux__)
+	uint64_t khz = read_kernel_tsc_khz();
+	if (khz) return khz * 1000;
+#endif
 
-		once_commit(&b);
+	*exact = 0;
+	if (intel && max_leaf >= 0x16) {
+		arch_cpuid(r, 0x16, 0); // base frequency MHz, which the TSC runs at (roughly)
+		if (r[0]) return r[0] * 1000000ull;
 	}
+#elif defined(__aarch64__)
+	uint64_t f;
+	__asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r"(f));
+	return f;
+#endif
+	*exact = 0;
+	return 0;
+}
+
+static int      cpu_timer_once = 0;
+static int      cpu_timer_refined = 0;
+static double   cpu_timer_freq = 0.0;
+static uint64_t cpu_timer_base_cpu = 0;
+static uint64_t cpu_timer_base_os = 0;
 
-	return (double)cpu_time_elapsed / cpu_freq_fp;
+NONSTD_ARCH_API double 
+get_cpu_timer_freq(void)
+{
+	if (once_enter(&cpu_timer_once)) {
+		int exact = 0;
+		double freq = query_cpu_timer_freq(&exact);
+		cpu_timer_base_cpu = read_cpu_timer();
+		cpu_timer_base_os  = read_os_timer();
+		if (freq == 0) {
+			uint64_t os_freq = get_os_timer_freq();
+			uint64_t elapsed_os = 0;
+			while(elapsed_os < os_freq / 200) { // 5ms
+				elapsed_os = read_os_timer() - cpu_timer_base_os;
+			}
+			freq = (double)(read_cpu_timer() - cpu_timer_base_cpu) * os_freq / elapsed_os;
+		}
+		__atomic_store(&cpu_timer_freq, &freq, __ATOMIC_RELAXED);
+		cpu_timer_refined = exact;
+		once_commit(&cpu_timer_once);
+	}
+
+	if (!__atomic_load_n(&cpu_timer_refined, __ATOMIC_RELAXED)) {
+		// Re-measure against the same baseline, once enough time has gone by
+		// for the answer to be much better than the initial estimate.
+		uint64_t cpu = read_cpu_timer();
+		uint64_t elapsed_os = read_os_timer() - cpu_timer_base_os;
+		uint64_t os_freq = get_os_timer_freq();
+		int zero = 0;
+		if (elapsed_os >= os_freq && 
+		    __atomic_compare_exchange_n(&cpu_timer_refined, &zero, 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			double freq = (double)(cpu - cpu_timer_base_cpu) * os_freq / elapsed_os;
+			__atomic_store(&cpu_timer_freq, &freq, __ATOMIC_RELAXED);
+		}
+	}
+
+	double freq;
+	__atomic_load(&cpu_timer_freq, &freq, __ATOMIC_RELAXED);
+	return freq;
+}
+
+NONSTD_ARCH_API double 
+cpu_time_to_sec(uint64_t cpu_time_elapsed) 
+{
+	return (double)cpu_time_elapsed / get_cpu_timer_freq();
 }
 
 
 NONSTD_ARCH_API double 
 get_wtime(void) 
 {
-	return cpu_time_to_sec(read_cpu_timer());
+	// measured from the calibration baseline, so that if the frequency estimate 
+	// is refined, the clock barely moves instead of jumping by (uptime * error).
+	double freq = get_cpu_timer_freq();
+	return (double)(read_cpu_timer() - cpu_timer_base_cpu) / freq 
+	     + (double)cpu_timer_base_os / get_os_timer_freq();
+}
+
+
+/* 
+   ........................................
+		PERFORMANCE COUNTERS
+   ........................................
+*/
+NONSTD_ARCH_API const char *
+perf_counter_name(int counter)
+{
+	static const char *names[PERFCTR_COUNT] = {
+		[PERFCTR_CYCLES]        = "cycles",
+		[PERFCTR_INSTRUCTIONS]  = "instructions",
+		[PERFCTR_L1D_MISSES]    = "L1D misses",
+		[PERFCTR_CACHE_MISSES]  = "LLC misses",
+		[PERFCTR_BRANCH_MISSES] = "branch misses",
+		[PERFCTR_PAGE_FAULTS]   = "page faults",
+	};
+	return counter >= 0 && counter < PERFCTR_COUNT ? names[counter] : "?";
+}
+
+NONSTD_ARCH_API int 
+perf_counters_available(PerfCounters *pc, int counter)
+{
+	return pc->n && counter >= 0 && counter < PERFCTR_COUNT && pc->fd[counter] >= 0;
+}
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+NONSTD_ARCH_API int 
+perf_counters_open(PerfCounters *pc)
+{
+	static const struct { uint32_t type; uint64_t config; } events[PERFCTR_COUNT] = {
+		[PERFCTR_CYCLES]        = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		[PERFCTR_INSTRUCTIONS]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		[PERFCTR_L1D_MISSES]    = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | 
+		                           (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+		[PERFCTR_CACHE_MISSES]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		[PERFCTR_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		[PERFCTR_PAGE_FAULTS]   = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	};
+
+	*pc = (PerfCounters){.leader = -1};
+	long pagesize = sysconf(_SC_PAGESIZE);
+	int rdpmc_ok = 1;
+
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		pc->fd[i] = -1;
+		// Software events never have cap_user_rdpmc, so in the group they 
+		// would turn rdpmc off for everything. They get a fd of their own,
+		// which is never multiplexed, and are read with a plain read().
+		int solo = events[i].type == PERF_TYPE_SOFTWARE;
+		struct perf_event_attr attr = {
+			.type = events[i].type,
+			.size = sizeof(attr),
+			.config = events[i].config,
+			.disabled = solo || pc->leader < 0, // the group starts when the leader is enabled
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+			.read_format = solo ? 0 : PERF_FORMAT_GROUP | PERF_FORMAT_ID | 
+			               PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+		};
+		int leader_fd = solo || pc->leader < 0 ? -1 : pc->fd[pc->leader];
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_fd, 0);
+		if (fd < 0) continue;
+		if (solo) {
+			pc->fd[i] = fd;
+			pc->n++;
+			pc->solo |= 1u << i;
+			continue;
+		}
+		if (ioctl(fd, PERF_EVENT_IOC_ID, &pc->id[i]) < 0) { close(fd); continue; }
+
+		pc->fd[i] = fd;
+		pc->n++;
+		if (pc->leader < 0) pc->leader = i;
+
+		void *page = mmap(0, pagesize, PROT_READ, MAP_SHARED, fd, 0);
+		pc->page[i] = page == MAP_FAILED ? 0 : page;
+		struct perf_event_mmap_page *pg = pc->page[i];
+		if (!pg || !pg->cap_user_rdpmc) rdpmc_ok = 0;
+	}
+
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		if (pc->fd[i] < 0 || !(pc->solo >> i & 1)) continue;
+		ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	if (pc->leader >= 0) {
+		int fd = pc->fd[pc->leader];
+		ioctl(fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+#if defined(__x86_64__)
+	pc->use_rdpmc = pc->leader >= 0 && rdpmc_ok;
+#endif
+	return pc->n;
+}
+
+#if defined(__x86_64__)
+// Reads one counter from user space. Returns 0 if the counter isn't on the
+// cpu right now (multiplexed out), in which case you have to use read().
+static int
+perf_counter_rdpmc(struct perf_event_mmap_page *pg, uint64_t *value)
+{
+	uint32_t seq;
+	uint64_t count;
+	do {
+		seq = __atomic_load_n(&pg->lock, __ATOMIC_ACQUIRE);
+		uint32_t idx = pg->index;
+		if (!pg->cap_user_rdpmc || !idx) return 0;
+		int64_t pmc = __builtin_ia32_rdpmc(idx - 1);
+		uint16_t width = pg->pmc_width;
+		pmc = (int64_t)((uint64_t)pmc << (64 - width)) >> (64 - width); // sign extend
+		count = pg->offset + pmc;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&pg->lock, __ATOMIC_RELAXED) != seq);
+	*value = count;
+	return 1;
+}
+#endif
+
+NONSTD_ARCH_API void 
+perf_counters_read(PerfCounters *pc, uint64_t values[PERFCTR_COUNT])
+{
+	for (int i = 0; i < PERFCTR_COUNT; i++) values[i] = 0;
+	if (!pc->n) return;
+
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		uint64_t value;
+		if (pc->fd[i] >= 0 && pc->solo >> i & 1 && read(pc->fd[i], &value, sizeof(value)) == sizeof(value)) 
+			values[i] = value;
+	}
+	if (pc->leader < 0) return;
+
+#if defined(__x86_64__)
+	if (pc->use_rdpmc) {
+		int ok = 1;
+		for (int i = 0; i < PERFCTR_COUNT && ok; i++) 
+			if (pc->fd[i] >= 0 && !(pc->solo >> i & 1)) ok = perf_counter_rdpmc(pc->page[i], &values[i]);
+		if (ok) return;
+		for (int i = 0; i < PERFCTR_COUNT; i++) 
+			if (!(pc->solo >> i & 1)) values[i] = 0;
+	}
+#endif
+
+	// nr, time enabled, time running, then {value, id} pairs
+	uint64_t buf[3 + 2*PERFCTR_COUNT];
+	if (read(pc->fd[pc->leader], buf, sizeof(buf)) < (ssize_t)(3*sizeof(uint64_t))) return;
+	double scale = buf[2] && buf[2] < buf[1] ? (double)buf[1] / buf[2] : 1.0;
+	for (uint64_t j = 0; j < buf[0] && j < PERFCTR_COUNT; j++) {
+		uint64_t value = buf[3 + 2*j], id = buf[4 + 2*j];
+		for (int i = 0; i < PERFCTR_COUNT; i++) 
+			if (pc->fd[i] >= 0 && pc->id[i] == id) values[i] = scale == 1.0 ? value : value * scale;
+	}
+}
+
+NONSTD_ARCH_API void 
+perf_counters_close(PerfCounters *pc)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		if (pc->page[i]) munmap(pc->page[i], pagesize);
+		if (pc->n && pc->fd[i] >= 0) close(pc->fd[i]);
+	}
+	*pc = (PerfCounters){0};
+}
+
+#else
+NONSTD_ARCH_API int  perf_counters_open(PerfCounters *pc) { *pc = (PerfCounters){0}; return 0; }
+NONSTD_ARCH_API void perf_counters_close(PerfCounters *pc) { *pc = (PerfCounters){0}; }
+NONSTD_ARCH_API void 
+perf_counters_read(PerfCounters *pc, uint64_t values[PERFCTR_COUNT]) 
+{ 
+	(void) pc;
+	for (int i = 0; i < PERFCTR_COUNT; i++) values[i] = 0;
+}
+#endif
+
+
+/* 
+   ........................................
+		PROFILER
+   ........................................
+*/
+#include <stdio.h>
+
+#include <stdlib.h>
+
+typedef struct {
+	uint64_t start;
+	uint64_t end;
+	uint32_t anchor;
+} ProfileTraceEvent;
+
+typedef struct {
+	ProfileAnchor anchors[PROFILE_MAX_ANCHORS]; // names unused, see profile_anchor_names
+	uint32_t parent;
+	uint32_t id;
+	int counters_tried;
+	PerfCounters counters;
+	ProfileTraceEvent *events; // ring buffer, allocated when first needed
+	uint64_t nevents;          // events ever written (free-running)
+} ProfileThread;
+
+// anchor 0 is the root: the parent of top-level blocks
+static const char *profile_anchor_names[PROFILE_MAX_ANCHORS];
+static uint32_t profile_anchor_count = 1;
+static uint64_t profile_start = 0;
+
+// Each thread gets its own table the first time it enters a profiled block.
+// Tables outlive their threads, so they can be reported after joining.
+// Past PROFILE_MAX_THREADS, threads share one overflow table (racily).
+static ProfileThread *profile_threads[PROFILE_MAX_THREADS];
+static uint32_t profile_thread_count = 0;
+static ProfileThread profile_overflow_thread = {.id = PROFILE_MAX_THREADS};
+static _Thread_local ProfileThread *profile_thread = 0;
+
+static int profile_tracing = 0;
+static int profile_counting = 0;
+static uint64_t profile_trace_start = 0;
+
+static uint32_t
+profile_register(uint32_t *anchor, const char *name)
+{
+	if (__atomic_load_n(&profile_anchor_count, __ATOMIC_RELAXED) >= PROFILE_MAX_ANCHORS) return 0;
+	uint32_t id = __atomic_fetch_add(&profile_anchor_count, 1, __ATOMIC_RELAXED);
+	if (id >= PROFILE_MAX_ANCHORS) return 0; // table full, lump it in with the root
+	__atomic_store_n(&profile_anchor_names[id], name, __ATOMIC_RELAXED);
+	uint32_t zero = 0;
+	if (!__atomic_compare_exchange_n(anchor, &zero, id, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) 
+		return zero; // somebody else registered this block first (our slot goes unused)
+	return id;
+}
+
+static ProfileThread *
+profile_get_thread(void)
+{
+	ProfileThread *t = profile_thread;
+	if (t) return t;
+
+	uint32_t id = __atomic_fetch_add(&profile_thread_count, 1, __ATOMIC_RELAXED);
+	if (id < PROFILE_MAX_THREADS && (t = calloc(1, sizeof(*t)))) {
+		t->id = id;
+		__atomic_store_n(&profile_threads[id], t, __ATOMIC_RELEASE);
+	} else {
+		t = &profile_overflow_thread;
+	}
+	profile_thread = t;
+	return t;
+}
+
+NONSTD_ARCH_API ProfileBlock 
+profile_block_begin(uint32_t *anchor, const char *name, uint64_t bytes)
+{
+	uint32_t id = __atomic_load_n(anchor, __ATOMIC_ACQUIRE);
+	if (!id) id = profile_register(anchor, name);
+	ProfileThread *t = profile_get_thread();
+	ProfileAnchor *a = &t->anchors[id];
+	a->bytes += bytes;
+	ProfileBlock b = {.old_inclusive = a->inclusive, .anchor = id, .parent = t->parent};
+	t->parent = id;
+
+	if (__atomic_load_n(&profile_counting, __ATOMIC_RELAXED) && t != &profile_overflow_thread) {
+		if (!t->counters_tried) {
+			t->counters_tried = 1;
+			perf_counters_open(&t->counters);
+		}
+		b.counting = t->counters.n > 0;
+		if (b.counting) perf_counters_read(&t->counters, b.counters);
+	}
+
+	b.start = read_cpu_timer();
+	return b;
+}
+
+NONSTD_ARCH_API void 
+profile_block_end(ProfileBlock *b)
+{
+	uint64_t end = read_cpu_timer();
+	uint64_t elapsed = end - b->start;
+	ProfileThread *t = profile_thread;
+	t->parent = b->parent;
+	ProfileAnchor *a = &t->anchors[b->anchor];
+	t->anchors[b->parent].exclusive -= elapsed;
+	a->exclusive += elapsed;
+	a->inclusive = b->old_inclusive + elapsed; // overwrite, so recursive calls count once
+	a->hits++;
+
+	if (b->counting) {
+		uint64_t now[PERFCTR_COUNT];
+		perf_counters_read(&t->counters, now);
+		for (int i = 0; i < PERFCTR_COUNT; i++) {
+			uint64_t delta = now[i] - b->counters[i];
+			a->counters[i] += delta;
+			t->anchors[b->parent].counters[i] -= delta;
+		}
+	}
+
+	if (__atomic_load_n(&profile_tracing, __ATOMIC_RELAXED)) {
+		if (!t->events && !(t->events = malloc(PROFILE_TRACE_EVENTS * sizeof(*t->events)))) return;
+		uint64_t n = t->nevents;
+		t->events[n & (PROFILE_TRACE_EVENTS-1)] = (ProfileTraceEvent){b->start, end, b->anchor};
+		__atomic_store_n(&t->nevents, n+1, __ATOMIC_RELEASE);
+	}
+}
+
+static ProfileThread *
+profile_thread_at(uint32_t i)
+{
+	if (i == PROFILE_MAX_THREADS) return &profile_overflow_thread;
+	return __atomic_load_n(&profile_threads[i], __ATOMIC_ACQUIRE);
+}
+
+static uint32_t
+profile_thread_slots(void)
+{
+	// every table, plus the overflow one if it's in use
+	uint32_t n = __atomic_load_n(&profile_thread_count, __ATOMIC_RELAXED);
+	return n > PROFILE_MAX_THREADS ? PROFILE_MAX_THREADS+1 : n;
+}
+
+NONSTD_ARCH_API void 
+profile_begin(void)
+{
+	uint32_t nthreads = profile_thread_slots();
+	for (uint32_t i = 0; i < nthreads; i++) {
+		ProfileThread *t = profile_thread_at(i);
+		if (t) memset(t->anchors, 0, sizeof(t->anchors));
+	}
+	profile_start = read_cpu_timer();
+}
+
+NONSTD_ARCH_API ProfileAnchor *
+profile_merge(int *count)
+{
+	static ProfileAnchor merged[PROFILE_MAX_ANCHORS];
+	memset(merged, 0, sizeof(merged));
+
+	uint32_t nanchors = __atomic_load_n(&profile_anchor_count, __ATOMIC_RELAXED);
+	if (nanchors > PROFILE_MAX_ANCHORS) nanchors = PROFILE_MAX_ANCHORS;
+	uint32_t nthreads = profile_thread_slots();
+	for (uint32_t i = 0; i < nthreads; i++) {
+		ProfileThread *t = profile_thread_at(i);
+		if (!t) continue;
+		for (uint32_t j = 1; j < nanchors; j++) {
+			merged[j].exclusive += t->anchors[j].exclusive;
+			merged[j].inclusive += t->anchors[j].inclusive;
+			merged[j].hits      += t->anchors[j].hits;
+			merged[j].bytes     += t->anchors[j].bytes;
+			for (int k = 0; k < PERFCTR_COUNT; k++) 
+				merged[j].counters[k] += t->anchors[j].counters[k];
+		}
+	}
+	for (uint32_t j = 1; j < nanchors; j++) 
+		merged[j].name = __atomic_load_n(&profile_anchor_names[j], __ATOMIC_RELAXED);
+	merged[0].name = "(root)";
+
+	if (count) *count = nanchors;
+	return merged;
+}
+
+NONSTD_ARCH_API int64_t 
+profile_report(char *buf, int64_t bufsz)
+{
+	uint64_t total = read_cpu_timer() - profile_start;
+	double freq = get_cpu_timer_freq();
+	int64_t len = 0;
+
+	// appends to buf if there's room, always counts the length
+	#define PROFILE_PRINTF(...) do { \
+		int n_ = snprintf(buf && len < bufsz ? buf+len : 0, buf && len < bufsz ? bufsz-len : 0, __VA_ARGS__); \
+		if (n_ > 0) len += n_; \
+	} while(0)
+
+	PROFILE_PRINTF("Total time: %.4f ms (cpu timer freq %.4f GHz)\n", 1000.0*total/freq, freq*1e-9);
+
+	int count = 0;
+	ProfileAnchor *anchors = profile_merge(&count);
+	for (int i = 1; i < count; i++) {
+		ProfileAnchor *a = &anchors[i];
+		if (!a->hits) continue;
+		PROFILE_PRINTF("  %s[%llu]: %llu (%.2f%%", a->name, (unsigned long long)a->hits, 
+			(unsigned long long)a->exclusive, 100.0*a->exclusive/total);
+		if (a->inclusive != a->exclusive) 
+			PROFILE_PRINTF(", %.2f%% w/children", 100.0*a->inclusive/total);
+		PROFILE_PRINTF(")");
+		if (a->bytes && a->inclusive) {
+			double mb = a->bytes / (1024.0*1024.0);
+			double gbps = a->bytes / (1024.0*1024.0*1024.0) / (a->inclusive / freq);
+			PROFILE_PRINTF("  %.3f MB at %.2f GB/s", mb, gbps);
+		}
+		if (a->counters[PERFCTR_CYCLES] || a->counters[PERFCTR_PAGE_FAULTS]) {
+			uint64_t *c = a->counters;
+			if (c[PERFCTR_CYCLES]) PROFILE_PRINTF("  IPC %.2f", (double)c[PERFCTR_INSTRUCTIONS] / c[PERFCTR_CYCLES]);
+			double per = a->bytes ? a->bytes / 1024.0 : a->hits;
+			PROFILE_PRINTF(" |");
+			for (int k = PERFCTR_L1D_MISSES; k < PERFCTR_COUNT; k++) 
+				PROFILE_PRINTF(" %.2f %s", c[k] / per, perf_counter_name(k));
+			PROFILE_PRINTF(a->bytes ? " per KB" : " per hit");
+		}
+		PROFILE_PRINTF("\n");
+	}
+	#undef PROFILE_PRINTF
+
+	return len + 1; // including the null terminator
+}
+
+NONSTD_ARCH_API void 
+profile_print_report(void)
+{
+	char buf[16384];
+	int64_t n = profile_report(buf, sizeof(buf));
+	fputs(buf, stdout);
+	if (n > (int64_t)sizeof(buf)) fputs("  ... (report truncated)\n", stdout);
+}
+
+NONSTD_ARCH_API void 
+profile_use_counters(int enable)
+{
+	__atomic_store_n(&profile_counting, enable, __ATOMIC_RELAXED);
+}
+
+NONSTD_ARCH_API void 
+profile_trace_begin(void)
+{
+	uint32_t nthreads = profile_thread_slots();
+	for (uint32_t i = 0; i < nthreads; i++) {
+		ProfileThread *t = profile_thread_at(i);
+		if (t) t->nevents = 0;
+	}
+	profile_trace_start = read_cpu_timer();
+	__atomic_store_n(&profile_tracing, 1, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API void 
+profile_trace_end(void)
+{
+	__atomic_store_n(&profile_tracing, 0, __ATOMIC_RELEASE);
+}
+
+NONSTD_ARCH_API int64_t 
+profile_trace_json(char *buf, int64_t bufsz)
+{
+	double us_per_tick = 1e6 / get_cpu_timer_freq();
+	int64_t len = 0;
+	
+	#define PROFILE_PRINTF(...) do { \
+		int n_ = snprintf(buf && len < bufsz ? buf+len : 0, buf && len < bufsz ? bufsz-len : 0, __VA_ARGS__); \
+		if (n_ > 0) len += n_; \
+	} while(0)
+
+	PROFILE_PRINTF("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	const char *sep = "";
+
+	uint32_t nthreads = profile_thread_slots();
+	for (uint32_t i = 0; i < nthreads; i++) {
+		ProfileThread *t = profile_thread_at(i);
+		if (!t || !t->events) continue;
+
+		PROFILE_PRINTF("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+			"\"args\":{\"name\":\"thread %u\"}}", sep, t->id, t->id);
+		sep = ",\n";
+
+		uint64_t n = __atomic_load_n(&t->nevents, __ATOMIC_ACQUIRE);
+		uint64_t first = n > PROFILE_TRACE_EVENTS ? n - PROFILE_TRACE_EVENTS : 0;
+		for (uint64_t j = first; j < n; j++) {
+			ProfileTraceEvent e = t->events[j & (PROFILE_TRACE_EVENTS-1)];
+			if (e.start < profile_trace_start) continue; // started before the trace did
+			const char *name = e.anchor ? profile_anchor_names[e.anchor] : "(unknown)";
+
+			PROFILE_PRINTF("%s{\"name\":\"", sep);
+			for (const char *c = name; *c; c++) { // names are normally identifiers, but just in case
+				if (*c == '"' || *c == '\\') PROFILE_PRINTF("\\%c", *c);
+				else if ((unsigned char)*c >= 0x20) PROFILE_PRINTF("%c", *c);
+			}
+			PROFILE_PRINTF("\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				t->id, (e.start - profile_trace_start) * us_per_tick, (e.end - e.start) * us_per_tick);
+		}
+	}
+	PROFILE_PRINTF("\n]}\n");
+	#undef PROFILE_PRINTF
+
+	return len + 1;
 }
 
 
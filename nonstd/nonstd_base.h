@@ -333,6 +333,25 @@ NONSTD_BASE_API  void print_allocation_header(AllocationHeader* x) ;
 #define ALLOCATE(arena, array_var, len) array_var = allocate_named((arena), (len)*ssizeof((array_var)[0]), #array_var, 0)
 #define ZERO_FILL(array_var, len) memset((array_var), 0, sizeof((array_var)[0])*(len))
 
+#ifdef NONSTD_ARCH_H
+/*
+	Allocates an SpscRing (see nonstd_arch.h) and storage for its 2^exp 
+	elements in an arena. The typed macro version is used like:
+
+	    SpscRing *r = SPSC_RING_CREATE(arena, Particle, 10);
+	    ...
+	    SPSC_RING_SLOT(r, Particle, first+i)->x = 1;
+*/
+NONSTD_BASE_API SpscRing* spsc_ring_create(Arena *a, int elem_size, int exp);
+#define SPSC_RING_CREATE(arena, type, exp) spsc_ring_create((arena), ssizeof(type), (exp))
+
+/*
+	Writes the profiler's trace (see profile_trace_json in nonstd_arch.h) to
+	a file. Returns 1 on success, 0 on failure.
+*/
+NONSTD_BASE_API int profile_trace_write_file(char *filename);
+#endif
+
 /* 
    ============================================================================
 		ERROR HANDLING
@@ -1324,12 +1343,16 @@ allocation_lookup(Arena *a, char *name, int name_len)
 NONSTD_BASE_API char* 
 allocate_sprintf(Arena *a, char *fmt, ...)
 {
+	// Most strings are short: format once into a stack buffer, and only
+	// format again (straight into the arena) if it didn't fit.
+	char buf[256];
 	va_list args1, args2;
 	va_start(args1, fmt);
 	va_copy(args2, args1);
-	int n = 1 + xvsnprintf(0, 0, fmt, args1);
-	char *mem = allocate(a, n);
-	xvsnprintf(mem, n, fmt, args2);
+	int n = 1 + xvsnprintf(buf, sizeof(buf), fmt, args1);
+	char *mem = allocate_empty(a, n);
+	if (n <= (int)sizeof(buf)) memcpy(mem, buf, n);
+	else xvsnprintf(mem, n, fmt, args2);
 	va_end(args1);
 	va_end(args2);
 	return mem;
@@ -1338,13 +1361,37 @@ allocate_sprintf(Arena *a, char *fmt, ...)
 NONSTD_BASE_API char* 
 allocate_cstrdup(Arena *a, char *cstr)
 {
-        if(!string) return 0;
-        int len = strlen(string);
+        if(!cstr) return 0;
+        int len = strlen(cstr);
         char *mem = allocate(a, len+1);
-        memcpy(mem, string, len);
+        memcpy(mem, cstr, len);
         return mem;
 }
 
+#ifdef NONSTD_ARCH_H
+NONSTD_BASE_API SpscRing* 
+spsc_ring_create(Arena *a, int elem_size, int exp)
+{
+	SpscRing *r = allocate(a, sizeof(*r)); // arena allocations are 64-byte aligned
+	void *mem = allocate_empty(a, MUL64(elem_size, 1ll << exp));
+	spsc_ring_init(r, mem, elem_size, exp);
+	return r;
+}
+
+NONSTD_BASE_API int 
+profile_trace_write_file(char *filename)
+{
+	// events can keep arriving while we write, so leave a bit of room 
+	i64 sz = profile_trace_json(0, 0);
+	i64 cap = sz + sz/8 + 4096;
+	char *buf = xmalloc(cap);
+	i64 len = profile_trace_json(buf, cap);
+	int ok = len <= cap && platform_write_file(filename, buf, len-1);
+	free(buf);
+	return ok;
+}
+#endif
+
 NONSTD_BASE_API AllocationHeader * 
 arena_foreach(Arena *a, i64 *state)
 {
@@ -4,7 +4,8 @@
 
 	nonstd_str.h: tools for manipulating strings in C, with slightly less agony.
 
-	No unicode support yet.
+	Text is bytes. UTF-8 can be validated, decoded a character at a time,
+	and transcoded to and from UTF-16/UTF-32; everything else is ASCII.
 
 	This file is a single-header library (credit to Sean Barrett for the
 	idea). It includes both the header and the actual definitions in
@@ -95,6 +96,27 @@ NONSTD_STR_API int is_ascii_control(char c);
 // Returns 1/0 if `c` is/isn't an ASCII control character;
 // i.e. 0x00-0x1f and 0x7f
 
+// Character classes, as bits (a byte can be in several). The is_ascii_*
+// functions and the pattern matcher's %a, %d etc. all look these up in one
+// 256-entry table. Bytes >= 0x80 aren't in any class.
+enum {
+	ASCII_CLASS_LOWER       = 0x01,  // a-z
+	ASCII_CLASS_UPPER       = 0x02,  // A-Z
+	ASCII_CLASS_DIGIT       = 0x04,  // 0-9
+	ASCII_CLASS_HEX_LETTER  = 0x08,  // a-fA-F
+	ASCII_CLASS_PUNCTUATION = 0x10,  // see is_ascii_punctuation()
+	ASCII_CLASS_WHITESPACE  = 0x20,  // see is_ascii_whitespace()
+	ASCII_CLASS_CONTROL     = 0x40,  // 0x00-0x1f and 0x7f
+	ASCII_CLASS_NUL         = 0x80,  // 0x00
+
+	ASCII_CLASS_LETTER       = ASCII_CLASS_LOWER | ASCII_CLASS_UPPER,
+	ASCII_CLASS_ALPHANUMERIC = ASCII_CLASS_LETTER | ASCII_CLASS_DIGIT,
+	ASCII_CLASS_HEXDIGIT     = ASCII_CLASS_DIGIT | ASCII_CLASS_HEX_LETTER,
+};
+
+NONSTD_STR_API int ascii_class(char c);
+// Returns the ASCII_CLASS_* bits of `c`.
+
 NONSTD_STR_API int cstr_endswith(const char *str, const char *ending); 
 // checks if a null terminated string ends with the specified (null terminated string) ending
 
@@ -117,8 +139,38 @@ NONSTD_STR_API int parse_decimal_ull(char *str, int len, unsigned long long *res
 // Parses a decimal ullong, which must not be '0x' prefixed, must not 
 // be '+'/'-' prefixed, and must begin exactly at `str`. Returns the number
 // of characters that were used for the conversion (conversion stops if it
-// encounters a non-ASCII-hex character), or -1 on overflow. NB a return 
-// of zero means couldn't parse anything.
+// encounters a non-ASCII-digit character), or -1 on overflow. NB a return 
+// of zero means couldn't parse anything. Digits are converted 8 at a time.
+
+NONSTD_STR_API int parse_decimal_ll(char *str, int len, long long *result);
+// Like parse_decimal_ull(), but for a signed llong, which may be '+'/'-' 
+// prefixed. The sign counts as a used character, but a lone sign doesn't
+// parse.
+
+NONSTD_STR_API int parse_double(char *str, int len, double *result);
+// Parses a decimal floating point number beginning exactly at `str`: an
+// optional '+'/'-', digits with an optional '.', and an optional exponent
+// ('e' or 'E', optional sign, digits). Also "inf", "infinity" and "nan", in 
+// any case. Returns the number of characters used, or 0 if there was no 
+// number there. The result is correctly rounded (like strtod(), but it 
+// never looks at the locale). Numbers too big for a double give +/-inf 
+// and numbers too small give 0; neither is an error.
+
+#define FORMAT_LL_MAX 20
+#define FORMAT_DOUBLE_MAX 24
+// The longest text format_ull()/format_ll() and format_double() write.
+
+NONSTD_STR_API int format_ull(char *dest, unsigned long long x);
+NONSTD_STR_API int format_ll(char *dest, long long x);
+// Writes `x` in decimal to `dest` (which needs room for FORMAT_LL_MAX bytes),
+// with no null terminator, and returns the length. Two digits at a time.
+
+NONSTD_STR_API int format_double(char *dest, double x);
+// Writes `x` to `dest` (which needs room for FORMAT_DOUBLE_MAX bytes) in
+// the fewest digits that parse back to exactly `x`, with no null terminator,
+// and returns the length. Like Python's repr(): "0.1", "1e+16", "1.5e-07",
+// "inf", "nan", but whole numbers have no ".0" ("100", "-0"). Never looks
+// at the locale.
 	
 
 ///////////   PATTERN MATCHING
@@ -145,6 +197,9 @@ NONSTD_STR_API int parse_decimal_ull(char *str, int len, unsigned long long *res
 //   - *  matches zero or more of the preceeding character/class (greedy)
 //   - ?  matches zero or one of the preceeding character/class
 //   - [  begins a character class (] closes it) (dash doesn't work inside classes yet)
+//   - (  begins a capture () closes it), the part of the match between
+//        them, which str_pattern_match_captures() returns (up to
+//        PATTERN_MAX_CAPTURES of them, and they can be nested)
 //   - preceeding any of the above special characters with a % sign
 //     escapes that character (i.e. matches it literally)
 //   - %% matches a literal % character
@@ -170,6 +225,27 @@ typedef struct
 	#define PATTERN_MACHINE_MAX_PROGRAM_SIZE 512
 	unsigned short code[PATTERN_MACHINE_MAX_PROGRAM_SIZE];
 
+	// Found by pattern_compile_ascii(), for pattern_match_ascii() to skip
+	// ahead to where a match could start: a literal that every match starts
+	// with (like "ERROR " in "ERROR %d+"), or if there isn't one, classes 
+	// that the first byte of every match is in (or not in, if start_negated).
+	int prefix_len;
+	#define PATTERN_PREFIX_MAX 32
+	char prefix[PATTERN_PREFIX_MAX];
+	int start_classes;
+	int start_negated;
+
+	int capture_count;
+	#define PATTERN_MAX_CAPTURES 16
+	// Where each capture starts and ends: the instruction that its ( or ) 
+	// comes just before
+	int capture_pc[2*PATTERN_MAX_CAPTURES];
+
+	// Programs from pattern_compile() have their code here instead, with
+	// room for long_code_cap instructions
+	unsigned short *long_code;
+	int long_code_cap;
+
 } CompiledStrPattern;
 
 NONSTD_STR_API CompiledStrPattern pattern_compile_ascii(char *pattern, int pattern_len);
@@ -178,12 +254,146 @@ NONSTD_STR_API CompiledStrPattern pattern_compile_ascii(char *pattern, int patte
 // Sets the error property of the returned struct if something
 // goes wrong.
 
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API CompiledStrPattern *pattern_compile(Arena *a, char *pattern, int pattern_len);
+// Like pattern_compile_ascii(), but the program is allocated from `a`, and
+// isn't limited to PATTERN_MACHINE_MAX_PROGRAM_SIZE instructions.
+#endif
+
 NONSTD_STR_API int pattern_match_ascii(char *string, int string_len, CompiledStrPattern *program, int *match_len);
 // Searches `string` for the first occurrence of `pattern`.
 // Also sets `match_len` to the length of the match, if applicable.
 // Returns -2 if the program contained an error, -1 if the 
 // pattern does not match, or the index of the match otherwise.
 
+NONSTD_STR_API int pattern_next_candidate(char *prefix, int prefix_len, int start_classes, int start_negated, char *string, int string_len, int i);
+// The first place from `i` on that a match could start, going by a 
+// program's prefix or start classes (see CompiledStrPattern), or 
+// string_len if there's none. Every way of running a program skips ahead 
+// with this, generated matchers too; it's only public for them.
+
+#ifdef NONSTD_BASE_H
+typedef struct
+{
+	int error;
+	// non-zero if the program had an error, or has something the DFA can't
+	// run (pattern_compile_ascii() doesn't make anything like that)
+
+	int element_count;
+	int class_count;
+	unsigned char byte_class[256];
+	int cache_flushes; // how many times the state cache filled up and was cleared
+
+	// the rest is private
+	struct PatternDfaElement *elements;
+	unsigned char class_byte[256];
+	char prefix[PATTERN_PREFIX_MAX];
+	int prefix_len;
+	unsigned short *scratch;
+	i64 *starts;
+	unsigned char *cache;
+	i64 cache_size;
+	i64 cache_used;
+	struct PatternDfaState **buckets;
+	struct PatternDfaState *idle;
+} PatternDfa;
+
+NONSTD_STR_API PatternDfa *pattern_dfa_create(Arena *a, CompiledStrPattern *program, int cache_bytes);
+// Makes a DFA, allocated from `a`, that finds the same matches as 
+// pattern_match_ascii() does with `program`, but in one pass over the 
+// input: time linear in its length, however the pattern could overlap
+// itself. States are made as the input needs them, and kept in a cache of
+// `cache_bytes` (0 for the default, 1MB), which is cleared if it fills up.
+// Sets the error property of the returned DFA if something goes wrong.
+
+NONSTD_STR_API int pattern_dfa_match(PatternDfa *dfa, char *string, int string_len, int *match_len);
+// Like pattern_match_ascii(): the index of the first match in `string`,
+// and its length in `match_len`, or -1 if there isn't one, or -2 if the DFA
+// has an error. Adds states to the DFA's cache, so a DFA can only be used
+// by one thread at a time.
+
+typedef struct
+{
+	PatternDfa *dfa;
+	i64 pos; // how much of the input has been looked at
+
+	// the rest is private
+	Arena *arena;
+	struct PatternDfaState *state;
+	int flushes;
+	unsigned short *threads;
+	int thread_count;
+	int draining;
+	i64 *starts;
+	i64 *next_starts;
+	i64 match_start;
+	i64 match_end;
+	char *chunk;
+	i64 chunk_start;
+	int chunk_len;
+	int last;
+	int done;
+	char *kept;
+	i64 kept_start;
+	int kept_len;
+	int kept_cap;
+} PatternStream;
+
+NONSTD_STR_API void pattern_stream_init(PatternStream *s, Arena *a, PatternDfa *dfa);
+NONSTD_STR_API void pattern_stream_input(PatternStream *s, char *chunk, int len, int last);
+NONSTD_STR_API int  pattern_stream_next(PatternStream *s, i64 *start, i64 *len);
+// Finds the matches of `dfa` in input that comes in pieces, like a file
+// read a block at a time, with matches that can span pieces. Give it each 
+// piece with pattern_stream_input(), with `last` set on the last one, then 
+// call pattern_stream_next() until it returns 0. Each call that returns 1
+// sets `start` and `len` to a match, as offsets into the whole input. The
+// matches are the ones str_pattern_next() would find in the whole input. A
+// 0 means it needs the next piece (or, after the last one, that it's done).
+// A piece only needs to stay around until then: the stream copies what it 
+// might need to look at again, into buffers allocated from `a`. Streams can
+// share a DFA, but not between threads.
+
+typedef struct
+{
+	int error;
+	// non-zero if the program had an error
+
+	int code_size;
+	int set_count; // distinct sets of bytes that the instructions match
+	int anchored;
+	int prefix_len;
+	char prefix[PATTERN_PREFIX_MAX];
+	int start_classes;
+	int start_negated;
+
+	// the rest is private
+	struct PatternInstruction *code;
+	uint64_t (*sets)[4];
+} PatternProgram;
+
+NONSTD_STR_API PatternProgram *pattern_program_create(Arena *a, CompiledStrPattern *program);
+// Decodes `program` once, into instructions allocated from `a`, that
+// pattern_program_match() runs without working out, for every instruction,
+// what it does and what it matches. Sets the error property of the
+// returned program if something goes wrong.
+
+NONSTD_STR_API int pattern_program_match(PatternProgram *p, char *string, int string_len, int *match_len);
+// Like pattern_match_ascii(), and with the same results. Doesn't change
+// the program, so threads can share one.
+
+NONSTD_STR_API int pattern_generate_c(char *buffer, int buffer_len, CompiledStrPattern *program, char *name);
+// Writes C source for `program` into `buffer`, to be compiled into a
+// project instead of compiling the pattern when it runs: a static 
+// CompiledStrPattern `name`_pattern, ready to use, and a function
+//     static int name_match(char *string, int string_len, int *match_len)
+// with the same results as pattern_match_ascii(), written out for this
+// pattern alone, so the compiler can inline and specialize all of it. The
+// source needs nonstd_str.h included before it. Returns the buffer size
+// (not including the null char) needed for all of it, or -1 if the program
+// has an error. Meant to be run offline, by a small program that writes a
+// header with the patterns a project uses.
+#endif
+
 
 #ifdef NONSTD_STR_DEBUG
 NONSTD_STR_API int debug_dump_program(char *buffer, int buffer_len, CompiledStrPattern *p);
@@ -218,8 +428,57 @@ NONSTD_STR_API Str str_split_str(Str* s, Str delim);
 // Pops the first substring (delimited by `delim`) off of `s` (modifying it).
 // `s` will have zero-length if there's nothing left to pop.
 
+NONSTD_STR_API Str str_split_any(Str* s, Str delims);
+// Like str_split(), but the substring is delimited by any one of the bytes
+// in `delims`.
+
+NONSTD_STR_API int str_find_byte(Str s, char c);
+// Returns the index of the first `c` in `s`, or -1 if there isn't one.
+
+NONSTD_STR_API int str_find_any(Str s, Str set);
+// Returns the index of the first byte of `s` that is one of the bytes in 
+// `set`, or -1 if there isn't one. Scans 16 or 32 bytes at a time with SIMD
+// where available; sets of up to 4 bytes are the fastest.
+
+NONSTD_STR_API int str_span_class(Str s, int classes);
+// Returns the length of the longest prefix of `s` whose bytes are all in
+// (at least one of) `classes`, e.g. str_span_class(s, ASCII_CLASS_DIGIT).
+// Long spans are measured 32 (or 16) bytes at a time with SIMD.
+
+NONSTD_STR_API int str_span_not_class(Str s, int classes);
+// Returns the length of the longest prefix of `s` with no bytes in `classes`.
+
+NONSTD_STR_API int str_parse_doubles(Str s, char delim, double *out, int max_count);
+NONSTD_STR_API int str_parse_lls(Str s, char delim, long long *out, int max_count);
+// Parse a delimited list of numbers, like a column of a CSV file ("1,2.5,3"
+// with delim ','), into `out`, in one pass. Spaces and tabs around each
+// number are skipped, and so is a delimiter at the very end. Stops after
+// `max_count` numbers. Returns how many numbers were written, or if a field
+// isn't a number (or an integer overflows), -1 - the index of that field.
+
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API Str *str_tokenize(Arena *a, Str s, Str delims, int *count);
+// Splits all of `s` at once, at every byte that is in `delims`, into an array
+// of Strs allocated from `a`. Sets *count to the number of fields. Adjacent 
+// delimiters give empty fields, and so does a trailing delimiter, as in a 
+// CSV line: "a,,b," gives "a", "", "b", "". An empty `s` gives no fields 
+// (and returns null). The fields point into `s`, nothing is copied.
+
+NONSTD_STR_API Str str_format_ll(Arena *a, long long x);
+NONSTD_STR_API Str str_format_double(Arena *a, double x);
+// format_ll()/format_double() into a null terminated string allocated from `a`.
+
+NONSTD_STR_API Str str_format_lls(Arena *a, long long *values, int count, char delim);
+NONSTD_STR_API Str str_format_doubles(Arena *a, double *values, int count, char delim);
+// Formats `count` numbers as one string, separated by `delim` ("1,2.5,3"
+// with delim ','), in one null terminated allocation from `a`. The 
+// allocation has room for the longest numbers, so can be bigger than the
+// string. The inverse of str_parse_lls()/str_parse_doubles().
+#endif
+
 NONSTD_STR_API int str_equal(Str a, Str b);
-// Returns 1 if `a` and `b` are equal, 0 otherwise
+// Returns 1 if `a` and `b` are equal, 0 otherwise. This and the rest of 
+// the comparisons go 16 or 32 bytes at a time with SIMD.
 
 NONSTD_STR_API int str_startswith(Str s, Str startswith);
 // Returns 1 if `s` begins with `startswith`, 0 otherwise
@@ -227,9 +486,57 @@ NONSTD_STR_API int str_startswith(Str s, Str startswith);
 NONSTD_STR_API int str_endswith(Str s, Str endswith);
 // Returns 1 if `s` ends with `endswith`, 0 otherwise
 
+NONSTD_STR_API int str_compare(Str a, Str b);
+// Compares `a` and `b` a byte at a time, as unsigned chars like memcmp(),
+// and returns a negative number if `a` comes first, a positive one if `b`
+// does, or 0 if they're equal. A string comes after its prefixes ("ab" 
+// after "a"). For sorting and binary searching tables of strings.
+
+NONSTD_STR_API int str_compare_length_first(Str a, Str b);
+// Like str_compare(), but shorter strings come first, and only strings of
+// the same length are compared byte by byte. Not alphabetical, but cheaper
+// (most comparisons are decided by the lengths), for tables where any 
+// consistent order will do.
+
 NONSTD_STR_API int str_search(Str haystack, Str needle);
 // Searches `haystack` for `needle`, returning the index at which is is found
-// or -1 if it is not found at all.
+// or -1 if it is not found at all. Uses SIMD where available, and is linear 
+// time in the worst case (see the implementation).
+
+#ifdef NONSTD_BASE_H
+#define STR_MULTI_SEARCH_TEDDY_MAX 32
+typedef struct
+{
+	int count;        // needles
+	int min_len;
+	int max_len;
+	int state_count;  // of the automaton
+	int class_count;  // bytes that are in no needle are one class, each other byte is its own
+	int teddy;        // if sets are small enough for the SIMD prefilter, the leading bytes it looks at
+	unsigned char byte_class[256];
+
+	// the rest is private
+	Str *needles;
+	int *next;
+	int *match;
+	unsigned char teddy_lo[3][16];
+	unsigned char teddy_hi[3][16];
+	unsigned char bucket_start[9];
+	unsigned char bucket_needles[STR_MULTI_SEARCH_TEDDY_MAX];
+} StrMultiSearch;
+
+NONSTD_STR_API StrMultiSearch *str_multi_search_create(Arena *a, Str *needles, int count);
+// Prepares to search for any of `count` needles at once (copies of them,
+// and an Aho-Corasick automaton, are allocated from `a`), so the time a 
+// search takes doesn't grow with the number of needles. Sets of up to 
+// STR_MULTI_SEARCH_TEDDY_MAX needles are also looked for with SIMD first.
+
+NONSTD_STR_API int str_multi_search(StrMultiSearch *ms, Str haystack, int *which);
+// Searches `haystack` for the first place any of the needles is found, and
+// returns its index, with the needle's index in `which`, or -1 if none of 
+// them are there. If more than one needle starts at that place, `which` 
+// is the lowest. Can be used by many threads at once.
+#endif
 
 NONSTD_STR_API int str_pattern_match(Str *match, Str *string, CompiledStrPattern *program);
 // Calls pattern_match_ascii() to match the specified pattern against `string`.
@@ -237,6 +544,97 @@ NONSTD_STR_API int str_pattern_match(Str *match, Str *string, CompiledStrPattern
 // the actual match. Returns 1 if a match was found, 0 if it was not (or if 
 // the program contains an error).
 
+NONSTD_STR_API int str_pattern_match_captures(Str *match, Str *string, CompiledStrPattern *program, Str *captures);
+// Like str_pattern_match(), and also sets captures[0] to captures[n-1] to 
+// the parts of the match in the pattern's n captures, numbered by where 
+// their ( is, recorded while the match is found rather than by going over
+// it again. So "(%d+)-(%d+)" on "10-20" gives "10" and "20". Their values
+// after a 0 are undefined. Every start the search tries pays a little for 
+// them, so where most starts fail (a long prefix that's common in the 
+// text) this is a few percent slower than str_pattern_match() and 
+// splitting the match up yourself; where most succeed, a lot faster. 
+// (The DFA, decoded programs and generated matchers find the same matches,
+// but not captures.)
+
+typedef struct
+{
+	CompiledStrPattern *program;
+	Str string;
+	int at;        // where the next search starts
+	int anchored;  // the pattern starts with ^, so there's only one place to look
+} StrPatternIter;
+
+NONSTD_STR_API StrPatternIter str_pattern_iter(Str string, CompiledStrPattern *program);
+NONSTD_STR_API int str_pattern_next(StrPatternIter *it, Str *match);
+NONSTD_STR_API int str_pattern_next_captures(StrPatternIter *it, Str *match, Str *captures);
+// Finds the matches in `string` one after another, one per call to
+// str_pattern_next(), which returns 0 when there are no more (or if the 
+// program contains an error). Unlike calling str_pattern_match() in a loop,
+// the string is searched as a whole, so ^ only matches at its start, and
+// after an empty match the search goes on from the next byte. With
+// str_pattern_next_captures(), also sets `captures` as
+// str_pattern_match_captures() does.
+
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API Str *str_pattern_match_all(Arena *a, Str string, CompiledStrPattern *program, int *count);
+// All of the matches str_pattern_next() finds, in one pass over `string`,
+// as an array allocated from `a`, with the number of them in *count. 
+// Returns null if there aren't any.
+#endif
+
+
+
+///////////   UTF-8
+// Untrusted text can be checked with utf8_validate() (SIMD, several bytes 
+// per cycle) before it's handled as bytes: the ASCII tools above leave 
+// anything >= 0x80 alone, or remove it (clean_ascii()). Valid means what
+// the Unicode standard says: no overlong forms, no surrogates (U+D800 to 
+// U+DFFF), nothing above U+10FFFF, and no truncated characters.
+
+NONSTD_STR_API int utf8_validate(char *s, int len);
+// Returns `len` if `s` is valid UTF-8, otherwise the index of the first 
+// byte of the first invalid (or truncated) character: so it's always the
+// length of the longest valid prefix.
+
+NONSTD_STR_API int utf8_decode(char *s, int len, int *codepoint);
+// Decodes the character at the start of `s` (len > 0) into *codepoint, and
+// returns the number of bytes it takes up (1 to 4). If the bytes there
+// aren't valid, *codepoint is -1, and the return value is the length of 
+// the invalid part (the "maximal subpart" that U+FFFD should replace).
+
+NONSTD_STR_API int utf8_encode(char *dest, int codepoint);
+// Writes `codepoint` as UTF-8 to `dest` (which needs room for 4 bytes), with
+// no null terminator, and returns the length, or 0 if it isn't a Unicode
+// scalar value (a surrogate, negative, or above 0x10FFFF).
+
+typedef struct
+{
+	Str string;
+	int at;        // the index of the next character
+} StrUtf8Iter;
+
+NONSTD_STR_API StrUtf8Iter str_utf8_iter(Str string);
+NONSTD_STR_API int str_utf8_next(StrUtf8Iter *it, int *codepoint);
+// Steps through the codepoints of `string`, one per call to str_utf8_next(),
+// which returns 0 at the end. Invalid bytes are stepped over like 
+// utf8_decode() does, with *codepoint -1.
+
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API uint16_t *str_to_utf16(Arena *a, Str s, int *len);
+NONSTD_STR_API uint32_t *str_to_utf32(Arena *a, Str s, int *len);
+// Transcodes UTF-8 into a null terminated array allocated (exactly) from 
+// `a`, and sets *len to its length in code units, not counting the null.
+// If `s` isn't valid UTF-8, returns null, nothing is allocated, and *len is
+// -1 - utf8_validate(s).
+
+NONSTD_STR_API Str str_from_utf16(Arena *a, uint16_t *s, int len);
+NONSTD_STR_API Str str_from_utf32(Arena *a, uint32_t *s, int len);
+// Transcodes `len` code units into null terminated UTF-8 allocated (exactly)
+// from `a`. If there's an unpaired surrogate (or in UTF-32, a value that 
+// isn't a Unicode scalar value), returns a Str with a null ptr and len
+// -1 - the index of it, and nothing is allocated.
+#endif
+
 
 
 #endif 
@@ -271,102 +669,332 @@ NONSTD_STR_API int str_pattern_match(Str *match, Str *string, CompiledStrPattern
 #  endif
 #endif
 
+#include <float.h>
 #include <limits.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define STR_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#  define STR_NOINLINE __declspec(noinline)
+#else
+#  define STR_NOINLINE
+#endif
 
-NONSTD_STR_API int
-clean_ascii(char *dest, char *src, int len)
+// SIMD SUPPORT
+// On x86-64, SSE2 is always available, and AVX2 versions of the hot loops 
+// are compiled with target attributes and picked at run time (or directly,
+// if compiling with -mavx2). On aarch64 we use NEON. Everything has a plain
+// C version, which is used elsewhere or if NONSTD_STR_NO_SIMD is defined.
+#if !defined(NONSTD_STR_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define STR_X86 1
+#  include <immintrin.h>
+#  define STR_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#  define STR_TARGET_AVX512VBMI2 __attribute__((target("avx512f,avx512bw,avx512vbmi2,popcnt")))
+#  if defined(__AVX2__) && defined(__BMI2__)
+#    define STR_CPU_HAS_AVX2 1
+#  else
+#    define STR_CPU_HAS_AVX2 (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+#  endif
+#  if defined(__AVX512BW__) && defined(__AVX512VBMI2__)
+#    define STR_CPU_HAS_AVX512VBMI2 1
+#  else
+#    define STR_CPU_HAS_AVX512VBMI2 (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi2"))
+#  endif
+#elif !defined(NONSTD_STR_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON) && (defined(__GNUC__) || defined(__clang__))
+#  define STR_NEON 1
+#  include <arm_neon.h>
+
+// NEON has no movemask: narrow each 0x00/0xff byte of a comparison to 4 bits
+// of a 64-bit mask (so divide bit positions by 4).
+static inline uint64_t
+str_neon_mask(uint8x16_t eq)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+#endif
+
+#if STR_X86 || STR_NEON
+// High nibble lookup for the "nibble" byte set tables: 1 << (high & 7),
+// split by the byte's top bit. See BYTE SET SCANNING.
+static const unsigned char str_nibble_hi[2][16] = {
+	{1,2,4,8,16,32,64,128, 0,0,0,0,0,0,0,0},
+	{0,0,0,0,0,0,0,0, 1,2,4,8,16,32,64,128},
+};
+#endif
+
+// ASCII TRANSFORMS
+// Case conversion is a range compare and an xor of 0x20, 16/32 bytes at a 
+// time. The cleaning filters classify a block of bytes into masks, and then
+// compress the bytes we keep to the front: in one instruction with AVX-512 
+// VBMI2, or 8 bytes at a time with BMI2's pext on AVX2 machines. A block 
+// where every byte is kept (most of them, in real text) is just copied.
+// Each SIMD kernel does as many whole blocks as it can and the scalar code
+// finishes the rest.
+
+static int
+str_case_scalar(char *dest, const char *src, int i, int len, char first)
 {
-	int o = 0;
-	for(int i = 0; i < len; i++) {
-		char s = src[i];
-		if (s=='\t' 
-		|| s=='\n' 
-		|| s=='\r' 
-		|| s=='\f' 
-		|| s=='\v' 
-		|| (s > 31 && s < 127)) {
-			dest[o++] = s;	
+	for (; i < len; i++) {
+		char c = src[i];
+		dest[i] = (unsigned char)(c - first) < 26 ? c ^ 0x20 : c;
+	}
+	return i;
+}
+
+#if STR_X86
+static int
+str_case_sse2(char *dest, const char *src, int len, char first)
+{
+	const __m128i lo = _mm_set1_epi8(first), last = _mm_set1_epi8(25), flip = _mm_set1_epi8(0x20);
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i t = _mm_sub_epi8(v, lo);
+		__m128i letter = _mm_cmpeq_epi8(_mm_min_epu8(t, last), t); // t <= 25, unsigned
+		_mm_storeu_si128((__m128i*)(dest + i), _mm_xor_si128(v, _mm_and_si128(letter, flip)));
+	}
+	return i;
+}
+
+static int STR_TARGET_AVX2
+str_case_avx2(char *dest, const char *src, int len, char first)
+{
+	const __m256i lo = _mm256_set1_epi8(first), last = _mm256_set1_epi8(25), flip = _mm256_set1_epi8(0x20);
+	int i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i t = _mm256_sub_epi8(v, lo);
+		__m256i letter = _mm256_cmpeq_epi8(_mm256_min_epu8(t, last), t);
+		_mm256_storeu_si256((__m256i*)(dest + i), _mm256_xor_si256(v, _mm256_and_si256(letter, flip)));
+	}
+	_mm256_zeroupper();
+	return i;
+}
+#endif
+
+#if STR_NEON
+static int
+str_case_neon(char *dest, const char *src, int len, char first)
+{
+	const uint8x16_t lo = vdupq_n_u8(first), n = vdupq_n_u8(26), flip = vdupq_n_u8(0x20);
+	int i = 0;
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t*)src + i);
+		uint8x16_t letter = vcltq_u8(vsubq_u8(v, lo), n);
+		vst1q_u8((uint8_t*)dest + i, veorq_u8(v, vandq_u8(letter, flip)));
+	}
+	return i;
+}
+#endif
+
+// converts letters from `first` to `first`+25 to the other case
+static void
+str_convert_case(char *dest, const char *src, int len, char first)
+{
+	int i = 0;
+#if STR_X86
+	if (STR_CPU_HAS_AVX2) i = str_case_avx2(dest, src, len, first);
+	else i = str_case_sse2(dest, src, len, first);
+#elif STR_NEON
+	i = str_case_neon(dest, src, len, first);
+#endif
+	str_case_scalar(dest, src, i, len, first);
+}
+
+// Where clean_ascii() and clean_whitespace_ascii() have got to: the next byte
+// to read, the next byte to write, and whether the last byte read was a space.
+typedef struct {
+	int i, o, space;
+} StrCleanState;
+
+// With `collapse` (clean_whitespace_ascii) whitespace becomes ' ' and only
+// the first of a run is kept. Without it (clean_ascii), bytes are kept 
+// as they are if they're printable or whitespace.
+static void
+str_clean_scalar(char *dest, const char *src, int len, int collapse, StrCleanState *st)
+{
+	int o = st->o, space = st->space;
+	for (int i = st->i; i < len; i++) {
+		unsigned char c = src[i];
+		int w = c == ' ' || (c >= '\t' && c <= '\r');
+		int printable = c >= 32 && c < 127;
+		int keep;
+		if (collapse) {
+			keep = (printable && !w) || (w && !space);
+			c = w ? ' ' : c;
+			space = w;
+		} else {
+			keep = printable || w;
 		}
+		// o <= i, so this store is in bounds (and harmless in place)
+		if (dest) dest[o] = c;
+		o += keep;
 	}
-	return o;
+	st->i = len;
+	st->o = o;
+	st->space = space;
 }
 
-NONSTD_STR_API int
-clean_whitespace_ascii(char *dest, char *src, int len) 
+#if STR_X86
+static void STR_TARGET_AVX512VBMI2
+str_clean_avx512(char *dest, const char *src, int len, int collapse, StrCleanState *st)
 {
-	int last_char_was_space = 0;
-	int o = 0;
-	for(int i = 0; i < len; i++) {
-		switch (src[i]) {
-		case ' ':  case '\t': case '\n':
-		case '\r': case '\f': case '\v':
-			if(!last_char_was_space) {
-				if(dest) dest[o] = ' ';
-				++o;
-			}
-			last_char_was_space = 1;
-			break;
-		default:
-			if(src[i] >= 32 && src[i] < 127) {
-				if(dest) dest[o] = src[i];
-				++o;
-			}
-			last_char_was_space = 0;
-			break;
+	const __m512i c8 = _mm512_set1_epi8(8), c14 = _mm512_set1_epi8(14);
+	const __m512i c31 = _mm512_set1_epi8(31), c127 = _mm512_set1_epi8(127), sp = _mm512_set1_epi8(' ');
+	int i = st->i, o = st->o;
+	uint64_t space = st->space;
+	for (; i + 64 <= len; i += 64) {
+		__m512i v = _mm512_loadu_si512((const void*)(src + i));
+		// signed compares: bytes >= 0x80 are negative, so neither printable nor whitespace
+		uint64_t w = (_mm512_cmpgt_epi8_mask(v, c8) & _mm512_cmpgt_epi8_mask(c14, v)) | _mm512_cmpeq_epi8_mask(v, sp);
+		uint64_t printable = _mm512_cmpgt_epi8_mask(v, c31) & _mm512_cmplt_epi8_mask(v, c127);
+		uint64_t keep;
+		if (collapse) {
+			keep = (printable & ~w) | (w & ~((w << 1) | space));
+			space = w >> 63;
+			v = _mm512_mask_mov_epi8(v, w, sp);
+		} else {
+			keep = printable | w;
+		}
+		if (dest) {
+			if (~keep) v = _mm512_maskz_compress_epi8(keep, v);
+			_mm512_storeu_si512((void*)(dest + o), v);
 		}
+		o += __builtin_popcountll(keep);
 	}
-	return o;
+	_mm256_zeroupper();
+	st->i = i;
+	st->o = o;
+	st->space = space;
 }
 
-NONSTD_STR_API int
-strip_whitespace_ascii(char *dest, char *src, int len) 
+static void STR_TARGET_AVX2
+str_clean_avx2(char *dest, const char *src, int len, int collapse, StrCleanState *st)
 {
-	int first=0,end=0;
-	for(int i = 0; i < len; i++) {
-		switch (src[i]) {
-		case ' ':  case '\t': case '\n':
-		case '\r': case '\f': case '\v':
-			continue;
+	const __m256i c8 = _mm256_set1_epi8(8), c14 = _mm256_set1_epi8(14);
+	const __m256i c31 = _mm256_set1_epi8(31), c127 = _mm256_set1_epi8(127), sp = _mm256_set1_epi8(' ');
+	int i = st->i, o = st->o;
+	uint32_t space = st->space;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i wv = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+			_mm256_and_si256(_mm256_cmpgt_epi8(v, c8), _mm256_cmpgt_epi8(c14, v)));
+		__m256i pv = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, c127), _mm256_cmpgt_epi8(v, c31));
+		uint32_t w = _mm256_movemask_epi8(wv), printable = _mm256_movemask_epi8(pv), keep;
+		if (collapse) {
+			keep = (printable & ~w) | (w & ~((w << 1) | space));
+			space = w >> 31;
+			v = _mm256_blendv_epi8(v, sp, wv);
+		} else {
+			keep = printable | w;
 		}
-		first = i;
-		break;
+		if (dest) {
+			if (keep == 0xffffffffu) {
+				_mm256_storeu_si256((__m256i*)(dest + o), v);
+			} else {
+				// pext gathers the kept bytes of each 8; o <= i + 8*g, so 
+				// the 8 byte stores stay inside the block we just read
+				uint64_t b[4];
+				int k = o;
+				_mm256_storeu_si256((__m256i*)b, v);
+				for (int g = 0; g < 4; g++) {
+					uint32_t m = (keep >> (8*g)) & 0xff;
+					uint64_t packed = _pext_u64(b[g], _pdep_u64(m, 0x0101010101010101ull) * 0xff);
+					memcpy(dest + k, &packed, 8);
+					k += __builtin_popcount(m);
+				}
+			}
+		}
+		o += __builtin_popcount(keep);
 	}
+	_mm256_zeroupper();
+	st->i = i;
+	st->o = o;
+	st->space = space;
+}
+#endif
 
-	for(int i = len-1; i >= 0; i--) {
-		switch (src[i]) {
-		case ' ':  case '\t': case '\n':
-		case '\r': case '\f': case '\v':
+#if STR_NEON
+static void
+str_clean_neon(char *dest, const char *src, int len, int collapse, StrCleanState *st)
+{
+	// NEON has no cheap compress: copy the blocks where everything is kept,
+	// and leave the others to the scalar code.
+	const uint8x16_t c9 = vdupq_n_u8(9), c5 = vdupq_n_u8(5), c32 = vdupq_n_u8(32), c95 = vdupq_n_u8(95);
+	const uint8x16_t sp = vdupq_n_u8(' ');
+	while (st->i + 16 <= len) {
+		int i = st->i;
+		uint8x16_t v = vld1q_u8((const uint8_t*)src + i);
+		uint8x16_t w = vorrq_u8(vceqq_u8(v, sp), vcltq_u8(vsubq_u8(v, c9), c5));
+		uint8x16_t printable = vcltq_u8(vsubq_u8(v, c32), c95);
+		uint8x16_t keep;
+		if (collapse) {
+			uint8x16_t wprev = vextq_u8(vdupq_n_u8(st->space ? 0xff : 0), w, 15);
+			keep = vorrq_u8(vbicq_u8(printable, w), vbicq_u8(w, wprev));
+			v = vbslq_u8(w, sp, v);
+		} else {
+			keep = vorrq_u8(printable, w);
+		}
+		if (vminvq_u8(keep) != 0xff) {
+			str_clean_scalar(dest, src, i + 16, collapse, st);
 			continue;
 		}
-		end = i+1;
-		break;
+		if (dest) vst1q_u8((uint8_t*)dest + st->o, v);
+		st->o += 16;
+		st->i += 16;
+		st->space = collapse && vgetq_lane_u8(w, 15);
 	}
+}
+#endif
 
-	int o = 0;
-	for(int i = first; i < end; i++) {
-		dest[o++] = src[i];
-	}
+static int
+str_clean(char *dest, const char *src, int len, int collapse)
+{
+	StrCleanState st = {0};
+#if STR_X86
+	if (STR_CPU_HAS_AVX512VBMI2) str_clean_avx512(dest, src, len, collapse, &st);
+	else if (STR_CPU_HAS_AVX2) str_clean_avx2(dest, src, len, collapse, &st);
+#elif STR_NEON
+	str_clean_neon(dest, src, len, collapse, &st);
+#endif
+	str_clean_scalar(dest, src, len, collapse, &st);
+	return st.o;
+}
+
+NONSTD_STR_API int
+clean_ascii(char *dest, char *src, int len)
+{
+	return str_clean(dest, src, len, 0);
+}
 
-	return o;
+NONSTD_STR_API int
+clean_whitespace_ascii(char *dest, char *src, int len) 
+{
+	return str_clean(dest, src, len, 1);
+}
+
+NONSTD_STR_API int
+strip_whitespace_ascii(char *dest, char *src, int len) 
+{
+	// The ends are usually short; the copy is the expensive part, and
+	// memmove is already vectorized (and safe in place).
+	Str s = str_strip(mkstr(src, len));
+	if (dest && s.len) memmove(dest, s.ptr, s.len);
+	return s.len;
 }
 
 NONSTD_STR_API void
 lowercase_ascii(char *dest, char *src, int len)
 {
-	for(int i = 0; i < len; i++) {
-		if(src[i] > 64 && src[i] < 91) dest[i] = src[i]+32;
-		else dest[i] = src[i];
-	}
+	str_convert_case(dest, src, len, 'A');
 }
 
 NONSTD_STR_API void
 uppercase_ascii(char *dest, char *src, int len)
 {
-	for(int i = 0; i < len; i++) {
-		if(src[i] > 96 && src[i] < 123) dest[i] = src[i]-32;
-		else dest[i] = src[i];
-	}
+	str_convert_case(dest, src, len, 'a');
 }
 
 NONSTD_STR_API int 
@@ -379,53 +1007,91 @@ is_character_in_set(char c, char *set, int len)
 	return 0;
 }
 
+// CHARACTER CLASSES
+// The class table is generated by the preprocessor from STR_CLASS_OF().
+
+#define STR_IN_RANGE(c, a, b) ((c) >= (a) && (c) <= (b))
+#define STR_CLASS_OF(c) ( \
+	(STR_IN_RANGE(c, 'a', 'z') ? ASCII_CLASS_LOWER : 0) | \
+	(STR_IN_RANGE(c, 'A', 'Z') ? ASCII_CLASS_UPPER : 0) | \
+	(STR_IN_RANGE(c, '0', '9') ? ASCII_CLASS_DIGIT : 0) | \
+	(STR_IN_RANGE(c, 'a', 'f') || STR_IN_RANGE(c, 'A', 'F') ? ASCII_CLASS_HEX_LETTER : 0) | \
+	(STR_IN_RANGE(c, '!', '/') || STR_IN_RANGE(c, ':', '@') || \
+	 STR_IN_RANGE(c, '[', '`') || STR_IN_RANGE(c, '{', '~') ? ASCII_CLASS_PUNCTUATION : 0) | \
+	((c) == ' ' || STR_IN_RANGE(c, '\t', '\r') ? ASCII_CLASS_WHITESPACE : 0) | \
+	(STR_IN_RANGE(c, 0, 0x1f) || (c) == 0x7f ? ASCII_CLASS_CONTROL : 0) | \
+	((c) == 0 ? ASCII_CLASS_NUL : 0))
+#define STR_CLASS_4(c)  STR_CLASS_OF(c), STR_CLASS_OF(c+1), STR_CLASS_OF(c+2), STR_CLASS_OF(c+3)
+#define STR_CLASS_16(c) STR_CLASS_4(c), STR_CLASS_4(c+4), STR_CLASS_4(c+8), STR_CLASS_4(c+12)
+#define STR_CLASS_64(c) STR_CLASS_16(c), STR_CLASS_16(c+16), STR_CLASS_16(c+32), STR_CLASS_16(c+48)
+
+static const unsigned char str_class_table[256] = { STR_CLASS_64(0), STR_CLASS_64(64) }; // the rest are 0
+
+#define STR_CLASS(c) str_class_table[(unsigned char)(c)]
+
+#if STR_X86 || STR_NEON
+// The same classes as nibble lookup tables (see BYTE SET SCANNING), one
+// per class bit; OR them together for a combination. All the members are
+// below 0x80, so the high nibble lookup is str_nibble_hi[0].
+// test_str_class.c checks these against the table.
+static const unsigned char str_class_nibbles[8][16] = {
+	{0x80,0xc0,0xc0,0xc0,0xc0,0xc0,0xc0,0xc0,0xc0,0xc0,0xc0,0x40,0x40,0x40,0x40,0x40}, // LOWER
+	{0x20,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x10,0x10,0x10,0x10,0x10}, // UPPER
+	{0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x00,0x00,0x00,0x00,0x00,0x00}, // DIGIT
+	{0x00,0x50,0x50,0x50,0x50,0x50,0x50,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, // HEX_LETTER
+	{0x50,0x04,0x04,0x04,0x04,0x04,0x04,0x04,0x04,0x04,0x0c,0xac,0xac,0xac,0xac,0x2c}, // PUNCTUATION
+	{0x04,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x01,0x01,0x01,0x01,0x00,0x00}, // WHITESPACE
+	{0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x03,0x83}, // CONTROL
+	{0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, // NUL
+};
+#endif
+
+NONSTD_STR_API int
+ascii_class(char c)
+{
+	return STR_CLASS(c);
+}
+
 NONSTD_STR_API int 
 is_ascii_punctuation(char c)
 {
-	char *p = "!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
-	return is_character_in_set(c,p,32);
+	return (STR_CLASS(c) & ASCII_CLASS_PUNCTUATION) != 0;
 }
 
 NONSTD_STR_API int 
 is_ascii_whitespace(char c)
 {
-	char *s = " \t\r\n\f\v";
-	return is_character_in_set(c,s,6);
+	return (STR_CLASS(c) & ASCII_CLASS_WHITESPACE) != 0;
 }
 
 NONSTD_STR_API int
 is_ascii_alphanumeric(char c)
 {
-	return
-	(c >= 'a' && c <= 'z') ||
-	(c >= 'A' && c <= 'Z') ||
-	(c >= '0' && c <= '9');
+	return (STR_CLASS(c) & ASCII_CLASS_ALPHANUMERIC) != 0;
 }
 
 NONSTD_STR_API int
 is_ascii_letter(char c)
 {
-	return
-	(c >= 'a' && c <= 'z') ||
-	(c >= 'A' && c <= 'Z');
+	return (STR_CLASS(c) & ASCII_CLASS_LETTER) != 0;
 }
 
 NONSTD_STR_API int
 is_ascii_lower(char c)
 {
-	return (c >= 'a' && c <= 'z');
+	return (STR_CLASS(c) & ASCII_CLASS_LOWER) != 0;
 }
 
 NONSTD_STR_API int
 is_ascii_upper(char c)
 {
-	return (c >= 'A' && c <= 'Z');
+	return (STR_CLASS(c) & ASCII_CLASS_UPPER) != 0;
 }
 
 NONSTD_STR_API int
 is_ascii_digit(char c)
 {
-	return (c >= '0' && c <= '9');
+	return (STR_CLASS(c) & ASCII_CLASS_DIGIT) != 0;
 }
 
 NONSTD_STR_API int
@@ -439,7 +1105,95 @@ is_ascii_hexdigit(char c)
 NONSTD_STR_API int
 is_ascii_control(char c)
 {
-	return (c >= 0 && c <= 0x1f) || c == 0x7f;
+	return (STR_CLASS(c) & ASCII_CLASS_CONTROL) != 0;
+}
+
+// The span kernels return the index of the first byte at or after `i` 
+// whose membership in the class is `stop_at_member`, or the end of the 
+// last whole block they looked at. The scalar loop takes it from there.
+
+#if STR_X86
+static int STR_TARGET_AVX2
+str_span_avx2(const unsigned char lo_table[16], const char *p, int i, int n, int stop_at_member)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lo_table));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)str_nibble_hi[0]));
+	const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+	const uint32_t flip = stop_at_member ? 0xffffffffu : 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+		__m256i hit = _mm256_and_si256(
+			_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+			_mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+		uint32_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, zero)) ^ flip;
+		if (stop) {
+			i += __builtin_ctz(stop);
+			break;
+		}
+	}
+	_mm256_zeroupper();
+	return i;
+}
+#endif
+
+#if STR_NEON
+static int
+str_span_neon(const unsigned char lo_table[16], const char *p, int i, int n, int stop_at_member)
+{
+	const uint8x16_t lo = vld1q_u8(lo_table), hi = vld1q_u8(str_nibble_hi[0]), nibble = vdupq_n_u8(0x0f);
+	const uint64_t flip = stop_at_member ? ~0ull : 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t*)p + i);
+		uint8x16_t hit = vandq_u8(vqtbl1q_u8(lo, vandq_u8(v, nibble)), vqtbl1q_u8(hi, vshrq_n_u8(v, 4)));
+		uint64_t stop = (str_neon_mask(vceqzq_u8(hit)) ^ flip) & 0x8888888888888888ull;
+		if (stop) {
+			i += __builtin_ctzll(stop) >> 2;
+			break;
+		}
+	}
+	return i;
+}
+#endif
+
+static int
+str_span(Str s, int classes, int stop_at_member)
+{
+	const char *p = s.ptr;
+	int n = s.len, i = 0;
+
+	// Short spans are the common case, and don't need the tables.
+	for (; i < n && i < 32; i++)
+		if (((STR_CLASS(p[i]) & classes) != 0) == stop_at_member) return i;
+	if (i >= n) return i;
+
+#if STR_X86 || STR_NEON
+	unsigned char lo[16] = {0};
+	for (int k = 0; k < 8; k++) {
+		if (!(classes & (1 << k))) continue;
+		for (int j = 0; j < 16; j++) lo[j] |= str_class_nibbles[k][j];
+	}
+#endif
+#if STR_X86
+	if (STR_CPU_HAS_AVX2) i = str_span_avx2(lo, p, i, n, stop_at_member);
+#elif STR_NEON
+	i = str_span_neon(lo, p, i, n, stop_at_member);
+#endif
+
+	for (; i < n; i++)
+		if (((STR_CLASS(p[i]) & classes) != 0) == stop_at_member) break;
+	return i;
+}
+
+NONSTD_STR_API int
+str_span_class(Str s, int classes)
+{
+	return str_span(s, classes, 0);
+}
+
+NONSTD_STR_API int
+str_span_not_class(Str s, int classes)
+{
+	return str_span(s, classes, 1);
 }
 
 
@@ -468,24 +1222,114 @@ parse_hexdigit(char c) {
 	return -1;
 }
 
+// INTEGER PARSING
+// Decimal digits are converted 8 at a time with SWAR (SIMD within a 
+// register): load 8 bytes as a little-endian u64, count how many leading 
+// bytes are digits, and combine them pairwise with three multiplies.
+
+static const uint64_t str_pow10_u64[20] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+	100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+	10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+	100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+};
+
+static int
+str_is_digit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+static int
+str_ctz64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) { x >>= 1; n++; }
+	return n;
+#endif
+}
+
+static int
+str_clz64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+	while (!(x >> 63)) { x <<= 1; n++; }
+	return n;
+#endif
+}
+
+static uint64_t
+str_load_le64(const char *p)
+{
+	// compilers turn this into a single load on little-endian machines
+	const unsigned char *u = (const unsigned char*)p;
+	return (uint64_t)u[0]       | (uint64_t)u[1] << 8  | (uint64_t)u[2] << 16 | (uint64_t)u[3] << 24 |
+	       (uint64_t)u[4] << 32 | (uint64_t)u[5] << 40 | (uint64_t)u[6] << 48 | (uint64_t)u[7] << 56;
+}
+
+// How many of the 8 bytes (starting with the low one) are digits before 
+// the first non-digit. A byte is a digit if its high nibble is 3, and still
+// is after adding 6 (i.e. the low nibble is < 10). A carry out of a byte
+// only comes from a non-digit, and only disturbs the bytes after it.
+static int
+str_swar_count_digits(uint64_t chunk)
+{
+	uint64_t bad = ((chunk & 0xf0f0f0f0f0f0f0f0ull) ^ 0x3030303030303030ull) |
+	               (((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) ^ 0x3030303030303030ull);
+	return bad ? str_ctz64(bad) >> 3 : 8;
+}
+
+// The value of 8 digits.
+static uint64_t
+str_swar_parse8(uint64_t chunk)
+{
+	chunk -= 0x3030303030303030ull;
+	chunk = chunk * 10 + (chunk >> 8); // pairs of digits, in every other byte
+	return (((chunk & 0x000000ff000000ffull) * (100 + (1000000ull << 32))) +
+	        (((chunk >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32)))) >> 32;
+}
+
+// Parses at most `max_digits` (<= 19, so it can't overflow) leading digits.
+// Returns how many there were.
+static int
+str_parse_digits(const char *s, int len, int max_digits, uint64_t *value)
+{
+	uint64_t v = 0;
+	int n = 0;
+	while (n + 8 <= len) {
+		uint64_t chunk = str_load_le64(s + n);
+		int k = str_swar_count_digits(chunk);
+		if (k > max_digits - n) k = max_digits - n;
+		if (k == 0) break;
+		// for a partial chunk, shift the digits up and put '0's in front
+		if (k < 8) chunk = (chunk << (8*(8-k))) | (0x3030303030303030ull >> (8*k));
+		v = v * str_pow10_u64[k] + str_swar_parse8(chunk);
+		n += k;
+		if (k < 8) break;
+	}
+	for (; n < len && n < max_digits && str_is_digit(s[n]); n++)
+		v = v * 10 + (s[n] - '0');
+	*value = v;
+	return n;
+}
+
 NONSTD_STR_API int
 parse_hex_ull(char *str, int len, unsigned long long *result)
 {
 	// returns number of chars consumed, or -1 on overflow
-	unsigned long long overflow_limit = ULLONG_MAX / 16;
-
 	unsigned long long v = 0;
-	int n = 0;
-	int idigit = 0;
-	while (str < str+len  &&  (idigit=parse_hexdigit(*str), idigit >= 0))
-	{
-		unsigned digit = idigit;
-		if(v > overflow_limit) return -1;
-		v *= 16;
-		if(UINT64_MAX-digit < v) return -1;
-		v += digit;
-		str++;
-		n++;
+	int n = 0, significant = 0, digit = 0;
+	for (; n < len && (digit = parse_hexdigit(str[n])) >= 0; n++) {
+		// 16 significant digits always fit, and 17 never do
+		significant += v != 0 || digit != 0;
+		if (significant > 16) return -1;
+		v = v << 4 | digit;
 	}
 
 	if (n > 0) *result = v;
@@ -496,44 +1340,769 @@ NONSTD_STR_API int
 parse_decimal_ull(char *str, int len, unsigned long long *result)
 {
 	// returns number of chars consumed, or -1 on overflow
-	unsigned long long overflow_limit = ULLONG_MAX / 10;
-
-	unsigned long long v = 0;
-	int n = 0;
-	while (str < str+len  &&  *str >= '0'  &&  *str <= '9')
-	{
-		unsigned digit = *str - '0';
-		if(v > overflow_limit) return -1;
-		v *= 10;
-		if(UINT64_MAX-digit < v) return -1;
-		v += digit;
-		str++;
-		n++;
+	uint64_t v = 0;
+	int n = str_parse_digits(str, len, 19, &v);
+
+	// one more digit might fit (more, with leading zeros), so check them
+	for (; n < len && str_is_digit(str[n]); n++) {
+		unsigned digit = str[n] - '0';
+		if (v > UINT64_MAX / 10 || v * 10 > UINT64_MAX - digit) return -1;
+		v = v * 10 + digit;
 	}
 
 	if (n > 0) *result = v;
 	return n;
 }
 
-enum {
-	OP_RET                     = 0x00,
-	OP_JUMP                    = 0x01,
-	OP_MATCH_START_END         = 0x02,
-	OP_MATCH                   = 0x03,
-	OP_MATCH_OR_RET_F          = 0x04,
-	OP_MATCH_AND_RET_T         = 0x05,
-	OP_MATCH_AND_RET_F         = 0x06,
-	OP_MATCH_AND_RPT           = 0x07,
-	OP_CALL                    = 0x08,
-	OP_RPT_IF_RET_T            = 0x09,
-	OP_RET_F_IF_RET_F          = 0x0a,
-	OP_MATCH_BUILTIN           = 0x0b,
-	OP_MATCH_BUILTIN_OR_RET_F  = 0x0c,
-	OP_MATCH_BUILTIN_AND_RET_T = 0x0d,
-	OP_MATCH_BUILTIN_AND_RET_F = 0x0e,
-	OP_MATCH_BUILTIN_AND_RPT   = 0x0f,
+NONSTD_STR_API int
+parse_decimal_ll(char *str, int len, long long *result)
+{
+	int n = 0, negative = 0;
+	if (len > 0 && (str[0] == '-' || str[0] == '+')) {
+		negative = str[0] == '-';
+		n = 1;
+	}
 
-	OP_MASK   = 0x0f,
+	unsigned long long u = 0;
+	int k = parse_decimal_ull(str + n, len - n, &u);
+	if (k <= 0) return k;
+	if (u > (unsigned long long)LLONG_MAX + negative) return -1;
+	*result = negative ? -(long long)(u - 1) - 1 : (long long)u;
+	return n + k;
+}
+
+// FLOAT PARSING
+// The decimal significand w (its first 19 significant digits) and power 
+// of ten q are read in one pass, and then, in order of preference:
+//   - If w < 2^53 and |q| <= 22, w and 10^q are exact doubles, so one IEEE
+//     multiply or divide is correctly rounded (Clinger's fast path).
+//   - Eisel-Lemire: multiply w by a 128-bit approximation of 5^q and round.
+//     That's exact for any 19 digit w (Mushtak & Lemire, "Fast number 
+//     parsing without fallback").
+//   - With more than 19 digits the true value is between w and w+1 (times
+//     10^q), so if both round the same way, that's the answer.
+//   - Otherwise, compare the exact decimal with the halfway point between
+//     the two candidates, using big integers. This is rare, and slow.
+
+// Little-endian array of 32-bit words, enough for any comparison we make
+// (a few thousand bits), and for making the table of powers of 5.
+#define STR_BIG_WORDS 128
+typedef struct {
+	uint32_t w[STR_BIG_WORDS];
+	int n;
+} StrBig;
+
+static void
+str_big_mul_small(StrBig *b, uint32_t m)
+{
+	uint64_t carry = 0;
+	for (int i = 0; i < b->n; i++) {
+		uint64_t t = (uint64_t)b->w[i] * m + carry;
+		b->w[i] = (uint32_t)t;
+		carry = t >> 32;
+	}
+	if (carry) {
+		assert(b->n < STR_BIG_WORDS);
+		b->w[b->n++] = (uint32_t)carry;
+	}
+}
+
+static void
+str_big_add_small(StrBig *b, uint32_t a)
+{
+	uint64_t carry = a;
+	for (int i = 0; carry && i < b->n; i++) {
+		uint64_t t = (uint64_t)b->w[i] + carry;
+		b->w[i] = (uint32_t)t;
+		carry = t >> 32;
+	}
+	if (carry) {
+		assert(b->n < STR_BIG_WORDS);
+		b->w[b->n++] = (uint32_t)carry;
+	}
+}
+
+static void
+str_big_mul_pow5(StrBig *b, int k)
+{
+	static const uint32_t pow5[14] = {1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 
+		1953125, 9765625, 48828125, 244140625, 1220703125};
+	for (; k >= 13; k -= 13) str_big_mul_small(b, pow5[13]);
+	if (k) str_big_mul_small(b, pow5[k]);
+}
+
+static void
+str_big_div_small(StrBig *b, uint32_t d)
+{
+	uint64_t rem = 0;
+	for (int i = b->n - 1; i >= 0; i--) {
+		uint64_t t = rem << 32 | b->w[i];
+		b->w[i] = (uint32_t)(t / d);
+		rem = t % d;
+	}
+	while (b->n > 0 && b->w[b->n - 1] == 0) b->n--;
+}
+
+static void
+str_big_shl(StrBig *b, int bits)
+{
+	int words = bits / 32, shift = bits % 32;
+	if (b->n == 0) return;
+	assert(b->n + words + 1 <= STR_BIG_WORDS);
+	b->w[b->n + words] = 0;
+	for (int i = b->n - 1; i >= 0; i--) {
+		uint32_t x = b->w[i];
+		if (shift) b->w[i + words + 1] |= x >> (32 - shift);
+		b->w[i + words] = shift ? x << shift : x;
+	}
+	for (int i = 0; i < words; i++) b->w[i] = 0;
+	b->n += words + 1;
+	while (b->n > 0 && b->w[b->n - 1] == 0) b->n--;
+}
+
+static int
+str_big_bitlen(const StrBig *b)
+{
+	if (b->n == 0) return 0;
+	return 32 * b->n - (str_clz64(b->w[b->n - 1]) - 32);
+}
+
+// 64 bits of b, starting at bit `pos` (which may be negative: zeros below bit 0)
+static uint64_t
+str_big_bits64(const StrBig *b, int pos)
+{
+	uint64_t r = 0;
+	for (int i = 63; i >= 0; i--) {
+		int bit = pos + i;
+		r <<= 1;
+		if (bit >= 0 && bit / 32 < b->n) r |= (b->w[bit / 32] >> (bit % 32)) & 1;
+	}
+	return r;
+}
+
+static int
+str_big_cmp(const StrBig *a, const StrBig *b)
+{
+	if (a->n != b->n) return a->n < b->n ? -1 : 1;
+	for (int i = a->n - 1; i >= 0; i--)
+		if (a->w[i] != b->w[i]) return a->w[i] < b->w[i] ? -1 : 1;
+	return 0;
+}
+
+// Powers of 5 from 5^-342 to 5^308, normalized to 128 bits {high, low}:
+// truncated for positive powers, and for negative ones, floor(2^b / 5^-q)+1 
+// for a suitable b, then truncated. These are for parsing (Eisel-Lemire).
+// For formatting (Schubfach), powers of 5 from 5^-292 to 5^324, as 126 bit
+// floor(5^q * 2^s) + 1 for the s that puts them in [2^125, 2^126), split
+// into two 63 bit halves {high, low}. Both are computed the first time 
+// either is needed, rather than being 20KB of constants in this file.
+#define STR_POW5_MIN_Q (-342)
+#define STR_POW5_MAX_Q 308
+#define STR_POW5_126_MIN_Q (-292)
+#define STR_POW5_126_MAX_Q 324
+static uint64_t str_pow5_128[STR_POW5_MAX_Q - STR_POW5_MIN_Q + 1][2];
+static uint64_t str_pow5_126[STR_POW5_126_MAX_Q - STR_POW5_126_MIN_Q + 1][2];
+static int str_pow5_state; // 0 not started, 1 in progress, 2 ready
+
+// stores the top 126 bits of p (plus one) as two 63 bit halves
+static void
+str_pow5_126_store(uint64_t dest[2], const StrBig *p)
+{
+	int len = str_big_bitlen(p);
+	uint64_t mask = (1ull << 63) - 1;
+	dest[0] = str_big_bits64(p, len - 63) & mask;
+	dest[1] = (str_big_bits64(p, len - 126) & mask) + 1;
+	if (dest[1] > mask) {
+		dest[1] = 0;
+		dest[0]++;
+	}
+}
+
+static void
+str_pow5_table_init(void)
+{
+	StrBig p = {{1}, 1};
+	for (int q = 0; q <= STR_POW5_126_MAX_Q; q++) {
+		int len = str_big_bitlen(&p);
+		if (q <= STR_POW5_MAX_Q) {
+			str_pow5_128[q - STR_POW5_MIN_Q][0] = str_big_bits64(&p, len - 64);
+			str_pow5_128[q - STR_POW5_MIN_Q][1] = str_big_bits64(&p, len - 128);
+		}
+		str_pow5_126_store(str_pow5_126[q - STR_POW5_126_MIN_Q], &p);
+		str_big_mul_small(&p, 5);
+	}
+
+	// f = floor(2^B / 5^k), one division by 5 at a time. B is big enough for
+	// every b below, and floor(2^b / 5^k) = f >> (B - b).
+	enum {F_WORDS = 56, B = F_WORDS*32 - 1};
+	StrBig f = {{0}, F_WORDS};
+	f.w[F_WORDS - 1] = 1u << 31;
+	for (int k = 1; k <= -STR_POW5_MIN_Q; k++) {
+		str_big_div_small(&f, 5);
+		if (-k >= STR_POW5_126_MIN_Q) str_pow5_126_store(str_pow5_126[-k - STR_POW5_126_MIN_Q], &f);
+
+		int z = ((k * 1217359) >> 19) + 1; // bits in 5^k
+		int b = k <= 27 ? z + 127 : 2*z + 128;
+		int shift = B - b, words = shift / 32, bits = shift % 32;
+		StrBig c = {{0}, 0};
+		for (int i = words; i < f.n; i++) {
+			uint64_t x = f.w[i] >> bits;
+			if (bits && i + 1 < f.n) x |= (uint64_t)f.w[i + 1] << (32 - bits);
+			c.w[c.n++] = (uint32_t)x;
+		}
+		while (c.n > 0 && c.w[c.n - 1] == 0) c.n--;
+		str_big_add_small(&c, 1);
+		int len = str_big_bitlen(&c);
+		str_pow5_128[-k - STR_POW5_MIN_Q][0] = str_big_bits64(&c, len - 64);
+		str_pow5_128[-k - STR_POW5_MIN_Q][1] = str_big_bits64(&c, len - 128);
+	}
+}
+
+static void
+str_pow5_tables_ready(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	if (__atomic_load_n(&str_pow5_state, __ATOMIC_ACQUIRE) != 2) {
+		int expected = 0;
+		if (__atomic_compare_exchange_n(&str_pow5_state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			str_pow5_table_init();
+			__atomic_store_n(&str_pow5_state, 2, __ATOMIC_RELEASE);
+		} else {
+			while (__atomic_load_n(&str_pow5_state, __ATOMIC_ACQUIRE) != 2);
+		}
+	}
+#else
+	if (str_pow5_state != 2) {
+		str_pow5_table_init();
+		str_pow5_state = 2;
+	}
+#endif
+}
+
+static const uint64_t *
+str_pow5(int q)
+{
+	str_pow5_tables_ready();
+	return str_pow5_128[q - STR_POW5_MIN_Q];
+}
+
+// returns the low 64 bits of a*b, and the high ones in *hi
+static uint64_t
+str_mul64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+	*hi = (uint64_t)(r >> 64);
+	return (uint64_t)r;
+#else
+	uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+	uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+	*hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+	return (mid << 32) | (uint32_t)p00;
+#endif
+}
+
+#define STR_DOUBLE_INF_BITS 0x7ff0000000000000ull
+
+// The bits of the double nearest to w * 10^q, for w != 0 (no sign).
+static uint64_t
+str_eisel_lemire(uint64_t w, int q)
+{
+	if (q < STR_POW5_MIN_Q) return 0;
+	if (q > STR_POW5_MAX_Q) return STR_DOUBLE_INF_BITS;
+
+	int lz = str_clz64(w);
+	w <<= lz;
+	const uint64_t *t = str_pow5(q);
+	uint64_t hi, lo = str_mul64(w, t[0], &hi);
+	if ((hi & 0x1ff) == 0x1ff) {
+		// the low bits we're about to drop might carry: take in the next word
+		uint64_t hi2;
+		str_mul64(w, t[1], &hi2);
+		lo += hi2;
+		if (hi2 > lo) hi++;
+	}
+
+	int upperbit = hi >> 63;
+	int shift = upperbit + 9;
+	uint64_t mantissa = hi >> shift;
+	// (152170 + 65536) / 2^16 ~= log2(10)
+	int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+
+	if (power2 <= 0) {
+		// subnormal (maybe: rounding up can make it the smallest normal)
+		if (-power2 + 1 >= 64) return 0;
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		power2 = mantissa < (1ull << 52) ? 0 : 1;
+		return mantissa | (uint64_t)power2 << 52;
+	}
+
+	// Exactly halfway between two doubles: round to even rather than up.
+	// That needs 5^q to be exact in 64 bits, so -4 <= q <= 23.
+	if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == hi)
+		mantissa &= ~1ull;
+
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if (mantissa >= (2ull << 52)) {
+		mantissa = 1ull << 52;
+		power2++;
+	}
+	mantissa &= ~(1ull << 52);
+	if (power2 >= 0x7ff) return STR_DOUBLE_INF_BITS;
+	return mantissa | (uint64_t)power2 << 52;
+}
+
+// The slow path: `bits` is the double just below (or at) the decimal number
+// written in mantissa[0..len) (digits and maybe a '.') times 10^exponent.
+// Returns it, or the next double up, whichever is nearest.
+static uint64_t
+str_parse_double_slow(const char *mantissa, int len, int exponent, uint64_t bits)
+{
+	// 800 digits is more than enough: a halfway point between two doubles 
+	// never has more than 767 significant digits. The rest only matter in 
+	// whether they're all zero.
+	enum {MAX_DIGITS = 800};
+	StrBig d = {{0}, 0};
+	int ndigits = 0, q = exponent, point = 0, sticky = 0;
+	uint32_t chunk = 0;
+	int chunk_len = 0;
+	for (int i = 0; i < len; i++) {
+		if (mantissa[i] == '.') {
+			point = 1;
+			continue;
+		}
+		int digit = mantissa[i] - '0';
+		if (ndigits == 0 && digit == 0) {
+			q -= point;
+		} else if (ndigits < MAX_DIGITS) {
+			chunk = chunk * 10 + digit;
+			q -= point;
+			ndigits++;
+			if (++chunk_len == 9) {
+				str_big_mul_small(&d, 1000000000);
+				str_big_add_small(&d, chunk);
+				chunk = chunk_len = 0;
+			}
+		} else {
+			sticky |= digit != 0;
+			q += !point;
+		}
+	}
+	str_big_mul_small(&d, (uint32_t)str_pow10_u64[chunk_len]);
+	str_big_add_small(&d, chunk);
+
+	// the halfway point is (2m+1) * 2^(e-1), where bits is m * 2^e
+	uint64_t m = bits & ((1ull << 52) - 1);
+	int e = (int)(bits >> 52);
+	if (e) m |= 1ull << 52;
+	e = (e ? e : 1) - 1075;
+	uint64_t h = 2*m + 1;
+	StrBig half = {{(uint32_t)h, (uint32_t)(h >> 32)}, h >> 32 ? 2 : 1};
+
+	// compare d * 5^q * 2^q with half * 2^(e-1)
+	if (q >= 0) str_big_mul_pow5(&d, q);
+	else str_big_mul_pow5(&half, -q);
+	if (q - (e - 1) >= 0) str_big_shl(&d, q - (e - 1));
+	else str_big_shl(&half, (e - 1) - q);
+
+	int cmp = str_big_cmp(&d, &half);
+	if (cmp == 0 && sticky) cmp = 1;
+	if (cmp > 0 || (cmp == 0 && (bits & 1))) bits++;
+	return bits;
+}
+
+// Returns the length of `word` if `s` starts with it (ignoring case), or 0.
+static int
+str_starts_with_nocase(const char *s, int len, const char *word)
+{
+	int i = 0;
+	for (; word[i]; i++)
+		if (i >= len || (s[i] | 0x20) != word[i]) return 0;
+	return i;
+}
+
+NONSTD_STR_API int
+parse_double(char *str, int len, double *result)
+{
+	static const double exact_pow10[23] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	int i = 0, negative = 0;
+	uint64_t sign = 0, bits = 0;
+	if (len > 0 && (str[0] == '-' || str[0] == '+')) {
+		negative = str[0] == '-';
+		i = 1;
+	}
+	sign = (uint64_t)negative << 63;
+
+	if (i < len && ((str[i] | 0x20) == 'i' || (str[i] | 0x20) == 'n')) {
+		int k = str_starts_with_nocase(str + i, len - i, "infinity");
+		if (!k) k = str_starts_with_nocase(str + i, len - i, "inf");
+		if (k) bits = STR_DOUBLE_INF_BITS;
+		else if ((k = str_starts_with_nocase(str + i, len - i, "nan"))) bits = 0x7ff8000000000000ull;
+		if (!k) return 0;
+		bits |= sign;
+		memcpy(result, &bits, sizeof(bits));
+		return i + k;
+	}
+
+	// The significand: w holds the first 19 significant digits, and q 
+	// the power of ten that goes with them.
+	int mantissa_start = i, ndigits = 0, nsig = 0, q = 0, truncated = 0;
+	uint64_t w = 0;
+	while (i < len && str[i] == '0') i++;
+	ndigits += i - mantissa_start;
+	nsig = str_parse_digits(str + i, len - i, 19, &w);
+	i += nsig;
+	ndigits += nsig;
+	for (; i < len && str_is_digit(str[i]); i++, ndigits++) {
+		q++;
+		truncated |= str[i] != '0';
+	}
+	if (i < len && str[i] == '.') {
+		int frac_start = ++i;
+		if (nsig == 0) {
+			while (i < len && str[i] == '0') i++;
+			q -= i - frac_start;
+		}
+		uint64_t f = 0;
+		int k = str_parse_digits(str + i, len - i, 19 - nsig, &f);
+		w = w * str_pow10_u64[k] + f;
+		nsig += k;
+		q -= k;
+		i += k;
+		for (; i < len && str_is_digit(str[i]); i++) truncated |= str[i] != '0';
+		ndigits += i - frac_start;
+	}
+	if (ndigits == 0) return 0;
+	int mantissa_end = i;
+
+	int exponent = 0;
+	if (i < len && (str[i] | 0x20) == 'e') {
+		int j = i + 1, exponent_negative = 0;
+		if (j < len && (str[j] == '-' || str[j] == '+')) exponent_negative = str[j++] == '-';
+		if (j < len && str_is_digit(str[j])) {
+			for (; j < len && str_is_digit(str[j]); j++)
+				if (exponent < 100000) exponent = exponent * 10 + (str[j] - '0');
+			if (exponent_negative) exponent = -exponent;
+			i = j;
+		}
+	}
+	q += exponent;
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+	if (!truncated && w <= (1ull << 53) && q >= -22 && q <= 22) {
+		double d = (double)w;
+		d = q < 0 ? d / exact_pow10[-q] : d * exact_pow10[q];
+		*result = negative ? -d : d;
+		return i;
+	}
+#else
+	(void) exact_pow10;
+#endif
+
+	if (w != 0) {
+		bits = str_eisel_lemire(w, q);
+		if (truncated && bits != str_eisel_lemire(w + 1, q))
+			bits = str_parse_double_slow(str + mantissa_start, mantissa_end - mantissa_start, exponent, bits);
+	}
+	bits |= sign;
+	memcpy(result, &bits, sizeof(bits));
+	return i;
+}
+
+// INTEGER FORMATTING
+// Digits are written back to front, two at a time from a table of the 
+// pairs "00" to "99", so there's one division (by a constant, so really a
+// multiply) per two digits.
+
+static const char str_digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// number of decimal digits in x (1 for 0)
+static int
+str_count_digits(uint64_t x)
+{
+	// 1233/4096 ~= log10(2)
+	int n = ((64 - str_clz64(x | 1)) * 1233) >> 12;
+	return n + ((x | 1) >= str_pow10_u64[n]);
+}
+
+// writes the n digits of x, ending at dest[n-1]
+static void
+str_write_digits(char *dest, uint64_t x, int n)
+{
+	char *p = dest + n;
+	while (x >= 100) {
+		uint64_t q = x / 100;
+		p -= 2;
+		memcpy(p, str_digit_pairs + 2*(x - q*100), 2);
+		x = q;
+	}
+	if (x >= 10) {
+		p -= 2;
+		memcpy(p, str_digit_pairs + 2*x, 2);
+	} else {
+		*--p = (char)('0' + x);
+	}
+}
+
+NONSTD_STR_API int
+format_ull(char *dest, unsigned long long x)
+{
+	int n = str_count_digits(x);
+	str_write_digits(dest, x, n);
+	return n;
+}
+
+NONSTD_STR_API int
+format_ll(char *dest, long long x)
+{
+	if (x >= 0) return format_ull(dest, x);
+	*dest = '-';
+	return 1 + format_ull(dest + 1, 0 - (unsigned long long)x);
+}
+
+// FLOAT FORMATTING
+// Shortest round trip output, with Schubfach (Giulietti, "The Schubfach
+// way to render doubles"). Like Ryu, it finds the shortest decimal in the
+// interval of reals that round to the double, using a 126-bit power of ten
+// per exponent, but it needs fewer multiplies and no loop over digits. It
+// gives the decimal nearest the double among the shortest (ties to even).
+
+static int
+str_flog10_pow2(int e) 
+{
+	// floor(e * log10(2))
+	return (int)(((int64_t)e * 661971961083ll) >> 41);
+}
+
+static int
+str_flog10_three_quarters_pow2(int e)
+{
+	// floor(log10(3/4 * 2^e))
+	return (int)(((int64_t)e * 661971961083ll - 274743187321ll) >> 41);
+}
+
+static int
+str_flog2_pow10(int e)
+{
+	// floor(e * log2(10))
+	return (int)(((int64_t)e * 913124641741ll) >> 38);
+}
+
+// g * cp / 2^127 (g = g1*2^63 + g0), rounded to odd
+static uint64_t
+str_round_to_odd(uint64_t g1, uint64_t g0, uint64_t cp)
+{
+	uint64_t x1, y1, mask = (1ull << 63) - 1;
+	str_mul64(g0, cp, &x1);
+	uint64_t y0 = str_mul64(g1, cp, &y1);
+	uint64_t z = (y0 >> 1) + x1;
+	uint64_t vbp = y1 + (z >> 63);
+	return vbp | (((z & mask) + mask) >> 63);
+}
+
+// The shortest decimal (nearest, among the shortest) that rounds to the 
+// double c * 2^q. Returns its digits, and the power of ten in *exp10. The 
+// digits can have trailing zeros.
+static uint64_t
+str_schubfach(int q, uint64_t c, int *exp10)
+{
+	int out = c & 1, k;
+	uint64_t cb = c << 2, cbr = cb + 2, cbl;
+	if (c != (1ull << 52) || q == -1074) {
+		cbl = cb - 2;
+		k = str_flog10_pow2(q);
+	} else {
+		// the double below is closer than the one above
+		cbl = cb - 1;
+		k = str_flog10_three_quarters_pow2(q);
+	}
+	int h = q + str_flog2_pow10(-k) + 2;
+
+	str_pow5_tables_ready();
+	const uint64_t *g = str_pow5_126[-k - STR_POW5_126_MIN_Q];
+	uint64_t vb = str_round_to_odd(g[0], g[1], cb << h);
+	uint64_t vbl = str_round_to_odd(g[0], g[1], cbl << h);
+	uint64_t vbr = str_round_to_odd(g[0], g[1], cbr << h);
+
+	// One digit shorter? (Java only asks when s >= 100, to always print two
+	// digits. Only subnormals have s < 100.) s/10 is s * (2^64/10, rounded up).
+	uint64_t s = vb >> 2, sp10_hi;
+	str_mul64(s, 1844674407370955168ull, &sp10_hi);
+	uint64_t sp10 = 10 * sp10_hi, tp10 = sp10 + 10;
+	int upin = vbl + out <= sp10 << 2;
+	int wpin = (tp10 << 2) + out <= vbr;
+	*exp10 = k;
+	if (upin != wpin) return upin ? sp10 : tp10;
+
+	uint64_t t = s + 1;
+	int uin = vbl + out <= s << 2;
+	int win = (t << 2) + out <= vbr;
+	if (uin != win) return uin ? s : t;
+	// both in the interval: the nearer one
+	int64_t cmp = (int64_t)(vb - ((s + t) << 1));
+	return cmp < 0 || (cmp == 0 && !(s & 1)) ? s : t;
+}
+
+NONSTD_STR_API int
+format_double(char *dest, double x)
+{
+	uint64_t bits, f = 0;
+	memcpy(&bits, &x, sizeof(bits));
+	char *p = dest;
+	if (bits >> 63) *p++ = '-';
+
+	uint64_t mantissa = bits & ((1ull << 52) - 1);
+	int biased = (int)(bits >> 52) & 0x7ff, e = 0;
+	if (biased == 0x7ff) {
+		if (mantissa) {
+			memcpy(dest, "nan", 3);
+			return 3;
+		}
+		memcpy(p, "inf", 3);
+		return (int)(p - dest) + 3;
+	} else if (biased) {
+		uint64_t c = mantissa | (1ull << 52);
+		int shift = 1075 - biased;
+		if (shift > 0 && shift < 53 && (c >> shift) << shift == c) {
+			// a whole number below 2^53: that's the shortest
+			f = c >> shift;
+		} else {
+			f = str_schubfach(-shift, c, &e);
+		}
+	} else if (mantissa) {
+		// subnormal. (Java scales the smallest two by 10, to print at least
+		// two digits, "4.9E-324", but we want the shortest, "5e-324".)
+		f = str_schubfach(-1074, mantissa, &e);
+	} else {
+		*p++ = '0';
+		return (int)(p - dest);
+	}
+
+	while (f % 10 == 0) {
+		f /= 10;
+		e++;
+	}
+	char digits[20];
+	int n = str_count_digits(f);
+	str_write_digits(digits, f, n);
+
+	// the power of ten of the first digit
+	int point = e + n - 1;
+	if (point < -4 || point >= 16) {
+		*p++ = digits[0];
+		if (n > 1) {
+			*p++ = '.';
+			memcpy(p, digits + 1, n - 1);
+			p += n - 1;
+		}
+		*p++ = 'e';
+		*p++ = point < 0 ? '-' : '+';
+		int a = point < 0 ? -point : point;
+		if (a >= 100) {
+			*p++ = (char)('0' + a / 100);
+			a %= 100;
+		}
+		memcpy(p, str_digit_pairs + 2*a, 2);
+		p += 2;
+	} else if (point < 0) {
+		memcpy(p, "0.0000", 1 - point);
+		p += 1 - point;
+		memcpy(p, digits, n);
+		p += n;
+	} else if (n <= point + 1) {
+		memcpy(p, digits, n);
+		p += n;
+		for (int i = n; i <= point; i++) *p++ = '0';
+	} else {
+		memcpy(p, digits, point + 1);
+		p += point + 1;
+		*p++ = '.';
+		memcpy(p, digits + point + 1, n - point - 1);
+		p += n - point - 1;
+	}
+	return (int)(p - dest);
+}
+
+// After a number, which ended at *i: skips blanks (unless the delimiter is
+// one) and the delimiter. Returns 1 if there's another field, 0 at the end,
+// -1 if anything else follows the number.
+static int
+str_list_next(Str s, int *i, char delim)
+{
+	int j = *i;
+	while (j < s.len && s.ptr[j] != delim && (s.ptr[j] == ' ' || s.ptr[j] == '\t')) j++;
+	if (j >= s.len) return 0;
+	if (s.ptr[j] != delim) return -1;
+	*i = ++j;
+	return j < s.len;
+}
+
+static int
+str_list_skip_blanks(Str s, int i)
+{
+	while (i < s.len && (s.ptr[i] == ' ' || s.ptr[i] == '\t')) i++;
+	return i;
+}
+
+NONSTD_STR_API int
+str_parse_doubles(Str s, char delim, double *out, int max_count)
+{
+	int i = 0, count = 0, more = s.len > 0;
+	while (more && count < max_count) {
+		i = str_list_skip_blanks(s, i);
+		int k = parse_double(s.ptr + i, s.len - i, &out[count]);
+		if (k <= 0) return -1 - count;
+		i += k;
+		if ((more = str_list_next(s, &i, delim)) < 0) return -1 - count;
+		count++;
+	}
+	return count;
+}
+
+NONSTD_STR_API int
+str_parse_lls(Str s, char delim, long long *out, int max_count)
+{
+	int i = 0, count = 0, more = s.len > 0;
+	while (more && count < max_count) {
+		i = str_list_skip_blanks(s, i);
+		int k = parse_decimal_ll(s.ptr + i, s.len - i, &out[count]);
+		if (k <= 0) return -1 - count;
+		i += k;
+		if ((more = str_list_next(s, &i, delim)) < 0) return -1 - count;
+		count++;
+	}
+	return count;
+}
+
+enum {
+	OP_RET                     = 0x00,
+	OP_JUMP                    = 0x01,
+	OP_MATCH_START_END         = 0x02,
+	OP_MATCH                   = 0x03,
+	OP_MATCH_OR_RET_F          = 0x04,
+	OP_MATCH_AND_RET_T         = 0x05,
+	OP_MATCH_AND_RET_F         = 0x06,
+	OP_MATCH_AND_RPT           = 0x07,
+	OP_CALL                    = 0x08,
+	OP_RPT_IF_RET_T            = 0x09,
+	OP_RET_F_IF_RET_F          = 0x0a,
+	OP_MATCH_BUILTIN           = 0x0b,
+	OP_MATCH_BUILTIN_OR_RET_F  = 0x0c,
+	OP_MATCH_BUILTIN_AND_RET_T = 0x0d,
+	OP_MATCH_BUILTIN_AND_RET_F = 0x0e,
+	OP_MATCH_BUILTIN_AND_RPT   = 0x0f,
+
+	OP_MASK   = 0x0f,
 	ARG_SHIFT = 4,
 };
 
@@ -544,7 +2113,12 @@ typedef struct
 	int input_counter;
 
 	CompiledStrPattern *program;
+	unsigned short *code;
 	int program_counter;
+	int *captures; // where each capture starts and ends, if they're wanted
+	int capture_next; // the next pc that starts or ends a capture, -1 if they aren't wanted
+	int capture_at;   // how far through capture_order that is
+	unsigned char capture_order[2*PATTERN_MAX_CAPTURES]; // the marks by pc
 
 	char *error;
 
@@ -554,6 +2128,12 @@ typedef struct
 	int stack[PATTERN_MACHINE_STACK_MAX];
 } PatternMachineState;
 
+// The program's code, wherever it is
+static inline unsigned short *
+pattern_code(CompiledStrPattern *program)
+{
+	return program->long_code ? program->long_code : program->code;
+}
 
 static int
 pattern_machine_get_input(PatternMachineState *m)
@@ -569,13 +2149,60 @@ pattern_machine_advance_input(PatternMachineState *m)
 	m->input_counter++;
 }
 
+// The RPT instructions for classes skip the whole run at once. Kept out of 
+// line: inlined, it makes the rest of pattern_machine_run() slower.
+static STR_NOINLINE void
+pattern_machine_span(PatternMachineState *m, char c, int classes, int negate)
+{
+	Str rest = mkstr(m->input + m->input_counter, m->input_len - m->input_counter);
+	if (c == '.') m->input_counter += rest.len;
+	else if (negate) m->input_counter += str_span_not_class(rest, classes);
+	else m->input_counter += str_span_class(rest, classes);
+}
+
+// The classes for %a, %d, etc. (upper or lower case), -1 if invalid
+static inline int
+pattern_builtin_classes(char c)
+{
+	switch (c | 0x20) {
+	case '.': return 0;
+	case 'a': return ASCII_CLASS_LETTER;
+	case 'c': return ASCII_CLASS_CONTROL;
+	case 'd': return ASCII_CLASS_DIGIT;
+	case 'l': return ASCII_CLASS_LOWER;
+	case 'p': return ASCII_CLASS_PUNCTUATION;
+	case 's': return ASCII_CLASS_WHITESPACE;
+	case 'u': return ASCII_CLASS_UPPER;
+	case 'w': return ASCII_CLASS_ALPHANUMERIC;
+	case 'x': return ASCII_CLASS_HEXDIGIT;
+	case 'z': return ASCII_CLASS_NUL;
+	}
+	return -1;
+}
+
+// Where the input is when an instruction is first reached is where the 
+// captures that start or end before it do. Outside the classes' subroutines
+// (where no capture starts or ends) the machine only goes forward, through 
+// every instruction up to the match's end, so the marks come up in the 
+// order of their pcs, and a match sets all of them.
+static inline void
+pattern_machine_capture(PatternMachineState *m)
+{
+	int n = 2*m->program->capture_count, at = m->capture_at;
+	for (; at < n && m->program->capture_pc[m->capture_order[at]] == m->program_counter; at++) 
+		m->captures[m->capture_order[at]] = m->input_counter;
+	m->capture_at = at;
+	m->capture_next = at < n ? m->program->capture_pc[m->capture_order[at]] : INT_MAX;
+}
+
 static int
 pattern_machine_run(PatternMachineState *m)
 {
        	while(1) {
 		assert(m->program_counter < m->program->code_size);
+		if (m->program_counter == m->capture_next) pattern_machine_capture(m);
 
-		unsigned short instr  = m->program->code[m->program_counter];
+		unsigned short instr  = m->code[m->program_counter];
 		unsigned short opcode = instr & OP_MASK;
 		unsigned short arg    = instr >> ARG_SHIFT;
 		char c = arg;
@@ -605,7 +2232,8 @@ pattern_machine_run(PatternMachineState *m)
 			}
 			break;
 		case OP_JUMP:
-			m->program_counter = arg-1;
+			// forward, over a class
+			m->program_counter += arg-1;
 			break;
 		case OP_MATCH_START_END:
 			if(c == '^') {
@@ -651,7 +2279,8 @@ pattern_machine_run(PatternMachineState *m)
 			// TODO guard against stack overflow
 			m->stack[m->stack_pointer++] = m->program_counter;
 			m->stack[m->stack_pointer++] = m->input_counter;
-			m->program_counter = arg-1;
+			// back, to a class
+			m->program_counter -= arg+1;
 			break;
 		case OP_RPT_IF_RET_T:
 			if (m->return_register) m->program_counter -= 2;
@@ -667,81 +2296,19 @@ pattern_machine_run(PatternMachineState *m)
 			assert(arg < 128);
 			int result = 0;
 			int input = pattern_machine_get_input(m);
+			int negate = c >= 'A' && c <= 'Z';
+			int classes = pattern_builtin_classes(c);
+			assert(classes >= 0 && "Invalid built-in match group");
+
+			if (opcode == OP_MATCH_BUILTIN_AND_RPT) {
+				// take the whole run at once, rather than one byte per instruction
+				pattern_machine_span(m, c, classes, negate);
+				break;
+			}
 
-			if(input <= CHAR_MAX && input >= CHAR_MIN)
-			switch(c)
-			{
-				case '.': result = 1; break;
-
-				case 'A': result = 1;
-				case 'a':
-					if (
-					(input >= 'A' && input <= 'Z') ||
-					(input >= 'a' && input <= 'z') )
-					       	result = !result;
-					break;
-
-				case 'C': result = 1;
-				case 'c':
-					if(input == 0x7f || (input >= 0 && input <= 0x1f))
-						result = !result;
-					break;
-
-				case 'D': result = 1;
-				case 'd':
-					if(input >= '0' && input <='9')
-						result = !result;
-					break;
-
-				case 'L': result = 1;
-				case 'l':
-					if(input >= 'a' && input <= 'z')
-						result = !result;
-					break;
-
-				case 'P': result = 1;
-				case 'p':
-					if(is_ascii_punctuation(input))
-						result = !result;
-					break;
-
-				case 'S': result = 1;
-				case 's':
-					if(is_ascii_whitespace(input))
-						result = !result;	
-					break;
-
-				case 'U': result = 1;
-				case 'u':
-					if(input >= 'A' && input <= 'Z')
-						result = !result;
-					break;
-
-				case 'W': result = 1;
-				case 'w':
-					if(
-					(input >= '0' && input <= '9') ||
-					(input >= 'A' && input <= 'Z') ||
-					(input >= 'a' && input <= 'z'))
-						result = !result;
-					break;
-
-				case 'X': result = 1; 
-				case 'x': if(
-					(input >= '0' && input <= '9') ||
-					(input >= 'A' && input <= 'F') ||
-					(input >= 'a' && input <= 'f'))
-						result = !result;
-					break;
-
-				case 'Z': result = 1;
-				case 'z':
-					if(input==0) result = !result;
-					break;
-
-				default:
-					assert(!"Invalid built-in match group");
-					break;
+			if(input <= CHAR_MAX && input >= CHAR_MIN) {
+				if (c == '.') result = 1;
+				else result = ((STR_CLASS(input) & classes) != 0) != negate;
 			}
 
 			if (result) pattern_machine_advance_input(m);
@@ -779,20 +2346,41 @@ program_add(unsigned short opcode, unsigned short arg, CompiledStrPattern *progr
 	assert(program);
 	if(program->error) return;
 
-	opcode = make_instruction(opcode, arg);
-	if(program->code_size < PATTERN_MACHINE_MAX_PROGRAM_SIZE)
-		program->code[program->code_size++] = opcode;
+	int cap = program->long_code ? program->long_code_cap : PATTERN_MACHINE_MAX_PROGRAM_SIZE;
+	if(program->code_size < cap)
+		pattern_code(program)[program->code_size++] = make_instruction(opcode, arg);
 	else program->error = 1;
 }
 
+// The literal bytes at the start of the program, up to the first thing 
+// that isn't one byte exactly once, or the builtin class of the first byte.
+// Not for programs starting with ^, which only try the start anyway.
+static void
+pattern_find_prefix(CompiledStrPattern *program)
+{
+	unsigned short *code = pattern_code(program);
+	for (int pc = 0; pc < program->code_size && program->prefix_len < PATTERN_PREFIX_MAX; pc++) {
+		if ((code[pc] & OP_MASK) != OP_MATCH_OR_RET_F) break;
+		program->prefix[program->prefix_len++] = code[pc] >> ARG_SHIFT;
+	}
+	if (program->prefix_len) return;
 
-NONSTD_STR_API CompiledStrPattern
-pattern_compile_ascii(char *pattern, int pattern_len)
+	char c = code[0] >> ARG_SHIFT;
+	if ((code[0] & OP_MASK) == OP_MATCH_BUILTIN_OR_RET_F && c != '.') {
+		program->start_classes = pattern_builtin_classes(c);
+		program->start_negated = c >= 'A' && c <= 'Z';
+	}
+}
+
+// Jumps go forward over a class's subroutine, and calls back to it, by the
+// distance in their argument, so that only a class has to fit in it.
+static void
+pattern_compile_to(CompiledStrPattern *program, char *pattern, int pattern_len)
 {
-	CompiledStrPattern program = {0};
 	int in_class = 0;
 	int invert_class = 0;
 	int class_pos = 0;
+	int open[PATTERN_MAX_CAPTURES], open_count = 0;
 
 	char *limit = pattern+pattern_len;
 	char *p = pattern;
@@ -806,49 +2394,54 @@ pattern_compile_ascii(char *pattern, int pattern_len)
 		if(in_class) {
 			/* INSIDE A CHARACTER CLASS */
 			if(c == ']') {
-				program_add(OP_RET, 0, &program);
+				program_add(OP_RET, 0, program);
 
 				in_class = 0;
-				program.code[class_pos] = make_instruction(OP_JUMP,program.code_size);
+				// the calls after it are a few further back than the jump over it goes
+				if (program->code_size + 3 - class_pos >= 1 << (16 - ARG_SHIFT)) program->error = 1;
+				if (program->error) return;
+				pattern_code(program)[class_pos] = make_instruction(OP_JUMP, program->code_size - class_pos);
+				#define PATTERN_CALL_CLASS() program_add(OP_CALL, program->code_size - (class_pos+1), program)
 
 				if(next == '?') {
-					program_add(OP_CALL, class_pos+1, &program);
+					PATTERN_CALL_CLASS();
 					p++;
 				} else if(next == '*') { 
-					program_add(OP_CALL, class_pos+1, &program);
-					program_add(OP_RPT_IF_RET_T, 0, &program);
+					PATTERN_CALL_CLASS();
+					program_add(OP_RPT_IF_RET_T, 0, program);
 					p++;
 				} else if(next == '+') {
-					program_add(OP_CALL, class_pos+1, &program);
-					program_add(OP_RET_F_IF_RET_F, 0, &program);
-					program_add(OP_CALL,  class_pos+1, &program);
-					program_add(OP_RPT_IF_RET_T, 0, &program);
+					PATTERN_CALL_CLASS();
+					program_add(OP_RET_F_IF_RET_F, 0, program);
+					PATTERN_CALL_CLASS();
+					program_add(OP_RPT_IF_RET_T, 0, program);
 					p++;
 				} else {
-					program_add(OP_CALL, class_pos+1, &program);
-					program_add(OP_RET_F_IF_RET_F, 0, &program);
+					PATTERN_CALL_CLASS();
+					program_add(OP_RET_F_IF_RET_F, 0, program);
 				}
+				#undef PATTERN_CALL_CLASS
 
 			} else if(c == '%') {
 
 				if(next > CHAR_MAX) goto error;
-				#define TOKENS_MAPPED_TO_CHAR2  "%.+*?^$[]"
+				#define TOKENS_MAPPED_TO_CHAR2  "%.+*?^$[]()"
 				#define TOKENS_MAPPED_TO_GROUP "acdlpsuwxzACDLPSUWXZ"
 				if(is_character_in_set(next, TOKENS_MAPPED_TO_CHAR2, sizeof(TOKENS_MAPPED_TO_CHAR2)-1)) {
 
-					if(!invert_class) program_add(OP_MATCH_AND_RET_T, next, &program);
-					else              program_add(OP_MATCH_AND_RET_F, next, &program);
+					if(!invert_class) program_add(OP_MATCH_AND_RET_T, next, program);
+					else              program_add(OP_MATCH_AND_RET_F, next, program);
 
 				} else if(is_character_in_set(next, TOKENS_MAPPED_TO_GROUP, sizeof(TOKENS_MAPPED_TO_GROUP)-1)) {
 
-					if(!invert_class) program_add(OP_MATCH_BUILTIN_AND_RET_T, next, &program);
-					else              program_add(OP_MATCH_BUILTIN_AND_RET_F, next, &program);
+					if(!invert_class) program_add(OP_MATCH_BUILTIN_AND_RET_T, next, program);
+					else              program_add(OP_MATCH_BUILTIN_AND_RET_F, next, program);
 
 				} else goto error;
 				p++;
 			} else {
-				if(!invert_class) program_add(OP_MATCH_AND_RET_T, c, &program);
-				else              program_add(OP_MATCH_AND_RET_F, c, &program);
+				if(!invert_class) program_add(OP_MATCH_AND_RET_T, c, program);
+				else              program_add(OP_MATCH_AND_RET_F, c, program);
 			}
 
 		} else {
@@ -860,45 +2453,52 @@ pattern_compile_ascii(char *pattern, int pattern_len)
 
 			if(c == '%') {
 				if(next > CHAR_MAX) goto error;
-				#define TOKENS_MAPPED_TO_CHAR  "%.+*?^$["
+				#define TOKENS_MAPPED_TO_CHAR  "%.+*?^$[()"
 				if(is_character_in_set(next, TOKENS_MAPPED_TO_CHAR, sizeof(TOKENS_MAPPED_TO_CHAR)-1)) {
 					if(nnext == '+') {
-						program_add(OP_MATCH_OR_RET_F, next, &program);
-						program_add(OP_MATCH_AND_RPT, next, &program);
+						program_add(OP_MATCH_OR_RET_F, next, program);
+						program_add(OP_MATCH_AND_RPT, next, program);
 						p+=2;
 					} else if(nnext == '*') {
-						program_add(OP_MATCH_AND_RPT, next, &program);
+						program_add(OP_MATCH_AND_RPT, next, program);
 						p+=2;
 					} else if(nnext == '?') {
-						program_add(OP_MATCH, next, &program);
+						program_add(OP_MATCH, next, program);
 						p+=2;
 					} else {
-						program_add(OP_MATCH_OR_RET_F, next, &program);
+						program_add(OP_MATCH_OR_RET_F, next, program);
 						p++;
 					}
 				} else if(is_character_in_set(next, TOKENS_MAPPED_TO_GROUP, sizeof(TOKENS_MAPPED_TO_GROUP)-1)) {
 					if(nnext == '+') {
-						program_add(OP_MATCH_BUILTIN_OR_RET_F, next, &program);
-						program_add(OP_MATCH_BUILTIN_AND_RPT, next, &program);
+						program_add(OP_MATCH_BUILTIN_OR_RET_F, next, program);
+						program_add(OP_MATCH_BUILTIN_AND_RPT, next, program);
 						p+=2;
 					} else if(nnext == '*') {
-						program_add(OP_MATCH_BUILTIN_AND_RPT, next, &program);
+						program_add(OP_MATCH_BUILTIN_AND_RPT, next, program);
 						p+=2;
 					} else if(nnext == '?') {
-						program_add(OP_MATCH_BUILTIN, next, &program);
+						program_add(OP_MATCH_BUILTIN, next, program);
 						p+=2;
 					} else {
-						program_add(OP_MATCH_BUILTIN_OR_RET_F, next, &program);
+						program_add(OP_MATCH_BUILTIN_OR_RET_F, next, program);
 						p++;
 					}
 				} else goto error;
 			} 
-			else if (c == '^') program_add(OP_MATCH_START_END, c, &program);
-			else if (c == '$') program_add(OP_MATCH_START_END, c, &program);
-			else if (c == '[') {
+			else if (c == '^') program_add(OP_MATCH_START_END, c, program);
+			else if (c == '$') program_add(OP_MATCH_START_END, c, program);
+			else if (c == '(') {
+				if(program->capture_count == PATTERN_MAX_CAPTURES) goto error;
+				open[open_count++] = program->capture_count;
+				program->capture_pc[2*program->capture_count++] = program->code_size;
+			} else if (c == ')') {
+				if(open_count == 0) goto error;
+				program->capture_pc[2*open[--open_count] + 1] = program->code_size;
+			} else if (c == '[') {
 				in_class = 1;
-				class_pos = program.code_size;
-				program_add(OP_RET, 0, &program); // this will later be replaced
+				class_pos = program->code_size;
+				program_add(OP_RET, 0, program); // this will later be replaced
 				if (next == '^') {
 					invert_class = 1;
 					p++;
@@ -907,181 +2507,2949 @@ pattern_compile_ascii(char *pattern, int pattern_len)
 				}
 			} else {
 				if(next == '+') {
-					program_add(OP_MATCH_OR_RET_F, c, &program);
-					program_add(OP_MATCH_AND_RPT, c, &program);
+					program_add(OP_MATCH_OR_RET_F, c, program);
+					program_add(OP_MATCH_AND_RPT, c, program);
 					p++;
 				} else if(next == '*') {
-					program_add(OP_MATCH_AND_RPT, c, &program);
+					program_add(OP_MATCH_AND_RPT, c, program);
 					p++;
 				} else if(next == '?') {
-					program_add(OP_MATCH, c, &program);
+					program_add(OP_MATCH, c, program);
 					p++;
-				} else	program_add(OP_MATCH_OR_RET_F, c, &program);
+				} else	program_add(OP_MATCH_OR_RET_F, c, program);
 			}
 		}
 	}
 
-	if(in_class) goto error;
-	program_add(OP_RET, 1, &program);
+	if(in_class || open_count) goto error;
+	program_add(OP_RET, 1, program);
+	if (!program->error) pattern_find_prefix(program);
+	return;
+
+	error: program->error = -1 - (p-pattern);
+} 
+
+NONSTD_STR_API CompiledStrPattern
+pattern_compile_ascii(char *pattern, int pattern_len)
+{
+	CompiledStrPattern program = {0};
+	pattern_compile_to(&program, pattern, pattern_len);
 	return program;
+}
 
-	error: program.error = -1 - (p-pattern);
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API CompiledStrPattern *
+pattern_compile(Arena *a, char *pattern, int pattern_len)
+{
+	CompiledStrPattern *program = allocate(a, sizeof(*program));
+	// each byte of the pattern makes 3 instructions at most
+	program->long_code_cap = 3 * (i64)pattern_len + 1 < INT_MAX ? 3 * pattern_len + 1 : INT_MAX;
+	program->long_code = allocate_empty(a, program->long_code_cap * (i64)sizeof(program->long_code[0]));
+	pattern_compile_to(program, pattern, pattern_len);
 	return program;
-} 
+}
+#endif
 
 
 
 
-NONSTD_STR_API int
-pattern_match_ascii(char *string, int string_len, CompiledStrPattern *program, int *match_len)
+static int
+pattern_starts_with_anchor(CompiledStrPattern *program)
 {
-	if(program->error) return -2;
-
-	int program_starts_with_anchor = 
-		((program->code[0] & OP_MASK) == OP_MATCH_START_END) &&
-		((program->code[0] >> ARG_SHIFT) == '^');
+	unsigned short *code = pattern_code(program);
+	return ((code[0] & OP_MASK) == OP_MATCH_START_END) &&
+		((code[0] >> ARG_SHIFT) == '^');
+}
 
-	for(int i = 0; i < string_len; i++) {
-		PatternMachineState m = {
-			.input = string,
-			.input_len = string_len,
-			.input_counter = i,
-			.program = program,
-		};
+NONSTD_STR_API int
+pattern_next_candidate(char *prefix, int prefix_len, int start_classes, int start_negated, char *string, int string_len, int i)
+{
+	Str rest = mkstr(string + i, string_len - i);
+	if (prefix_len) {
+		int at = str_search(rest, mkstr(prefix, prefix_len));
+		return at < 0 ? string_len : i + at;
+	}
+	if (!start_classes) return i;
+	if (start_negated) return i + str_span_class(rest, start_classes);
+	return i + str_span_not_class(rest, start_classes);
+}
 
+// The first match that starts in string[from..string_len). The machine 
+// sees the whole string, so ^ only matches at 0, and it's only set up once.
+// Where the captures start and end goes in `captures`, if it isn't null:
+// they're recorded as the machine goes, starting over at each start.
+static int
+pattern_search(char *string, int string_len, int from, int anchored, CompiledStrPattern *program, int *match_len, int *captures)
+{
+	PatternMachineState m = {
+		.input = string,
+		.input_len = string_len,
+		.program = program,
+		.code = pattern_code(program),
+		.capture_next = -1,
+	};
+	if (captures && program->capture_count) {
+		// the marks, sorted by pc
+		m.captures = captures;
+		for (int k = 0; k < 2*program->capture_count; k++) {
+			int j = k;
+			for (; j > 0 && program->capture_pc[m.capture_order[j-1]] > program->capture_pc[k]; j--) 
+				m.capture_order[j] = m.capture_order[j-1];
+			m.capture_order[j] = k;
+		}
+	}
+
+	int skip = !anchored && (program->prefix_len || program->start_classes);
+	for(int i = from; i < string_len; i++) {
+		if (skip) {
+			// skip to the next place a match could start
+			i = pattern_next_candidate(program->prefix, program->prefix_len, program->start_classes, 
+			                           program->start_negated, string, string_len, i);
+			if (i == string_len) break;
+		}
+
+		m.input_counter = i;
+		m.program_counter = 0;
+		m.stack_pointer = 0;
+		m.return_register = 0;
+		if (m.captures) {
+			// a failed start leaves some set, but a match sets them all again
+			m.capture_at = 0;
+			m.capture_next = program->capture_pc[m.capture_order[0]];
+		}
 		int yes = pattern_machine_run(&m);
 		if(yes) {
 			*match_len = m.input_counter-i;
 			return i;
 		}
 
-		if (program_starts_with_anchor) break;
+		if (anchored) break;
 	}
 	return -1;
 }
 
-NONSTD_STR_API Str 
-str_strip(Str s)
+NONSTD_STR_API int
+pattern_match_ascii(char *string, int string_len, CompiledStrPattern *program, int *match_len)
 {
-	for(int i = 0; i < s.len; i++) {
-		switch (s.ptr[i]) {
-		case ' ':  case '\t': case '\n':
-		case '\r': case '\f': case '\v':
-			s.ptr++;
-			s.len--;
-			continue;
+	if(program->error) return -2;
+	return pattern_search(string, string_len, 0, pattern_starts_with_anchor(program), program, match_len, 0);
+}
+
+#ifdef NONSTD_BASE_H
+// PATTERN DFA
+// The bytecode VM never backtracks: each element of a pattern (a byte or
+// class, maybe with ?, * or +, or an anchor) takes what it can, so from a
+// given start there's just one way to go. The VM's cost is in trying every
+// start. The DFA tries them all at once: a "thread" for each start that is
+// still going, at some element of the pattern, in order of start. Threads at
+// the same element would do the same thing from then on, so only the first
+// (the one with the earlier start) is kept, and there are never more of them
+// than elements. A DFA state is that list of elements, and moving to the next
+// state on a byte can be cached. The starts themselves can't be part of the
+// state, so each transition has a map from the threads of the next state to
+// the threads they came from, to keep an array of starts up to date.
+//
+// When a thread reaches the end of the pattern, the threads after it (later
+// starts) are dropped and no new ones are started, but the threads before it
+// go on, as one of them could still match, further left. Once none are left,
+// the leftmost match is known.
+//
+// Bytes that every element treats the same are one class, and transitions
+// are per class, not per byte.
+
+enum {
+	PATTERN_DFA_ONE,   // x
+	PATTERN_DFA_OPT,   // x?
+	PATTERN_DFA_STAR,  // x* (x+ is x then x*)
+	PATTERN_DFA_START, // ^
+	PATTERN_DFA_END,   // $
+};
+
+struct PatternDfaElement {
+	uint64_t set[4];
+	int kind;
+};
+
+typedef struct {
+	struct PatternDfaState *next; // null until it's been needed
+	unsigned short *map;          // for each thread of next, the thread it came from
+	int match;                    // the thread that matched just before the byte, or -1
+} PatternDfaTransition;
+
+struct PatternDfaState {
+	struct PatternDfaState *chain; // in a bucket of the hash table
+	unsigned hash;
+	int count;                     // threads
+	int draining;                  // no new threads are started
+	PatternDfaTransition *transitions;
+	unsigned short threads[];
+};
+
+#define PATTERN_DFA_BUCKETS 1024
+#define PATTERN_DFA_SET_HAS(set, b) ((set)[(b) >> 6] >> ((b) & 63) & 1)
+
+static int
+pattern_builtin_has(char c, int b)
+{
+	if (c == '.') return 1;
+	int negate = c >= 'A' && c <= 'Z';
+	return ((STR_CLASS(b) & pattern_builtin_classes(c)) != 0) != negate;
+}
+
+// The set of bytes a class subroutine (like "[abc]") at `pc` accepts. For 
+// each byte, the first test it passes decides. Returns -1 if that's not 
+// what the code there looks like.
+static int
+pattern_dfa_class_set(CompiledStrPattern *program, int pc, uint64_t set[4])
+{
+	unsigned short *code = pattern_code(program);
+	memset(set, 0, 4 * sizeof(uint64_t));
+	for (int b = 0; b < 256; b++) {
+		for (int q = pc; ; q++) {
+			if (q < 0 || q >= program->code_size) return -1;
+			unsigned short opcode = code[q] & OP_MASK;
+			char c = code[q] >> ARG_SHIFT;
+			if (opcode == OP_RET) break;
+			int hit;
+			if (opcode == OP_MATCH_AND_RET_T || opcode == OP_MATCH_AND_RET_F) hit = (unsigned char)c == b;
+			else if (opcode == OP_MATCH_BUILTIN_AND_RET_T || opcode == OP_MATCH_BUILTIN_AND_RET_F) hit = pattern_builtin_has(c, b);
+			else return -1;
+			if (!hit) continue;
+			if (opcode == OP_MATCH_AND_RET_T || opcode == OP_MATCH_BUILTIN_AND_RET_T) 
+				set[b >> 6] |= 1ull << (b & 63);
+			break;
 		}
-		break;
 	}
+	return 0;
+}
 
-	for(int i = s.len-1; i >= 0; i--) {
-		switch (s.ptr[i]) {
-		case ' ':  case '\t': case '\n':
-		case '\r': case '\f': case '\v':
-			s.len--;
+// Turns the bytecode back into a list of elements. Returns the number of 
+// elements, or -1 if the code isn't the kind pattern_compile_ascii() makes.
+static int
+pattern_dfa_decode(CompiledStrPattern *program, struct PatternDfaElement *elements)
+{
+	unsigned short *code = pattern_code(program);
+	int n = 0;
+	for (int pc = 0; pc < program->code_size; ) {
+		unsigned short opcode = code[pc] & OP_MASK;
+		unsigned short arg    = code[pc] >> ARG_SHIFT;
+		char c = arg;
+		struct PatternDfaElement *e = &elements[n];
+		memset(e, 0, sizeof(*e));
+
+		switch (opcode) {
+		case OP_RET:
+			return arg ? n : -1;
+		case OP_JUMP:
+			// over a class subroutine
+			if (arg == 0) return -1;
+			pc += arg;
 			continue;
+		case OP_MATCH_START_END:
+			e->kind = c == '^' ? PATTERN_DFA_START : PATTERN_DFA_END;
+			pc++;
+			break;
+		case OP_MATCH_OR_RET_F:
+		case OP_MATCH:
+		case OP_MATCH_AND_RPT:
+			e->set[(unsigned char)c >> 6] = 1ull << ((unsigned char)c & 63);
+			e->kind = opcode == OP_MATCH_OR_RET_F ? PATTERN_DFA_ONE : opcode == OP_MATCH ? PATTERN_DFA_OPT : PATTERN_DFA_STAR;
+			pc++;
+			break;
+		case OP_MATCH_BUILTIN_OR_RET_F:
+		case OP_MATCH_BUILTIN:
+		case OP_MATCH_BUILTIN_AND_RPT:
+			if (pattern_builtin_classes(c) < 0) return -1;
+			for (int b = 0; b < 256; b++) 
+				if (pattern_builtin_has(c, b)) e->set[b >> 6] |= 1ull << (b & 63);
+			e->kind = opcode == OP_MATCH_BUILTIN_OR_RET_F ? PATTERN_DFA_ONE : opcode == OP_MATCH_BUILTIN ? PATTERN_DFA_OPT : PATTERN_DFA_STAR;
+			pc++;
+			break;
+		case OP_CALL:
+			if (pattern_dfa_class_set(program, pc - arg, e->set) < 0) return -1;
+			// CALL; RPT_IF_RET_T is *, CALL; RET_F_IF_RET_F is one, and CALL alone is ?
+			unsigned short follow = pc + 1 < program->code_size ? code[pc + 1] & OP_MASK : OP_RET;
+			if (follow == OP_RPT_IF_RET_T) {
+				e->kind = PATTERN_DFA_STAR;
+				pc += 2;
+			} else if (follow == OP_RET_F_IF_RET_F) {
+				e->kind = PATTERN_DFA_ONE;
+				pc += 2;
+			} else {
+				e->kind = PATTERN_DFA_OPT;
+				pc++;
+			}
+			break;
+		default:
+			return -1;
 		}
-		break;
+		n++;
+	}
+	return -1;
+}
+
+// Bump allocation from the cache, 8 byte aligned; null if it's full
+static void *
+pattern_dfa_cache_alloc(PatternDfa *dfa, i64 size)
+{
+	size = (size + 7) & ~7ll;
+	if (dfa->cache_used + size > dfa->cache_size) return 0;
+	void *p = dfa->cache + dfa->cache_used;
+	dfa->cache_used += size;
+	return p;
+}
+
+// Finds or adds the state with these threads. Null if the cache is full.
+static struct PatternDfaState *
+pattern_dfa_intern(PatternDfa *dfa, unsigned short *threads, int count, int draining)
+{
+	unsigned hash = 2166136261u ^ draining;
+	for (int i = 0; i < count; i++) hash = (hash ^ threads[i]) * 16777619u;
+
+	struct PatternDfaState **bucket = &dfa->buckets[hash % PATTERN_DFA_BUCKETS];
+	for (struct PatternDfaState *s = *bucket; s; s = s->chain) {
+		if (s->hash == hash && s->count == count && s->draining == draining && 
+		    !memcmp(s->threads, threads, count * sizeof(threads[0])))
+			return s;
 	}
+
+	struct PatternDfaState *s = pattern_dfa_cache_alloc(dfa, sizeof(*s) + count * sizeof(threads[0]));
+	PatternDfaTransition *t = pattern_dfa_cache_alloc(dfa, dfa->class_count * (i64)sizeof(*t));
+	if (!s || !t) return 0;
+	memset(t, 0, dfa->class_count * sizeof(*t));
+	s->chain = *bucket;
+	s->hash = hash;
+	s->count = count;
+	s->draining = draining;
+	s->transitions = t;
+	memcpy(s->threads, threads, count * sizeof(threads[0]));
+	*bucket = s;
 	return s;
 }
 
-NONSTD_STR_API Str
-str_split(Str* s, char delim)
+// Empties the cache (but for the idle state: no threads, still starting them)
+static void
+pattern_dfa_flush(PatternDfa *dfa)
 {
-	Str rtn = { .ptr = s->ptr };
-	for(int i = 0; i < s->len; i++){
-		if(s->ptr[i]==delim) {
-			rtn.len = i;
-			s->ptr += (i+1);
-			s->len -= (i+1);
-			goto out;
+	dfa->cache_used = 0;
+	dfa->buckets = pattern_dfa_cache_alloc(dfa, PATTERN_DFA_BUCKETS * sizeof(dfa->buckets[0]));
+	memset(dfa->buckets, 0, PATTERN_DFA_BUCKETS * sizeof(dfa->buckets[0]));
+	dfa->idle = pattern_dfa_intern(dfa, dfa->scratch, 0, 0);
+	dfa->cache_flushes++;
+}
+
+// Moves all the threads of `s` (and a new one, if `spawn`) on over byte
+// `b` (-1 at the end of the input), at the start of the input or not. 
+// Writes the threads of the next state to `out`, and for each, the thread
+// it came from to `map` (s->count for the new thread). Returns the thread
+// that matched just before `b`, or -1.
+static int
+pattern_dfa_step(PatternDfa *dfa, struct PatternDfaState *s, int b, int at_start, int spawn,
+	unsigned short *out, int *out_count, unsigned short *map, int *out_draining)
+{
+	struct PatternDfaElement *elements = dfa->elements;
+	int n = dfa->element_count, count = 0, match = -1;
+	int threads = s->count + spawn;
+	// elements already in `out`
+	unsigned short *seen = dfa->scratch + 2*(n + 2);
+	memset(seen, 0, (n + 1) * sizeof(seen[0]));
+
+	for (int j = 0; j < threads && match < 0; j++) {
+		int i = j < s->count ? s->threads[j] : 0;
+		for (;;) {
+			if (i == n) {
+				// a match, and the threads after this one don't matter now
+				match = j;
+				break;
+			}
+			struct PatternDfaElement *e = &elements[i];
+			if (e->kind == PATTERN_DFA_START) {
+				if (!at_start) break;
+				i++;
+				continue;
+			}
+			if (e->kind == PATTERN_DFA_END) {
+				if (b >= 0) break;
+				i++;
+				continue;
+			}
+			int in = b >= 0 && PATTERN_DFA_SET_HAS(e->set, b);
+			if (in) {
+				int to = e->kind == PATTERN_DFA_STAR ? i : i + 1;
+				if (!seen[to]) {
+					seen[to] = 1;
+					out[count] = to;
+					map[count++] = j;
+				}
+				break;
+			}
+			if (e->kind == PATTERN_DFA_ONE) break;
+			i++;
 		}
 	}
-	rtn.len = s->len;
-	s->ptr += s->len+1;
-	s->len = 0;
-	out: return rtn;
+	*out_count = count;
+	// A pattern that starts with ^ can only match at the start
+	int anchored = n > 0 && elements[0].kind == PATTERN_DFA_START;
+	*out_draining = s->draining || match >= 0 || anchored;
+	return match;
 }
 
-NONSTD_STR_API Str
-str_split_str(Str* s, Str delim)
+// The transition out of *cur on byte class c, worked out (and cached) if 
+// it hasn't been. If the cache fills up, it's cleared, and *cur is replaced
+// with its copy in the new cache.
+static PatternDfaTransition *
+pattern_dfa_transition(PatternDfa *dfa, struct PatternDfaState **cur, int c)
 {
-	int i = str_search(*s, delim);
-	Str rtn = { .ptr = s->ptr };
-	if (i > -1) {
-		rtn.len = i;
-		s->ptr += (i+delim.len);
-		s->len -= (i+delim.len);
-		return rtn;
+	int n = dfa->element_count;
+	unsigned short *out = dfa->scratch, *map = dfa->scratch + (n + 2);
+	int count = 0, draining = 0;
+	int match = pattern_dfa_step(dfa, *cur, dfa->class_byte[c], 0, !(*cur)->draining, out, &count, map, &draining);
+
+	struct PatternDfaState *next = pattern_dfa_intern(dfa, out, count, draining);
+	unsigned short *m = pattern_dfa_cache_alloc(dfa, count * sizeof(map[0]));
+	if (!next || !m) {
+		// Full. Save the current state's threads, clear, and start again. 
+		// (The cache is always big enough for a few states.)
+		unsigned short *threads = dfa->scratch + 3*(n + 2);
+		int cur_count = (*cur)->count, cur_draining = (*cur)->draining;
+		memcpy(threads, (*cur)->threads, cur_count * sizeof(threads[0]));
+		pattern_dfa_flush(dfa);
+		*cur = pattern_dfa_intern(dfa, threads, cur_count, cur_draining);
+		next = pattern_dfa_intern(dfa, out, count, draining);
+		m = pattern_dfa_cache_alloc(dfa, count * sizeof(map[0]));
+		assert(*cur && next && m);
+	}
+	memcpy(m, map, count * sizeof(map[0]));
+
+	PatternDfaTransition *t = &(*cur)->transitions[c];
+	t->next = next;
+	t->map = m;
+	t->match = match;
+	return t;
+}
+
+NONSTD_STR_API PatternDfa *
+pattern_dfa_create(Arena *a, CompiledStrPattern *program, int cache_bytes)
+{
+	PatternDfa *dfa = allocate(a, sizeof(*dfa));
+	if (program->error) {
+		dfa->error = program->error;
+		return dfa;
+	}
+
+	// there are fewer elements than instructions
+	dfa->elements = allocate(a, (program->code_size + 1) * (i64)sizeof(dfa->elements[0]));
+	int n = pattern_dfa_decode(program, dfa->elements);
+	// threads are unsigned shorts
+	if (n < 0 || n > USHRT_MAX - 2) {
+		dfa->error = 1;
+		return dfa;
+	}
+	dfa->element_count = n;
+	dfa->prefix_len = program->prefix_len;
+	memcpy(dfa->prefix, program->prefix, program->prefix_len);
+
+	// Byte classes: split the classes so far by each element's set in turn
+	memset(dfa->byte_class, 0, sizeof(dfa->byte_class));
+	dfa->class_count = 1;
+	for (int i = 0; i < n; i++) {
+		short split[256][2];
+		memset(split, -1, sizeof(split));
+		int classes = 0;
+		for (int b = 0; b < 256; b++) {
+			int in = PATTERN_DFA_SET_HAS(dfa->elements[i].set, b);
+			short *to = &split[dfa->byte_class[b]][in];
+			if (*to < 0) *to = classes++;
+			dfa->byte_class[b] = *to;
+		}
+		dfa->class_count = classes;
+	}
+	for (int b = 255; b >= 0; b--) dfa->class_byte[dfa->byte_class[b]] = b;
+
+	// scratch: out, map, seen, a saved state and pattern_dfa_match()'s
+	// state, and its starts (two arrays)
+	dfa->scratch = allocate(a, 5 * (n + 2) * (i64)sizeof(dfa->scratch[0]));
+	dfa->starts = allocate(a, 2 * (n + 2) * (i64)sizeof(dfa->starts[0]));
+
+	// room for at least a few of the biggest states
+	i64 biggest = sizeof(struct PatternDfaState) + dfa->class_count * sizeof(PatternDfaTransition) + 4*(n + 2) + 64;
+	i64 minimum = PATTERN_DFA_BUCKETS * sizeof(dfa->buckets[0]) + 8 * biggest;
+	dfa->cache_size = cache_bytes > 0 ? cache_bytes : 1 << 20;
+	if (dfa->cache_size < minimum) dfa->cache_size = minimum;
+	dfa->cache = allocate_empty(a, dfa->cache_size);
+	pattern_dfa_flush(dfa);
+	dfa->cache_flushes = 0;
+	return dfa;
+}
+
+// STREAMING
+// The DFA only ever looks at one byte at a time, so the input can come in
+// pieces, and matches can span them. pattern_dfa_match() is a stream with
+// one piece. After a match, the search starts again at its end, and the
+// bytes from there have usually been looked at already (to see if a thread
+// that started earlier would match). So from when there's a match, until
+// it's settled, a stream keeps a copy of the input that it may have to go
+// over again.
+
+// The stream's state, which a cache flush since the stream last ran (by 
+// another stream, say) would have freed: make it again if so
+static struct PatternDfaState *
+pattern_stream_state(PatternStream *s)
+{
+	PatternDfa *dfa = s->dfa;
+	if (s->flushes != dfa->cache_flushes) {
+		s->state = pattern_dfa_intern(dfa, s->threads, s->thread_count, s->draining);
+		if (!s->state) {
+			pattern_dfa_flush(dfa);
+			s->state = pattern_dfa_intern(dfa, s->threads, s->thread_count, s->draining);
+		}
+		s->flushes = dfa->cache_flushes;
+	}
+	return s->state;
+}
+
+// Runs the DFA over bytes[0..n), the input from offset `base`, until a 
+// match is settled: there are no threads left, and no new ones are being
+// started. Returns how many bytes it used.
+static int
+pattern_dfa_feed(PatternStream *s, const char *bytes, i64 base, int n)
+{
+	PatternDfa *dfa = s->dfa;
+	struct PatternDfaState *cur = pattern_stream_state(s);
+	i64 *starts = s->starts, *next_starts = s->next_starts;
+	int p = 0;
+
+	if (base == 0 && n > 0) {
+		// The first byte isn't cached, as ^ can match there
+		int count, draining, e = dfa->element_count;
+		unsigned short *out = dfa->scratch, *map = dfa->scratch + (e + 2);
+		if (pattern_dfa_step(dfa, cur, (unsigned char)bytes[0], 1, 1, out, &count, map, &draining) >= 0) {
+			s->match_start = 0;
+			s->match_end = 0;
+		}
+		for (int j = 0; j < count; j++) starts[j] = 0;
+		cur = pattern_dfa_intern(dfa, out, count, draining);
+		if (!cur) {
+			pattern_dfa_flush(dfa);
+			cur = pattern_dfa_intern(dfa, out, count, draining);
+		}
+		p = 1;
+	}
+
+	for (; p < n; p++) {
+		if (cur->count == 0 && cur->draining) break;
+
+		if (cur == dfa->idle) {
+			// nothing going on: skip bytes that don't start anything
+			if (dfa->prefix_len) {
+				int at = pattern_next_candidate(dfa->prefix, dfa->prefix_len, 0, 0, (char*)bytes, n, p);
+				// it could still start near the end, and go on in the next piece
+				if (at == n) at = n - p > dfa->prefix_len ? n - dfa->prefix_len + 1 : p;
+				p = at;
+			}
+			PatternDfaTransition *idle = dfa->idle->transitions;
+			while (p < n && idle[dfa->byte_class[(unsigned char)bytes[p]]].next == dfa->idle) p++;
+			if (p == n) break;
+		}
+
+		PatternDfaTransition *t = &cur->transitions[dfa->byte_class[(unsigned char)bytes[p]]];
+		if (!t->next) t = pattern_dfa_transition(dfa, &cur, dfa->byte_class[(unsigned char)bytes[p]]);
+		if (t->match >= 0) {
+			s->match_start = t->match < cur->count ? starts[t->match] : base + p;
+			s->match_end = base + p;
+		}
+
+		struct PatternDfaState *next = t->next;
+		for (int j = 0; j < next->count; j++) 
+			next_starts[j] = t->map[j] < cur->count ? starts[t->map[j]] : base + p;
+		i64 *swap = starts;
+		starts = next_starts;
+		next_starts = swap;
+		cur = next;
+	}
+
+	s->state = cur;
+	s->starts = starts;
+	s->next_starts = next_starts;
+	s->thread_count = cur->count;
+	s->draining = cur->draining;
+	memcpy(s->threads, cur->threads, cur->count * sizeof(cur->threads[0]));
+	s->flushes = dfa->cache_flushes;
+	return p;
+}
+
+// Keeps the input from `from` to the end of the chunk, for after it's gone
+static void
+pattern_stream_keep(PatternStream *s, i64 from)
+{
+	i64 chunk_end = s->chunk_start + s->chunk_len;
+	int skip = 0;
+	if (from >= s->chunk_start) {
+		s->kept_len = 0;
+		skip = from - s->chunk_start;
 	} else {
-		rtn.len = s->len;
-		s->ptr += s->len+delim.len;
-		s->len = 0;
-		return rtn;
+		int drop = from - s->kept_start;
+		memmove(s->kept, s->kept + drop, s->kept_len - drop);
+		s->kept_len -= drop;
 	}
+	int add = s->chunk_len - skip;
+	if (s->kept_len + add > s->kept_cap) {
+		int cap = s->kept_cap ? s->kept_cap : 256;
+		while (cap < s->kept_len + add) cap *= 2;
+		char *kept = allocate_empty(s->arena, cap);
+		if (s->kept_len) memcpy(kept, s->kept, s->kept_len);
+		s->kept = kept;
+		s->kept_cap = cap;
+	}
+	if (add) memcpy(s->kept + s->kept_len, s->chunk + skip, add);
+	s->kept_len += add;
+	s->kept_start = chunk_end - s->kept_len;
 }
 
-NONSTD_STR_API int 
-str_equal(Str a, Str b)
+static void
+pattern_stream_start(PatternStream *s, PatternDfa *dfa, i64 *starts, unsigned short *threads)
+{
+	memset(s, 0, sizeof(*s));
+	s->dfa = dfa;
+	s->state = dfa->idle;
+	s->flushes = dfa->cache_flushes;
+	s->starts = starts;
+	s->next_starts = starts + (dfa->element_count + 2);
+	s->threads = threads;
+	s->match_start = -1;
+	s->done = dfa->error != 0;
+}
+
+NONSTD_STR_API void
+pattern_stream_init(PatternStream *s, Arena *a, PatternDfa *dfa)
+{
+	int n = dfa->element_count;
+	i64 *starts = allocate(a, 2 * (n + 2) * (i64)sizeof(starts[0]));
+	unsigned short *threads = allocate(a, (n + 2) * (i64)sizeof(threads[0]));
+	pattern_stream_start(s, dfa, starts, threads);
+	s->arena = a;
+}
+
+NONSTD_STR_API void
+pattern_stream_input(PatternStream *s, char *chunk, int len, int last)
+{
+	s->chunk = chunk;
+	s->chunk_start += s->chunk_len;
+	s->chunk_len = len;
+	s->last = last;
+}
+
+NONSTD_STR_API int
+pattern_stream_next(PatternStream *s, i64 *start, i64 *len)
 {
-	if(a.len==b.len) {
-		for(int i = 0; i < a.len; i++)
-			if(a.ptr[i]!=b.ptr[i]) goto nope;
+	while (!s->done) {
+		i64 chunk_end = s->chunk_start + s->chunk_len;
+		struct PatternDfaState *cur = pattern_stream_state(s);
+		int settled = cur->count == 0 && cur->draining;
+
+		if (!settled && s->pos < chunk_end) {
+			// the kept input, then the chunk
+			if (s->pos < s->chunk_start) 
+				s->pos += pattern_dfa_feed(s, s->kept + (s->pos - s->kept_start), s->pos, s->chunk_start - s->pos);
+			else 
+				s->pos += pattern_dfa_feed(s, s->chunk + (s->pos - s->chunk_start), s->pos, chunk_end - s->pos);
+			continue;
+		}
+
+		if (!settled) {
+			if (!s->last) {
+				// want more
+				pattern_stream_keep(s, s->match_start >= 0 ? s->match_end : chunk_end);
+				return 0;
+			}
+			// the end, where $ matches, and no new threads start
+			if (cur->count > 0) {
+				int e = s->dfa->element_count, count, draining;
+				unsigned short *out = s->dfa->scratch, *map = s->dfa->scratch + (e + 2);
+				int j = pattern_dfa_step(s->dfa, cur, -1, 0, 0, out, &count, map, &draining);
+				if (j >= 0) {
+					s->match_start = s->starts[j];
+					s->match_end = s->pos;
+				}
+			}
+		}
+
+		if (s->match_start < 0) {
+			s->done = 1;
+			break;
+		}
+		*start = s->match_start;
+		*len = s->match_end - s->match_start;
+
+		// and again from the end of it (or the byte after an empty match)
+		s->pos = s->match_end + (s->match_end == s->match_start);
+		s->match_start = -1;
+		s->state = s->dfa->idle;
+		s->thread_count = 0;
+		s->draining = 0;
 		return 1;
 	}
-	nope: return 0;
+	return 0;
 }
 
 NONSTD_STR_API int
-str_search(Str haystack, Str needle)
+pattern_dfa_match(PatternDfa *dfa, char *string, int string_len, int *match_len)
+{
+	if (dfa->error) return -2;
+
+	PatternStream s;
+	pattern_stream_start(&s, dfa, dfa->starts, dfa->scratch + 4*(dfa->element_count + 2));
+	pattern_stream_input(&s, string, string_len, 1);
+	i64 start = 0, len = 0;
+	if (!pattern_stream_next(&s, &start, &len)) return -1;
+	*match_len = len;
+	return start;
+}
+// PRE-DECODED PROGRAMS
+// The bytecode, decoded once: literal bytes, builtin classes and [classes]
+// alike become a 256-bit set of the bytes they match, and each kind of
+// instruction has its own opcode, with nothing left to work out while
+// running. A call to a class subroutine, with the instruction after it that
+// makes it one, ? or *, is a single instruction on the class's set, as it
+// can only take one byte or none. With GCC and Clang, each instruction jumps
+// straight to the code for the next one through a table of label addresses
+// ("computed goto"), which branch predictors do better with than one shared
+// switch.
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define PATTERN_COMPUTED_GOTO 1
+#else
+#  define PATTERN_COMPUTED_GOTO 0
+#endif
+
+enum {
+	PATTERN_I_RET_F,
+	PATTERN_I_RET_T,
+	PATTERN_I_JUMP,
+	PATTERN_I_START,           // ^
+	PATTERN_I_END,             // $
+	PATTERN_I_ONE,             // a byte in the set, or return false
+	PATTERN_I_OPT,             // a byte in the set, if there is one
+	PATTERN_I_STAR,            // as many bytes in the set as there are
+	PATTERN_I_SPAN,            // the same, for a builtin class, with str_span_class()
+	PATTERN_I_MATCH_AND_RET_T, // in a class: a byte in the set, and return true
+	PATTERN_I_MATCH_AND_RET_F, // in a class: a byte in the set, and return false
+	PATTERN_I_CALL,
+	PATTERN_I_RPT_IF_RET_T,
+	PATTERN_I_RET_F_IF_RET_F,
+};
+
+struct PatternInstruction {
+	unsigned char op;
+	unsigned char negate;   // for SPAN
+	int arg;                // where to jump or call, the index of the set, or
+	                        // for SPAN the classes (-1 for any byte)
+};
+
+#define PATTERN_SET_HAS(set, b) ((set)[(unsigned char)(b) >> 6] >> ((unsigned char)(b) & 63) & 1)
+
+// The index of `set` in the program's sets, adding it if it isn't there
+static int
+pattern_program_set(PatternProgram *p, uint64_t set[4])
+{
+	for (int i = 0; i < p->set_count; i++) 
+		if (!memcmp(p->sets[i], set, sizeof(p->sets[i]))) return i;
+	memcpy(p->sets[p->set_count], set, sizeof(p->sets[0]));
+	return p->set_count++;
+}
+
+NONSTD_STR_API PatternProgram *
+pattern_program_create(Arena *a, CompiledStrPattern *program)
 {
-	for (int offset = 0; offset <= haystack.len-needle.len; offset++) {
-		for (int i = 0; i < needle.len; i++) {
-			if (haystack.ptr[i+offset]!=needle.ptr[i]) goto nope;
+	PatternProgram *p = allocate(a, sizeof(*p));
+	p->error = program->error;
+	if (p->error) return p;
+
+	int n = program->code_size;
+	p->code = allocate(a, n * (i64)sizeof(p->code[0]));
+	p->sets = allocate(a, n * (i64)sizeof(p->sets[0]));
+	p->anchored = pattern_starts_with_anchor(program);
+	p->prefix_len = program->prefix_len;
+	memcpy(p->prefix, program->prefix, sizeof(p->prefix));
+	p->start_classes = program->start_classes;
+	p->start_negated = program->start_negated;
+
+	// where each instruction went, for jumps and calls
+	unsigned short *code = pattern_code(program);
+	int *moved = allocate(a, (n + 1) * (i64)sizeof(int));
+	int count = 0;
+	for (int pc = 0; pc < n; pc++) {
+		unsigned short opcode = code[pc] & OP_MASK;
+		unsigned short arg    = code[pc] >> ARG_SHIFT;
+		char c = arg;
+		struct PatternInstruction *ins = &p->code[count];
+		moved[pc] = count++;
+		if (opcode >= OP_MATCH_BUILTIN && pattern_builtin_classes(c) < 0) {
+			p->error = 1;
+			return p;
+		}
+
+		uint64_t set[4];
+		switch (opcode) {
+		case OP_RET:           ins->op = arg ? PATTERN_I_RET_T : PATTERN_I_RET_F; break;
+		case OP_JUMP:          ins->op = PATTERN_I_JUMP; ins->arg = pc + arg; break;
+		case OP_MATCH_START_END:  ins->op = c == '^' ? PATTERN_I_START : PATTERN_I_END; break;
+		case OP_RPT_IF_RET_T:     ins->op = PATTERN_I_RPT_IF_RET_T; break;
+		case OP_RET_F_IF_RET_F:   ins->op = PATTERN_I_RET_F_IF_RET_F; break;
+		case OP_MATCH_OR_RET_F:
+		case OP_MATCH_BUILTIN_OR_RET_F:  ins->op = PATTERN_I_ONE; break;
+		case OP_MATCH:
+		case OP_MATCH_BUILTIN:           ins->op = PATTERN_I_OPT; break;
+		case OP_MATCH_AND_RPT:           ins->op = PATTERN_I_STAR; break;
+		case OP_MATCH_AND_RET_T:
+		case OP_MATCH_BUILTIN_AND_RET_T: ins->op = PATTERN_I_MATCH_AND_RET_T; break;
+		case OP_MATCH_AND_RET_F:
+		case OP_MATCH_BUILTIN_AND_RET_F: ins->op = PATTERN_I_MATCH_AND_RET_F; break;
+		case OP_MATCH_BUILTIN_AND_RPT:
+			ins->op = PATTERN_I_SPAN;
+			ins->arg = c == '.' ? -1 : pattern_builtin_classes(c);
+			ins->negate = c >= 'A' && c <= 'Z';
+			break;
+		case OP_CALL:
+			ins->op = PATTERN_I_CALL;
+			ins->arg = pc - arg;
+			if (pattern_dfa_class_set(program, pc - arg, set) < 0) break;
+			// a class takes one byte or none, like a builtin does, so the
+			// call and what follows it are one instruction, on its set
+			unsigned short follow = pc + 1 < n ? code[pc + 1] & OP_MASK : OP_RET;
+			if (follow == OP_RPT_IF_RET_T)        ins->op = PATTERN_I_STAR;
+			else if (follow == OP_RET_F_IF_RET_F) ins->op = PATTERN_I_ONE;
+			else                                  ins->op = PATTERN_I_OPT;
+			ins->arg = pattern_program_set(p, set);
+			if (ins->op != PATTERN_I_OPT) moved[++pc] = count;
+			continue;
+		}
+		if (ins->op >= PATTERN_I_ONE && ins->op <= PATTERN_I_MATCH_AND_RET_F && ins->op != PATTERN_I_SPAN) {
+			memset(set, 0, sizeof(set));
+			for (int b = 0; b < 256; b++) {
+				int in = opcode >= OP_MATCH_BUILTIN ? pattern_builtin_has(c, b) : (unsigned char)c == b;
+				if (in) set[b >> 6] |= 1ull << (b & 63);
+			}
+			ins->arg = pattern_program_set(p, set);
 		}
-		return offset;
-		nope: ;
 	}
-	return -1;
+	moved[n] = count;
+	p->code_size = count;
+
+	for (int i = 0; i < count; i++) {
+		struct PatternInstruction *ins = &p->code[i];
+		if (ins->op != PATTERN_I_JUMP && ins->op != PATTERN_I_CALL) continue;
+		if (ins->arg < 0 || ins->arg >= n) {
+			p->error = 1;
+			return p;
+		}
+		ins->arg = moved[ins->arg];
+	}
+	return p;
 }
 
-NONSTD_STR_API int 
-str_pattern_match(Str *match, Str *string, CompiledStrPattern *program)
+// Runs the program from string[i], returning 1 if it matches, with the end
+// of the match in *end
+static int
+pattern_program_run(PatternProgram *p, const char *string, int len, int i, int *end)
 {
-	int match_len = 0;
-	int loc = pattern_match_ascii(string->ptr, string->len, program, &match_len);
-	if (loc >= 0) {
-		*match  = mkstr(string->ptr+loc, match_len);
-		*string = mkstr(match->ptr+match_len, string->len-match_len-loc);
-		return 1;
+	const struct PatternInstruction *code = p->code, *ip = code;
+	const uint64_t (*sets)[4] = (const uint64_t (*)[4])p->sets;
+	int stack[PATTERN_MACHINE_STACK_MAX], sp = 0, ret = 0;
+
+#if PATTERN_COMPUTED_GOTO
+	static const void *labels[] = {
+		[PATTERN_I_RET_F]           = &&ret_f,
+		[PATTERN_I_RET_T]           = &&ret_t,
+		[PATTERN_I_JUMP]            = &&jump,
+		[PATTERN_I_START]           = &&start,
+		[PATTERN_I_END]             = &&end,
+		[PATTERN_I_ONE]             = &&one,
+		[PATTERN_I_OPT]             = &&opt,
+		[PATTERN_I_STAR]            = &&star,
+		[PATTERN_I_SPAN]            = &&span,
+		[PATTERN_I_MATCH_AND_RET_T] = &&match_and_ret_t,
+		[PATTERN_I_MATCH_AND_RET_F] = &&match_and_ret_f,
+		[PATTERN_I_CALL]            = &&call,
+		[PATTERN_I_RPT_IF_RET_T]    = &&rpt_if_ret_t,
+		[PATTERN_I_RET_F_IF_RET_F]  = &&ret_f_if_ret_f,
+	};
+#  define PATTERN_NEXT goto *labels[ip->op]
+#  define PATTERN_OP(name, label) label:
+#else
+#  define PATTERN_NEXT goto dispatch
+#  define PATTERN_OP(name, label) case name: label:
+#endif
+#define PATTERN_IN(ins) (i < len && PATTERN_SET_HAS(sets[(ins)->arg], string[i]))
+
+	PATTERN_NEXT;
+#if !PATTERN_COMPUTED_GOTO
+	dispatch:
+	switch (ip->op) {
+#endif
+	PATTERN_OP(PATTERN_I_RET_T, ret_t)
+		ret = 1;
+		if (sp == 0) {
+			*end = i;
+			return 1;
+		}
+		sp -= 2;
+		ip = code + stack[sp] + 1;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_RET_F, ret_f)
+		ret = 0;
+		if (sp == 0) return 0;
+		// back to where the call was made, in the string too
+		i = stack[--sp];
+		ip = code + stack[--sp] + 1;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_JUMP, jump)
+		ip = code + ip->arg;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_START, start)
+		if (i != 0) goto ret_f;
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_END, end)
+		if (i != len) goto ret_f;
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_ONE, one)
+		if (!PATTERN_IN(ip)) goto ret_f;
+		i++;
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_OPT, opt)
+		i += PATTERN_IN(ip);
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_STAR, star)
+		while (PATTERN_IN(ip)) i++;
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_SPAN, span)
+		{
+			Str rest = mkstr((char*)string + i, len - i);
+			if (ip->arg < 0) i = len;
+			else if (ip->negate) i += str_span_not_class(rest, ip->arg);
+			else                 i += str_span_class(rest, ip->arg);
+		}
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_MATCH_AND_RET_T, match_and_ret_t)
+		if (PATTERN_IN(ip)) {
+			i++;
+			goto ret_t;
+		}
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_MATCH_AND_RET_F, match_and_ret_f)
+		if (PATTERN_IN(ip)) {
+			i++;
+			goto ret_f;
+		}
+		ip++;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_CALL, call)
+		if (sp + 2 > PATTERN_MACHINE_STACK_MAX) return 0;
+		stack[sp++] = ip - code;
+		stack[sp++] = i;
+		ip = code + ip->arg;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_RPT_IF_RET_T, rpt_if_ret_t)
+		// back to the call before this
+		ip += ret ? -1 : 1;
+		PATTERN_NEXT;
+	PATTERN_OP(PATTERN_I_RET_F_IF_RET_F, ret_f_if_ret_f)
+		if (!ret) goto ret_f;
+		ip++;
+		PATTERN_NEXT;
+#if !PATTERN_COMPUTED_GOTO
 	}
 	return 0;
+#endif
+#undef PATTERN_NEXT
+#undef PATTERN_OP
+#undef PATTERN_IN
 }
 
 NONSTD_STR_API int
-str_startswith(Str s, Str startswith)
+pattern_program_match(PatternProgram *p, char *string, int string_len, int *match_len)
 {
-	if (s.len >= startswith.len) {
-		for(int i = 0; i < startswith.len; i++)
-			if(s.ptr[i]!=startswith.ptr[i]) goto nope;
-		return 1;
+	if (p->error) return -2;
+
+	int skip = !p->anchored && (p->prefix_len || p->start_classes);
+	for (int i = 0; i < string_len; i++) {
+		if (skip) {
+			// skip to the next place a match could start
+			i = pattern_next_candidate(p->prefix, p->prefix_len, p->start_classes, p->start_negated, string, string_len, i);
+			if (i == string_len) break;
+		}
+
+		int end = 0;
+		if (pattern_program_run(p, string, string_len, i, &end)) {
+			*match_len = end - i;
+			return i;
+		}
+		if (p->anchored) break;
 	}
-	nope: return 0;
+	return -1;
 }
 
-NONSTD_STR_API int
-str_endswith(Str s, Str endswith)
+// GENERATED MATCHERS
+// The elements that a DFA is made from are all that a matcher needs: each
+// takes what it can and never gives any of it back, so matching from a
+// given start is one pass down the list, which can be written out as C. The
+// test for a set of bytes is a comparison or two where it can be, and a 
+// table where it can't.
+
+#include <stdio.h>
+#include <stdarg.h>
+
+typedef struct {
+	char *buffer;
+	int buffer_len;
+	int len;
+} PatternWriter;
+
+static void
+pattern_write(PatternWriter *w, const char *format, ...)
 {
-	if (s.len >= endswith.len) {
-		int offset = s.len-endswith.len;
-		for(int i = 0; i < endswith.len; i++)
-			if(s.ptr[i+offset]!=endswith.ptr[i]) goto nope;
-		return 1;
+	int room = w->len < w->buffer_len ? w->buffer_len - w->len : 0;
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(room ? w->buffer + w->len : NULL, room, format, args);
+	va_end(args);
+	if (n > 0) w->len += n;
+}
+
+static void
+pattern_write_byte(PatternWriter *w, int b)
+{
+	if (b < 128 && (is_ascii_alphanumeric(b) || (is_ascii_punctuation(b) && b != '\'' && b != '\\')))
+		pattern_write(w, "'%c'", b);
+	else pattern_write(w, "0x%02x", b);
+}
+
+// The runs of bytes in `set` (or not in it), in `runs` if it's big enough
+static int
+pattern_set_runs(uint64_t set[4], int in, int runs[][2], int max)
+{
+	int n = 0;
+	for (int b = 0; b < 256; b++) {
+		if ((int)PATTERN_DFA_SET_HAS(set, b) != in) continue;
+		if (n > 0 && runs[n - 1][1] == b - 1) runs[n - 1][1] = b;
+		else {
+			if (n < max) runs[n][0] = runs[n][1] = b;
+			n++;
+			if (n > max) return n;
+		}
 	}
-	nope: return 0;
+	return n;
 }
 
+#define PATTERN_WRITE_RUNS_MAX 3
+
+// The first element with the same set as element `k`, which a table for
+// the set is named after
+static int
+pattern_set_first(struct PatternDfaElement *elements, int k)
+{
+	int j = 0;
+	while (memcmp(elements[j].set, elements[k].set, sizeof(elements[k].set))) j++;
+	return j;
+}
+
+// Writes a test, in parentheses, of whether s[i] is in the set of element `k`
+static void
+pattern_write_test(PatternWriter *w, struct PatternDfaElement *elements, int k, char *name)
+{
+	int runs[PATTERN_WRITE_RUNS_MAX][2];
+	int in = 1;
+	int n = pattern_set_runs(elements[k].set, 1, runs, PATTERN_WRITE_RUNS_MAX);
+	if (n > PATTERN_WRITE_RUNS_MAX) {
+		in = 0;
+		n = pattern_set_runs(elements[k].set, 0, runs, PATTERN_WRITE_RUNS_MAX);
+	}
+	if (n > PATTERN_WRITE_RUNS_MAX) {
+		pattern_write(w, "(%s_set%i[s[i] >> 3] >> (s[i] & 7) & 1)", name, pattern_set_first(elements, k));
+		return;
+	}
+	if (n == 0) {
+		pattern_write(w, in ? "(0)" : "(1)");
+		return;
+	}
+	pattern_write(w, in ? "(" : "(!(");
+	for (int r = 0; r < n; r++) {
+		int lo = runs[r][0], hi = runs[r][1];
+		int wrap = n > 1;
+		if (r) pattern_write(w, " || ");
+		if (lo == hi) {
+			pattern_write(w, "s[i] == ");
+			pattern_write_byte(w, lo);
+		} else if (lo == 0) {
+			pattern_write(w, "s[i] <= ");
+			pattern_write_byte(w, hi);
+		} else if (hi == 255) {
+			pattern_write(w, "s[i] >= ");
+			pattern_write_byte(w, lo);
+		} else {
+			pattern_write(w, wrap ? "(s[i] >= " : "s[i] >= ");
+			pattern_write_byte(w, lo);
+			pattern_write(w, " && s[i] <= ");
+			pattern_write_byte(w, hi);
+			if (wrap) pattern_write(w, ")");
+		}
+	}
+	pattern_write(w, in ? ")" : "))");
+}
+
+static void
+pattern_write_string(PatternWriter *w, char *s, int len)
+{
+	pattern_write(w, "\"");
+	for (int i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		if (c >= ' ' && c < 127 && c != '"' && c != '\\' && c != '?') pattern_write(w, "%c", c);
+		else pattern_write(w, "\\%03o", c);
+	}
+	pattern_write(w, "\"");
+}
+
+NONSTD_STR_API int
+pattern_generate_c(char *buffer, int buffer_len, CompiledStrPattern *program, char *name)
+{
+	if (program->error) return -1;
+	struct PatternDfaElement *elements = xmalloc(program->code_size * (i64)sizeof(*elements));
+	int n = pattern_dfa_decode(program, elements);
+	if (n < 0) {
+		free(elements);
+		return -1;
+	}
+
+	PatternWriter w = {buffer, buffer_len, 0};
+	if (buffer_len > 0) buffer[0] = 0;
+
+	// the program, as it is, with its code in an array of its own if it's long
+	unsigned short *code = pattern_code(program);
+	int long_code = program->code_size > PATTERN_MACHINE_MAX_PROGRAM_SIZE;
+	if (long_code) pattern_write(&w, "static unsigned short %s_code[%i] = {", name, program->code_size);
+	else pattern_write(&w, "static CompiledStrPattern %s_pattern = {\n\t.code_size = %i,\n\t.code = {", name, program->code_size);
+	for (int pc = 0; pc < program->code_size; pc++) 
+		pattern_write(&w, "%s0x%04x,", pc % 8 ? " " : long_code ? "\n\t" : "\n\t\t", code[pc]);
+	if (long_code) {
+		pattern_write(&w, "\n};\n\nstatic CompiledStrPattern %s_pattern = {\n\t.code_size = %i,\n", name, program->code_size);
+		pattern_write(&w, "\t.long_code = %s_code,\n\t.long_code_cap = %i,\n", name, program->code_size);
+	} else pattern_write(&w, "\n\t},\n");
+	if (program->capture_count) {
+		pattern_write(&w, "\t.capture_count = %i,\n\t.capture_pc = {", program->capture_count);
+		for (int k = 0; k < 2*program->capture_count; k++) pattern_write(&w, k ? " %i," : "%i,", program->capture_pc[k]);
+		pattern_write(&w, "},\n");
+	}
+	if (program->prefix_len) {
+		pattern_write(&w, "\t.prefix_len = %i,\n\t.prefix = ", program->prefix_len);
+		pattern_write_string(&w, program->prefix, program->prefix_len);
+		pattern_write(&w, ",\n");
+	}
+	if (program->start_classes) 
+		pattern_write(&w, "\t.start_classes = 0x%x,\n\t.start_negated = %i,\n", program->start_classes, program->start_negated);
+	pattern_write(&w, "};\n\n");
+
+	// tables for the sets that need them
+	for (int k = 0; k < n; k++) {
+		int runs[PATTERN_WRITE_RUNS_MAX][2];
+		if (pattern_set_runs(elements[k].set, 1, runs, PATTERN_WRITE_RUNS_MAX) <= PATTERN_WRITE_RUNS_MAX) continue;
+		if (pattern_set_runs(elements[k].set, 0, runs, PATTERN_WRITE_RUNS_MAX) <= PATTERN_WRITE_RUNS_MAX) continue;
+		if (pattern_set_first(elements, k) != k) continue;
+		pattern_write(&w, "static const unsigned char %s_set%i[32] = {", name, k);
+		for (int j = 0; j < 32; j++) 
+			pattern_write(&w, "%s0x%02x,", j % 8 ? " " : "\n\t", (unsigned)(elements[k].set[j >> 3] >> (j & 7) * 8 & 0xff));
+		pattern_write(&w, "\n};\n\n");
+	}
+
+	// matching from a given start: where the match ends, or -1
+	pattern_write(&w, "static inline int\n%s_at(const unsigned char *s, int len, int i)\n{\n", name);
+	for (int k = 0; k < n; k++) {
+		struct PatternDfaElement *e = &elements[k];
+		switch (e->kind) {
+		case PATTERN_DFA_START: pattern_write(&w, "\tif (i != 0) return -1;\n"); break;
+		case PATTERN_DFA_END:   pattern_write(&w, "\tif (i != len) return -1;\n"); break;
+		case PATTERN_DFA_ONE:
+			pattern_write(&w, "\tif (i >= len || !");
+			pattern_write_test(&w, elements, k, name);
+			pattern_write(&w, ") return -1;\n\ti++;\n");
+			break;
+		case PATTERN_DFA_OPT:
+			pattern_write(&w, "\tif (i < len && ");
+			pattern_write_test(&w, elements, k, name);
+			pattern_write(&w, ") i++;\n");
+			break;
+		case PATTERN_DFA_STAR:
+			pattern_write(&w, "\twhile (i < len && ");
+			pattern_write_test(&w, elements, k, name);
+			pattern_write(&w, ") i++;\n");
+			break;
+		}
+	}
+	pattern_write(&w, "\treturn i;\n}\n\n");
+
+	// the search, like pattern_match_ascii()
+	int anchored = pattern_starts_with_anchor(program);
+	pattern_write(&w, "static int\n%s_match(char *string, int string_len, int *match_len)\n{\n", name);
+	pattern_write(&w, "\tconst unsigned char *s = (const unsigned char *)string;\n");
+	pattern_write(&w, "\tfor (int i = 0; i < string_len; i++) {\n");
+	if (!anchored && (program->prefix_len || program->start_classes)) {
+		pattern_write(&w, "\t\ti = pattern_next_candidate(");
+		if (program->prefix_len) pattern_write_string(&w, program->prefix, program->prefix_len);
+		else pattern_write(&w, "0");
+		pattern_write(&w, ", %i, 0x%x, %i, string, string_len, i);\n\t\tif (i == string_len) break;\n", 
+			program->prefix_len, program->start_classes, program->start_negated);
+	} else if (!anchored && n > 0 && elements[0].kind == PATTERN_DFA_ONE) {
+		pattern_write(&w, "\t\twhile (i < string_len && !");
+		pattern_write_test(&w, elements, 0, name);
+		pattern_write(&w, ") i++;\n\t\tif (i == string_len) break;\n");
+	}
+	pattern_write(&w, "\t\tint end = %s_at(s, string_len, i);\n", name);
+	pattern_write(&w, "\t\tif (end >= 0) {\n\t\t\t*match_len = end - i;\n\t\t\treturn i;\n\t\t}\n");
+	if (anchored) pattern_write(&w, "\t\tbreak;\n");
+	pattern_write(&w, "\t}\n\treturn -1;\n}\n");
+
+	free(elements);
+	return w.len;
+}
+
+#endif // NONSTD_BASE_H
+
+NONSTD_STR_API Str 
+str_strip(Str s)
+{
+	while(s.len > 0) {
+		switch (s.ptr[0]) {
+		case ' ':  case '\t': case '\n':
+		case '\r': case '\f': case '\v':
+			s.ptr++;
+			s.len--;
+			continue;
+		}
+		break;
+	}
+
+	for(int i = s.len-1; i >= 0; i--) {
+		switch (s.ptr[i]) {
+		case ' ':  case '\t': case '\n':
+		case '\r': case '\f': case '\v':
+			s.len--;
+			continue;
+		}
+		break;
+	}
+	return s;
+}
+
+// BYTE SET SCANNING
+// Finds the bytes of a string that belong to a set. Small sets are matched
+// by comparing against each byte of the set. Larger ones use the "nibble"
+// lookup: split each byte into its low and high 4 bits, and look them up 
+// in two 16-entry tables (a byte shuffle does 16 or 32 lookups at a time).
+// lo[k][low] has bit (high & 7) set for each member whose top bit is k, and
+// the high nibble lookup gives 1 << (high & 7), so a byte is in the set if 
+// the two lookups have a bit in common.
+
+#define STR_SMALL_SET 4
+
+typedef struct {
+	int small;                       // number of bytes, if it's a small set, otherwise 0
+	int has_high;                    // any bytes >= 0x80 in the set?
+	unsigned char bytes[STR_SMALL_SET];
+	unsigned char lo[2][16];
+	uint64_t bits[4];                // for the scalar code
+} StrByteSet;
+
+#define STR_SET_HAS(set, c) ((set)->bits[(unsigned char)(c) >> 6] >> ((unsigned char)(c) & 63) & 1)
+
+static void
+str_byte_set_init(StrByteSet *set, Str bytes)
+{
+	memset(set, 0, sizeof(*set));
+	int distinct = 0;
+	for (int i = 0; i < bytes.len; i++) {
+		unsigned char c = bytes.ptr[i];
+		if (STR_SET_HAS(set, c)) continue;
+		set->bits[c >> 6] |= 1ull << (c & 63);
+		set->lo[c >> 7][c & 15] |= 1 << ((c >> 4) & 7);
+		set->has_high |= c >> 7;
+		if (distinct < STR_SMALL_SET) set->bytes[distinct] = c;
+		distinct++;
+	}
+	if (distinct <= STR_SMALL_SET) {
+		set->small = distinct;
+		// pad with repeats, so the SIMD code can always compare against 4
+		for (int i = distinct; i < STR_SMALL_SET && distinct; i++) set->bytes[i] = set->bytes[0];
+	}
+}
+
+// All the scanners have the same interface: find the members of `set` in
+// p[0..n). If `pos` is null, just count them. Otherwise write the positions
+// of up to `max` of them to `pos` and stop. Returns the number found.
+
+static int
+str_scan_set_scalar(const StrByteSet *set, const char *p, int n, int *pos, int max)
+{
+	int found = 0;
+	for (int i = 0; i < n; i++) {
+		if (!STR_SET_HAS(set, p[i])) continue;
+		if (pos) {
+			pos[found] = i;
+			if (++found == max) break;
+		} else {
+			found++;
+		}
+	}
+	return found;
+}
+
+#if STR_X86 || STR_NEON
+// The SIMD scanners finish off p[i..n) with the scalar code
+static int
+str_scan_set_tail(const StrByteSet *set, const char *p, int i, int n, int *pos, int found, int max)
+{
+	int k = str_scan_set_scalar(set, p + i, n - i, pos ? pos + found : 0, max - found);
+	if (pos) for (int j = found; j < found + k; j++) pos[j] += i;
+	return found + k;
+}
+
+// Shared by the SIMD scanners: record the set bits of `mask` (1 bit per byte,
+// or every 4th bit for NEON) for the block at `base`. Jumps to `done` if 
+// we've filled `pos`.
+#define STR_SCAN_EMIT(mask, base, shift) \
+	if (!pos) { \
+		found += __builtin_popcountll(mask); \
+	} else { \
+		while (mask) { \
+			pos[found] = (base) + (__builtin_ctzll(mask) >> (shift)); \
+			if (++found == max) goto done; \
+			mask &= mask - 1; \
+		} \
+	}
+#endif
+
+#if STR_X86
+static int
+str_scan_set_sse2(const StrByteSet *set, const char *p, int n, int *pos, int max)
+{
+	// SSE2 has no byte shuffle, so this only handles small sets
+	const __m128i b0 = _mm_set1_epi8(set->bytes[0]), b1 = _mm_set1_epi8(set->bytes[1]);
+	const __m128i b2 = _mm_set1_epi8(set->bytes[2]), b3 = _mm_set1_epi8(set->bytes[3]);
+	int found = 0, i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i eq = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, b0), _mm_cmpeq_epi8(v, b1)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, b2), _mm_cmpeq_epi8(v, b3)));
+		uint64_t mask = (unsigned)_mm_movemask_epi8(eq);
+		STR_SCAN_EMIT(mask, i, 0)
+	}
+	found = str_scan_set_tail(set, p, i, n, pos, found, max);
+	done: return found;
+}
+
+static int STR_TARGET_AVX2
+str_scan_set_avx2(const StrByteSet *set, const char *p, int n, int *pos, int max)
+{
+	const __m256i b0 = _mm256_set1_epi8(set->bytes[0]), b1 = _mm256_set1_epi8(set->bytes[1]);
+	const __m256i b2 = _mm256_set1_epi8(set->bytes[2]), b3 = _mm256_set1_epi8(set->bytes[3]);
+	const __m256i lo0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->lo[0]));
+	const __m256i lo1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->lo[1]));
+	const __m256i hi0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)str_nibble_hi[0]));
+	const __m256i hi1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)str_nibble_hi[1]));
+	const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+	int found = 0, i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+		uint64_t mask;
+		if (set->small) {
+			__m256i eq = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, b0), _mm256_cmpeq_epi8(v, b1)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, b2), _mm256_cmpeq_epi8(v, b3)));
+			mask = (unsigned)_mm256_movemask_epi8(eq);
+		} else {
+			__m256i lo = _mm256_and_si256(v, nibble);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+			__m256i hit = _mm256_and_si256(_mm256_shuffle_epi8(lo0, lo), _mm256_shuffle_epi8(hi0, hi));
+			if (set->has_high) 
+				hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_shuffle_epi8(lo1, lo), _mm256_shuffle_epi8(hi1, hi)));
+			mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, zero));
+		}
+		STR_SCAN_EMIT(mask, i, 0)
+	}
+	found = str_scan_set_tail(set, p, i, n, pos, found, max);
+	done: 
+	_mm256_zeroupper();
+	return found;
+}
+#endif
+
+#if STR_NEON
+static int
+str_scan_set_neon(const StrByteSet *set, const char *p, int n, int *pos, int max)
+{
+	const uint8x16_t b0 = vdupq_n_u8(set->bytes[0]), b1 = vdupq_n_u8(set->bytes[1]);
+	const uint8x16_t b2 = vdupq_n_u8(set->bytes[2]), b3 = vdupq_n_u8(set->bytes[3]);
+	const uint8x16_t lo0 = vld1q_u8(set->lo[0]), lo1 = vld1q_u8(set->lo[1]);
+	const uint8x16_t hi0 = vld1q_u8(str_nibble_hi[0]), hi1 = vld1q_u8(str_nibble_hi[1]);
+	const uint8x16_t nibble = vdupq_n_u8(0x0f);
+	int found = 0, i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t*)p + i), hit;
+		if (set->small) {
+			hit = vorrq_u8(vorrq_u8(vceqq_u8(v, b0), vceqq_u8(v, b1)), vorrq_u8(vceqq_u8(v, b2), vceqq_u8(v, b3)));
+		} else {
+			uint8x16_t lo = vandq_u8(v, nibble), hi = vshrq_n_u8(v, 4);
+			hit = vandq_u8(vqtbl1q_u8(lo0, lo), vqtbl1q_u8(hi0, hi));
+			if (set->has_high) hit = vorrq_u8(hit, vandq_u8(vqtbl1q_u8(lo1, lo), vqtbl1q_u8(hi1, hi)));
+			hit = vtstq_u8(hit, hit);
+		}
+		uint64_t mask = str_neon_mask(hit) & 0x8888888888888888ull;
+		STR_SCAN_EMIT(mask, i, 2)
+	}
+	found = str_scan_set_tail(set, p, i, n, pos, found, max);
+	done: return found;
+}
+#endif
+
+static int
+str_scan_set(const StrByteSet *set, const char *p, int n, int *pos, int max)
+{
+#if STR_X86
+	if (STR_CPU_HAS_AVX2) return str_scan_set_avx2(set, p, n, pos, max);
+	if (set->small) return str_scan_set_sse2(set, p, n, pos, max);
+#elif STR_NEON
+	return str_scan_set_neon(set, p, n, pos, max);
+#endif
+	return str_scan_set_scalar(set, p, n, pos, max);
+}
+
+NONSTD_STR_API int
+str_find_byte(Str s, char c)
+{
+	// libc's memchr is already vectorized
+	if (s.len <= 0) return -1;
+	const char *found = memchr(s.ptr, c, s.len);
+	return found ? found - s.ptr : -1;
+}
+
+NONSTD_STR_API int
+str_find_any(Str s, Str set)
+{
+	if (set.len == 1) return str_find_byte(s, set.ptr[0]);
+	if (s.len <= 0) return -1;
+	// Check the first few bytes before setting up the tables. Splitting 
+	// fields off a long string usually finds the delimiter here.
+	int i = 0;
+	for (; i < s.len && i < 32; i++)
+		for (int j = 0; j < set.len; j++) if (s.ptr[i] == set.ptr[j]) return i;
+	if (i == s.len) return -1;
+
+	StrByteSet byte_set;
+	str_byte_set_init(&byte_set, set);
+	int pos = -1;
+	str_scan_set(&byte_set, s.ptr + i, s.len - i, &pos, 1);
+	return pos < 0 ? -1 : i + pos;
+}
+
+// pops s[0..i), and the delimiter at i, off of s. i < 0 means pop everything
+static Str
+str_pop_field(Str *s, int i)
+{
+	Str rtn = { .ptr = s->ptr, .len = i < 0 ? s->len : i };
+	if (i < 0) {
+		s->ptr += s->len+1;
+		s->len = 0;
+	} else {
+		s->ptr += (i+1);
+		s->len -= (i+1);
+	}
+	return rtn;
+}
+
+NONSTD_STR_API Str
+str_split(Str* s, char delim)
+{
+	return str_pop_field(s, str_find_byte(*s, delim));
+}
+
+NONSTD_STR_API Str
+str_split_any(Str* s, Str delims)
+{
+	return str_pop_field(s, str_find_any(*s, delims));
+}
+
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API Str *
+str_tokenize(Arena *a, Str s, Str delims, int *count)
+{
+	*count = 0;
+	if (s.len <= 0) return 0;
+
+	StrByteSet set;
+	str_byte_set_init(&set, delims);
+
+	// One counting pass (just popcounts) so that the array is allocated
+	// exactly, then fill it in, a batch of delimiter positions at a time.
+	int n = str_scan_set(&set, s.ptr, s.len, 0, 0) + 1;
+	Str *fields = allocate_empty(a, n * (i64)sizeof(Str));
+
+	int pos[256], start = 0, nfields = 0, k;
+	do {
+		int base = start;
+		k = str_scan_set(&set, s.ptr + base, s.len - base, pos, COUNT_ARRAY(pos));
+		for (int j = 0; j < k; j++) {
+			int end = base + pos[j];
+			fields[nfields++] = mkstr(s.ptr + start, end - start);
+			start = end + 1;
+		}
+	} while (k == COUNT_ARRAY(pos));
+	fields[nfields++] = mkstr(s.ptr + start, s.len - start);
+
+	assert(nfields == n);
+	*count = n;
+	return fields;
+}
+
+NONSTD_STR_API Str
+str_format_ll(Arena *a, long long x)
+{
+	char buf[FORMAT_LL_MAX];
+	int n = format_ll(buf, x);
+	char *mem = allocate_empty(a, n + 1);
+	memcpy(mem, buf, n);
+	mem[n] = 0;
+	return mkstr(mem, n);
+}
+
+NONSTD_STR_API Str
+str_format_double(Arena *a, double x)
+{
+	char buf[FORMAT_DOUBLE_MAX];
+	int n = format_double(buf, x);
+	char *mem = allocate_empty(a, n + 1);
+	memcpy(mem, buf, n);
+	mem[n] = 0;
+	return mkstr(mem, n);
+}
+
+NONSTD_STR_API Str
+str_format_lls(Arena *a, long long *values, int count, char delim)
+{
+	i64 size = (i64)count * (FORMAT_LL_MAX + 1) + 1;
+	assert(size <= INT_MAX);
+	char *mem = allocate_empty(a, size), *p = mem;
+	for (int i = 0; i < count; i++) {
+		p += format_ll(p, values[i]);
+		*p++ = delim;
+	}
+	if (count > 0) p--;
+	*p = 0;
+	return mkstr(mem, (int)(p - mem));
+}
+
+NONSTD_STR_API Str
+str_format_doubles(Arena *a, double *values, int count, char delim)
+{
+	i64 size = (i64)count * (FORMAT_DOUBLE_MAX + 1) + 1;
+	assert(size <= INT_MAX);
+	char *mem = allocate_empty(a, size), *p = mem;
+	for (int i = 0; i < count; i++) {
+		p += format_double(p, values[i]);
+		*p++ = delim;
+	}
+	if (count > 0) p--;
+	*p = 0;
+	return mkstr(mem, (int)(p - mem));
+}
+#endif
+
+NONSTD_STR_API Str
+str_split_str(Str* s, Str delim)
+{
+	int i = str_search(*s, delim);
+	Str rtn = { .ptr = s->ptr };
+	if (i > -1) {
+		rtn.len = i;
+		s->ptr += (i+delim.len);
+		s->len -= (i+delim.len);
+		return rtn;
+	} else {
+		rtn.len = s->len;
+		s->ptr += s->len+delim.len;
+		s->len = 0;
+		return rtn;
+	}
+}
+
+// COMPARISON
+// Equality, prefixes and ordering all come down to finding the first byte
+// where two strings differ. Up to 16 bytes, that's two overlapping loads 
+// of 4 or 8 bytes, xor'd: the lowest set bit is the place. Longer strings
+// are compared 16 or 32 bytes at a time with SIMD (or 8 at a time without),
+// and the last block overlaps the one before it, so there's never a tail
+// to do a byte at a time.
+
+static uint32_t
+str_load_le32(const char *p)
+{
+	const unsigned char *u = (const unsigned char*)p;
+	return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+#if STR_X86
+static int
+str_mismatch_sse2(const char *a, const char *b, int n)
+{
+	// n >= 16
+	int i = 0;
+	for (;; i += 16) {
+		if (i + 16 > n) i = n - 16;
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i)), y = _mm_loadu_si128((const __m128i*)(b + i));
+		unsigned diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff) return i + __builtin_ctz(diff);
+		if (i + 16 == n) return n;
+	}
+}
+
+static int STR_TARGET_AVX2
+str_mismatch_avx2(const char *a, const char *b, int n)
+{
+	// n >= 64; two blocks an iteration, and an AND of them is the common case
+	int i = 0;
+	for (;; i += 64) {
+		if (i + 64 > n) i = n - 64;
+		__m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+		__m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i + 32)), _mm256_loadu_si256((const __m256i*)(b + i + 32)));
+		if ((unsigned)_mm256_movemask_epi8(_mm256_and_si256(e0, e1)) != 0xffffffffu) {
+			uint64_t diff = ~((uint64_t)(unsigned)_mm256_movemask_epi8(e1) << 32 | (unsigned)_mm256_movemask_epi8(e0));
+			_mm256_zeroupper();
+			return i + str_ctz64(diff);
+		}
+		if (i + 64 == n) break;
+	}
+	_mm256_zeroupper();
+	return n;
+}
+#endif
+
+#if STR_NEON
+static int
+str_mismatch_neon(const char *a, const char *b, int n)
+{
+	// n >= 16
+	int i = 0;
+	for (;; i += 16) {
+		if (i + 16 > n) i = n - 16;
+		uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t*)a + i), vld1q_u8((const uint8_t*)b + i));
+		if (vminvq_u8(eq) != 0xff) return i + (str_ctz64(~str_neon_mask(eq)) >> 2);
+		if (i + 16 == n) return n;
+	}
+}
+#endif
+
+// The index of the first byte where a[0..n) and b[0..n) differ, or n
+static int
+str_mismatch(const char *a, const char *b, int n)
+{
+	if (n < 4) {
+		for (int i = 0; i < n; i++)
+			if (a[i] != b[i]) return i;
+		return n;
+	}
+	if (n <= 8) {
+		uint32_t head = str_load_le32(a) ^ str_load_le32(b);
+		if (head) return str_ctz64(head) >> 3;
+		uint32_t tail = str_load_le32(a + n - 4) ^ str_load_le32(b + n - 4);
+		return tail ? n - 4 + (str_ctz64(tail) >> 3) : n;
+	}
+	if (n <= 16) {
+		uint64_t head = str_load_le64(a) ^ str_load_le64(b);
+		if (head) return str_ctz64(head) >> 3;
+		uint64_t tail = str_load_le64(a + n - 8) ^ str_load_le64(b + n - 8);
+		return tail ? n - 8 + (str_ctz64(tail) >> 3) : n;
+	}
+#if STR_X86
+	if (n >= 64 && STR_CPU_HAS_AVX2) return str_mismatch_avx2(a, b, n);
+	return str_mismatch_sse2(a, b, n);
+#elif STR_NEON
+	return str_mismatch_neon(a, b, n);
+#else
+	for (int i = 0;; i += 8) {
+		if (i + 8 > n) i = n - 8;
+		uint64_t diff = str_load_le64(a + i) ^ str_load_le64(b + i);
+		if (diff) return i + (str_ctz64(diff) >> 3);
+		if (i + 8 == n) return n;
+	}
+#endif
+}
+
+NONSTD_STR_API int 
+str_equal(Str a, Str b)
+{
+	if (a.len != b.len) return 0;
+	return a.ptr == b.ptr || str_mismatch(a.ptr, b.ptr, a.len) == a.len;
+}
+
+NONSTD_STR_API int
+str_startswith(Str s, Str startswith)
+{
+	return s.len >= startswith.len && str_mismatch(s.ptr, startswith.ptr, startswith.len) == startswith.len;
+}
+
+NONSTD_STR_API int
+str_endswith(Str s, Str endswith)
+{
+	return s.len >= endswith.len && 
+		str_mismatch(s.ptr + s.len - endswith.len, endswith.ptr, endswith.len) == endswith.len;
+}
+
+NONSTD_STR_API int
+str_compare(Str a, Str b)
+{
+	int n = a.len < b.len ? a.len : b.len;
+	// most different strings differ in the first byte (in a sort, anyway)
+	int i = n && a.ptr[0] != b.ptr[0] ? 0 : a.ptr == b.ptr ? n : str_mismatch(a.ptr, b.ptr, n);
+	if (i < n) return (unsigned char)a.ptr[i] - (unsigned char)b.ptr[i];
+	return (a.len > b.len) - (a.len < b.len);
+}
+
+NONSTD_STR_API int
+str_compare_length_first(Str a, Str b)
+{
+	if (a.len != b.len) return a.len < b.len ? -1 : 1;
+	int i = a.ptr == b.ptr ? a.len : str_mismatch(a.ptr, b.ptr, a.len);
+	return i < a.len ? (unsigned char)a.ptr[i] - (unsigned char)b.ptr[i] : 0;
+}
+
+// SUBSTRING SEARCH
+// The fast paths find candidate positions where the first and last bytes of 
+// the needle match (16 or 32 positions at a time), and only then compare the
+// rest. That's very fast on real text, but a pathological haystack (think 
+// "aaaa...") can make nearly every position a candidate. So each search 
+// counts its false candidates, and if there are too many, hands the rest of
+// the haystack over to the Two-Way algorithm, which is linear in the worst case.
+
+#define STR_SEARCH_TOO_MANY_MISSES(misses, pos) ((misses) > 32 + ((pos) >> 3))
+
+// Maximal suffix of x for the ordering given by `reverse`, for Two-Way's 
+// critical factorization. Returns its start - 1, and its period in *period.
+static int
+str_two_way_max_suffix(const unsigned char *x, int m, int *period, int reverse)
+{
+	int ms = -1, j = 0, k = 1, p = 1;
+	while (j + k < m) {
+		unsigned char a = x[j + k], b = x[ms + k];
+		if (reverse ? a > b : a < b) {
+			j += k;
+			k = 1;
+			p = j - ms;
+		} else if (a == b) {
+			if (k != p) {
+				k++;
+			} else {
+				j += p;
+				k = 1;
+			}
+		} else {
+			ms = j;
+			j = ms + 1;
+			k = p = 1;
+		}
+	}
+	*period = p;
+	return ms;
+}
+
+// Crochemore-Perrin Two-Way string matching: O(n+m) time, O(1) space.
+static int
+str_search_two_way(const unsigned char *y, int n, const unsigned char *x, int m)
+{
+	int p1, p2;
+	int ms1 = str_two_way_max_suffix(x, m, &p1, 0);
+	int ms2 = str_two_way_max_suffix(x, m, &p2, 1);
+	int ell = ms1 > ms2 ? ms1 : ms2;
+	int per = ms1 > ms2 ? p1 : p2;
+
+	if (memcmp(x, x + per, ell + 1) == 0) {
+		// periodic needle: remember how much of the left part is known to match
+		int memory = -1;
+		for (int j = 0; j <= n - m; ) {
+			int i = (ell > memory ? ell : memory) + 1;
+			while (i < m && x[i] == y[i + j]) i++;
+			if (i >= m) {
+				i = ell;
+				while (i > memory && x[i] == y[i + j]) i--;
+				if (i <= memory) return j;
+				j += per;
+				memory = m - per - 1;
+			} else {
+				j += i - ell;
+				memory = -1;
+			}
+		}
+	} else {
+		per = (ell + 1 > m - ell - 1 ? ell + 1 : m - ell - 1) + 1;
+		for (int j = 0; j <= n - m; ) {
+			int i = ell + 1;
+			while (i < m && x[i] == y[i + j]) i++;
+			if (i >= m) {
+				i = ell;
+				while (i >= 0 && x[i] == y[i + j]) i--;
+				if (i < 0) return j;
+				j += per;
+			} else {
+				j += i - ell;
+			}
+		}
+	}
+	return -1;
+}
+
+// Portable version: memchr for the first byte (libc's memchr is vectorized),
+// then compare the rest. Needle length >= 2.
+static int
+str_search_memchr(const char *h, int n, const char *x, int m)
+{
+	int misses = 0;
+	for (int i = 0; i <= n - m; ) {
+		const char *c = memchr(h + i, x[0], n - m + 1 - i);
+		if (!c) return -1;
+		i = c - h;
+		if (c[m-1] == x[m-1] && !memcmp(c + 1, x + 1, m - 2)) return i;
+		if (STR_SEARCH_TOO_MANY_MISSES(++misses, i)) {
+			int r = str_search_two_way((const unsigned char*)h + i, n - i, (const unsigned char*)x, m);
+			return r < 0 ? -1 : i + r;
+		}
+		i++;
+	}
+	return -1;
+}
+
+#if STR_X86
+static int
+str_search_sse2(const char *h, int n, const char *x, int m)
+{
+	const __m128i first = _mm_set1_epi8(x[0]);
+	const __m128i last  = _mm_set1_epi8(x[m-1]);
+	int misses = 0, i = 0;
+	for (; i + m - 1 + 16 <= n; i += 16) {
+		__m128i block_first = _mm_loadu_si128((const __m128i*)(h + i));
+		__m128i block_last  = _mm_loadu_si128((const __m128i*)(h + i + m - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+		while (mask) {
+			int pos = i + __builtin_ctz(mask);
+			if (!memcmp(h + pos + 1, x + 1, m - 2)) return pos;
+			if (STR_SEARCH_TOO_MANY_MISSES(++misses, pos)) {
+				int r = str_search_two_way((const unsigned char*)h + pos, n - pos, (const unsigned char*)x, m);
+				return r < 0 ? -1 : pos + r;
+			}
+			mask &= mask - 1;
+		}
+	}
+	int r = str_search_memchr(h + i, n - i, x, m);
+	return r < 0 ? -1 : i + r;
+}
+
+static int STR_TARGET_AVX2
+str_search_avx2(const char *h, int n, const char *x, int m)
+{
+	const __m256i first = _mm256_set1_epi8(x[0]);
+	const __m256i last  = _mm256_set1_epi8(x[m-1]);
+	int misses = 0, i = 0;
+	for (; i + m - 1 + 32 <= n; i += 32) {
+		__m256i block_first = _mm256_loadu_si256((const __m256i*)(h + i));
+		__m256i block_last  = _mm256_loadu_si256((const __m256i*)(h + i + m - 1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+		while (mask) {
+			int pos = i + __builtin_ctz(mask);
+			if (!memcmp(h + pos + 1, x + 1, m - 2)) {
+				_mm256_zeroupper();
+				return pos;
+			}
+			if (STR_SEARCH_TOO_MANY_MISSES(++misses, pos)) {
+				_mm256_zeroupper();
+				int r = str_search_two_way((const unsigned char*)h + pos, n - pos, (const unsigned char*)x, m);
+				return r < 0 ? -1 : pos + r;
+			}
+			mask &= mask - 1;
+		}
+	}
+	_mm256_zeroupper();
+	int r = str_search_memchr(h + i, n - i, x, m);
+	return r < 0 ? -1 : i + r;
+}
+#endif
+
+#if STR_NEON
+static int
+str_search_neon(const char *h, int n, const char *x, int m)
+{
+	const uint8x16_t first = vdupq_n_u8(x[0]);
+	const uint8x16_t last  = vdupq_n_u8(x[m-1]);
+	int misses = 0, i = 0;
+	for (; i + m - 1 + 16 <= n; i += 16) {
+		uint8x16_t block_first = vld1q_u8((const uint8_t*)h + i);
+		uint8x16_t block_last  = vld1q_u8((const uint8_t*)h + i + m - 1);
+		uint64_t mask = str_neon_mask(vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last)));
+		mask &= 0x8888888888888888ull; // one bit per byte
+		while (mask) {
+			int pos = i + (__builtin_ctzll(mask) >> 2);
+			if (!memcmp(h + pos + 1, x + 1, m - 2)) return pos;
+			if (STR_SEARCH_TOO_MANY_MISSES(++misses, pos)) {
+				int r = str_search_two_way((const unsigned char*)h + pos, n - pos, (const unsigned char*)x, m);
+				return r < 0 ? -1 : pos + r;
+			}
+			mask &= mask - 1;
+		}
+	}
+	int r = str_search_memchr(h + i, n - i, x, m);
+	return r < 0 ? -1 : i + r;
+}
+#endif
+
+NONSTD_STR_API int
+str_search(Str haystack, Str needle)
+{
+	const char *h = haystack.ptr, *x = needle.ptr;
+	int n = haystack.len, m = needle.len;
+	if (m <= 0) return 0;
+	if (m > n) return -1;
+	if (m == 1) {
+		const char *c = memchr(h, x[0], n);
+		return c ? c - h : -1;
+	}
+#if STR_X86
+	if (STR_CPU_HAS_AVX2) return str_search_avx2(h, n, x, m);
+	return str_search_sse2(h, n, x, m);
+#elif STR_NEON
+	return str_search_neon(h, n, x, m);
+#else
+	return str_search_memchr(h, n, x, m);
+#endif
+}
+
+#ifdef NONSTD_BASE_H
+// MULTIPLE NEEDLES
+// An Aho-Corasick automaton: a trie of the needles, where every state also
+// has a transition for each byte that doesn't continue a needle, to the 
+// state for the longest suffix of what's been read that is in the trie. 
+// So it reads each byte of the haystack once, however many needles there 
+// are. The transitions are a dense table by byte class, holding the next
+// state's offset in the table, times two, plus 1 if a needle ends there.
+//
+// A needle that ends at i and is the longest one ending there starts the
+// earliest, but a longer needle ending later could still start before it,
+// so we keep going until no needle could.
+//
+// For small sets, "Teddy" (from Hyperscan) finds where needles could start
+// 32 or 16 bytes at a time. Each needle is put in one of 8 buckets, and for
+// each of the first 1-3 bytes of the needles, two nibble tables give the
+// buckets with a needle that has that low or high nibble there. A position
+// where the lookups of the bytes that follow have a bucket in common is 
+// checked against the needles in those buckets.
+
+#if STR_X86 || STR_NEON
+// The needles in `buckets` that are at p[0..n), the first (lowest index)
+// one, or -1 if none are
+static int
+str_teddy_check(StrMultiSearch *ms, const char *p, int n, unsigned buckets)
+{
+	int best = -1;
+	for (; buckets; buckets &= buckets - 1) {
+		int b = __builtin_ctz(buckets);
+		for (int j = ms->bucket_start[b]; j < ms->bucket_start[b + 1]; j++) {
+			int k = ms->bucket_needles[j];
+			if (best >= 0 && k > best) break;
+			Str x = ms->needles[k];
+			if (x.len <= n && !memcmp(p, x.ptr, x.len)) best = k;
+		}
+	}
+	return best;
+}
+#endif
+
+#if STR_X86
+static int STR_TARGET_AVX2
+str_teddy_avx2(StrMultiSearch *ms, const char *h, int n, int *at, int *which)
+{
+	__m256i lo[3], hi[3];
+	for (int j = 0; j < 3; j++) {
+		lo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)ms->teddy_lo[j]));
+		hi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)ms->teddy_hi[j]));
+	}
+	const __m256i nibble = _mm256_set1_epi8(0x0f), zero = _mm256_setzero_si256();
+	int m = ms->teddy, i = 0;
+	for (; i + 32 + m - 1 <= n; i += 32) {
+		__m256i hit = _mm256_set1_epi8(-1);
+		for (int j = 0; j < m; j++) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(h + i + j));
+			__m256i l = _mm256_and_si256(v, nibble);
+			__m256i u = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+			hit = _mm256_and_si256(hit, _mm256_and_si256(_mm256_shuffle_epi8(lo[j], l), _mm256_shuffle_epi8(hi[j], u)));
+		}
+		unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, zero));
+		if (!mask) continue;
+		unsigned char buckets[32];
+		_mm256_storeu_si256((__m256i*)buckets, hit);
+		for (; mask; mask &= mask - 1) {
+			int pos = __builtin_ctz(mask);
+			int k = str_teddy_check(ms, h + i + pos, n - i - pos, buckets[pos]);
+			if (k >= 0) {
+				_mm256_zeroupper();
+				*which = k;
+				*at = i + pos;
+				return 1;
+			}
+		}
+	}
+	_mm256_zeroupper();
+	*at = i;
+	return 0;
+}
+#endif
+
+#if STR_NEON
+static int
+str_teddy_neon(StrMultiSearch *ms, const char *h, int n, int *at, int *which)
+{
+	uint8x16_t lo[3], hi[3];
+	for (int j = 0; j < 3; j++) {
+		lo[j] = vld1q_u8(ms->teddy_lo[j]);
+		hi[j] = vld1q_u8(ms->teddy_hi[j]);
+	}
+	const uint8x16_t nibble = vdupq_n_u8(0x0f);
+	int m = ms->teddy, i = 0;
+	for (; i + 16 + m - 1 <= n; i += 16) {
+		uint8x16_t hit = vdupq_n_u8(0xff);
+		for (int j = 0; j < m; j++) {
+			uint8x16_t v = vld1q_u8((const uint8_t*)h + i + j);
+			hit = vandq_u8(hit, vandq_u8(vqtbl1q_u8(lo[j], vandq_u8(v, nibble)), vqtbl1q_u8(hi[j], vshrq_n_u8(v, 4))));
+		}
+		uint64_t mask = str_neon_mask(vtstq_u8(hit, hit)) & 0x8888888888888888ull;
+		if (!mask) continue;
+		unsigned char buckets[16];
+		vst1q_u8(buckets, hit);
+		for (; mask; mask &= mask - 1) {
+			int pos = __builtin_ctzll(mask) >> 2;
+			int k = str_teddy_check(ms, h + i + pos, n - i - pos, buckets[pos]);
+			if (k >= 0) {
+				*which = k;
+				*at = i + pos;
+				return 1;
+			}
+		}
+	}
+	*at = i;
+	return 0;
+}
+#endif
+
+NONSTD_STR_API StrMultiSearch *
+str_multi_search_create(Arena *a, Str *needles, int count)
+{
+	StrMultiSearch *ms = allocate(a, sizeof(*ms));
+	ms->count = count;
+	ms->needles = allocate(a, (count + 1) * (i64)sizeof(Str));
+	int total = 0;
+	ms->min_len = INT_MAX;
+	for (int k = 0; k < count; k++) {
+		Str x = needles[k];
+		ms->needles[k] = mkstr(allocate(a, x.len + 1), x.len);
+		memcpy(ms->needles[k].ptr, x.ptr, x.len);
+		total += x.len;
+		if (x.len < ms->min_len) ms->min_len = x.len;
+		if (x.len > ms->max_len) ms->max_len = x.len;
+		for (int i = 0; i < x.len; i++) ms->byte_class[(unsigned char)x.ptr[i]] = 1;
+	}
+	if (!count) ms->min_len = 0;
+
+	// class 0 is the bytes that aren't in any needle
+	ms->class_count = 1;
+	for (int b = 0; b < 256; b++) 
+		if (ms->byte_class[b]) ms->byte_class[b] = ms->class_count++;
+
+	// the trie; 0 is "no transition" while building, as nothing goes back
+	// to the root in a trie
+	int classes = ms->class_count;
+	int *next = allocate(a, (total + 1) * (i64)classes * sizeof(int));
+	ms->match = allocate(a, (total + 1) * (i64)sizeof(int));
+	ms->state_count = 1;
+	for (int i = 0; i <= total; i++) ms->match[i] = -1;
+	for (int k = 0; k < count; k++) {
+		int s = 0;
+		Str x = ms->needles[k];
+		for (int i = 0; i < x.len; i++) {
+			int *t = &next[s * classes + ms->byte_class[(unsigned char)x.ptr[i]]];
+			if (!*t) *t = ms->state_count++;
+			s = *t;
+		}
+		// the first of any duplicates
+		if (ms->match[s] < 0) ms->match[s] = k;
+	}
+
+	// Breadth first, so a state's suffix (shorter) is done before it. The
+	// missing transitions of a state are its suffix's transitions.
+	i64 checkpoint = arena_checkpoint(a);
+	int *fail  = allocate(a, ms->state_count * (i64)sizeof(int));
+	int *queue = allocate(a, ms->state_count * (i64)sizeof(int));
+	int head = 0, tail = 0;
+	for (int c = 0; c < classes; c++) 
+		if (next[c]) queue[tail++] = next[c];
+	while (head < tail) {
+		int s = queue[head++];
+		if (ms->match[s] < 0) ms->match[s] = ms->match[fail[s]];
+		for (int c = 0; c < classes; c++) {
+			int *t = &next[s * classes + c];
+			if (*t) {
+				fail[*t] = next[fail[s] * classes + c];
+				queue[tail++] = *t;
+			} else {
+				*t = next[fail[s] * classes + c];
+			}
+		}
+	}
+	arena_rollback(a, checkpoint);
+
+	// states to offsets, with the match bit
+	for (int i = 0; i < ms->state_count * classes; i++) 
+		next[i] = next[i] * classes * 2 | (ms->match[next[i]] >= 0);
+	ms->next = next;
+
+	// Teddy: needles with the same first bytes share a bucket
+	ms->teddy = count <= STR_MULTI_SEARCH_TEDDY_MAX && ms->min_len > 0 ? (ms->min_len < 3 ? ms->min_len : 3) : 0;
+	if (ms->teddy) {
+		int bucket_of[STR_MULTI_SEARCH_TEDDY_MAX], size[8] = {0};
+		for (int k = 0; k < count; k++) {
+			unsigned hash = 2166136261u;
+			for (int j = 0; j < ms->teddy; j++) hash = (hash ^ (unsigned char)ms->needles[k].ptr[j]) * 16777619u;
+			int b = count <= 8 ? k : (int)(hash % 8);
+			bucket_of[k] = b;
+			size[b]++;
+			for (int j = 0; j < ms->teddy; j++) {
+				unsigned char c = ms->needles[k].ptr[j];
+				ms->teddy_lo[j][c & 15] |= 1 << b;
+				ms->teddy_hi[j][c >> 4] |= 1 << b;
+			}
+		}
+		// the needles of each bucket, in order
+		for (int b = 0; b < 8; b++) ms->bucket_start[b + 1] = ms->bucket_start[b] + size[b];
+		int fill[8];
+		for (int b = 0; b < 8; b++) fill[b] = ms->bucket_start[b];
+		for (int k = 0; k < count; k++) ms->bucket_needles[fill[bucket_of[k]]++] = k;
+	}
+	return ms;
+}
+
+NONSTD_STR_API int
+str_multi_search(StrMultiSearch *ms, Str haystack, int *which)
+{
+	const char *h = haystack.ptr;
+	int n = haystack.len, i = 0, k = -1;
+	if (!ms->count) return -1;
+	if (ms->match[0] >= 0) {
+		// an empty needle, so the first needle that's at 0
+		for (k = 0; k < ms->match[0]; k++) 
+			if (ms->needles[k].len <= n && !memcmp(h, ms->needles[k].ptr, ms->needles[k].len)) break;
+		*which = k;
+		return 0;
+	}
+
+#if STR_X86 || STR_NEON
+	// Teddy does what it can in whole blocks, and leaves the rest for the 
+	// automaton. It checks every start before i.
+	if (ms->teddy) {
+		int at = 0, found;
+#if STR_X86
+		if (!STR_CPU_HAS_AVX2) goto automaton;
+		found = str_teddy_avx2(ms, h, n, &at, &k);
+#else
+		found = str_teddy_neon(ms, h, n, &at, &k);
+#endif
+		if (found) {
+			*which = k;
+			return at;
+		}
+		i = at;
+	}
+#if STR_X86
+	automaton:;
+#endif
+#endif
+
+	const int *next = ms->next;
+	const int classes = ms->class_count;
+	int state = 0, best_start = INT_MAX, end = n;
+	for (; i < end; i++) {
+		state = next[(state >> 1) + ms->byte_class[(unsigned char)h[i]]];
+		if (!(state & 1)) continue;
+		int found = ms->match[(state >> 1) / classes];
+		int start = i + 1 - ms->needles[found].len;
+		if (start < best_start || (start == best_start && found < k)) {
+			best_start = start;
+			k = found;
+		}
+		// a needle that ends after this can't start before best_start
+		if (best_start + ms->max_len < end) end = best_start + ms->max_len;
+	}
+	if (k < 0) return -1;
+	*which = k;
+	return best_start;
+}
+#endif // NONSTD_BASE_H
+
+NONSTD_STR_API int 
+str_pattern_match(Str *match, Str *string, CompiledStrPattern *program)
+{
+	int match_len = 0;
+	int loc = pattern_match_ascii(string->ptr, string->len, program, &match_len);
+	if (loc >= 0) {
+		*match  = mkstr(string->ptr+loc, match_len);
+		*string = mkstr(match->ptr+match_len, string->len-match_len-loc);
+		return 1;
+	}
+	return 0;
+}
+
+// Sets captures to the spans that pattern_search() found
+static void
+pattern_set_captures(Str *captures, char *string, int *spans, int count)
+{
+	for (int k = 0; k < count; k++) 
+		captures[k] = mkstr(string + spans[2*k], spans[2*k+1] - spans[2*k]);
+}
+
+NONSTD_STR_API int
+str_pattern_match_captures(Str *match, Str *string, CompiledStrPattern *program, Str *captures)
+{
+	if (program->error) return 0;
+	int match_len = 0, spans[2*PATTERN_MAX_CAPTURES];
+	int loc = pattern_search(string->ptr, string->len, 0, pattern_starts_with_anchor(program), program, &match_len, spans);
+	if (loc < 0) return 0;
+	pattern_set_captures(captures, string->ptr, spans, program->capture_count);
+	*match  = mkstr(string->ptr+loc, match_len);
+	*string = mkstr(match->ptr+match_len, string->len-match_len-loc);
+	return 1;
+}
+
+NONSTD_STR_API StrPatternIter
+str_pattern_iter(Str string, CompiledStrPattern *program)
+{
+	StrPatternIter it = {
+		.program = program,
+		.string = string,
+		.anchored = pattern_starts_with_anchor(program),
+	};
+	if (program->error) it.at = string.len;
+	return it;
+}
+
+NONSTD_STR_API int
+str_pattern_next_captures(StrPatternIter *it, Str *match, Str *captures)
+{
+	if (it->at >= it->string.len || (it->anchored && it->at > 0)) return 0;
+	int len = 0, spans[2*PATTERN_MAX_CAPTURES];
+	int at = pattern_search(it->string.ptr, it->string.len, it->at, it->anchored, it->program, &len, captures ? spans : 0);
+	if (at < 0) {
+		it->at = it->string.len;
+		return 0;
+	}
+	if (captures) pattern_set_captures(captures, it->string.ptr, spans, it->program->capture_count);
+	*match = mkstr(it->string.ptr + at, len);
+	// after an empty match, go on from the next byte
+	it->at = at + len + (len == 0);
+	return 1;
+}
+
+NONSTD_STR_API int
+str_pattern_next(StrPatternIter *it, Str *match)
+{
+	return str_pattern_next_captures(it, match, 0);
+}
+
+#ifdef NONSTD_BASE_H
+NONSTD_STR_API Str *
+str_pattern_match_all(Arena *a, Str string, CompiledStrPattern *program, int *count)
+{
+	// Collect them in batches, and only copy them to the arena at the end,
+	// when we know how many there are
+	Str batch[256], *all = 0, *result = 0;
+	int n = 0, total = 0, cap = 0;
+	StrPatternIter it = str_pattern_iter(string, program);
+	for (;;) {
+		int more = str_pattern_next(&it, &batch[n]);
+		n += more;
+		if (n == COUNT_ARRAY(batch) || (!more && n && all)) {
+			if (total + n > cap) {
+				cap = cap ? cap * 2 : 4 * COUNT_ARRAY(batch);
+				all = xrealloc(all, cap * (i64)sizeof(Str));
+			}
+			memcpy(all + total, batch, n * sizeof(Str));
+			total += n;
+			n = 0;
+		}
+		if (!more) break;
+	}
+	*count = total + n;
+	if (*count) {
+		result = allocate_empty(a, *count * (i64)sizeof(Str));
+		memcpy(result, all ? all : batch, *count * sizeof(Str));
+	}
+	free(all);
+	return result;
+}
+#endif
+
+// UTF-8
+// Validation is Keiser and Lemire's lookup method ("Validating UTF-8 In Less
+// Than One Instruction Per Byte"): almost every error shows up in a pair of
+// adjacent bytes, so look up each byte's high nibble, and the previous 
+// byte's high and low nibbles, in three 16-entry tables of error bits, and
+// AND them: the bits left over are errors. The one thing pairs can't see 
+// is the length of a sequence (a lead byte needs exactly 1 to 3 
+// continuation bytes), which is checked by shifting in the bytes 2 and 3
+// back. Blocks of plain ASCII skip all that. Error bits are collected over
+// 64 bytes at a time, and the scalar code takes over from the start of the
+// character that was being checked when they show up, to find the exact 
+// place. x86 needs AVX2 for its byte shuffles; other machines (and plain 
+// SSE2) get the scalar code, which skips ASCII 8 bytes at a time.
+
+// The scalar decoder, which the rest is checked against. `lo` and `hi` 
+// bound the second byte, to rule out overlong forms, surrogates and 
+// values above 0x10FFFF.
+static int
+str_utf8_decode(const unsigned char *s, int len, int *codepoint)
+{
+	unsigned c = s[0], v, lo = 0x80, hi = 0xbf;
+	int n;
+	if (c < 0x80) {
+		*codepoint = c;
+		return 1;
+	} else if (c - 0xc2 <= 0xdf - 0xc2) {
+		n = 2;
+		v = c & 0x1f;
+	} else if (c - 0xe0 <= 0xef - 0xe0) {
+		n = 3;
+		v = c & 0x0f;
+		if (c == 0xe0) lo = 0xa0;
+		if (c == 0xed) hi = 0x9f;
+	} else if (c - 0xf0 <= 0xf4 - 0xf0) {
+		n = 4;
+		v = c & 0x07;
+		if (c == 0xf0) lo = 0x90;
+		if (c == 0xf4) hi = 0x8f;
+	} else {
+		*codepoint = -1;
+		return 1;
+	}
+	for (int k = 1; k < n; k++) {
+		if (k >= len || s[k] < lo || s[k] > hi) {
+			*codepoint = -1;
+			return k;
+		}
+		v = v << 6 | (s[k] & 0x3f);
+		lo = 0x80;
+		hi = 0xbf;
+	}
+	*codepoint = v;
+	return n;
+}
+
+static int
+str_utf8_validate_scalar(const unsigned char *s, int i, int len)
+{
+	while (i < len) {
+		uint64_t w;
+		if (i + 8 <= len && (memcpy(&w, s + i, 8), !(w & 0x8080808080808080ull))) {
+			i += 8;
+			continue;
+		}
+		int codepoint, n = str_utf8_decode(s + i, len - i, &codepoint);
+		if (codepoint < 0) return i;
+		i += n;
+	}
+	return len;
+}
+
+// Where the scalar code should take over from the SIMD code, which has 
+// checked everything before s[i] except, maybe, a character that s[i] is
+// in the middle of: its first byte, if there's one in the 3 before.
+static int
+str_utf8_resume(const unsigned char *s, int i)
+{
+	for (int k = 1; k <= 3 && k <= i; k++) {
+		unsigned c = s[i - k];
+		if (c < 0x80) break;
+		if (c >= 0xc0) return (c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2) > k ? i - k : i;
+	}
+	return i;
+}
+
+#if STR_X86 || STR_NEON
+enum {
+	STR_UTF8_TOO_SHORT  = 1 << 0, // a lead byte, then no continuation byte
+	STR_UTF8_TOO_LONG   = 1 << 1, // ASCII, then a continuation byte
+	STR_UTF8_OVERLONG_3 = 1 << 2, // 11100000 100_____
+	STR_UTF8_TOO_LARGE  = 1 << 3, // 11110100 1001____, 11110100 101_____, 11110101+ 10______
+	STR_UTF8_SURROGATE  = 1 << 4, // 11101101 101_____
+	STR_UTF8_OVERLONG_2 = 1 << 5, // 1100000_ 10______
+	STR_UTF8_TOO_LARGE_1000 = 1 << 6, // 11110101+ 1000____
+	STR_UTF8_OVERLONG_4 = 1 << 6, // 11110000 1000____
+	STR_UTF8_TWO_CONTS  = 1 << 7, // two continuation bytes: right only as the 2nd and 3rd, or 3rd and 4th
+	STR_UTF8_CARRY = STR_UTF8_TOO_SHORT | STR_UTF8_TOO_LONG | STR_UTF8_TWO_CONTS,
+};
+
+#define STR_UTF8_LARGE (STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000)
+#define STR_UTF8_CONT (STR_UTF8_TOO_LONG | STR_UTF8_OVERLONG_2 | STR_UTF8_TWO_CONTS)
+
+static const unsigned char str_utf8_tables[3][16] = {
+	// the previous byte's high nibble
+	{STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG,
+	 STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG,
+	 STR_UTF8_TWO_CONTS, STR_UTF8_TWO_CONTS, STR_UTF8_TWO_CONTS, STR_UTF8_TWO_CONTS,
+	 STR_UTF8_TOO_SHORT | STR_UTF8_OVERLONG_2,
+	 STR_UTF8_TOO_SHORT,
+	 STR_UTF8_TOO_SHORT | STR_UTF8_OVERLONG_3 | STR_UTF8_SURROGATE,
+	 STR_UTF8_TOO_SHORT | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000 | STR_UTF8_OVERLONG_4},
+	// its low nibble
+	{STR_UTF8_CARRY | STR_UTF8_OVERLONG_3 | STR_UTF8_OVERLONG_2 | STR_UTF8_OVERLONG_4,
+	 STR_UTF8_CARRY | STR_UTF8_OVERLONG_2,
+	 STR_UTF8_CARRY, STR_UTF8_CARRY,
+	 STR_UTF8_CARRY | STR_UTF8_TOO_LARGE,
+	 STR_UTF8_LARGE, STR_UTF8_LARGE, STR_UTF8_LARGE,
+	 STR_UTF8_LARGE, STR_UTF8_LARGE, STR_UTF8_LARGE, STR_UTF8_LARGE, STR_UTF8_LARGE,
+	 STR_UTF8_LARGE | STR_UTF8_SURROGATE,
+	 STR_UTF8_LARGE, STR_UTF8_LARGE},
+	// this byte's high nibble
+	{STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT,
+	 STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT,
+	 STR_UTF8_CONT | STR_UTF8_OVERLONG_3 | STR_UTF8_TOO_LARGE_1000 | STR_UTF8_OVERLONG_4,
+	 STR_UTF8_CONT | STR_UTF8_OVERLONG_3 | STR_UTF8_TOO_LARGE,
+	 STR_UTF8_CONT | STR_UTF8_SURROGATE | STR_UTF8_TOO_LARGE,
+	 STR_UTF8_CONT | STR_UTF8_SURROGATE | STR_UTF8_TOO_LARGE,
+	 STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT},
+};
+
+// A block ending in the first bytes of a character has to be followed by 
+// its continuation bytes: the last 3 bytes of a block are over these if so
+static const unsigned char str_utf8_incomplete[32] = {
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,0xef,0xdf,0xbf,
+};
+#endif
+
+#if STR_X86
+// Error bits for block `v`, which comes after `prev`
+static inline __m256i STR_TARGET_AVX2
+str_utf8_check_avx2(__m256i v, __m256i prev, __m256i t1h, __m256i t1l, __m256i t2h)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i before = _mm256_permute2x128_si256(prev, v, 0x21);
+	__m256i prev1 = _mm256_alignr_epi8(v, before, 15);
+	__m256i prev2 = _mm256_alignr_epi8(v, before, 14);
+	__m256i prev3 = _mm256_alignr_epi8(v, before, 13);
+	__m256i special = _mm256_and_si256(
+		_mm256_and_si256(
+			_mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+			_mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nibble))),
+		_mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+	// 2 bytes after a 3 or 4 byte lead, or 3 after a 4 byte lead, must be a
+	// continuation byte (so TWO_CONTS is right there, and only there)
+	__m256i must_continue = _mm256_or_si256(
+		_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+		_mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+	return _mm256_xor_si256(_mm256_and_si256(must_continue, _mm256_set1_epi8(0x80)), special);
+}
+
+static int STR_TARGET_AVX2
+str_utf8_validate_avx2(const unsigned char *s, int len)
+{
+	const __m256i t1h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)str_utf8_tables[0]));
+	const __m256i t1l = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)str_utf8_tables[1]));
+	const __m256i t2h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)str_utf8_tables[2]));
+	const __m256i incomplete = _mm256_loadu_si256((const __m256i*)str_utf8_incomplete);
+	__m256i prev = _mm256_setzero_si256(), prev_incomplete = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 64 <= len; i += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(s + i + 32));
+		__m256i error;
+		if (!_mm256_movemask_epi8(_mm256_or_si256(a, b))) {
+			error = prev_incomplete;
+			prev_incomplete = _mm256_setzero_si256();
+		} else {
+			error = _mm256_or_si256(str_utf8_check_avx2(a, prev, t1h, t1l, t2h), str_utf8_check_avx2(b, a, t1h, t1l, t2h));
+			prev_incomplete = _mm256_subs_epu8(b, incomplete);
+		}
+		if (!_mm256_testz_si256(error, error)) break;
+		prev = b;
+	}
+	_mm256_zeroupper();
+	return i;
+}
+#endif
+
+#if STR_NEON
+static inline uint8x16_t
+str_utf8_check_neon(uint8x16_t v, uint8x16_t prev, uint8x16_t t1h, uint8x16_t t1l, uint8x16_t t2h)
+{
+	uint8x16_t prev1 = vextq_u8(prev, v, 15);
+	uint8x16_t special = vandq_u8(
+		vandq_u8(vqtbl1q_u8(t1h, vshrq_n_u8(prev1, 4)), vqtbl1q_u8(t1l, vandq_u8(prev1, vdupq_n_u8(0x0f)))),
+		vqtbl1q_u8(t2h, vshrq_n_u8(v, 4)));
+	uint8x16_t must_continue = vorrq_u8(
+		vqsubq_u8(vextq_u8(prev, v, 14), vdupq_n_u8(0xe0 - 0x80)),
+		vqsubq_u8(vextq_u8(prev, v, 13), vdupq_n_u8(0xf0 - 0x80)));
+	return veorq_u8(vandq_u8(must_continue, vdupq_n_u8(0x80)), special);
+}
+
+static int
+str_utf8_validate_neon(const unsigned char *s, int len)
+{
+	const uint8x16_t t1h = vld1q_u8(str_utf8_tables[0]), t1l = vld1q_u8(str_utf8_tables[1]), t2h = vld1q_u8(str_utf8_tables[2]);
+	const uint8x16_t incomplete = vld1q_u8(str_utf8_incomplete + 16);
+	uint8x16_t prev = vdupq_n_u8(0), prev_incomplete = vdupq_n_u8(0);
+	int i = 0;
+	for (; i + 64 <= len; i += 64) {
+		uint8x16_t v[4], error;
+		for (int k = 0; k < 4; k++) v[k] = vld1q_u8(s + i + 16*k);
+		if (vmaxvq_u8(vorrq_u8(vorrq_u8(v[0], v[1]), vorrq_u8(v[2], v[3]))) < 0x80) {
+			error = prev_incomplete;
+			prev_incomplete = vdupq_n_u8(0);
+		} else {
+			error = str_utf8_check_neon(v[0], prev, t1h, t1l, t2h);
+			for (int k = 1; k < 4; k++) error = vorrq_u8(error, str_utf8_check_neon(v[k], v[k-1], t1h, t1l, t2h));
+			prev_incomplete = vqsubq_u8(v[3], incomplete);
+		}
+		if (vmaxvq_u8(error)) break;
+		prev = v[3];
+	}
+	return i;
+}
+#endif
+
+NONSTD_STR_API int
+utf8_validate(char *s, int len)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	int i = 0;
+#if STR_X86
+	if (STR_CPU_HAS_AVX2) i = str_utf8_resume(p, str_utf8_validate_avx2(p, len));
+#elif STR_NEON
+	i = str_utf8_resume(p, str_utf8_validate_neon(p, len));
+#endif
+	return str_utf8_validate_scalar(p, i, len);
+}
+
+NONSTD_STR_API int
+utf8_decode(char *s, int len, int *codepoint)
+{
+	return str_utf8_decode((const unsigned char *)s, len, codepoint);
+}
+
+// Writes a Unicode scalar value as UTF-8
+static inline int
+str_utf8_put(unsigned char *dest, unsigned c)
+{
+	if (c < 0x80) {
+		dest[0] = c;
+		return 1;
+	} else if (c < 0x800) {
+		dest[0] = 0xc0 | c >> 6;
+		dest[1] = 0x80 | (c & 0x3f);
+		return 2;
+	} else if (c < 0x10000) {
+		dest[0] = 0xe0 | c >> 12;
+		dest[1] = 0x80 | (c >> 6 & 0x3f);
+		dest[2] = 0x80 | (c & 0x3f);
+		return 3;
+	} else {
+		dest[0] = 0xf0 | c >> 18;
+		dest[1] = 0x80 | (c >> 12 & 0x3f);
+		dest[2] = 0x80 | (c >> 6 & 0x3f);
+		dest[3] = 0x80 | (c & 0x3f);
+		return 4;
+	}
+}
+
+NONSTD_STR_API int
+utf8_encode(char *dest, int codepoint)
+{
+	unsigned c = codepoint;
+	if (c - 0xd800 < 0x800 || c >= 0x110000) return 0;
+	return str_utf8_put((unsigned char *)dest, c);
+}
+
+NONSTD_STR_API StrUtf8Iter
+str_utf8_iter(Str string)
+{
+	return (StrUtf8Iter){string, 0};
+}
+
+NONSTD_STR_API int
+str_utf8_next(StrUtf8Iter *it, int *codepoint)
+{
+	if (it->at >= it->string.len) return 0;
+	const unsigned char *p = (const unsigned char *)it->string.ptr + it->at;
+	if (*p < 0x80) {
+		*codepoint = *p;
+		it->at++;
+	} else {
+		it->at += str_utf8_decode(p, it->string.len - it->at, codepoint);
+	}
+	return 1;
+}
+
+#ifdef NONSTD_BASE_H
+// TRANSCODING
+// Check (and count the output) first, so that the output is allocated 
+// exactly, then convert without checking. Runs of ASCII are widened or
+// narrowed 16 code units at a time with SIMD.
+
+// The lengths of valid UTF-8 in UTF-32 (characters) and UTF-16 (characters,
+// and another one for each 4 byte character, which is a surrogate pair):
+// the bytes that aren't continuation bytes, and the bytes >= 0xf0.
+static void
+str_utf8_count(const unsigned char *s, int len, int *chars, int *fours)
+{
+	int c = 0, f = 0, i = 0;
+#if STR_X86
+	// signed: continuation bytes are -128 to -65, and 0xf0+ are -16 to -1
+	// (and the only negative bytes above -17). Each byte of the sums counts
+	// up to 255 blocks, then they're added up with psadbw.
+	const __m128i cont_max = _mm_set1_epi8((char)0xbf), four_min = _mm_set1_epi8((char)0xef), zero = _mm_setzero_si128();
+	while (i + 16 <= len) {
+		__m128i cs = zero, fs = zero;
+		for (int k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+			cs = _mm_sub_epi8(cs, _mm_cmpgt_epi8(v, cont_max));
+			fs = _mm_sub_epi8(fs, _mm_and_si128(_mm_cmpgt_epi8(v, four_min), _mm_cmplt_epi8(v, zero)));
+		}
+		cs = _mm_sad_epu8(cs, zero);
+		fs = _mm_sad_epu8(fs, zero);
+		c += _mm_cvtsi128_si32(cs) + _mm_extract_epi16(cs, 4);
+		f += _mm_cvtsi128_si32(fs) + _mm_extract_epi16(fs, 4);
+	}
+#elif STR_NEON
+	for (; i + 16 <= len; i += 16) {
+		int8x16_t v = vld1q_s8((const int8_t*)s + i);
+		c += vaddvq_u8(vandq_u8(vcgtq_s8(v, vdupq_n_s8(-65)), vdupq_n_u8(1)));
+		f += vaddvq_u8(vandq_u8(vandq_u8(vcgtq_s8(v, vdupq_n_s8(-17)), vcltzq_s8(v)), vdupq_n_u8(1)));
+	}
+#endif
+	for (; i < len; i++) {
+		c += (s[i] & 0xc0) != 0x80;
+		f += s[i] >= 0xf0;
+	}
+	*chars = c;
+	*fours = f;
+}
+
+// Widens the 16 bytes at s to `size` bytes each, if they're all ASCII (and
+// returns 16), otherwise does nothing and returns 0
+static inline int
+str_widen_ascii(const unsigned char *s, void *out, int size)
+{
+#if STR_X86
+	__m128i v = _mm_loadu_si128((const __m128i*)s), zero = _mm_setzero_si128();
+	if (_mm_movemask_epi8(v)) return 0;
+	__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+	__m128i *o = out;
+	if (size == 2) {
+		_mm_storeu_si128(o, lo);
+		_mm_storeu_si128(o + 1, hi);
+	} else {
+		_mm_storeu_si128(o,     _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128(o + 1, _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128(o + 2, _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128(o + 3, _mm_unpackhi_epi16(hi, zero));
+	}
+	return 16;
+#elif STR_NEON
+	uint8x16_t v = vld1q_u8(s);
+	if (vmaxvq_u8(v) >= 0x80) return 0;
+	uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_high_u8(v);
+	if (size == 2) {
+		vst1q_u16((uint16_t*)out, lo);
+		vst1q_u16((uint16_t*)out + 8, hi);
+	} else {
+		uint32_t *o = out;
+		vst1q_u32(o,      vmovl_u16(vget_low_u16(lo)));
+		vst1q_u32(o + 4,  vmovl_high_u16(lo));
+		vst1q_u32(o + 8,  vmovl_u16(vget_low_u16(hi)));
+		vst1q_u32(o + 12, vmovl_high_u16(hi));
+	}
+	return 16;
+#else
+	uint64_t w[2];
+	memcpy(w, s, 16);
+	if ((w[0] | w[1]) & 0x8080808080808080ull) return 0;
+	for (int k = 0; k < 16; k++) {
+		if (size == 2) ((uint16_t*)out)[k] = s[k];
+		else ((uint32_t*)out)[k] = s[k];
+	}
+	return 16;
+#endif
+}
+
+// Narrows 16 code units of `size` bytes at s to bytes, if they're all 
+// ASCII (and returns 16), otherwise does nothing and returns 0
+static inline int
+str_narrow_ascii(const void *s, unsigned char *out, int size)
+{
+#if STR_X86
+	const __m128i *p = s;
+	__m128i lo, hi, high_bits;
+	if (size == 2) {
+		lo = _mm_loadu_si128(p);
+		hi = _mm_loadu_si128(p + 1);
+		high_bits = _mm_and_si128(_mm_or_si128(lo, hi), _mm_set1_epi16(~0x7f));
+	} else {
+		__m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1);
+		__m128i c = _mm_loadu_si128(p + 2), d = _mm_loadu_si128(p + 3);
+		high_bits = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), _mm_set1_epi32(~0x7f));
+		lo = _mm_packs_epi32(a, b);
+		hi = _mm_packs_epi32(c, d);
+	}
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(high_bits, _mm_setzero_si128())) != 0xffff) return 0;
+	_mm_storeu_si128((__m128i*)out, _mm_packus_epi16(lo, hi));
+	return 16;
+#elif STR_NEON
+	uint16x8_t lo, hi;
+	if (size == 2) {
+		lo = vld1q_u16((const uint16_t*)s);
+		hi = vld1q_u16((const uint16_t*)s + 8);
+	} else {
+		const uint32_t *p = s;
+		uint32x4_t a = vld1q_u32(p), b = vld1q_u32(p + 4), c = vld1q_u32(p + 8), d = vld1q_u32(p + 12);
+		if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80) return 0;
+		lo = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+		hi = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+	}
+	if (vmaxvq_u16(vorrq_u16(lo, hi)) >= 0x80) return 0;
+	vst1q_u8(out, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+	return 16;
+#else
+	for (int k = 0; k < 16; k++)
+		if ((size == 2 ? ((const uint16_t*)s)[k] : ((const uint32_t*)s)[k]) >= 0x80) return 0;
+	for (int k = 0; k < 16; k++)
+		out[k] = size == 2 ? ((const uint16_t*)s)[k] : ((const uint32_t*)s)[k];
+	return 16;
+#endif
+}
+
+// Decodes valid UTF-8 into `out`, of `size` byte code units
+static void
+str_utf8_widen(const unsigned char *s, int len, void *out, int size)
+{
+	uint16_t *o16 = out;
+	uint32_t *o32 = out;
+	// after a block that isn't all ASCII, go on a character at a time to
+	// the end of it before trying again
+	int i = 0, o = 0, scalar_end = 0;
+	while (i < len) {
+		unsigned c = s[i];
+		if (c < 0x80) {
+			if (i >= scalar_end && i + 16 <= len) {
+				if (str_widen_ascii(s + i, size == 2 ? (void*)(o16 + o) : (void*)(o32 + o), size)) {
+					i += 16;
+					o += 16;
+					continue;
+				}
+				scalar_end = i + 16;
+			}
+			i++;
+		} else if (c < 0xe0) {
+			c = (c & 0x1f) << 6 | (s[i+1] & 0x3f);
+			i += 2;
+		} else if (c < 0xf0) {
+			c = (c & 0x0f) << 12 | (s[i+1] & 0x3f) << 6 | (s[i+2] & 0x3f);
+			i += 3;
+		} else {
+			c = (c & 0x07) << 18 | (s[i+1] & 0x3f) << 12 | (s[i+2] & 0x3f) << 6 | (s[i+3] & 0x3f);
+			i += 4;
+			if (size == 2) {
+				c -= 0x10000;
+				o16[o++] = 0xd800 | c >> 10;
+				o16[o++] = 0xdc00 | (c & 0x3ff);
+				continue;
+			}
+		}
+		if (size == 2) o16[o++] = c;
+		else o32[o++] = c;
+	}
+}
+
+static void *
+str_utf8_transcode(Arena *a, Str s, int *len, int size)
+{
+	const unsigned char *p = (const unsigned char *)s.ptr;
+	int valid = utf8_validate(s.ptr, s.len);
+	if (valid < s.len) {
+		*len = -1 - valid;
+		return 0;
+	}
+	int chars, fours;
+	str_utf8_count(p, s.len, &chars, &fours);
+	int n = size == 2 ? chars + fours : chars;
+	void *out = allocate_empty(a, (n + 1) * (i64)size);
+	str_utf8_widen(p, s.len, out, size);
+	if (size == 2) ((uint16_t*)out)[n] = 0;
+	else ((uint32_t*)out)[n] = 0;
+	*len = n;
+	return out;
+}
+
+NONSTD_STR_API uint16_t *
+str_to_utf16(Arena *a, Str s, int *len)
+{
+	return str_utf8_transcode(a, s, len, 2);
+}
+
+NONSTD_STR_API uint32_t *
+str_to_utf32(Arena *a, Str s, int *len)
+{
+	return str_utf8_transcode(a, s, len, 4);
+}
+
+// The codepoint at s[i] (of `size` byte code units), setting *units to how
+// many it takes up, or -1 if it isn't one
+static inline int
+str_utf_unit(const void *s, int i, int len, int size, int *units)
+{
+	*units = 1;
+	if (size == 4) {
+		uint32_t c = ((const uint32_t*)s)[i];
+		return c - 0xd800 < 0x800 || c >= 0x110000 ? -1 : (int)c;
+	}
+	const uint16_t *p = s;
+	unsigned c = p[i];
+	if (c - 0xd800 >= 0x800) return c;
+	if (c >= 0xdc00 || i + 1 >= len || p[i+1] - 0xdc00u >= 0x400) return -1;
+	*units = 2;
+	return 0x10000 + ((c - 0xd800) << 10 | (p[i+1] - 0xdc00));
+}
+
+// The UTF-8 length of UTF-16: each unit is 3 bytes, less one if it's
+// below 0x800 and another if it's ASCII, and a surrogate is half of a 4
+// byte character. Returns -1 if the surrogates aren't all in pairs: that
+// is, unless every unit after a high surrogate (0xd800 to 0xdbff) is a low
+// one (0xdc00 to 0xdfff) and every other unit isn't.
+static i64
+str_utf16_count(const uint16_t *p, int len)
+{
+	i64 n = 0;
+	int i = 0, bad = 0;
+	if (len > 0 && (p[0] & 0xfc00) == 0xdc00) return -1;
+#if STR_X86
+	const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1), ten = _mm_set1_epi16((short)0xfc00);
+	const __m128i not_ascii = _mm_set1_epi16((short)0xff80), not_small = _mm_set1_epi16((short)0xf800);
+	const __m128i surrogate = _mm_set1_epi16((short)0xd800), low = _mm_set1_epi16((short)0xdc00);
+	__m128i mismatched = zero;
+	while (i + 9 <= len) {
+		// each lane goes down by at most 2 a block
+		__m128i sum = zero;
+		int start = i;
+		for (int k = 0; k < 8192 && i + 9 <= len; k++, i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+			__m128i next = _mm_loadu_si128((const __m128i*)(p + i + 1));
+			__m128i top = _mm_and_si128(v, not_small);
+			sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_cmpeq_epi16(_mm_and_si128(v, not_ascii), zero),
+				_mm_add_epi16(_mm_cmpeq_epi16(top, zero), _mm_cmpeq_epi16(top, surrogate))));
+			mismatched = _mm_or_si128(mismatched, _mm_xor_si128(
+				_mm_cmpeq_epi16(_mm_and_si128(v, ten), surrogate), 
+				_mm_cmpeq_epi16(_mm_and_si128(next, ten), low)));
+		}
+		sum = _mm_madd_epi16(sum, ones);
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+		n += 3 * (i64)(i - start) + _mm_cvtsi128_si32(sum);
+	}
+	bad = _mm_movemask_epi8(mismatched);
+#elif STR_NEON
+	uint16x8_t mismatched = vdupq_n_u16(0);
+	for (; i + 9 <= len; i += 8) {
+		uint16x8_t v = vld1q_u16(p + i), next = vld1q_u16(p + i + 1);
+		uint16x8_t top = vandq_u16(v, vdupq_n_u16(0xf800));
+		uint16x8_t minus = vaddq_u16(vaddq_u16(vcltq_u16(v, vdupq_n_u16(0x80)), vceqq_u16(top, vdupq_n_u16(0))),
+			vceqq_u16(top, vdupq_n_u16(0xd800)));
+		n += 3 * 8 + vaddvq_s16(vreinterpretq_s16_u16(minus));
+		mismatched = vorrq_u16(mismatched, veorq_u16(
+			vceqq_u16(vandq_u16(v, vdupq_n_u16(0xfc00)), vdupq_n_u16(0xd800)),
+			vceqq_u16(vandq_u16(next, vdupq_n_u16(0xfc00)), vdupq_n_u16(0xdc00))));
+	}
+	bad = vmaxvq_u16(mismatched) != 0;
+#endif
+	for (; i < len; i++) {
+		unsigned c = p[i];
+		int high = (c & 0xfc00) == 0xd800;
+		n += 1 + (c >= 0x80) + (c >= 0x800) - ((c & 0xf800) == 0xd800);
+		bad |= high != (i + 1 < len && (p[i+1] & 0xfc00) == 0xdc00);
+	}
+	return bad ? -1 : n;
+}
+
+// UTF-16 or UTF-32 (code units of `size` bytes) to UTF-8
+static Str
+str_utf_narrow(Arena *a, const void *s, int len, int size)
+{
+	const uint16_t *p16 = s;
+	const uint32_t *p32 = s;
+	i64 n = 0;
+	int check = 0, units;
+	if (size == 2) {
+		n = str_utf16_count(p16, len);
+		// and if not, find where
+		for (int i = 0; n < 0 && i < len; i += units)
+			if (str_utf_unit(s, i, len, 2, &units) < 0) return mkstr(0, -1 - i);
+	} else {
+		for (int i = 0; i < len; i++) {
+			uint32_t c = p32[i];
+			n += 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+			check |= (c & 0xfffff800) == 0xd800 || c >= 0x110000;
+		}
+		for (int i = 0; check && i < len; i++)
+			if (str_utf_unit(s, i, len, 4, &units) < 0) return mkstr(0, -1 - i);
+	}
+	assert(n < INT_MAX);
+
+	unsigned char *out = allocate_empty(a, n + 1), *o = out;
+	for (int i = 0, scalar_end = 0; i < len; i += units) {
+		if (i >= scalar_end && i + 16 <= len) {
+			if (str_narrow_ascii((const char*)s + (i64)i * size, o, size)) {
+				o += 16;
+				units = 16;
+				continue;
+			}
+			scalar_end = i + 16;
+		}
+		o += str_utf8_put(o, str_utf_unit(s, i, len, size, &units));
+	}
+	*o = 0;
+	assert(o - out == n);
+	return mkstr((char*)out, (int)n);
+}
+
+NONSTD_STR_API Str
+str_from_utf16(Arena *a, uint16_t *s, int len)
+{
+	return str_utf_narrow(a, s, len, 2);
+}
+
+NONSTD_STR_API Str
+str_from_utf32(Arena *a, uint32_t *s, int len)
+{
+	return str_utf_narrow(a, s, len, 4);
+}
+#endif
+
 #ifdef NONSTD_STR_DEBUG
 #include <stdio.h>
 NONSTD_STR_API int
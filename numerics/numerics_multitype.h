@@ -154,12 +154,14 @@ int64_t  NAME(histogram) (int64_t Nbins, double *bins, int64_t *counts, bool aut
 	if (auto_bins) {
 		TYPE min = 0, max = 0;
 		(void) NAME(minmax)(&min, &max, Ndata, data);
-		max = nextafter((double)max, DBL_MAX); // bins are [a,b)
+		// bins are [a,b). Keep the bound in double: stored back into a float 
+		// TYPE, it would round down to max again and the max would miss.
+		double upper = nextafter((double)max, DBL_MAX); 
 
-		double step = (max-min)/Nbins;
+		double step = (upper-min)/Nbins;
 		for (int64_t i = 0; i < Nbins; i++)
 			bins[i] = min + i * step; 
-		bins[Nbins] = max;
+		bins[Nbins] = upper;
 	}
 
 	for (int64_t b = 0; b < Nbins; b++)
@@ -0,0 +1,69 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+#include "benchmark.h"
+
+// Arena allocation against malloc/free.
+
+typedef struct {
+	Arena arena;
+	int64_t size;
+	int count;
+} ArenaBench;
+
+static void
+bench_allocate (void *ctx)
+{
+	ArenaBench *b = ctx;
+	for (int i = 0; i < b->count; i++) DO_NOT_OPTIMIZE(allocate_empty(&b->arena, b->size));
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_allocate_zeroed (void *ctx)
+{
+	ArenaBench *b = ctx;
+	for (int i = 0; i < b->count; i++) DO_NOT_OPTIMIZE(allocate(&b->arena, b->size));
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_malloc (void *ctx)
+{
+	ArenaBench *b = ctx;
+	static void *p[1024];
+	for (int i = 0; i < b->count; i++) DO_NOT_OPTIMIZE(p[i] = malloc(b->size));
+	for (int i = 0; i < b->count; i++) free(p[i]);
+}
+
+static void
+bench_checkpoint (void *ctx)
+{
+	ArenaBench *b = ctx;
+	i64 c = arena_checkpoint(&b->arena);
+	DO_NOT_OPTIMIZE(allocate_empty(&b->arena, b->size));
+	arena_rollback(&b->arena, c);
+}
+
+int main (int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	ArenaBench b = {.count = 1024};
+	int64_t sizes[] = {16, 256, 4096};
+	char names[4][COUNT_ARRAY(sizes)][64];
+	for (int i = 0; i < COUNT_ARRAY(sizes); i++) {
+		b.size = sizes[i];
+		snprintf(names[0][i], 64, "allocate_empty %lli B x1024", (long long) sizes[i]);
+		snprintf(names[1][i], 64, "allocate %lli B x1024", (long long) sizes[i]);
+		snprintf(names[2][i], 64, "malloc+free %lli B x1024", (long long) sizes[i]);
+		snprintf(names[3][i], 64, "checkpoint+allocate+rollback %lli B", (long long) sizes[i]);
+		bench_run(names[0][i], bench_allocate,        &b, 0, b.count);
+		bench_run(names[1][i], bench_allocate_zeroed, &b, b.count*b.size, b.count);
+		bench_run(names[2][i], bench_malloc,          &b, 0, b.count);
+		bench_run(names[3][i], bench_checkpoint,      &b, 0, 1);
+	}
+
+	arena_destroy(&b.arena);
+	return 0;
+}
@@ -0,0 +1,95 @@
+// numerics.h can't be used together with nonstd_base.h (both define round_up), 
+// so only the arch part of nonstd, for the timer.
+#define NONSTD_ARCH_IMPLEMENTATION
+#define NONSTD_ARCH_API static
+#include "../nonstd/nonstd_arch.h"
+#define NUMERICS_IMPLEMENTATION
+#include "../numerics/numerics.h"
+#include "benchmark.h"
+
+// Numerics kernels on 1M-element arrays.
+
+#define N (1<<20)
+#define NBINS 16
+
+typedef struct {
+	float *f32;
+	uint16_t *f16;
+	float *out;
+	double bins[NBINS+1];
+	int64_t counts[NBINS];
+} NumBench;
+
+static void bench_f32_to_f16 (void *ctx) { NumBench *b = ctx; f32_to_f16(b->f16, b->f32, N); CLOBBER_MEMORY(); }
+static void bench_f16_to_f32 (void *ctx) { NumBench *b = ctx; f16_to_f32(b->out, b->f16, N); CLOBBER_MEMORY(); }
+static void bench_f32_to_f16_c (void *ctx) { NumBench *b = ctx; f32_to_f16_c(b->f16, b->f32, N); CLOBBER_MEMORY(); }
+static void bench_f16_to_f32_c (void *ctx) { NumBench *b = ctx; f16_to_f32_c(b->out, b->f16, N); CLOBBER_MEMORY(); }
+
+static void
+bench_histogram (void *ctx)
+{
+	NumBench *b = ctx;
+	DO_NOT_OPTIMIZE(histogramf(NBINS, b->bins, b->counts, 0, N, b->f32));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_histogram_auto (void *ctx)
+{
+	NumBench *b = ctx;
+	DO_NOT_OPTIMIZE(histogramf(NBINS, b->bins, b->counts, 1, N, b->f32));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_minmax (void *ctx)
+{
+	NumBench *b = ctx;
+	float lo, hi;
+	minmaxf(&lo, &hi, N, b->f32);
+	DO_NOT_OPTIMIZE(lo);
+	DO_NOT_OPTIMIZE(hi);
+}
+
+static void bench_mean (void *ctx) { NumBench *b = ctx; DO_NOT_OPTIMIZE(meanf(N, b->f32)); }
+
+static void
+bench_transpose (void *ctx)
+{
+	NumBench *b = ctx;
+	transposef(1024, N/1024, b->out, b->f32);
+	CLOBBER_MEMORY();
+}
+
+int main (int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	NumBench b = {0};
+	b.f32 = malloc(N * sizeof(float));
+	b.out = malloc(N * sizeof(float));
+	b.f16 = malloc(N * sizeof(uint16_t));
+	uint64_t state = 7;
+	for (int i = 0; i < N; i++) { // roughly normal: sum of uniforms
+		float x = -6;
+		for (int j = 0; j < 12; j++) {
+			state = state * 6364136223846793005ull + 1442695040888963407ull;
+			x += (state >> 40) * 0x1p-24f;
+		}
+		b.f32[i] = x;
+	}
+	f32_to_f16_c(b.f16, b.f32, N);
+	histogramf(NBINS, b.bins, b.counts, 1, N, b.f32);
+
+	bench_run("f32_to_f16 1M",         bench_f32_to_f16,     &b, N*sizeof(float), N);
+	bench_run("f32_to_f16_c 1M",       bench_f32_to_f16_c,   &b, N*sizeof(float), N);
+	bench_run("f16_to_f32 1M",         bench_f16_to_f32,     &b, N*sizeof(uint16_t), N);
+	bench_run("f16_to_f32_c 1M",       bench_f16_to_f32_c,   &b, N*sizeof(uint16_t), N);
+	bench_run("histogramf 16 bins 1M",      bench_histogram,      &b, N*sizeof(float), N);
+	bench_run("histogramf auto 16 bins 1M", bench_histogram_auto, &b, N*sizeof(float), N);
+	bench_run("minmaxf 1M",            bench_minmax,         &b, N*sizeof(float), N);
+	bench_run("meanf 1M",              bench_mean,           &b, N*sizeof(float), N);
+	bench_run("transposef 1024x1024",  bench_transpose,      &b, N*sizeof(float), N);
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+#include "benchmark.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+// Queue and synchronization overhead. The single-threaded benchmarks measure
+// the cost of the operations themselves (no contention); the spsc transfer
+// moves items between two threads.
+
+#define EXP 10
+#define BATCH 32
+
+static uint32_t q32 = 0;
+static uint64_t q64 = 0;
+static uint32_t sem = 0;
+static uint32_t slots[1<<EXP];
+static BlockingConcurrentQueue bq = BLOCKING_CONCURRENT_QUEUE_INITIALIZER(EXP);
+static SpscRing *ring = 0;
+
+static void
+bench_queue_roundtrip (void *ctx)
+{
+	(void) ctx;
+	int i = queue_push(&q32, EXP);
+	slots[i] = 1;
+	queue_push_commit(&q32);
+	i = queue_pop(&q32, EXP);
+	DO_NOT_OPTIMIZE(slots[i]);
+	queue_pop_commit(&q32);
+}
+
+static void
+bench_queue_mpop_roundtrip (void *ctx)
+{
+	(void) ctx;
+	int i = queue_push(&q32, EXP);
+	slots[i] = 1;
+	queue_push_commit(&q32);
+	uint32_t save;
+	i = queue_mpop(&q32, EXP, &save);
+	DO_NOT_OPTIMIZE(slots[i]);
+	DO_NOT_OPTIMIZE(queue_mpop_commit(&q32, save));
+}
+
+static void
+bench_queue64_roundtrip (void *ctx)
+{
+	(void) ctx;
+	int64_t i = queue64_push(&q64, EXP);
+	slots[i] = 1;
+	queue64_push_commit(&q64);
+	i = queue64_pop(&q64, EXP);
+	DO_NOT_OPTIMIZE(slots[i]);
+	queue64_pop_commit(&q64);
+}
+
+static void
+bench_queue_batch_roundtrip (void *ctx)
+{
+	(void) ctx;
+	int n = 0, mask = (1<<EXP)-1;
+	int i = queue_push_n(&q32, EXP, BATCH, &n);
+	for (int j = 0; j < n; j++) slots[(i+j) & mask] = j;
+	queue_push_commit_n(&q32, n);
+	i = queue_pop_n(&q32, EXP, BATCH, &n);
+	for (int j = 0; j < n; j++) DO_NOT_OPTIMIZE(slots[(i+j) & mask]);
+	queue_pop_commit_n(&q32, n);
+}
+
+static void
+bench_spsc_batch_roundtrip (void *ctx)
+{
+	(void) ctx;
+	uint32_t first;
+	int n = spsc_ring_push_reserve(ring, BATCH, &first);
+	for (int j = 0; j < n; j++) *SPSC_RING_SLOT(ring, uint32_t, first+j) = j;
+	spsc_ring_push_commit(ring, n);
+	n = spsc_ring_pop_reserve(ring, BATCH, &first);
+	for (int j = 0; j < n; j++) DO_NOT_OPTIMIZE(*SPSC_RING_SLOT(ring, uint32_t, first+j));
+	spsc_ring_pop_commit(ring, n);
+}
+
+static void
+bench_blocking_roundtrip (void *ctx)
+{
+	(void) ctx;
+	int i = blocking_queue_push(&bq);
+	slots[i] = 1;
+	blocking_queue_push_commit(&bq);
+	i = blocking_queue_pop(&bq);
+	DO_NOT_OPTIMIZE(slots[i]);
+	blocking_queue_pop_commit(&bq);
+}
+
+static void
+bench_semaphore (void *ctx)
+{
+	(void) ctx;
+	semaphore_post(&sem);
+	DO_NOT_OPTIMIZE(semaphore_wait(&sem));
+}
+
+#define TRANSFER 100000
+static void *
+spsc_consumer (void *nothing)
+{
+	(void) nothing;
+	uint64_t sum = 0;
+	for (int got = 0; got < TRANSFER; ) {
+		uint32_t first;
+		int n = spsc_ring_pop_reserve(ring, BATCH, &first);
+		if (!n) { sched_yield(); continue; }
+		for (int j = 0; j < n; j++) sum += *SPSC_RING_SLOT(ring, uint32_t, first+j);
+		spsc_ring_pop_commit(ring, n);
+		got += n;
+	}
+	DO_NOT_OPTIMIZE(sum);
+	return 0;
+}
+
+static void
+bench_spsc_transfer (void *ctx)
+{
+	(void) ctx;
+	pthread_t c = {0};
+	pthread_create(&c, 0, spsc_consumer, 0);
+	for (int sent = 0; sent < TRANSFER; ) {
+		uint32_t first;
+		int n = spsc_ring_push_reserve(ring, BATCH, &first);
+		if (!n) { sched_yield(); continue; }
+		for (int j = 0; j < n; j++) *SPSC_RING_SLOT(ring, uint32_t, first+j) = sent+j;
+		spsc_ring_push_commit(ring, n);
+		sent += n;
+	}
+	void *nothing = 0;
+	pthread_join(c, &nothing);
+}
+
+int main (int argc, char **argv)
+{
+	bench_init(argc, argv);
+	Arena arena = {0};
+	ring = SPSC_RING_CREATE(&arena, uint32_t, EXP);
+
+	bench_run("queue push+pop",             bench_queue_roundtrip,       0, 0, 1);
+	bench_run("queue push+mpop",            bench_queue_mpop_roundtrip,  0, 0, 1);
+	bench_run("queue64 push+pop",           bench_queue64_roundtrip,     0, 0, 1);
+	bench_run("queue push_n+pop_n x32",     bench_queue_batch_roundtrip, 0, 0, BATCH);
+	bench_run("spsc_ring reserve+commit x32", bench_spsc_batch_roundtrip, 0, 0, BATCH);
+	bench_run("blocking_queue push+pop",    bench_blocking_roundtrip,    0, 0, 1);
+	bench_run("semaphore post+wait",        bench_semaphore,             0, 0, 1);
+	bench_run("spsc_ring 2-thread transfer", bench_spsc_transfer,        0, TRANSFER*sizeof(uint32_t), TRANSFER);
+
+	arena_destroy(&arena);
+	return 0;
+}
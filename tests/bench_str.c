@@ -0,0 +1,848 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+#include "benchmark.h"
+
+// String functions over a synthetic ~1MB text of words, numbers and lines.
+
+#define TEXT_LEN (1<<20)
+
+typedef struct {
+	char *text;
+	char *out;
+	int len;
+	CompiledStrPattern pattern;
+	CompiledStrPattern words;
+	CompiledStrPattern letters_1;
+	CompiledStrPattern errors;
+	CompiledStrPattern errors_plain;
+	PatternDfa *pattern_dfa;
+	PatternDfa *letters_1_dfa;
+	CompiledStrPattern ident;
+	CompiledStrPattern word_number;
+	CompiledStrPattern word_number_captures;
+	CompiledStrPattern word_space_captures;
+	PatternProgram *pattern_decoded;
+	PatternProgram *words_decoded;
+	PatternProgram *ident_decoded;
+	char *runs;
+	int runs_len;
+	Str *keywords;
+	int keyword_count;
+	StrMultiSearch *multi;
+	Str needle;
+	char *periodic;
+	char *csv;
+	char *dirty;
+	char *floats;
+	int floats_len;
+	double *column;
+	long long *ints;
+	int column_len;
+	char *utf8;
+	int utf8_len;
+	uint16_t *utf16;
+	int utf16_len;
+	Str *table;        // sorted, for binary searches
+	int table_len;
+	Str *lookups;
+	int lookup_count;
+	Arena arena;
+} StrBench;
+
+static void
+make_text (char *text, int len)
+{
+	static char *words[] = {"alpha", "Beta", "gamma", "DELTA", "epsilon", "zeta", "eta", "Theta", "12345", "678"};
+	u64 state = 42;
+	int i = 0;
+	while (i < len) {
+		char *w = words[rand_pcg32(&state) % COUNT_ARRAY(words)];
+		for (; *w && i < len; w++) text[i++] = *w;
+		if (i < len) text[i++] = rand_pcg32(&state) % 12 ? ' ' : '\n';
+	}
+}
+
+static void
+bench_search (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_search(mkstr(b->text, b->len), b->needle));
+}
+
+static void
+bench_search_periodic (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_search(mkstr(b->periodic, b->len), b->needle));
+}
+
+static void
+bench_split_lines (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->text, b->len);
+	int n = 0;
+	while (s.len > 0) {
+		Str line = str_split(&s, '\n');
+		n += line.len > 0;
+	}
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_split_words (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->text, b->len);
+	int n = 0;
+	while (s.len > 0) {
+		Str word = str_split(&s, ' ');
+		n += word.len;
+	}
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_csv_split (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->csv, b->len);
+	int n = 0;
+	while (s.len > 0) {
+		Str line = str_split(&s, '\n');
+		while (line.len > 0) {
+			Str field = str_split(&line, ',');
+			n += field.len;
+		}
+	}
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_csv_split_any (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->csv, b->len);
+	int n = 0;
+	while (s.len > 0) {
+		Str field = str_split_any(&s, cstr(",\n"));
+		n += field.len;
+	}
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_csv_tokenize (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0;
+	Str *fields = str_tokenize(&b->arena, mkstr(b->csv, b->len), cstr(",\n"), &n);
+	DO_NOT_OPTIMIZE(fields);
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_tokenize_big_set (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0;
+	Str *fields = str_tokenize(&b->arena, mkstr(b->text, b->len), cstr(" \n\t.,;:!?-"), &n);
+	DO_NOT_OPTIMIZE(fields);
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_lowercase (void *ctx)
+{
+	StrBench *b = ctx;
+	lowercase_ascii(b->out, b->text, b->len);
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_uppercase (void *ctx)
+{
+	StrBench *b = ctx;
+	uppercase_ascii(b->out, b->text, b->len);
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_clean_whitespace (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(clean_whitespace_ascii(b->out, b->text, b->len));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_clean_ascii (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(clean_ascii(b->out, b->text, b->len));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_clean_whitespace_dirty (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(clean_whitespace_ascii(b->out, b->dirty, b->len));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_strip_whitespace (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(strip_whitespace_ascii(b->out, b->text, b->len));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_equal (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_equal(mkstr(b->text, b->len), mkstr(b->out, b->len)));
+}
+
+static void
+bench_parse_decimal (void *ctx)
+{
+	(void) ctx;
+	static char *numbers[] = {"0", "7", "42", "12345", "9876543210", "18446744073709551615"};
+	for (int i = 0; i < COUNT_ARRAY(numbers); i++) {
+		unsigned long long x = 0;
+		parse_decimal_ull(numbers[i], strlen(numbers[i]), &x);
+		DO_NOT_OPTIMIZE(x);
+	}
+}
+
+static void
+bench_parse_double (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->floats, b->floats_len);
+	double sum = 0;
+	while (s.len > 0) {
+		Str field = str_split(&s, ',');
+		double d = 0;
+		parse_double(field.ptr, field.len, &d);
+		sum += d;
+	}
+	DO_NOT_OPTIMIZE(sum);
+}
+
+static void
+bench_strtod (void *ctx)
+{
+	StrBench *b = ctx;
+	// the fields end at a comma, which stops strtod too
+	char *p = b->floats, *end = b->floats + b->floats_len;
+	double sum = 0;
+	while (p < end) {
+		sum += strtod(p, &p);
+		p++;
+	}
+	DO_NOT_OPTIMIZE(sum);
+}
+
+static void
+bench_parse_doubles (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_parse_doubles(mkstr(b->floats, b->floats_len), ',', b->column, TEXT_LEN/8));
+	CLOBBER_MEMORY();
+}
+
+static void
+bench_format_doubles (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_format_doubles(&b->arena, b->column, b->column_len, ',').len);
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_snprintf_doubles (void *ctx)
+{
+	StrBench *b = ctx;
+	// what it takes to round trip with printf: "%.17g", not the shortest
+	char *p = b->out;
+	for (int i = 0; i < b->column_len; i++) p += snprintf(p, 32, "%.17g,", b->column[i]);
+	DO_NOT_OPTIMIZE(p);
+}
+
+static void
+bench_format_lls (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_format_lls(&b->arena, b->ints, b->column_len, ',').len);
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_snprintf_lls (void *ctx)
+{
+	StrBench *b = ctx;
+	char *p = b->out;
+	for (int i = 0; i < b->column_len; i++) p += snprintf(p, 32, "%lli,", b->ints[i]);
+	DO_NOT_OPTIMIZE(p);
+}
+
+static void
+bench_pattern (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->text, b->len), match = {0};
+	int n = 0;
+	while (str_pattern_match(&match, &s, &b->pattern)) n++;
+	DO_NOT_OPTIMIZE(n);
+}
+
+static int
+count_matches_decoded (char *text, int len, PatternProgram *p)
+{
+	int n = 0, match_len = 0;
+	for (int at = 0, i = 0; (at = pattern_program_match(p, text + i, len - i, &match_len)) >= 0; i += at + match_len + !match_len) n++;
+	return n;
+}
+
+static void
+bench_pattern_decoded (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(count_matches_decoded(b->text, b->len, b->pattern_decoded));
+}
+
+static void
+bench_pattern_iter (void *ctx)
+{
+	StrBench *b = ctx;
+	StrPatternIter it = str_pattern_iter(mkstr(b->text, b->len), &b->pattern);
+	Str match;
+	int n = 0;
+	while (str_pattern_next(&it, &match)) n++;
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_pattern_stream (void *ctx)
+{
+	StrBench *b = ctx;
+	PatternStream s;
+	pattern_stream_init(&s, &b->arena, b->pattern_dfa);
+	i64 start, len;
+	int n = 0;
+	for (int at = 0; at < b->len; at += 4096) {
+		pattern_stream_input(&s, b->text + at, 4096, at + 4096 >= b->len);
+		while (pattern_stream_next(&s, &start, &len)) n++;
+	}
+	arena_clear(&b->arena, 0);
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_pattern_match_all (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0;
+	DO_NOT_OPTIMIZE(str_pattern_match_all(&b->arena, mkstr(b->text, b->len), &b->words, &n));
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_pattern_words (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->text, b->len), match = {0};
+	int n = 0;
+	while (str_pattern_match(&match, &s, &b->words)) n++;
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_pattern_words_decoded (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(count_matches_decoded(b->text, b->len, b->words_decoded));
+}
+
+static void
+bench_pattern_ident (void *ctx)
+{
+	StrBench *b = ctx;
+	Str s = mkstr(b->text, b->len), match = {0};
+	int n = 0;
+	while (str_pattern_match(&match, &s, &b->ident)) n++;
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_pattern_ident_decoded (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(count_matches_decoded(b->text, b->len, b->ident_decoded));
+}
+
+static void
+bench_pattern_captures (void *ctx)
+{
+	StrBench *b = ctx;
+	StrPatternIter it = str_pattern_iter(mkstr(b->text, b->len), &b->word_number_captures);
+	Str match, captures[2];
+	unsigned long long sum = 0, x = 0;
+	while (str_pattern_next_captures(&it, &match, captures)) {
+		parse_decimal_ull(captures[1].ptr, captures[1].len, &x);
+		sum += x + captures[0].len;
+	}
+	DO_NOT_OPTIMIZE(sum);
+}
+
+// a match at almost every start, where a second pass would cost the most
+static void
+bench_pattern_captures_dense (void *ctx)
+{
+	StrBench *b = ctx;
+	StrPatternIter it = str_pattern_iter(mkstr(b->text, b->len), &b->word_space_captures);
+	Str match, captures[2];
+	unsigned long long sum = 0;
+	while (str_pattern_next_captures(&it, &match, captures)) sum += captures[0].len + captures[1].len;
+	DO_NOT_OPTIMIZE(sum);
+}
+
+static void
+bench_pattern_reparse (void *ctx)
+{
+	StrBench *b = ctx;
+	StrPatternIter it = str_pattern_iter(mkstr(b->text, b->len), &b->word_number);
+	Str match;
+	unsigned long long sum = 0, x = 0;
+	while (str_pattern_next(&it, &match)) {
+		Str word = str_split(&match, ' ');
+		parse_decimal_ull(match.ptr, match.len, &x);
+		sum += x + word.len;
+	}
+	DO_NOT_OPTIMIZE(sum);
+}
+
+static int
+count_matches (char *text, int len, CompiledStrPattern *pattern)
+{
+	Str s = mkstr(text, len), match = {0};
+	int n = 0;
+	while (str_pattern_match(&match, &s, pattern)) n++;
+	return n;
+}
+
+static void
+bench_pattern_sparse (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(count_matches(b->out, b->len, &b->errors));
+}
+
+static void
+bench_pattern_sparse_plain (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(count_matches(b->out, b->len, &b->errors_plain));
+}
+
+static void
+bench_multi_search (void *ctx)
+{
+	StrBench *b = ctx;
+	int which = 0;
+	DO_NOT_OPTIMIZE(str_multi_search(b->multi, mkstr(b->text, b->len), &which));
+}
+
+static void
+bench_search_each (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0;
+	for (int k = 0; k < b->keyword_count; k++) n += str_search(mkstr(b->text, b->len), b->keywords[k]) >= 0;
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_pattern_dfa (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0, len = 0;
+	for (int at = 0, p = 0; (at = pattern_dfa_match(b->pattern_dfa, b->text + p, b->len - p, &len)) >= 0; p += at + len + !len) n++;
+	DO_NOT_OPTIMIZE(n);
+}
+
+static void
+bench_pattern_vm_runs (void *ctx)
+{
+	StrBench *b = ctx;
+	int len = 0, at = pattern_match_ascii(b->runs, b->runs_len, &b->letters_1, &len);
+	DO_NOT_OPTIMIZE(at);
+}
+
+static void
+bench_pattern_dfa_runs (void *ctx)
+{
+	StrBench *b = ctx;
+	int len = 0, at = pattern_dfa_match(b->letters_1_dfa, b->runs, b->runs_len, &len);
+	DO_NOT_OPTIMIZE(at);
+}
+
+static void
+bench_span_class (void *ctx)
+{
+	StrBench *b = ctx;
+	// the dirty text, in runs of printable non-letters and everything else
+	Str s = mkstr(b->dirty, b->len);
+	int n = 0;
+	while (s.len > 0) {
+		int k = str_span_not_class(s, ASCII_CLASS_LETTER);
+		k += str_span_class(mkstr(s.ptr + k, s.len - k), ASCII_CLASS_LETTER);
+		s.ptr += k;
+		s.len -= k;
+		n++;
+	}
+	DO_NOT_OPTIMIZE(n);
+}
+
+static int
+compare_strs (const void *a, const void *b)
+{
+	return str_compare(*(const Str *)a, *(const Str *)b);
+}
+
+static int
+memcmp_strs (Str a, Str b)
+{
+	int r = memcmp(a.ptr, b.ptr, a.len < b.len ? a.len : b.len);
+	return r ? r : (a.len > b.len) - (a.len < b.len);
+}
+
+#define BINARY_SEARCH(b, compare, found) do { \
+	for (int k = 0; k < (b)->lookup_count; k++) { \
+		int lo = 0, hi = (b)->table_len; \
+		while (lo < hi) { \
+			int mid = (lo + hi) / 2; \
+			int c = compare((b)->table[mid], (b)->lookups[k]); \
+			if (c == 0) { found++; break; } \
+			if (c < 0) lo = mid + 1; \
+			else hi = mid; \
+		} \
+	} \
+} while (0)
+
+static void
+bench_binary_search (void *ctx)
+{
+	StrBench *b = ctx;
+	int found = 0;
+	BINARY_SEARCH(b, str_compare, found);
+	DO_NOT_OPTIMIZE(found);
+}
+
+static void
+bench_binary_search_memcmp (void *ctx)
+{
+	StrBench *b = ctx;
+	int found = 0;
+	BINARY_SEARCH(b, memcmp_strs, found);
+	DO_NOT_OPTIMIZE(found);
+}
+
+static void
+bench_equal_words (void *ctx)
+{
+	StrBench *b = ctx;
+	int found = 0;
+	for (int k = 0; k + 1 < b->lookup_count; k++) found += str_equal(b->lookups[k], b->lookups[k+1]);
+	DO_NOT_OPTIMIZE(found);
+}
+
+static void
+bench_utf8_validate (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(utf8_validate(b->utf8, b->utf8_len));
+}
+
+static void
+bench_utf8_validate_ascii (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(utf8_validate(b->text, b->len));
+}
+
+static void
+bench_utf8_validate_scalar (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_utf8_validate_scalar((unsigned char *)b->utf8, 0, b->utf8_len));
+}
+
+static void
+bench_utf8_iter (void *ctx)
+{
+	StrBench *b = ctx;
+	StrUtf8Iter it = str_utf8_iter(mkstr(b->utf8, b->utf8_len));
+	int c = 0, sum = 0;
+	while (str_utf8_next(&it, &c)) sum += c;
+	DO_NOT_OPTIMIZE(sum);
+}
+
+static void
+bench_to_utf16 (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0;
+	DO_NOT_OPTIMIZE(str_to_utf16(&b->arena, mkstr(b->utf8, b->utf8_len), &n));
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_to_utf16_ascii (void *ctx)
+{
+	StrBench *b = ctx;
+	int n = 0;
+	DO_NOT_OPTIMIZE(str_to_utf16(&b->arena, mkstr(b->text, b->len), &n));
+	arena_clear(&b->arena, 0);
+}
+
+static void
+bench_from_utf16 (void *ctx)
+{
+	StrBench *b = ctx;
+	DO_NOT_OPTIMIZE(str_from_utf16(&b->arena, b->utf16, b->utf16_len).ptr);
+	arena_clear(&b->arena, 0);
+}
+
+int main (int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	StrBench b = {.len = TEXT_LEN};
+	b.text = xmalloc(TEXT_LEN);
+	b.out = xmalloc(TEXT_LEN);
+	make_text(b.text, b.len);
+	memcpy(b.out, b.text, b.len);
+
+	char *pattern = "%d%d%d%d%d";
+	b.pattern = pattern_compile_ascii(pattern, strlen(pattern));
+	// no match, so each search scans the whole text
+	static char *needles[] = {"zq", "not here", "neither is this: 32 bytes long!!", 
+		"alpha Beta gamma DELTA epsilon zeta eta Theta 12345 678 alpha Beta gamma DELTA epsilon zeta eta Thet"};
+	for (int i = 0; i < COUNT_ARRAY(needles); i++) {
+		char name[64];
+		b.needle = mkstr(needles[i], strlen(needles[i]));
+		snprintf(name, sizeof(name), "str_search 1MB (needle %i, no match)", b.needle.len);
+		bench_run(name, bench_search, &b, b.len, 0);
+	}
+
+	// pathological: "aaaa...", needle "aaa...ab"
+	b.periodic = xmalloc(TEXT_LEN);
+	memset(b.periodic, 'a', TEXT_LEN);
+	static char worst[64];
+	memset(worst, 'a', sizeof(worst));
+	worst[sizeof(worst)-1] = 'b';
+	b.needle = mkstr(worst, sizeof(worst));
+	bench_run("str_search 1MB (a..ab in a..a)", bench_search_periodic, &b, b.len, 0);
+	b.needle = mkstr("not in the text", 15);
+
+	// keywords that aren't in the text: a few (Teddy), and a lot (Aho-Corasick)
+	{
+		static char *few[] = {"ERROR", "FATAL", "panic", "segfault", "timeout", "refused", "denied", "abort"};
+		static char many[200][8];
+		Str keywords[200];
+		u64 state = 77;
+		Arena keyword_arena = {0};
+		for (int k = 0; k < COUNT_ARRAY(few); k++) keywords[k] = cstr(few[k]);
+		b.keywords = keywords;
+		b.keyword_count = COUNT_ARRAY(few);
+		b.multi = str_multi_search_create(&keyword_arena, keywords, b.keyword_count);
+		bench_run("str_multi_search 8 keywords 1MB", bench_multi_search, &b, b.len, 0);
+		bench_run("str_search x8 keywords 1MB",      bench_search_each,  &b, b.len, 0);
+		for (int k = 0; k < COUNT_ARRAY(many); k++) {
+			for (int j = 0; j < 6; j++) many[k][j] = 'a' + rand_pcg32(&state) % 26;
+			keywords[k] = mkstr(many[k], 6);
+		}
+		b.keyword_count = COUNT_ARRAY(many);
+		b.multi = str_multi_search_create(&keyword_arena, keywords, b.keyword_count);
+		bench_run("str_multi_search 200 keywords 1MB", bench_multi_search, &b, b.len, 0);
+		bench_run("str_search x200 keywords 1MB",      bench_search_each,  &b, b.len, 0);
+		arena_destroy(&keyword_arena);
+	}
+
+	bench_run("str_split lines 1MB",         bench_split_lines,      &b, b.len, 0);
+	bench_run("str_split words 1MB",         bench_split_words,      &b, b.len, 0);
+
+	// CSV: lines of 8 short numeric fields
+	b.csv = xmalloc(TEXT_LEN);
+	{
+		u64 state = 1;
+		int i = 0, field = 0;
+		while (i < TEXT_LEN) {
+			int digits = 1 + rand_pcg32(&state) % 8;
+			for (int j = 0; j < digits && i < TEXT_LEN; j++) b.csv[i++] = '0' + rand_pcg32(&state) % 10;
+			if (i < TEXT_LEN) b.csv[i++] = ++field % 8 ? ',' : '\n';
+		}
+	}
+	bench_run("CSV 1MB: str_split lines, fields", bench_csv_split,     &b, b.len, 0);
+	bench_run("CSV 1MB: str_split_any \",\\n\"",  bench_csv_split_any, &b, b.len, 0);
+	bench_run("CSV 1MB: str_tokenize \",\\n\"",   bench_csv_tokenize,  &b, b.len, 0);
+	bench_run("str_tokenize 1MB (10 delims)",     bench_tokenize_big_set, &b, b.len, 0);
+	bench_run("str_equal 1MB",               bench_equal,            &b, b.len, 0);
+
+	// a sorted table of the distinct lines' first 40 bytes (they share long
+	// prefixes of common words), looked up by every line
+	{
+		Str s = mkstr(b.text, b.len);
+		b.lookups = xmalloc(b.len / 2 * sizeof(Str));
+		while (s.len > 0) {
+			Str line = str_split(&s, '\n');
+			if (line.len > 40) line.len = 40;
+			b.lookups[b.lookup_count++] = line;
+		}
+		b.table = xmalloc(b.lookup_count * sizeof(Str));
+		memcpy(b.table, b.lookups, b.lookup_count * sizeof(Str));
+		qsort(b.table, b.lookup_count, sizeof(Str), compare_strs);
+		for (int k = 0; k < b.lookup_count; k++)
+			if (!b.table_len || !str_equal(b.table[b.table_len-1], b.table[k])) b.table[b.table_len++] = b.table[k];
+	}
+	bench_run("binary search with str_compare (lookups)", bench_binary_search,        &b, 0, b.lookup_count);
+	bench_run("binary search with memcmp (lookups)",      bench_binary_search_memcmp, &b, 0, b.lookup_count);
+	bench_run("str_equal on lines (pairs)",               bench_equal_words,          &b, 0, b.lookup_count);
+	bench_run("lowercase_ascii 1MB",         bench_lowercase,        &b, b.len, 0);
+	bench_run("uppercase_ascii 1MB",         bench_uppercase,        &b, b.len, 0);
+	bench_run("clean_ascii 1MB",             bench_clean_ascii,      &b, b.len, 0);
+	bench_run("clean_whitespace_ascii 1MB",  bench_clean_whitespace, &b, b.len, 0);
+	bench_run("strip_whitespace_ascii 1MB",  bench_strip_whitespace, &b, b.len, 0);
+
+	// the same text with tabs, double spaces and 1% junk bytes: few blocks are copied whole
+	b.dirty = xmalloc(TEXT_LEN);
+	{
+		u64 state = 9;
+		for (int i = 0; i < TEXT_LEN; i++) {
+			u32 r = rand_pcg32(&state) % 100;
+			b.dirty[i] = r == 0 ? (char)(rand_pcg32(&state) % 256) : r < 3 ? '\t' : b.text[i];
+		}
+	}
+	bench_run("clean_whitespace_ascii 1MB dirty", bench_clean_whitespace_dirty, &b, b.len, 0);
+	bench_run("parse_decimal_ull x6",        bench_parse_decimal,    &b, 0, 6);
+	bench_run("str_pattern_match %d x5 1MB", bench_pattern,          &b, b.len, 0);
+
+	// sparse: "ERROR 42" every 64KB, with and without skipping to the prefix
+	memcpy(b.out, b.text, b.len);
+	for (int i = 1000; i + 8 < b.len; i += 1 << 16) memcpy(b.out + i, "ERROR 42", 8);
+	b.errors = pattern_compile_ascii("ERROR %d+", 9);
+	b.errors_plain = b.errors;
+	b.errors_plain.prefix_len = 0;
+	bench_run("str_pattern_match ERROR %d+ 1MB",       bench_pattern_sparse,       &b, b.len, 0);
+	bench_run("str_pattern_match ERROR %d+ 1MB (VM)",  bench_pattern_sparse_plain, &b, b.len, 0);
+
+	Arena dfa_arena = {0}; // b.arena gets cleared
+	b.pattern_dfa = pattern_dfa_create(&dfa_arena, &b.pattern, 0);
+	bench_run("pattern_dfa_match %d x5 1MB", bench_pattern_dfa,      &b, b.len, 0);
+	b.pattern_decoded = pattern_program_create(&dfa_arena, &b.pattern);
+	bench_run("pattern_program_match %d x5 1MB", bench_pattern_decoded, &b, b.len, 0);
+	bench_run("str_pattern_next %d x5 1MB",  bench_pattern_iter,     &b, b.len, 0);
+	bench_run("pattern_stream %d x5 1MB (4KB pieces)", bench_pattern_stream, &b, b.len, 0);
+
+	// pathological for the VM: "%a+1" in runs of 4096 letters with no 1 after them
+	b.runs_len = 1 << 16;
+	b.runs = xmalloc(b.runs_len);
+	for (int i = 0; i < b.runs_len; i++) b.runs[i] = i % 4096 == 4095 ? ' ' : 'a' + i % 26;
+	b.letters_1 = pattern_compile_ascii("%a+1", 4);
+	b.letters_1_dfa = pattern_dfa_create(&dfa_arena, &b.letters_1, 0);
+	bench_run("pattern_match_ascii %a+1 64KB runs", bench_pattern_vm_runs,  &b, b.runs_len, 0);
+	bench_run("pattern_dfa_match %a+1 64KB runs",   bench_pattern_dfa_runs, &b, b.runs_len, 0);
+
+	// ~1MB of comma separated doubles: "%.17g", and short ones like "12.375"
+	b.floats = xmalloc(TEXT_LEN + 64);
+	b.column = xmalloc(TEXT_LEN/8 * sizeof(double));
+	{
+		u64 state = 3;
+		int i = 0, n = 0;
+		while (i < TEXT_LEN) {
+			if (n++ % 2) {
+				double d = (double)rand_pcg32(&state) / rand_pcg32(&state) * 1e-3;
+				i += snprintf(b.floats + i, 32, "%.17g,", d);
+			} else {
+				i += snprintf(b.floats + i, 32, "%u.%03u,", rand_pcg32(&state) % 1000, rand_pcg32(&state) % 1000);
+			}
+		}
+		b.floats_len = i - 1;
+		b.floats[b.floats_len] = 0;
+	}
+	bench_run("parse_double 1MB of numbers", bench_parse_double, &b, b.floats_len, 0);
+	bench_run("strtod 1MB of numbers",       bench_strtod,       &b, b.floats_len, 0);
+	bench_run("str_parse_doubles 1MB",       bench_parse_doubles, &b, b.floats_len, 0);
+
+	// and back
+	b.column_len = str_parse_doubles(mkstr(b.floats, b.floats_len), ',', b.column, TEXT_LEN/8);
+	b.ints = xmalloc(b.column_len * sizeof(long long));
+	{
+		u64 state = 5;
+		for (int i = 0; i < b.column_len; i++) b.ints[i] = (long long)rand_pcg32(&state) - (1ll << 31);
+	}
+	bench_run("str_format_doubles (items)",  bench_format_doubles,   &b, 0, b.column_len);
+	bench_run("snprintf %.17g (items)",      bench_snprintf_doubles, &b, 0, b.column_len);
+	bench_run("str_format_lls (items)",      bench_format_lls,       &b, 0, b.column_len);
+	bench_run("snprintf %lli (items)",       bench_snprintf_lls,     &b, 0, b.column_len);
+
+	pattern = "%a+%s*%p*";
+	b.words = pattern_compile_ascii(pattern, strlen(pattern));
+	bench_run("str_pattern_match %a+%s*%p* 1MB", bench_pattern_words, &b, b.len, 0);
+	bench_run("str_pattern_match_all %a+%s*%p* 1MB", bench_pattern_match_all, &b, b.len, 0);
+	b.words_decoded = pattern_program_create(&dfa_arena, &b.words);
+	bench_run("pattern_program_match %a+%s*%p* 1MB", bench_pattern_words_decoded, &b, b.len, 0);
+	pattern = "[%a_][%w_]*";
+	b.ident = pattern_compile_ascii(pattern, strlen(pattern));
+	b.ident_decoded = pattern_program_create(&dfa_arena, &b.ident);
+	bench_run("str_pattern_match [%a_][%w_]* 1MB",     bench_pattern_ident,         &b, b.len, 0);
+	bench_run("pattern_program_match [%a_][%w_]* 1MB", bench_pattern_ident_decoded, &b, b.len, 0);
+	pattern = "(%a+) (%d+)";
+	b.word_number_captures = pattern_compile_ascii(pattern, strlen(pattern));
+	pattern = "%a+ %d+";
+	b.word_number = pattern_compile_ascii(pattern, strlen(pattern));
+	bench_run("str_pattern_next_captures (%a+) (%d+) 1MB", bench_pattern_captures, &b, b.len, 0);
+	bench_run("str_pattern_next %a+ %d+, split, parse 1MB", bench_pattern_reparse, &b, b.len, 0);
+	pattern = "(%a+)(%s*)";
+	b.word_space_captures = pattern_compile_ascii(pattern, strlen(pattern));
+	bench_run("str_pattern_next_captures (%a+)(%s*) 1MB", bench_pattern_captures_dense, &b, b.len, 0);
+	memset(b.dirty, 'x', TEXT_LEN/2);
+	bench_run("str_span_class letters 1MB",   bench_span_class,       &b, b.len, 0);
+
+	// ~1MB of UTF-8: the words, with every third one in Greek, Cyrillic, CJK or emoji
+	b.utf8 = xmalloc(TEXT_LEN + 64);
+	{
+		static char *words[] = {"\xce\xb1\xce\xbb\xcf\x86\xce\xb1", "\xd0\xb1\xd0\xb5\xd1\x82\xd0\xb0",
+			"\xe6\x96\x87\xe5\xad\x97", "\xf0\x9f\x98\x80", "caf\xc3\xa9"};
+		u64 state = 8;
+		Str s = mkstr(b.text, b.len);
+		while (b.utf8_len < TEXT_LEN - 32 && s.len > 0) {
+			Str w = str_split(&s, ' ');
+			char *u = rand_pcg32(&state) % 3 ? 0 : words[rand_pcg32(&state) % COUNT_ARRAY(words)];
+			if (u) w = mkstr(u, strlen(u));
+			memcpy(b.utf8 + b.utf8_len, w.ptr, w.len);
+			b.utf8_len += w.len;
+			b.utf8[b.utf8_len++] = ' ';
+		}
+	}
+	bench_run("utf8_validate 1MB ASCII",          bench_utf8_validate_ascii,  &b, b.len, 0);
+	bench_run("utf8_validate 1MB mixed",          bench_utf8_validate,        &b, b.utf8_len, 0);
+	bench_run("utf8_validate 1MB mixed (scalar)", bench_utf8_validate_scalar, &b, b.utf8_len, 0);
+	bench_run("str_utf8_next 1MB mixed",          bench_utf8_iter,            &b, b.utf8_len, 0);
+	bench_run("str_to_utf16 1MB ASCII",           bench_to_utf16_ascii,       &b, b.len, 0);
+	bench_run("str_to_utf16 1MB mixed",           bench_to_utf16,             &b, b.utf8_len, 0);
+	{
+		Arena utf16_arena = {0};
+		b.utf16 = str_to_utf16(&utf16_arena, mkstr(b.utf8, b.utf8_len), &b.utf16_len);
+		bench_run("str_from_utf16 1MB mixed",     bench_from_utf16,           &b, b.utf8_len, 0);
+		arena_destroy(&utf16_arena);
+	}
+
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+	benchmark.h - a small micro-benchmark harness for the nonstd tests.
+
+	Include it after nonstd.h (it times things with read_cpu_timer). Usage:
+
+	    static void bench_thing (void *ctx) 
+	    {
+	        Thing *t = ctx;
+	        DO_NOT_OPTIMIZE(do_thing(t->data, t->n));
+	    }
+
+	    int main (int argc, char **argv)
+	    {
+	        bench_init(argc, argv);
+	        bench_run("do_thing 1MB", bench_thing, &thing, 1<<20, 0);
+	        ...
+	    }
+
+	bench_run(name, fn, ctx, bytes, items) times calls of fn(ctx), where each
+	call processes `bytes` bytes and `items` items (either can be zero, they
+	only control the throughput columns). It
+	- warms up (runs fn for a while untimed)
+	- picks how many calls to time per sample, so each sample is long enough 
+	  that timer overhead and resolution don't matter
+	- takes samples until the time budget is used up (at least BENCH_MIN_SAMPLES)
+	- prints one line: min/median/p99 time per call, and throughput computed 
+	  from the median.
+	- if hardware performance counters are available (see perf_counters_open),
+	  prints a second line with the IPC and the misses per item (per call if
+	  items is zero), averaged over the timed calls. Only counters that could
+	  be opened are shown.
+
+	Command line: `-f text` runs only benchmarks whose name contains text, 
+	`-t seconds` sets the time budget per benchmark (default 0.25).
+
+	DO_NOT_OPTIMIZE(x) forces the compiler to compute x (a scalar or pointer)
+	without actually doing anything with it. CLOBBER_MEMORY() makes it assume
+	all memory was read and written, so stores can't be optimized away.
+*/
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DO_NOT_OPTIMIZE(x) __asm__ __volatile__ ("" : : "r,m"(x) : "memory")
+#define CLOBBER_MEMORY()   __asm__ __volatile__ ("" : : : "memory")
+#else
+static volatile uint64_t bench_sink;
+#define DO_NOT_OPTIMIZE(x) (bench_sink = (uint64_t)(x))
+#define CLOBBER_MEMORY()
+#endif
+
+#define BENCH_MIN_SAMPLES 10
+#define BENCH_MAX_SAMPLES 2000
+
+typedef void (*BenchFn)(void *ctx);
+
+typedef struct {
+	const char *name;
+	double min_ns;     // time per call
+	double median_ns;
+	double p99_ns;
+	int64_t calls_per_sample;
+	int64_t samples;
+	double bytes_per_sec; // based on the median
+	double items_per_sec;
+	double counters[PERFCTR_COUNT]; // per call, zero if unavailable
+} BenchResult;
+
+static struct {
+	const char *filter;
+	double budget_sec;
+	int header_printed;
+	PerfCounters counters;
+} bench_config = {.budget_sec = 0.25};
+
+static void
+bench_init(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i+1 < argc) bench_config.filter = argv[++i];
+		else if (!strcmp(argv[i], "-t") && i+1 < argc) bench_config.budget_sec = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [-f name_filter] [-t seconds_per_benchmark]\n", argv[0]);
+			exit(1);
+		}
+	}
+	perf_counters_open(&bench_config.counters);
+}
+
+static int
+bench_compare_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t
+bench_time_calls(BenchFn fn, void *ctx, int64_t calls)
+{
+	uint64_t start = read_cpu_timer();
+	for (int64_t i = 0; i < calls; i++) fn(ctx);
+	return read_cpu_timer() - start;
+}
+
+static void
+bench_print(BenchResult *r, int64_t items)
+{
+	if (!bench_config.header_printed) {
+		printf("%-40s %12s %12s %12s %10s %12s\n", "benchmark", "min", "median", "p99", "GB/s", "Mitems/s");
+		bench_config.header_printed = 1;
+	}
+
+	char t[3][32];
+	double ns[3] = {r->min_ns, r->median_ns, r->p99_ns};
+	for (int i = 0; i < 3; i++) {
+		if      (ns[i] < 1e3) snprintf(t[i], sizeof(t[i]), "%.2f ns", ns[i]);
+		else if (ns[i] < 1e6) snprintf(t[i], sizeof(t[i]), "%.2f us", ns[i]*1e-3);
+		else                  snprintf(t[i], sizeof(t[i]), "%.2f ms", ns[i]*1e-6);
+	}
+	printf("%-40s %12s %12s %12s", r->name, t[0], t[1], t[2]);
+	if (r->bytes_per_sec) printf(" %10.3f", r->bytes_per_sec * 1e-9);
+	else                  printf(" %10s", "-");
+	if (r->items_per_sec) printf(" %12.3f", r->items_per_sec * 1e-6);
+	else                  printf(" %12s", "-");
+	printf("\n");
+
+	PerfCounters *pc = &bench_config.counters;
+	if (pc->n) {
+		printf("    ");
+		if (perf_counters_available(pc, PERFCTR_CYCLES) && perf_counters_available(pc, PERFCTR_INSTRUCTIONS) && r->counters[PERFCTR_CYCLES])
+			printf("IPC %.2f, ", r->counters[PERFCTR_INSTRUCTIONS] / r->counters[PERFCTR_CYCLES]);
+		printf("per %s:", items ? "item" : "call");
+		for (int i = 0; i < PERFCTR_COUNT; i++) 
+			if (perf_counters_available(pc, i)) 
+				printf(" %.3g %s", r->counters[i] / (items ? items : 1), perf_counter_name(i));
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+static BenchResult
+bench_run(const char *name, BenchFn fn, void *ctx, int64_t bytes, int64_t items)
+{
+	BenchResult r = {.name = name};
+	if (bench_config.filter && !strstr(name, bench_config.filter)) return r;
+
+	double freq = get_cpu_timer_freq();
+	uint64_t budget = bench_config.budget_sec * freq;
+
+	// Warm up (caches, branch predictors, page faults, clock speed) for a 
+	// tenth of the budget, doubling the calls each round. The last round 
+	// tells us how long one call takes, roughly.
+	int64_t calls = 1;
+	uint64_t elapsed = 0, warmup = 0;
+	while (warmup < budget/10) {
+		elapsed = bench_time_calls(fn, ctx, calls);
+		warmup += elapsed;
+		if (warmup < budget/10) calls *= 2;
+	}
+
+	// enough calls per sample that a sample takes ~1/200 of the budget, 
+	// but at least 10 microseconds worth
+	uint64_t target = budget / 200;
+	if (target < freq * 1e-5) target = freq * 1e-5;
+	double ticks_per_call = (double)elapsed / calls;
+	r.calls_per_sample = ticks_per_call > 0 ? target / ticks_per_call : calls;
+	if (r.calls_per_sample < 1) r.calls_per_sample = 1;
+
+	static double samples[BENCH_MAX_SAMPLES];
+	uint64_t total = 0;
+	uint64_t counters_before[PERFCTR_COUNT], counters_after[PERFCTR_COUNT];
+	perf_counters_read(&bench_config.counters, counters_before);
+	while (r.samples < BENCH_MAX_SAMPLES && (r.samples < BENCH_MIN_SAMPLES || total < budget)) {
+		uint64_t t = bench_time_calls(fn, ctx, r.calls_per_sample);
+		total += t;
+		samples[r.samples++] = t * 1e9 / freq / r.calls_per_sample;
+	}
+	perf_counters_read(&bench_config.counters, counters_after);
+	for (int i = 0; i < PERFCTR_COUNT; i++) 
+		r.counters[i] = (double)(counters_after[i] - counters_before[i]) / (r.samples * r.calls_per_sample);
+
+	qsort(samples, r.samples, sizeof(samples[0]), bench_compare_double);
+	r.min_ns    = samples[0];
+	r.median_ns = samples[r.samples/2];
+	r.p99_ns    = samples[(r.samples*99)/100];
+	r.bytes_per_sec = bytes * 1e9 / r.median_ns;
+	r.items_per_sec = items * 1e9 / r.median_ns;
+
+	bench_print(&r, items);
+	return r;
+}
+
+#endif
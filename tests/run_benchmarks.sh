@@ -0,0 +1,13 @@
+#!/bin/sh
+# usage: run_benchmarks.sh [benchmark arguments, e.g. -f name -t seconds]
+# Builds every bench_*.c with optimizations and runs it.
+out=${TMPDIR:-/tmp}/nonstd_bench
+mkdir -p $out
+for f in bench_*.c; do
+	name=${f%.c}
+	echo "$name"
+	echo "----------------------------------"
+	cc -O2 -pthread -o $out/$name $f -lm && $out/$name "$@"
+	echo
+	echo
+done
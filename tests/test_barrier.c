@@ -0,0 +1,70 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <pthread.h>
+#include <stdio.h>
+
+// Barrier: threads publish a value per step and check everyone else's after
+// the barrier, many times over without any reset. Latch: workers count down,
+// main thread waits.
+
+#define NTHD 4
+#define NSTEPS 20000
+
+Barrier barrier = BARRIER_INITIALIZER(NTHD);
+int step_of[NTHD] = {0};
+int errors[NTHD] = {0};
+int serial[NTHD] = {0};
+
+Latch latch = LATCH_INITIALIZER(NTHD);
+int done[NTHD] = {0};
+
+void *stepper (void *threadid)
+{
+	int tid = (intptr_t)threadid;
+	for (int step = 1; step <= NSTEPS; step++) {
+		__atomic_store_n(&step_of[tid], step, __ATOMIC_RELAXED);
+		serial[tid] += barrier_wait(&barrier);
+		for (int i = 0; i < NTHD; i++) 
+			if (__atomic_load_n(&step_of[i], __ATOMIC_RELAXED) != step) errors[tid]++;
+		barrier_wait(&barrier);
+	}
+	return 0;
+}
+
+void *worker (void *threadid)
+{
+	int tid = (intptr_t)threadid;
+	struct timespec ms = {0, (tid+1)*5*1000*1000};
+	nanosleep(&ms, 0);
+	done[tid] = 1;
+	latch_count_down(&latch, 1);
+	return 0;
+}
+
+int main (void)
+{
+	pthread_t t[NTHD] = {0};
+	void *nothing = 0;
+
+	for (int i = 0; i < NTHD; i++) pthread_create(&t[i], 0, stepper, (void*)(intptr_t)i);
+	for (int i = 0; i < NTHD; i++) pthread_join(t[i], &nothing);
+	int nerr = 0, nserial = 0;
+	for (int i = 0; i < NTHD; i++) nerr += errors[i], nserial += serial[i];
+	printf("barrier: %i errors, %i serial returns (expected %i)\n", nerr, nserial, NSTEPS);
+	int ok = nerr == 0 && nserial == NSTEPS;
+
+	ok &= !latch_try_wait(&latch);
+	for (int i = 0; i < NTHD; i++) pthread_create(&t[i], 0, worker, (void*)(intptr_t)i);
+	latch_wait(&latch);
+	int ndone = 0;
+	for (int i = 0; i < NTHD; i++) ndone += done[i];
+	printf("latch: %i of %i workers done\n", ndone, NTHD);
+	ok &= ndone == NTHD && latch_try_wait(&latch);
+	for (int i = 0; i < NTHD; i++) pthread_join(t[i], &nothing);
+
+	printf(ok ? "OK\n" : "FAIL\n");
+	return !ok;
+}
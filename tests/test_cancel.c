@@ -0,0 +1,105 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <pthread.h>
+#include <stdio.h>
+
+// Timed waits and cancellation: timeouts expire, cancel wakes blocked
+// waiters, and a cancelled blocking queue drains before reporting it.
+
+#define EXP 4
+#define NTHD 3
+
+uint32_t event = 0;
+uint32_t sem = 0;
+BlockingConcurrentQueue bq = BLOCKING_CONCURRENT_QUEUE_INITIALIZER(EXP);
+int results[NTHD] = {0};
+
+void *event_waiter (void *threadid)
+{
+	results[(intptr_t)threadid] = event_wait(&event);
+	return 0;
+}
+
+void *sem_waiter (void *threadid)
+{
+	results[(intptr_t)threadid] = semaphore_wait(&sem);
+	return 0;
+}
+
+void *queue_consumer (void *threadid)
+{
+	int n = 0;
+	while (blocking_queue_pop(&bq) >= 0) {
+		blocking_queue_pop_commit(&bq);
+		n++;
+	}
+	results[(intptr_t)threadid] = n;
+	return 0;
+}
+
+int run_threads (void *(*fn)(void*), void (*cancel)(void))
+{
+	pthread_t t[NTHD] = {0};
+	for (int i = 0; i < NTHD; i++) pthread_create(&t[i], 0, fn, (void*)(intptr_t)i);
+	struct timespec ms = {0, 20*1000*1000};
+	nanosleep(&ms, 0);
+	cancel();
+	void *nothing = 0;
+	for (int i = 0; i < NTHD; i++) pthread_join(t[i], &nothing);
+	return 1;
+}
+
+void cancel_event (void) { event_cancel(&event); }
+void cancel_sem (void) { semaphore_cancel(&sem); }
+void cancel_queue (void) { blocking_queue_cancel(&bq); }
+
+int check (int ok, const char *what)
+{
+	printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main (void)
+{
+	int ok = 1;
+
+	// timeouts
+	double t0 = get_wtime();
+	ok &= check(event_wait_timeout(&event, 0.05) == SYNC_TIMED_OUT, "event times out");
+	ok &= check(get_wtime() - t0 >= 0.04, "event waited for the timeout");
+	ok &= check(semaphore_wait_timeout(&sem, 0.01) == SYNC_TIMED_OUT, "semaphore times out");
+	ok &= check(blocking_queue_pop_timeout(&bq, 0.01) == SYNC_TIMED_OUT, "empty queue pop times out");
+	for (int i = 0; i < (1<<EXP)-1; i++) {
+		blocking_queue_push(&bq);
+		blocking_queue_push_commit(&bq);
+	}
+	ok &= check(blocking_queue_push_timeout(&bq, 0.01) == SYNC_TIMED_OUT, "full queue push times out");
+
+	// immediate success
+	event_post(&event);
+	ok &= check(event_wait_timeout(&event, 0.01) == 1, "posted event returns immediately");
+	event_reset(&event);
+	semaphore_post(&sem);
+	ok &= check(semaphore_wait_timeout(&sem, 0.01) == 1, "posted semaphore returns immediately");
+
+	// cancellation wakes blocked waiters
+	run_threads(event_waiter, cancel_event);
+	for (int i = 0; i < NTHD; i++) ok &= check(results[i] == SYNC_CANCELLED, "event waiter cancelled");
+	run_threads(sem_waiter, cancel_sem);
+	for (int i = 0; i < NTHD; i++) ok &= check(results[i] == SYNC_CANCELLED, "semaphore waiter cancelled");
+
+	// cancelled queue: pushes fail, pops drain what's left
+	blocking_queue_cancel(&bq);
+	ok &= check(blocking_queue_push(&bq) == SYNC_CANCELLED, "push after cancel fails");
+	int drained = 0;
+	run_threads(queue_consumer, cancel_queue);
+	for (int i = 0; i < NTHD; i++) drained += results[i];
+	ok &= check(drained == (1<<EXP)-1, "cancelled queue drained");
+	ok &= check(blocking_queue_pop_timeout(&bq, 1) == SYNC_CANCELLED, "pop from drained queue fails");
+
+	printf(ok ? "OK\n" : "FAIL\n");
+	return !ok;
+}
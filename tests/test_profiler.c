@@ -0,0 +1,132 @@
+#define NONSTD_PROFILER
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+// Profiler: nested blocks, recursion, and bandwidth blocks, then checks
+// the numbers in the anchor table add up. Then a traced producer/consumer
+// pair, checking the per-thread counters merge and the queue waits show up.
+
+#define N (1<<22)
+
+int fib (int n)
+{
+	PROFILE_FUNCTION;
+	return n < 2 ? n : fib(n-1) + fib(n-2);
+}
+
+double sum (float *x, int n)
+{
+	PROFILE_BANDWIDTH("sum", n*sizeof(*x));
+	double s = 0;
+	for (int i = 0; i < n; i++) s += x[i];
+	return s;
+}
+
+double work (float *x)
+{
+	PROFILE_FUNCTION;
+	double s = 0;
+	for (int i = 0; i < 10; i++) s += sum(x, N);
+	s += fib(20);
+	return s;
+}
+
+ProfileAnchor *find (const char *name)
+{
+	int count = 0;
+	ProfileAnchor *anchors = profile_merge(&count);
+	for (int i = 1; i < count; i++) 
+		if (anchors[i].name && !strcmp(anchors[i].name, name)) return &anchors[i];
+	return 0;
+}
+
+#define NMSG 1000
+BlockingConcurrentQueue bq = BLOCKING_CONCURRENT_QUEUE_INITIALIZER(3);
+
+void *producer (void *nothing)
+{
+	(void) nothing;
+	for (int i = 0; i < NMSG; i++) {
+		PROFILE_BLOCK("produce");
+		blocking_queue_push(&bq);
+		blocking_queue_push_commit(&bq);
+	}
+	return 0;
+}
+
+void *consumer (void *nothing)
+{
+	(void) nothing;
+	for (int i = 0; i < NMSG; i++) {
+		PROFILE_BLOCK("consume");
+		blocking_queue_pop(&bq);
+		blocking_queue_pop_commit(&bq);
+	}
+	return 0;
+}
+
+int threaded_test (void)
+{
+	profile_begin();
+	profile_trace_begin();
+	pthread_t p = {0}, c = {0};
+	pthread_create(&p, 0, producer, 0);
+	pthread_create(&c, 0, consumer, 0);
+	void *nothing = 0;
+	pthread_join(p, &nothing);
+	pthread_join(c, &nothing);
+	profile_trace_end();
+	profile_print_report();
+
+	ProfileAnchor *prod = find("produce"), *cons = find("consume"); 
+	ProfileAnchor *pushw = find("blocking_queue_push wait"), *popw = find("blocking_queue_pop wait");
+	int ok = prod && cons && pushw && popw;
+	ok = ok && prod->hits == NMSG && cons->hits == NMSG && pushw->hits == NMSG && popw->hits == NMSG;
+	ok = ok && prod->inclusive >= pushw->inclusive && cons->inclusive >= popw->inclusive;
+
+	// the threads are joined, so the size can't change between the calls
+	int64_t cap = profile_trace_json(0, 0);
+	char *json = xmalloc(cap);
+	int64_t len = profile_trace_json(json, cap) - 1; // without the null char
+	int nconsume = 0;
+	for (char *s = json; (s = strstr(s, "\"name\":\"consume\"")); s++) nconsume++;
+	ok = ok && nconsume == NMSG;
+	ok = ok && strstr(json, "\"name\":\"blocking_queue_pop wait\"") && strstr(json, "\"thread_name\"");
+	ok = ok && json[0] == '{' && len > 4 && !strcmp(json + len - 4, "\n]}\n");
+	printf("trace: %lli bytes, %i consume events\n", (long long) len, nconsume);
+	free(json);
+	return ok;
+}
+
+int main (void)
+{
+	float *x = xmalloc(N*sizeof(*x));
+	for (int i = 0; i < N; i++) x[i] = 1;
+
+	profile_begin();
+	double s = work(x);
+	profile_print_report();
+
+	ProfileAnchor *w = find("work"), *f = find("fib"), *b = find("sum");
+	int ok = w && f && b;
+	ok = ok && s == 10.0*N + 6765;
+	ok = ok && w->hits == 1 && b->hits == 10 && f->hits == 21891;  // fib(20) makes 21891 calls
+	ok = ok && b->bytes == 10ull*N*sizeof(float);
+	ok = ok && f->inclusive == f->exclusive;  // recursion isn't double-counted
+	ok = ok && w->inclusive >= w->exclusive + b->inclusive + f->inclusive - 1000;
+	ok = ok && w->exclusive < w->inclusive / 10;
+
+	char small[16];
+	int64_t need = profile_report(small, sizeof(small));
+	ok = ok && need > (int64_t)sizeof(small) && strlen(small) == sizeof(small)-1;
+
+	ok &= threaded_test();
+
+	printf(ok ? "OK\n" : "FAIL\n");
+	return !ok;
+}
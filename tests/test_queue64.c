@@ -0,0 +1,99 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <pthread.h>
+#include <stdio.h>
+
+// Stress test for the wide queue: one producer, several consumers (mpop),
+// with more slots than the 32-bit queue can address.
+
+#define EXP 20
+#define NCONS 4
+#define NITEMS (1ll<<24)
+
+uint64_t q = 0;
+uint64_t *slots = 0;
+int64_t consumed = 0;
+
+int64_t sums[NCONS] = {0};
+int64_t counts[NCONS] = {0};
+int out_of_order[NCONS] = {0};
+
+void *pfn (void *nothing)
+{
+	(void) nothing;
+
+	for(int64_t i = 1; i <= NITEMS; i++) {
+		int64_t k;
+		while ((k = queue64_push(&q, EXP)) < 0) SPIN_LOOP_HINT();
+		slots[k] = i;
+		queue64_push_commit(&q);
+	}
+
+	printf("producer exit\n");
+	return 0;
+}
+
+void *cfn (void *threadid)
+{
+	int tid = (intptr_t)threadid;
+	uint64_t last = 0;
+
+	while (__atomic_load_n(&consumed, __ATOMIC_RELAXED) < NITEMS) {
+		uint64_t save;
+		int64_t k = queue64_mpop(&q, EXP, &save);
+		if (k < 0) {
+			SPIN_LOOP_HINT();
+			continue;
+		}
+		uint64_t v = slots[k];
+		if (queue64_mpop_commit(&q, save)) {
+			if (v <= last) out_of_order[tid]++;
+			last = v;
+			sums[tid] += v;
+			counts[tid]++;
+			__atomic_add_fetch(&consumed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	printf("consumer %i exit (%lli items)\n", tid, (long long) counts[tid]);
+	return 0;
+}
+
+int main (void)
+{
+	slots = xmalloc(sizeof(*slots) << EXP);
+
+	pthread_t p = {0};
+	pthread_t c[NCONS] = {0};
+	pthread_create(&p, 0, pfn, 0);
+	for (int i = 0; i < COUNT_ARRAY(c); i++) {
+		pthread_create(&c[i], 0, cfn, (void*)(intptr_t)i);
+	}
+
+	void *nothing = 0;
+	pthread_join(p, &nothing);
+	for (int i = 0; i < COUNT_ARRAY(c); i++) {
+		pthread_join(c[i], &nothing);
+	}
+
+	int64_t sum = 0, count = 0, ooo = 0;
+	for (int i = 0; i < NCONS; i++) {
+		sum += sums[i];
+		count += counts[i];
+		ooo += out_of_order[i];
+	}
+
+	int64_t expected = NITEMS*(NITEMS+1)/2;
+	printf("received %lli items, sum %lli (expected %lli), %lli out of order\n",
+		(long long) count, (long long) sum, (long long) expected, (long long) ooo);
+
+	if (count != NITEMS || sum != expected || ooo) {
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
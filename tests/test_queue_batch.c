@@ -0,0 +1,137 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <pthread.h>
+#include <stdio.h>
+
+// Batched push/pop: random batch sizes (so batches wrap around the end of
+// the slot array) through the raw queue and the blocking queue.
+
+#define EXP 6
+#define NTHD 3
+#define NITEMS 200000ll
+#define MAXBATCH 13
+
+uint32_t rq = 0;
+uint64_t rslots[1<<EXP] = {0};
+
+BlockingConcurrentQueue bq = BLOCKING_CONCURRENT_QUEUE_INITIALIZER(EXP);
+uint64_t bslots[1<<EXP] = {0};
+int64_t bsums[NTHD] = {0};
+
+void *raw_producer (void *nothing)
+{
+	(void) nothing;
+	u64 state = 0x1234;
+	int mask = (1<<EXP)-1;
+
+	for(int64_t i = 1; i <= NITEMS; ) {
+		int want = 1 + rand_pcg32(&state) % MAXBATCH;
+		int n = 0;
+		int k = queue_push_n(&rq, EXP, want, &n);
+		if (k < 0) {
+			SPIN_LOOP_HINT();
+			continue;
+		}
+		for (int j = 0; j < n; j++) rslots[(k+j) & mask] = i++;
+		queue_push_commit_n(&rq, n);
+	}
+	return 0;
+}
+
+int raw_test (void)
+{
+	pthread_t p = {0};
+	pthread_create(&p, 0, raw_producer, 0);
+
+	u64 state = 0x5678;
+	int mask = (1<<EXP)-1;
+	uint64_t expect = 1;
+	int errors = 0;
+	while (expect <= NITEMS) {
+		int want = 1 + rand_pcg32(&state) % MAXBATCH;
+		int n = 0;
+		int k = queue_pop_n(&rq, EXP, want, &n);
+		if (k < 0) {
+			SPIN_LOOP_HINT();
+			continue;
+		}
+		for (int j = 0; j < n; j++)
+			if (rslots[(k+j) & mask] != expect++) errors++;
+		queue_pop_commit_n(&rq, n);
+	}
+
+	void *nothing = 0;
+	pthread_join(p, &nothing);
+	printf("raw queue: %i errors\n", errors);
+	return errors == 0;
+}
+
+void *bq_producer (void *threadid)
+{
+	int tid = (intptr_t)threadid;
+	u64 state = 0x9999 + tid;
+	int mask = (1<<EXP)-1;
+
+	int64_t per_thread = NITEMS/NTHD;
+	for(int64_t i = 0; i < per_thread; ) {
+		int want = 1 + rand_pcg32(&state) % MAXBATCH;
+		if (want > per_thread-i) want = per_thread-i;
+		int n = 0;
+		int k = blocking_queue_push_n(&bq, want, &n);
+		for (int j = 0; j < n; j++) bslots[(k+j) & mask] = 1 + tid*per_thread + i++;
+		blocking_queue_push_commit_n(&bq, n);
+	}
+	return 0;
+}
+
+void *bq_consumer (void *threadid)
+{
+	int tid = (intptr_t)threadid;
+	u64 state = 0x4444 + tid;
+	int mask = (1<<EXP)-1;
+
+	int64_t per_thread = NITEMS/NTHD;
+	for(int64_t i = 0; i < per_thread; ) {
+		int want = 1 + rand_pcg32(&state) % MAXBATCH;
+		if (want > per_thread-i) want = per_thread-i;
+		int n = 0;
+		int k = blocking_queue_pop_n(&bq, want, &n);
+		for (int j = 0; j < n; j++) bsums[tid] += bslots[(k+j) & mask];
+		blocking_queue_pop_commit_n(&bq, n);
+		i += n;
+	}
+	return 0;
+}
+
+int blocking_test (void)
+{
+	pthread_t p[NTHD] = {0};
+	pthread_t c[NTHD] = {0};
+	for (int i = 0; i < NTHD; i++) {
+		pthread_create(&p[i], 0, bq_producer, (void*)(intptr_t)i);
+		pthread_create(&c[i], 0, bq_consumer, (void*)(intptr_t)i);
+	}
+
+	void *nothing = 0;
+	for (int i = 0; i < NTHD; i++) {
+		pthread_join(p[i], &nothing);
+		pthread_join(c[i], &nothing);
+	}
+
+	int64_t total = (NITEMS/NTHD)*NTHD;
+	int64_t sum = 0;
+	for (int i = 0; i < NTHD; i++) sum += bsums[i];
+	printf("blocking queue: sum %lli (expected %lli)\n", (long long) sum, (long long) (total*(total+1)/2));
+	return sum == total*(total+1)/2;
+}
+
+int main (void)
+{
+	int ok = raw_test();
+	ok &= blocking_test();
+	printf(ok ? "OK\n" : "FAIL\n");
+	return !ok;
+}
@@ -0,0 +1,85 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <pthread.h>
+#include <stdio.h>
+
+// SPSC ring: batched producer and consumer with random batch sizes (so
+// batches wrap around the end of the storage), then single push/pop.
+
+#define EXP 8
+#define NITEMS 200000ll
+#define MAXBATCH 13
+
+typedef struct {
+	int64_t seq;
+	int64_t check;
+} Item;
+
+SpscRing *ring = 0;
+
+void *producer (void *nothing)
+{
+	(void) nothing;
+	u64 state = 0x1234;
+
+	for(int64_t i = 1; i <= NITEMS; ) {
+		int want = 1 + rand_pcg32(&state) % MAXBATCH;
+		if (want > NITEMS+1-i) want = NITEMS+1-i;
+		uint32_t first;
+		int n = spsc_ring_push_reserve(ring, want, &first);
+		if (!n) {
+			SPIN_LOOP_HINT();
+			continue;
+		}
+		for (int j = 0; j < n; j++, i++) 
+			*SPSC_RING_SLOT(ring, Item, first+j) = (Item){i, ~i};
+		spsc_ring_push_commit(ring, n);
+	}
+	return 0;
+}
+
+int main (void)
+{
+	Arena arena = {0};
+	ring = SPSC_RING_CREATE(&arena, Item, EXP);
+	int ok = (intptr_t)ring % 64 == 0;
+
+	pthread_t p = {0};
+	pthread_create(&p, 0, producer, 0);
+
+	u64 state = 0x5678;
+	int64_t expect = 1, errors = 0;
+	while (expect <= NITEMS) {
+		int want = 1 + rand_pcg32(&state) % MAXBATCH;
+		uint32_t first;
+		int n = spsc_ring_pop_reserve(ring, want, &first);
+		if (!n) {
+			SPIN_LOOP_HINT();
+			continue;
+		}
+		for (int j = 0; j < n; j++, expect++) {
+			Item *it = SPSC_RING_SLOT(ring, Item, first+j);
+			if (it->seq != expect || it->check != ~expect) errors++;
+		}
+		spsc_ring_pop_commit(ring, n);
+	}
+	void *nothing = 0;
+	pthread_join(p, &nothing);
+	printf("batched: %lli errors\n", (long long) errors);
+	ok &= errors == 0;
+
+	// every slot is usable, and full/empty are reported
+	Item it = {0};
+	int pushed = 0, popped = 0;
+	while (spsc_ring_push(ring, &(Item){pushed, 0})) pushed++;
+	while (spsc_ring_pop(ring, &it) && it.seq == popped) popped++;
+	printf("single: pushed %i popped %i\n", pushed, popped);
+	ok &= pushed == 1<<EXP && popped == 1<<EXP;
+
+	arena_destroy(&arena);
+	printf(ok ? "OK\n" : "FAIL\n");
+	return !ok;
+}
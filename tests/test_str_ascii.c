@@ -0,0 +1,140 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// The ASCII transforms against simple byte-at-a-time versions, on random 
+// bytes at every length and alignment around the SIMD block sizes, with a 
+// separate buffer, in place, and with a null dest (just counting).
+
+static int
+ref_clean (char *dest, const char *src, int len, int collapse)
+{
+	int o = 0, space = 0;
+	for (int i = 0; i < len; i++) {
+		unsigned char c = src[i];
+		int w = c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+		int printable = c > 31 && c < 127;
+		if (collapse) {
+			if (w && !space) dest[o++] = ' ';
+			else if (!w && printable) dest[o++] = c;
+			space = w;
+		} else if (w || printable) {
+			dest[o++] = c;
+		}
+	}
+	return o;
+}
+
+// How many bytes are left without the whitespace at the ends, from *start
+static int
+ref_strip (const char *src, int len, int *start)
+{
+	#define REF_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == '\f' || (c) == '\v')
+	int first = 0, end = len;
+	while (first < end && REF_BLANK(src[first])) first++;
+	while (end > first && REF_BLANK(src[end-1])) end--;
+	#undef REF_BLANK
+	*start = first;
+	return end - first;
+}
+
+static void
+ref_case (char *dest, const char *src, int len, int upper)
+{
+	for (int i = 0; i < len; i++) {
+		char c = src[i];
+		if (!upper && c >= 'A' && c <= 'Z') c += 32;
+		if (upper && c >= 'a' && c <= 'z') c -= 32;
+		dest[i] = c;
+	}
+}
+
+static int errors = 0;
+
+static void
+expect (int ok, char *what, int len, int offset)
+{
+	if (!ok && errors++ < 10) printf("%s wrong: len %i offset %i\n", what, len, offset);
+}
+
+int main (void)
+{
+	static char src[600], want[600], got[600], inplace[600];
+	u64 state = 3;
+
+	for (int iter = 0; iter < 4000; iter++) {
+		int len = iter < 300 ? iter : (int)(rand_pcg32(&state) % 512);
+		int offset = rand_pcg32(&state) % 64;
+		char *s = src + offset;
+		// mostly text with runs of whitespace, some control and high bytes
+		int dirt = iter % 4;
+		for (int i = 0; i < len; i++) {
+			int r = (int)(rand_pcg32(&state) % 100);
+			if (r < 15) s[i] = " \t\n\r\f\v"[rand_pcg32(&state) % (r < 10 ? 1 : 6)];
+			else if (r < 15 + dirt) s[i] = rand_pcg32(&state) % 256;
+			else s[i] = 32 + rand_pcg32(&state) % 95;
+		}
+
+		for (int collapse = 0; collapse < 2; collapse++) {
+			char *name = collapse ? "clean_whitespace_ascii" : "clean_ascii";
+			int n = ref_clean(want, s, len, collapse);
+			int m = collapse ? clean_whitespace_ascii(got, s, len) : clean_ascii(got, s, len);
+			expect(n == m && !memcmp(want, got, n), name, len, offset);
+			m = collapse ? clean_whitespace_ascii(0, s, len) : clean_ascii(0, s, len);
+			expect(n == m, name, len, offset);
+			memcpy(inplace, s, len);
+			m = collapse ? clean_whitespace_ascii(inplace, inplace, len) : clean_ascii(inplace, inplace, len);
+			expect(n == m && !memcmp(want, inplace, n), name, len, offset);
+		}
+
+		for (int upper = 0; upper < 2; upper++) {
+			char *name = upper ? "uppercase_ascii" : "lowercase_ascii";
+			ref_case(want, s, len, upper);
+			if (upper) uppercase_ascii(got, s, len);
+			else lowercase_ascii(got, s, len);
+			expect(!memcmp(want, got, len), name, len, offset);
+			memcpy(inplace, s, len);
+			if (upper) uppercase_ascii(inplace, inplace, len);
+			else lowercase_ascii(inplace, inplace, len);
+			expect(!memcmp(want, inplace, len), name, len, offset);
+		}
+
+		int start = 0, n = ref_strip(s, len, &start);
+		Str stripped = str_strip(mkstr(s, len));
+		expect(stripped.len == n && stripped.ptr == s + start, "str_strip", len, offset);
+		memcpy(inplace, s, len);
+		int m = strip_whitespace_ascii(inplace, inplace, len);
+		expect(m == n && !memcmp(inplace, s + start, m), "strip_whitespace_ascii", len, offset);
+	}
+
+	// every byte value, in a block big enough for every kernel
+	char all[256];
+	for (int i = 0; i < 256; i++) all[i] = i;
+	for (int collapse = 0; collapse < 2; collapse++) {
+		int n = ref_clean(want, all, 256, collapse);
+		int m = collapse ? clean_whitespace_ascii(got, all, 256) : clean_ascii(got, all, 256);
+		expect(n == m && !memcmp(want, got, n), "clean, all bytes", 256, 0);
+	}
+	ref_case(want, all, 256, 0);
+	lowercase_ascii(got, all, 256);
+	expect(!memcmp(want, got, 256), "lowercase, all bytes", 256, 0);
+	ref_case(want, all, 256, 1);
+	uppercase_ascii(got, all, 256);
+	expect(!memcmp(want, got, 256), "uppercase, all bytes", 256, 0);
+
+	// runs of blanks at the ends, all blanks, none
+	char *strips[] = {"   x", "    hello world", "\t \n\r\f\vab c \t\t", "      ", "x", "a  b", ""};
+	for (int i = 0; i < COUNT_ARRAY(strips); i++) {
+		int len = strlen(strips[i]), start = 0, n = ref_strip(strips[i], len, &start);
+		memcpy(inplace, strips[i], len);
+		int m = strip_whitespace_ascii(inplace, inplace, len);
+		expect(m == n && !memcmp(inplace, strips[i] + start, n), "strip_whitespace_ascii, by hand", len, 0);
+	}
+
+	printf("%i errors\n", errors);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
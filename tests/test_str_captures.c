@@ -0,0 +1,181 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// Captures in random patterns: with them, a pattern matches what it does
+// without them, and where each ( or ) is, is where the part of the pattern
+// before it (anchored at the match) stops matching. And programs from
+// pattern_compile(), too long for pattern_compile_ascii().
+
+static int errors = 0;
+
+// The pattern without its captures, as far as `end`
+static int
+strip_captures (char *pattern, int end, char *out)
+{
+	int n = 0;
+	for (int i = 0; i < end; i++) {
+		if (pattern[i] == '%' && i + 1 < end) {
+			out[n++] = pattern[i++];
+			out[n++] = pattern[i];
+		} else if (pattern[i] != '(' && pattern[i] != ')') out[n++] = pattern[i];
+	}
+	out[n] = 0;
+	return n;
+}
+
+// Where the pattern up to `end` stops matching, from `start`
+static int
+reference_position (char *pattern, int end, char *string, int len, int start)
+{
+	char anchored[160] = "^";
+	int n = 1 + strip_captures(pattern, end, anchored + 1);
+	CompiledStrPattern prog = pattern_compile_ascii(anchored, n);
+	int match_len = 0;
+	if (n == 1) return start;
+	if (pattern_match_ascii(string + start, len - start, &prog, &match_len) != 0) return -1;
+	return start + match_len;
+}
+
+int main (void)
+{
+	Arena arena = {0};
+	u64 state = 11;
+	static char *atoms[] = {"a", "b", "1", " ", "%a", "%d", "%s", "%.", "[ab]", "[%d ]", "%("};
+	char *bytes = "aab1 (";
+	char pattern[128], plain[128], string[100];
+
+	for (int i = 0; i < 5000; i++) {
+		// atoms, with some of them in (nested) captures
+		int len = 0, depth = 0, opens[PATTERN_MAX_CAPTURES], closes[PATTERN_MAX_CAPTURES], count = 0, stack[PATTERN_MAX_CAPTURES];
+		if (rand_pcg32(&state) % 8 == 0) pattern[len++] = '^';
+		int atom_count = 1 + rand_pcg32(&state) % 5;
+		for (int j = 0; j < atom_count; j++) {
+			while (count < 6 && rand_pcg32(&state) % 3 == 0) {
+				stack[depth++] = count;
+				opens[count++] = len;
+				pattern[len++] = '(';
+			}
+			len += snprintf(pattern + len, 16, "%s", atoms[rand_pcg32(&state) % COUNT_ARRAY(atoms)]);
+			u32 r = rand_pcg32(&state) % 8;
+			if (r < 3) pattern[len++] = "?*+"[r];
+			while (depth && rand_pcg32(&state) % 2 == 0) {
+				closes[stack[--depth]] = len;
+				pattern[len++] = ')';
+			}
+		}
+		while (depth) {
+			closes[stack[--depth]] = len;
+			pattern[len++] = ')';
+		}
+		if (rand_pcg32(&state) % 8 == 0) pattern[len++] = '$';
+		pattern[len] = 0;
+
+		CompiledStrPattern prog = pattern_compile_ascii(pattern, len);
+		CompiledStrPattern without = pattern_compile_ascii(plain, strip_captures(pattern, len, plain));
+		if ((prog.error || prog.capture_count != count) && errors++ < 10) {
+			printf("\"%s\": error %i, %i captures\n", pattern, prog.error, prog.capture_count);
+			continue;
+		}
+
+		for (int j = 0; j < 10; j++) {
+			int string_len = rand_pcg32(&state) % COUNT_ARRAY(string);
+			for (int k = 0; k < string_len; k++) string[k] = bytes[rand_pcg32(&state) % 6];
+
+			Str s = mkstr(string, string_len), match, want_match;
+			Str rest = s, want_rest = s, captures[PATTERN_MAX_CAPTURES];
+			int got = str_pattern_match_captures(&match, &rest, &prog, captures);
+			int want = str_pattern_match(&want_match, &want_rest, &without);
+			if ((got != want || (got && (match.ptr != want_match.ptr || match.len != want_match.len))) && errors++ < 10) {
+				printf("\"%s\" in \"%.*s\": matched %i, not %i as \"%s\"\n", pattern, string_len, string, got, want, plain);
+				continue;
+			}
+			if (!got) continue;
+
+			int start = match.ptr - string;
+			for (int k = 0; k < count; k++) {
+				int from = reference_position(pattern, opens[k], string, string_len, start);
+				int to = reference_position(pattern, closes[k], string, string_len, start);
+				if ((captures[k].ptr - string != from || captures[k].len != to - from) && errors++ < 10)
+					printf("\"%s\" in \"%.*s\": capture %i is at %i (%i), not %i (%i)\n", pattern, string_len, string,
+						k, (int)(captures[k].ptr - string), captures[k].len, from, to - from);
+			}
+		}
+	}
+
+	// by hand
+	{
+		char *pattern = "(%a+)=((%d+)(%.?%d*))()";
+		CompiledStrPattern prog = pattern_compile_ascii(pattern, strlen(pattern));
+		Str s = cstr("x, key=12.5; k=7"), match, captures[5];
+		if (prog.capture_count != 5 || !str_pattern_match_captures(&match, &s, &prog, captures)) errors++;
+		else if (!str_equal(captures[0], cstr("key")) || !str_equal(captures[1], cstr("12.5")) ||
+			!str_equal(captures[2], cstr("12")) || !str_equal(captures[3], cstr(".5")) ||
+			captures[4].len != 0 || captures[4].ptr != match.ptr + match.len) errors++;
+
+		// one after another
+		StrPatternIter it = str_pattern_iter(cstr("a=1 bb=22 ccc=x"), &prog);
+		int n = 0;
+		for (; str_pattern_next_captures(&it, &match, captures); n++)
+			if (captures[1].len != n + 1) errors++;
+		if (n != 2) errors++;
+
+		// ( and ) are escaped like the rest
+		prog = pattern_compile_ascii("%((%d)%)", 8);
+		s = cstr("f(1) (2)");
+		if (prog.capture_count != 1 || !str_pattern_match_captures(&match, &s, &prog, captures) ||
+			!str_equal(match, cstr("(1)")) || !str_equal(captures[0], cstr("1"))) errors++;
+		if (pattern_compile_ascii("[()]", 4).error) errors++;
+
+		char *bad[] = {"(a", "a)", "(a)+", "(a))"};
+		for (int i = 0; i < COUNT_ARRAY(bad); i++)
+			if (!pattern_compile_ascii(bad[i], strlen(bad[i])).error) errors++;
+		char deep[2 * PATTERN_MAX_CAPTURES + 3];
+		int n_deep = 0;
+		for (int i = 0; i <= PATTERN_MAX_CAPTURES; i++) deep[n_deep++] = '(';
+		for (int i = 0; i <= PATTERN_MAX_CAPTURES; i++) deep[n_deep++] = ')';
+		if (!pattern_compile_ascii(deep, n_deep).error) errors++;
+		if (pattern_compile_ascii(deep + 1, n_deep - 2).error) errors++;
+	}
+
+	// programs of any size, from an arena
+	{
+		static char pattern[8000];
+		int len = 0;
+		for (int i = 0; i < 2000; i++) pattern[len++] = 'a' + i % 3;
+		len += snprintf(pattern + len, 64, "(%%d+)[xy]");
+		for (int i = 0; i < 2000; i++) pattern[len++] = 'a' + i % 3;
+		if (pattern_compile_ascii(pattern, len).error != 1) errors++;
+
+		CompiledStrPattern *prog = pattern_compile(&arena, pattern, len);
+		if (prog->error || prog->code_size < 4000) errors++;
+		static char string[10000];
+		int string_len = snprintf(string, 16, "xx");
+		memcpy(string + string_len, pattern, 2000);
+		string_len += 2000;
+		string_len += snprintf(string + string_len, 16, "123y");
+		memcpy(string + string_len, pattern, 2000);
+		string_len += 2000;
+
+		Str s = mkstr(string, string_len), match, capture;
+		int match_len = 0;
+		if (!str_pattern_match_captures(&match, &s, prog, &capture) || match.ptr != string + 2 ||
+			match.len != 4004 || !str_equal(capture, cstr("123"))) errors++;
+		if (pattern_dfa_match(pattern_dfa_create(&arena, prog, 0), string, string_len, &match_len) != 2 || match_len != 4004) errors++;
+		if (pattern_program_match(pattern_program_create(&arena, prog), string, string_len, &match_len) != 2 || match_len != 4004) errors++;
+
+		// but a class has to fit in a jump
+		len = 0;
+		pattern[len++] = '[';
+		for (int i = 0; i < 5000; i++) pattern[len++] = 'a';
+		pattern[len++] = ']';
+		if (pattern_compile(&arena, pattern, len)->error != 1) errors++;
+	}
+
+	arena_destroy(&arena);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
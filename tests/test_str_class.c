@@ -0,0 +1,106 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// The class table against the definitions it replaced, str_span_class and 
+// str_span_not_class against a byte loop (for every class on its own, so the
+// SIMD nibble tables get checked against the table, and random combinations),
+// and some patterns that use the classes.
+
+static int errors = 0;
+
+static void
+expect (int ok, char *what, int a, int b)
+{
+	if (!ok && errors++ < 10) printf("%s wrong (%i, %i)\n", what, a, b);
+}
+
+static int
+ref_span (Str s, int classes, int stop_at_member)
+{
+	int i = 0;
+	while (i < s.len && ((ascii_class(s.ptr[i]) & classes) != 0) != stop_at_member) i++;
+	return i;
+}
+
+static int
+match_len (char *pattern, char *string)
+{
+	CompiledStrPattern prog = pattern_compile_ascii(pattern, strlen(pattern));
+	int len = -1;
+	int at = pattern_match_ascii(string, strlen(string), &prog, &len);
+	return at == 0 ? len : -1;
+}
+
+int main (void)
+{
+	for (int i = 0; i < 256; i++) {
+		char c = i;
+		int punct = 0;
+		for (char *p = "!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~"; *p; p++) punct |= *p == c;
+		expect(is_ascii_punctuation(c) == punct, "is_ascii_punctuation", i, 0);
+		expect(is_ascii_whitespace(c) == (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v'), "is_ascii_whitespace", i, 0);
+		expect(is_ascii_letter(c) == ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')), "is_ascii_letter", i, 0);
+		expect(is_ascii_alphanumeric(c) == (is_ascii_letter(c) || (c >= '0' && c <= '9')), "is_ascii_alphanumeric", i, 0);
+		expect(is_ascii_lower(c) == (c >= 'a' && c <= 'z'), "is_ascii_lower", i, 0);
+		expect(is_ascii_upper(c) == (c >= 'A' && c <= 'Z'), "is_ascii_upper", i, 0);
+		expect(is_ascii_digit(c) == (c >= '0' && c <= '9'), "is_ascii_digit", i, 0);
+		expect(is_ascii_control(c) == ((c >= 0 && c <= 0x1f) || c == 0x7f), "is_ascii_control", i, 0);
+		expect(!!(ascii_class(c) & ASCII_CLASS_HEXDIGIT) == (parse_hexdigit(c) >= 0), "ASCII_CLASS_HEXDIGIT", i, 0);
+		expect(!!(ascii_class(c) & ASCII_CLASS_NUL) == (c == 0), "ASCII_CLASS_NUL", i, 0);
+	}
+
+	// For each class, a long run of its members (in a random order, so each
+	// member is at every position of a block sometimes) and then each byte 
+	// in turn: the span must stop there exactly when that byte isn't a member.
+	static char buf[300];
+	u64 state = 11;
+	for (int k = 0; k < 8; k++) {
+		int cls = 1 << k;
+		char members[128];
+		int nmembers = 0;
+		for (int i = 0; i < 256; i++) if (ascii_class(i) & cls) members[nmembers++] = i;
+		for (int stop = 0; stop < 256; stop++) {
+			int at = 40 + rand_pcg32(&state) % 200;
+			for (int i = 0; i < at; i++) buf[i] = members[rand_pcg32(&state) % nmembers];
+			buf[at] = stop;
+			Str s = mkstr(buf, at + 1);
+			expect(str_span_class(s, cls) == ref_span(s, cls, 0), "str_span_class", cls, stop);
+			for (int i = 0; i < at; i++) buf[i] = rand_pcg32(&state) % 256;
+			for (int i = 0; i < at; i++) if (ascii_class(buf[i]) & cls) buf[i] = 0x80;
+			expect(str_span_not_class(s, cls) == ref_span(s, cls, 1), "str_span_not_class", cls, stop);
+		}
+	}
+
+	// random text and random combinations of classes
+	for (int iter = 0; iter < 20000; iter++) {
+		int len = rand_pcg32(&state) % COUNT_ARRAY(buf);
+		int cls = rand_pcg32(&state) % 256;
+		for (int i = 0; i < len; i++) buf[i] = rand_pcg32(&state) % (iter & 1 ? 128 : 256);
+		Str s = mkstr(buf, len);
+		expect(str_span_class(s, cls) == ref_span(s, cls, 0), "str_span_class, random", cls, len);
+		expect(str_span_not_class(s, cls) == ref_span(s, cls, 1), "str_span_not_class, random", cls, len);
+	}
+
+	char long_word[200];
+	memset(long_word, 'q', sizeof(long_word)-1);
+	long_word[sizeof(long_word)-1] = 0;
+
+	expect(match_len("%a+", "hello, world") == 5, "%a+", 0, 0);
+	expect(match_len("%a*", "123") == 0, "%a*", 0, 0);
+	expect(match_len("%s*%p+", " \t\n!?. x") == 6, "%s*%p+", 0, 0);
+	expect(match_len("%S+", "abc def") == 3, "%S+", 0, 0);
+	expect(match_len("%x+", "DeadBeefZ") == 8, "%x+", 0, 0);
+	expect(match_len("%w+%s", "abc123 ") == 7, "%w+%s", 0, 0);
+	expect(match_len("%l+%u", "abcD") == 4, "%l+%u", 0, 0);
+	expect(match_len("%C+", "abc\x01") == 3, "%C+", 0, 0);
+	expect(match_len("%a+", long_word) == (int)sizeof(long_word)-1, "%a+ (long)", 0, 0);
+	expect(match_len("%D*%d", long_word) == -1, "%D*%d", 0, 0);
+
+	printf("%i errors\n", errors);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
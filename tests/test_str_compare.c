@@ -0,0 +1,90 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// str_equal, str_startswith, str_endswith and str_compare against byte at a
+// time versions, on pairs of strings that are the same up to a random
+// point (so they differ in every block and at every size the SIMD code
+// handles), at random alignments. And a sort with str_compare.
+
+static int errors = 0;
+
+static int
+naive_compare (Str a, Str b)
+{
+	for (int i = 0; i < a.len && i < b.len; i++)
+		if (a.ptr[i] != b.ptr[i]) return (unsigned char)a.ptr[i] < (unsigned char)b.ptr[i] ? -1 : 1;
+	return a.len < b.len ? -1 : a.len > b.len;
+}
+
+static int
+sign (int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+static int
+compare_for_qsort (const void *a, const void *b)
+{
+	return str_compare(*(const Str *)a, *(const Str *)b);
+}
+
+int main (void)
+{
+	static char abuf[400], bbuf[400];
+	static Str table[1000];
+	static char bytes[1000][8];
+	u64 state = 17;
+
+	for (int iter = 0; iter < 200000; iter++) {
+		int max = iter % 4 ? 40 : 300;
+		int alen = rand_pcg32(&state) % max, blen = rand_pcg32(&state) % 3 ? alen : (int)(rand_pcg32(&state) % max);
+		char *a = abuf + rand_pcg32(&state) % 64, *b = bbuf + rand_pcg32(&state) % 64;
+		for (int i = 0; i < alen; i++) a[i] = rand_pcg32(&state) % 4 ? 'x' : (char)rand_pcg32(&state);
+		memcpy(b, a, blen < alen ? blen : alen);
+		for (int i = alen; i < blen; i++) b[i] = (char)rand_pcg32(&state);
+		// one byte different, sometimes
+		int n = alen < blen ? alen : blen;
+		if (n && rand_pcg32(&state) % 2) b[rand_pcg32(&state) % n] ^= 1 << rand_pcg32(&state) % 8;
+
+		Str sa = mkstr(a, alen), sb = mkstr(b, blen);
+		int want = naive_compare(sa, sb);
+		int want_starts = alen >= blen && !naive_compare(mkstr(a, blen), sb);
+		int want_ends = alen >= blen && !naive_compare(mkstr(a + alen - blen, blen), sb);
+		if (sign(str_compare(sa, sb)) != want && errors++ < 10)
+			printf("str_compare of %i and %i bytes is %i, not %i\n", alen, blen, str_compare(sa, sb), want);
+		if (sign(str_compare(sb, sa)) != -want && errors++ < 10)
+			printf("str_compare of %i and %i bytes is %i, not %i\n", blen, alen, str_compare(sb, sa), -want);
+		if (str_equal(sa, sb) != !want && errors++ < 10)
+			printf("str_equal of %i and %i bytes is %i\n", alen, blen, str_equal(sa, sb));
+		if (str_startswith(sa, sb) != want_starts && errors++ < 10)
+			printf("str_startswith of %i and %i bytes is %i\n", alen, blen, want_starts);
+		if (str_endswith(sa, sb) != want_ends && errors++ < 10)
+			printf("str_endswith of %i and %i bytes is %i\n", alen, blen, want_ends);
+		int want_length_first = alen != blen ? (alen < blen ? -1 : 1) : want;
+		if (sign(str_compare_length_first(sa, sb)) != want_length_first && errors++ < 10)
+			printf("str_compare_length_first of %i and %i bytes is wrong\n", alen, blen);
+	}
+
+	// the same string, and empty ones
+	if (str_compare(cstr("abc"), cstr("abc")) || !str_equal(cstr(""), mkstr(0, 0))) errors++;
+	if (str_compare(cstr(""), cstr("a")) >= 0 || str_compare(cstr("\xff"), cstr("a")) <= 0) errors++;
+	if (!str_startswith(cstr("abc"), cstr("")) || !str_endswith(cstr(""), cstr(""))) errors++;
+
+	// sorting
+	for (int i = 0; i < COUNT_ARRAY(table); i++) {
+		int len = rand_pcg32(&state) % 8;
+		for (int j = 0; j < len; j++) bytes[i][j] = "ab\xf0"[rand_pcg32(&state) % 3];
+		table[i] = mkstr(bytes[i], len);
+	}
+	qsort(table, COUNT_ARRAY(table), sizeof(table[0]), compare_for_qsort);
+	for (int i = 1; i < COUNT_ARRAY(table); i++)
+		if (naive_compare(table[i-1], table[i]) > 0 && errors++ < 10) printf("not sorted at %i\n", i);
+
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
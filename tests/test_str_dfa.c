@@ -0,0 +1,123 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// pattern_dfa_match and pattern_program_match against pattern_match_ascii,
+// for random patterns and random strings over a few bytes, so that patterns
+// overlap and repeat a lot; with a default cache and one small enough to be
+// flushed often. And pattern_match_ascii against itself without the prefix
+// and start class it skips ahead with.
+
+static int errors = 0;
+
+static void
+check (CompiledStrPattern *prog, PatternDfa *dfa, PatternProgram *decoded, char *pattern, char *string, int len)
+{
+	int vm_len = -1, dfa_len = -1, plain_len = -1, decoded_len = -1;
+	int vm = pattern_match_ascii(string, len, prog, &vm_len);
+	int at = pattern_dfa_match(dfa, string, len, &dfa_len);
+	if ((at != vm || (vm >= 0 && dfa_len != vm_len)) && errors++ < 10)
+		printf("\"%s\" in \"%.*s\": vm %i (%i), dfa %i (%i)\n", pattern, len, string, vm, vm_len, at, dfa_len);
+
+	at = pattern_program_match(decoded, string, len, &decoded_len);
+	if ((at != vm || (vm >= 0 && decoded_len != vm_len)) && errors++ < 10)
+		printf("\"%s\" in \"%.*s\": vm %i (%i), decoded %i (%i)\n", pattern, len, string, vm, vm_len, at, decoded_len);
+
+	CompiledStrPattern plain = *prog;
+	plain.prefix_len = 0;
+	plain.start_classes = 0;
+	int slow = pattern_match_ascii(string, len, &plain, &plain_len);
+	if ((slow != vm || (vm >= 0 && plain_len != vm_len)) && errors++ < 10)
+		printf("\"%s\" in \"%.*s\": %i (%i), without skipping %i (%i)\n", pattern, len, string, vm, vm_len, slow, plain_len);
+}
+
+int main (void)
+{
+	Arena arena = {0};
+	u64 state = 5;
+	static char *atoms[] = {"a", "b", "c", "1", " ", "%a", "%d", "%s", "%.", "%A", "%%", "[ab]", "[a%d]", "[^a]", "[%s.]"};
+	char *bytes = "aab1 c.A%";
+	char pattern[128], string[256];
+	int flushes = 0;
+
+	for (int i = 0; i < 3000; i++) {
+		int len = 0;
+		if (rand_pcg32(&state) % 6 == 0) pattern[len++] = '^';
+		int atom_count = 1 + rand_pcg32(&state) % 5;
+		for (int j = 0; j < atom_count; j++) {
+			char *atom = atoms[rand_pcg32(&state) % COUNT_ARRAY(atoms)];
+			len += snprintf(pattern + len, 16, "%s", atom);
+			u32 r = rand_pcg32(&state) % 8;
+			if (r < 3) pattern[len++] = "?*+"[r];
+		}
+		if (rand_pcg32(&state) % 6 == 0) pattern[len++] = '$';
+		pattern[len] = 0;
+
+		CompiledStrPattern prog = pattern_compile_ascii(pattern, len);
+		if (prog.error) {
+			if (errors++ < 10) printf("\"%s\" didn't compile\n", pattern);
+			continue;
+		}
+		i64 checkpoint = arena_checkpoint(&arena);
+		PatternDfa *dfa = pattern_dfa_create(&arena, &prog, 0);
+		PatternDfa *small = pattern_dfa_create(&arena, &prog, 1);
+		PatternProgram *decoded = pattern_program_create(&arena, &prog);
+		if (dfa->error || small->error || decoded->error) {
+			if (errors++ < 10) printf("no DFA or decoded program for \"%s\"\n", pattern);
+			continue;
+		}
+		for (int j = 0; j < 20; j++) {
+			int string_len = rand_pcg32(&state) % (j < 10 ? 12 : 256);
+			for (int k = 0; k < string_len; k++) string[k] = bytes[rand_pcg32(&state) % 9];
+			check(&prog, dfa, decoded, pattern, string, string_len);
+			check(&prog, small, decoded, pattern, string, string_len);
+		}
+		flushes += small->cache_flushes;
+		arena_rollback(&arena, checkpoint);
+	}
+	if (flushes == 0) printf("the small cache was never flushed\n");
+
+	// long runs that the VM has to go over again from every start
+	{
+		char *pattern = "%a+1";
+		CompiledStrPattern prog = pattern_compile_ascii(pattern, strlen(pattern));
+		PatternDfa *dfa = pattern_dfa_create(&arena, &prog, 0);
+		int len = 0, at = pattern_dfa_match(dfa, "abc", 3, &len);
+		if (at != -1) errors++;
+		at = pattern_dfa_match(dfa, "12 abc1", 7, &len);
+		if (at != 3 || len != 4) errors++;
+		if (pattern_dfa_match(dfa, "", 0, &len) != -1) errors++;
+	}
+
+	// what gets skipped to
+	{
+		CompiledStrPattern prog = pattern_compile_ascii("ERROR %d+", 9);
+		if (prog.prefix_len != 6 || memcmp(prog.prefix, "ERROR ", 6)) errors++;
+		prog = pattern_compile_ascii("ab+c", 4);
+		if (prog.prefix_len != 2 || prog.start_classes) errors++;
+		prog = pattern_compile_ascii("%%%.x", 5);
+		if (prog.prefix_len != 3 || memcmp(prog.prefix, "%.x", 3)) errors++;
+		prog = pattern_compile_ascii("%D+x", 4);
+		if (prog.prefix_len || prog.start_classes != ASCII_CLASS_DIGIT || !prog.start_negated) errors++;
+		prog = pattern_compile_ascii("a?b", 3);
+		if (prog.prefix_len || prog.start_classes) errors++;
+		int len = 0;
+		prog = pattern_compile_ascii("ERROR %d+", 9);
+		if (pattern_match_ascii("ERROR x ERRORERROR 42", 21, &prog, &len) != 13 || len != 8) errors++;
+	}
+
+	// errors carry over
+	{
+		CompiledStrPattern prog = pattern_compile_ascii("[ab", 3);
+		int len = 0;
+		if (!prog.error || pattern_dfa_match(pattern_dfa_create(&arena, &prog, 0), "ab", 2, &len) != -2) errors++;
+		if (pattern_program_match(pattern_program_create(&arena, &prog), "ab", 2, &len) != -2) errors++;
+	}
+
+	arena_destroy(&arena);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
@@ -0,0 +1,135 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// format_ull/format_ll against printf, and format_double: it must parse
+// back to the same double, have no more digits than the shortest "%.*e"
+// that does, and when it has as many, be the same digits. Then some
+// exact strings, and the arena and column formatters.
+
+static int errors = 0;
+
+static void
+check_double (double d)
+{
+	char buf[FORMAT_DOUBLE_MAX + 1], ref[64];
+	int len = format_double(buf, d);
+	buf[len] = 0;
+
+	double back = strtod(buf, 0);
+	if (memcmp(&back, &d, sizeof(d)) != 0 && !(d != d && back != back)) {
+		if (errors++ < 10) printf("format_double(%.17g) = \"%s\" doesn't round trip\n", d, buf);
+		return;
+	}
+	if (d != d || d - d != 0 || d == 0) return;
+
+	// the shortest correctly rounded digits that round trip
+	int precision = 1;
+	for (; precision < 17; precision++) {
+		snprintf(ref, sizeof(ref), "%.*e", precision - 1, d);
+		if (strtod(ref, 0) == d) break;
+	}
+	snprintf(ref, sizeof(ref), "%.*e", precision - 1, d);
+
+	char digits[32], ref_digits[32];
+	int n = 0, ref_n = 0;
+	for (char *c = buf; *c && *c != 'e'; c++) if (*c >= '0' && *c <= '9' && (n || *c != '0')) digits[n++] = *c;
+	for (char *c = ref; *c && *c != 'e'; c++) if (*c >= '0' && *c <= '9') ref_digits[ref_n++] = *c;
+	while (n > 0 && digits[n-1] == '0') n--;
+	while (ref_n > 0 && ref_digits[ref_n-1] == '0') ref_n--;
+	if ((n > ref_n || (n == ref_n && memcmp(digits, ref_digits, n))) && errors++ < 10)
+		printf("format_double(%.17g) = \"%s\", but \"%s\" is as short\n", d, buf, ref);
+}
+
+static void
+check_string (double d, char *expected)
+{
+	char buf[FORMAT_DOUBLE_MAX + 1];
+	int len = format_double(buf, d);
+	buf[len] = 0;
+	if (strcmp(buf, expected) && errors++ < 10) printf("format_double(%.17g) = \"%s\", expected \"%s\"\n", d, buf, expected);
+}
+
+int main (void)
+{
+	u64 state = 11;
+	char buf[64], ref[64];
+
+	static unsigned long long ulls[] = {0, 1, 9, 10, 99, 100, 12345, 4294967295ull, 4294967296ull,
+		9999999999999999999ull, 10000000000000000000ull, 18446744073709551615ull};
+	for (int i = 0; i < COUNT_ARRAY(ulls); i++) {
+		buf[format_ull(buf, ulls[i])] = 0;
+		snprintf(ref, sizeof(ref), "%llu", ulls[i]);
+		if (strcmp(buf, ref) && errors++ < 10) printf("format_ull \"%s\" != \"%s\"\n", buf, ref);
+	}
+	for (int i = 0; i < 200000; i++) {
+		long long x = (long long)((u64)rand_pcg32(&state) << 32 | rand_pcg32(&state)) >> (rand_pcg32(&state) % 64);
+		if (i == 0) x = LLONG_MIN;
+		if (i == 1) x = LLONG_MAX;
+		buf[format_ll(buf, x)] = 0;
+		snprintf(ref, sizeof(ref), "%lli", x);
+		if (strcmp(buf, ref) && errors++ < 10) printf("format_ll \"%s\" != \"%s\"\n", buf, ref);
+	}
+
+	check_string(0.0, "0");
+	check_string(-0.0, "-0");
+	check_string(1.0, "1");
+	check_string(100.0, "100");
+	check_string(0.1, "0.1");
+	check_string(-1.5, "-1.5");
+	check_string(0.0001, "0.0001");
+	check_string(0.00001, "1e-05");
+	check_string(1e15, "1000000000000000");
+	check_string(1e16, "1e+16");
+	check_string(123456789012345680.0, "1.2345678901234568e+17");
+	check_string(0.1 + 0.2, "0.30000000000000004");
+	check_string(5e-324, "5e-324");
+	check_string(1e23, "1e+23");
+	check_string(1.7976931348623157e308, "1.7976931348623157e+308");
+	check_string(-2.2250738585072014e-308, "-2.2250738585072014e-308");
+	check_string(1.0/0.0, "inf");
+	check_string(-1.0/0.0, "-inf");
+	check_string(0.0/0.0, "nan");
+
+	// every subnormal mantissa near the bottom, powers of two, and random bits
+	for (u64 m = 1; m < 2000; m++) {
+		double d;
+		memcpy(&d, &m, sizeof(d));
+		check_double(d);
+	}
+	for (int e = -1074; e <= 1023; e++) check_double(ldexp(1.0, e));
+	for (int i = 0; i < 30000; i++) {
+		u64 bits = (u64)rand_pcg32(&state) << 32 | rand_pcg32(&state);
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		check_double(d);
+		// short decimals, which are most of what gets written
+		check_double((double)(int)(rand_pcg32(&state) % 2000000 - 1000000) / 1000);
+	}
+
+	{
+		Arena arena = {0};
+		double d[] = {1.5, -2, 0.25, 1e300};
+		long long ll[] = {-9223372036854775807ll - 1, 0, 42};
+		Str s = str_format_doubles(&arena, d, COUNT_ARRAY(d), ',');
+		if (!str_equal(s, cstr("1.5,-2,0.25,1e+300")) || s.ptr[s.len] != 0) errors++;
+		double back[8];
+		if (str_parse_doubles(s, ',', back, 8) != 4 || memcmp(back, d, sizeof(d))) errors++;
+		s = str_format_lls(&arena, ll, COUNT_ARRAY(ll), ' ');
+		if (!str_equal(s, cstr("-9223372036854775808 0 42"))) errors++;
+		if (str_format_lls(&arena, ll, 0, ',').len != 0) errors++;
+		if (!str_equal(str_format_double(&arena, 0.1), cstr("0.1"))) errors++;
+		if (!str_equal(str_format_ll(&arena, -7), cstr("-7"))) errors++;
+		char *long_one = allocate_sprintf(&arena, "%0300d|%s", 5, "end");
+		if (strlen(long_one) != 304 || strcmp(long_one + 300, "|end")) errors++;
+		if (strcmp(allocate_sprintf(&arena, "%d-%s", 12, "ab"), "12-ab")) errors++;
+		arena_destroy(&arena);
+	}
+
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
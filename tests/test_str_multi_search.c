@@ -0,0 +1,90 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// str_multi_search against trying every needle at every position: random
+// sets of needles over small alphabets (so they overlap, share prefixes and
+// repeat), big sets for the automaton alone and small ones for Teddy, which
+// are also run without it.
+
+static int errors = 0;
+
+static int
+naive_multi_search (Str h, Str *needles, int count, int *which)
+{
+	for (int i = 0; i <= h.len; i++) {
+		for (int k = 0; k < count; k++) {
+			if (needles[k].len <= h.len - i && !memcmp(h.ptr + i, needles[k].ptr, needles[k].len)) {
+				*which = k;
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+static void
+check (StrMultiSearch *ms, Str h, Str *needles, int count)
+{
+	int which = -1, want_which = -1;
+	int got = str_multi_search(ms, h, &which);
+	int want = naive_multi_search(h, needles, count, &want_which);
+	if ((got != want || (want >= 0 && which != want_which)) && errors++ < 10)
+		printf("%i needles (teddy %i), haystack \"%.*s\": got %i (needle %i), expected %i (needle %i)\n",
+			count, ms->teddy, h.len, h.ptr, got, which, want, want_which);
+}
+
+int main (void)
+{
+	Arena arena = {0};
+	static char h[2048], bytes[300 * 12];
+	Str needles[300];
+	u64 state = 3;
+
+	for (int iter = 0; iter < 3000; iter++) {
+		int alphabet = 2 + rand_pcg32(&state) % 4;
+		int base = iter % 3 == 0 ? 0xfd : 'a';
+		int count = iter % 4 == 0 ? 1 + rand_pcg32(&state) % 300 : 1 + rand_pcg32(&state) % STR_MULTI_SEARCH_TEDDY_MAX;
+		int min_len = iter % 50 == 0 ? 0 : 1 + rand_pcg32(&state) % 3;
+		char *b = bytes;
+		for (int k = 0; k < count; k++) {
+			int len = min_len + rand_pcg32(&state) % 8;
+			for (int j = 0; j < len; j++) b[j] = base + rand_pcg32(&state) % alphabet;
+			needles[k] = mkstr(b, len);
+			b += len;
+		}
+
+		i64 checkpoint = arena_checkpoint(&arena);
+		StrMultiSearch *ms = str_multi_search_create(&arena, needles, count);
+		StrMultiSearch no_teddy = *ms;
+		no_teddy.teddy = 0;
+		for (int j = 0; j < 10; j++) {
+			// mostly other bytes, so that matches are rarer and further in
+			int n = rand_pcg32(&state) % (j < 5 ? 40 : count > STR_MULTI_SEARCH_TEDDY_MAX ? 512 : COUNT_ARRAY(h));
+			for (int i = 0; i < n; i++) h[i] = rand_pcg32(&state) % 8 ? 'x' + rand_pcg32(&state) % 2 : base + rand_pcg32(&state) % alphabet;
+			check(ms, mkstr(h, n), needles, count);
+			check(&no_teddy, mkstr(h, n), needles, count);
+		}
+		arena_rollback(&arena, checkpoint);
+	}
+
+	// edge cases
+	{
+		Str some[] = {cstr("abc"), cstr("bc"), cstr("abcd"), cstr("bc")};
+		StrMultiSearch *ms = str_multi_search_create(&arena, some, 4);
+		int which = -1;
+		if (str_multi_search(ms, cstr("xxabcd"), &which) != 2 || which != 0) errors++;
+		if (str_multi_search(ms, cstr("xxbcd"), &which) != 2 || which != 1) errors++;
+		if (str_multi_search(ms, cstr("ab"), &which) != -1) errors++;
+		if (str_multi_search(ms, cstr(""), &which) != -1) errors++;
+		ms = str_multi_search_create(&arena, some, 0);
+		if (str_multi_search(ms, cstr("abc"), &which) != -1) errors++;
+	}
+
+	arena_destroy(&arena);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
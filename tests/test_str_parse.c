@@ -0,0 +1,164 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+// parse_double against strtod (random doubles printed shortest-ish and
+// long, random digit strings, more than 19 digits, halfway cases and the
+// edges of the range), the integer parsers against strtoull/strtoll, and
+// the column parsers.
+
+static int errors = 0;
+
+static int
+same_double (double a, double b)
+{
+	if (a != a) return b != b;
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static void
+check_double (char *text)
+{
+	int len = strlen(text);
+	char *end = NULL;
+	double expected = strtod(text, &end), got = 0;
+	int n = parse_double(text, len, &got);
+	if ((n != end - text || (n && !same_double(got, expected))) && errors++ < 10)
+		printf("parse_double(\"%s\") = %.17g (%i chars), strtod %.17g (%i)\n", text, got, n, expected, (int)(end - text));
+}
+
+static void
+check_ull (char *text)
+{
+	int len = strlen(text);
+	char *end = NULL;
+	errno = 0;
+	unsigned long long expected = strtoull(text, &end, 10), got = 0;
+	int expected_n = errno == ERANGE ? -1 : (int)(end - text);
+	int n = parse_decimal_ull(text, len, &got);
+	// no sign for the unsigned one
+	if (text[0] != '-' && text[0] != '+' && (n != expected_n || (n > 0 && got != expected)) && errors++ < 10)
+		printf("parse_decimal_ull(\"%s\") = %llu (%i), strtoull %llu (%i)\n", text, got, n, expected, expected_n);
+
+	long long sexpected = 0, sgot = 0;
+	errno = 0;
+	sexpected = strtoll(text, &end, 10);
+	expected_n = errno == ERANGE ? -1 : (int)(end - text);
+	n = parse_decimal_ll(text, len, &sgot);
+	if ((n != expected_n || (n > 0 && sgot != sexpected)) && errors++ < 10)
+		printf("parse_decimal_ll(\"%s\") = %lli (%i), strtoll %lli (%i)\n", text, sgot, n, sexpected, expected_n);
+}
+
+int main (void)
+{
+	char buf[2048];
+	u64 state = 7;
+
+	static char *cases[] = {
+		"0", "-0", "+1", "1.", ".5", "00012.5000", "1e10", "1E-10", "1e", "1e+", "2.5e+3x",
+		"1e400", "-1e400", "1e-400", "4.9406564584124654e-324", "2.4703282292062327e-324",
+		"2.4703282292062328e-324", "2.2250738585072011e-308", "2.2250738585072014e-308",
+		"1.7976931348623157e308", "1.7976931348623158e308", "1.7976931348623159e308",
+		"9007199254740993", "9007199254740992.5", "9007199254740993.0000000000000000001",
+		"0.1", "0.3", "123456789012345678901234567890", "3.14159265358979323846264338327950288",
+		"7.2057594037927933e+16", "1.00000000000000011102230246251565404236316680908203125",
+		"1.00000000000000011102230246251565404236316680908203124",
+		"1.00000000000000011102230246251565404236316680908203126",
+		"inf", "-Infinity", "NaN", "infinit", "-", ".", "e5", "", "x",
+		"0.000000000000000000000000000000000000000000001e-280",
+	};
+	for (int i = 0; i < COUNT_ARRAY(cases); i++) check_double(cases[i]);
+
+	for (int i = 0; i < 200000; i++) {
+		u64 bits = (u64)rand_pcg32(&state) << 32 | rand_pcg32(&state);
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		if (d != d) continue;
+		int digits = i % 3 == 0 ? 17 : i % 3 == 1 ? 16 : 1 + rand_pcg32(&state) % 25;
+		snprintf(buf, sizeof(buf), "%.*g", digits, d);
+		check_double(buf);
+	}
+
+	// random digit strings, some long, with points and exponents
+	for (int i = 0; i < 100000; i++) {
+		int len = 0, digits = 1 + rand_pcg32(&state) % (i % 10 == 0 ? 900 : 30);
+		int point = rand_pcg32(&state) % (digits + 1);
+		for (int j = 0; j < digits; j++) {
+			if (j == point) buf[len++] = '.';
+			// runs of zeros and nines find carries and ties
+			u32 r = rand_pcg32(&state) % 10;
+			buf[len++] = r < 3 ? '0' : r < 5 ? '9' : '0' + rand_pcg32(&state) % 10;
+		}
+		if (rand_pcg32(&state) % 2) len += snprintf(buf + len, 32, "e%i", (int)(rand_pcg32(&state) % 700) - 350);
+		buf[len] = 0;
+		check_double(buf);
+	}
+
+	// exact halfway points between doubles, and one digit either side
+	for (int i = 0; i < 20000; i++) {
+		u64 bits = ((u64)rand_pcg32(&state) << 32 | rand_pcg32(&state)) & 0x7fefffffffffffffull;
+		double lo, hi;
+		memcpy(&lo, &bits, sizeof(lo));
+		bits++;
+		memcpy(&hi, &bits, sizeof(hi));
+		long double mid = ((long double)lo + hi) / 2;
+		int len = snprintf(buf, sizeof(buf), "%.40Le", mid);
+		check_double(buf);
+		buf[len - 6]++;
+		check_double(buf);
+	}
+
+	// integers
+	static char *ints[] = {
+		"0", "-0", "+7", "42abc", "18446744073709551615", "18446744073709551616",
+		"99999999999999999999", "000000000000000000000000000018446744073709551615",
+		"9223372036854775807", "9223372036854775808", "-9223372036854775808", "-9223372036854775809",
+		"12345678", "123456789", "1234567890123456", "12345678901234567", "-", "+", "", "x1",
+	};
+	for (int i = 0; i < COUNT_ARRAY(ints); i++) check_ull(ints[i]);
+	for (int i = 0; i < 100000; i++) {
+		int len = 0, digits = 1 + rand_pcg32(&state) % 22;
+		if (rand_pcg32(&state) % 4 == 0) buf[len++] = '-';
+		for (int j = 0; j < digits; j++) buf[len++] = '0' + rand_pcg32(&state) % 10;
+		if (rand_pcg32(&state) % 2) buf[len++] = "x .,e"[rand_pcg32(&state) % 5];
+		buf[len] = 0;
+		check_ull(buf);
+	}
+
+	// len is the end, whatever follows it
+	{
+		unsigned long long u = 0;
+		long long ll = 0;
+		double d = 0;
+		unsigned long long hex = 0;
+		if (parse_decimal_ull("123456789012", 5, &u) != 5 || u != 12345) errors++;
+		if (parse_decimal_ll("-123456789012", 9, &ll) != 9 || ll != -12345678) errors++;
+		if (parse_double("1.2345e7", 4, &d) != 4 || d != 1.23) errors++;
+		if (parse_hex_ull("ffffffffffffffff", 16, &hex) != 16 || hex != ~0ull) errors++;
+		if (parse_hex_ull("00000ffffffffffffffff", 21, &hex) != 21 || hex != ~0ull) errors++;
+		if (parse_hex_ull("1ffffffffffffffff", 17, &hex) != -1) errors++;
+		if (parse_hex_ull("abcdef0123", 4, &hex) != 4 || hex != 0xabcd) errors++;
+	}
+
+	// columns
+	{
+		double d[8];
+		long long ll[8];
+		if (str_parse_doubles(cstr("1.5, -2e3 ,\t0.25,"), ',', d, 8) != 3 || d[0] != 1.5 || d[1] != -2e3 || d[2] != 0.25) errors++;
+		if (str_parse_doubles(cstr("1;2;3;4"), ';', d, 2) != 2 || d[1] != 2) errors++;
+		if (str_parse_doubles(cstr("1,2x,3"), ',', d, 8) != -2) errors++;
+		if (str_parse_doubles(cstr("1,,3"), ',', d, 8) != -2) errors++;
+		if (str_parse_doubles(cstr(""), ',', d, 8) != 0) errors++;
+		if (str_parse_lls(cstr("-9223372036854775808 7 42"), ' ', ll, 8) != 3 || ll[0] != LLONG_MIN || ll[2] != 42) errors++;
+		if (str_parse_lls(cstr("1,99999999999999999999"), ',', ll, 8) != -2) errors++;
+		if (str_parse_lls(cstr("1,2.5"), ',', ll, 8) != -2) errors++;
+	}
+
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
@@ -0,0 +1,93 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// Matchers written by pattern_generate_c() (into test_str_pattern_gen.h,
+// which `test_str_pattern_gen write` writes again) against
+// pattern_match_ascii(), on random strings; and the programs they came with
+// against the ones pattern_compile_ascii() makes now.
+
+static char *patterns[][2] = {
+	{"errors",        "ERROR %d+"},
+	{"ident",         "^%s*[%a_][%w_]*"},
+	{"digits",        "%d%d%d%d%d"},
+	{"not_a",         "[^a]b"},
+	{"abc",           "a?b*c$"},
+	{"any_x",         "%.x"},
+	{"non_digits",    "%D+;"},
+	{"space_punct",   "[%s.]*%p+"},
+	{"punct_or_lower","[%p%l]+[%d:]"},
+};
+
+#ifndef GENERATING
+#include "test_str_pattern_gen.h"
+
+typedef int (*GeneratedMatch)(char *string, int string_len, int *match_len);
+
+static struct {
+	CompiledStrPattern *program;
+	GeneratedMatch match;
+} generated[] = {
+	{&errors_pattern,         errors_match},
+	{&ident_pattern,          ident_match},
+	{&digits_pattern,         digits_match},
+	{&not_a_pattern,          not_a_match},
+	{&abc_pattern,            abc_match},
+	{&any_x_pattern,          any_x_match},
+	{&non_digits_pattern,     non_digits_match},
+	{&space_punct_pattern,    space_punct_match},
+	{&punct_or_lower_pattern, punct_or_lower_match},
+};
+#endif
+
+int main (int argc, char **argv)
+{
+	int errors = 0;
+	static char buffer[1 << 16];
+
+	if (argc > 1 && !strcmp(argv[1], "write")) {
+		printf("// Written by `test_str_pattern_gen write`, with pattern_generate_c()\n");
+		for (int p = 0; p < COUNT_ARRAY(patterns); p++) {
+			CompiledStrPattern prog = pattern_compile_ascii(patterns[p][1], strlen(patterns[p][1]));
+			int len = pattern_generate_c(buffer, sizeof(buffer), &prog, patterns[p][0]);
+			if (len < 0 || len >= (int)sizeof(buffer)) return 1;
+			printf("\n// \"%s\"\n%s", patterns[p][1], buffer);
+		}
+		return 0;
+	}
+
+#ifndef GENERATING
+	u64 state = 7;
+	char *bytes = "ERROR 12345 _ab;c.:x%\t";
+	char string[200];
+	for (int p = 0; p < COUNT_ARRAY(patterns); p++) {
+		CompiledStrPattern prog = pattern_compile_ascii(patterns[p][1], strlen(patterns[p][1]));
+		if (memcmp(&prog, generated[p].program, sizeof(prog)) && errors++ < 10)
+			printf("\"%s\" compiles to something else now\n", patterns[p][1]);
+
+		for (int i = 0; i < 2000; i++) {
+			int len = rand_pcg32(&state) % (i < 1000 ? 12 : COUNT_ARRAY(string));
+			for (int k = 0; k < len; k++) string[k] = bytes[rand_pcg32(&state) % strlen(bytes)];
+			int vm_len = -1, gen_len = -1;
+			int vm = pattern_match_ascii(string, len, &prog, &vm_len);
+			int at = generated[p].match(string, len, &gen_len);
+			if ((at != vm || (vm >= 0 && gen_len != vm_len)) && errors++ < 10)
+				printf("\"%s\" in \"%.*s\": vm %i (%i), generated %i (%i)\n", patterns[p][1], len, string, vm, vm_len, at, gen_len);
+		}
+	}
+
+	// errors, and what the buffer needs
+	CompiledStrPattern bad = pattern_compile_ascii("[ab", 3);
+	if (pattern_generate_c(buffer, sizeof(buffer), &bad, "bad") != -1) errors++;
+	CompiledStrPattern prog = pattern_compile_ascii("a%d+", 4);
+	int need = pattern_generate_c(NULL, 0, &prog, "x");
+	if (need <= 0 || pattern_generate_c(buffer, need + 1, &prog, "x") != need || (int)strlen(buffer) != need) errors++;
+	if (pattern_generate_c(buffer, 10, &prog, "x") != need || strlen(buffer) != 9) errors++;
+#endif
+
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
@@ -0,0 +1,349 @@
+// Written by `test_str_pattern_gen write`, with pattern_generate_c()
+
+// "ERROR %d+"
+static CompiledStrPattern errors_pattern = {
+	.code_size = 9,
+	.code = {
+		0x0454, 0x0524, 0x0524, 0x04f4, 0x0524, 0x0204, 0x064c, 0x064f,
+		0x0010,
+	},
+	.prefix_len = 6,
+	.prefix = "ERROR ",
+};
+
+static inline int
+errors_at(const unsigned char *s, int len, int i)
+{
+	if (i >= len || !(s[i] == 'E')) return -1;
+	i++;
+	if (i >= len || !(s[i] == 'R')) return -1;
+	i++;
+	if (i >= len || !(s[i] == 'R')) return -1;
+	i++;
+	if (i >= len || !(s[i] == 'O')) return -1;
+	i++;
+	if (i >= len || !(s[i] == 'R')) return -1;
+	i++;
+	if (i >= len || !(s[i] == 0x20)) return -1;
+	i++;
+	if (i >= len || !(s[i] >= '0' && s[i] <= '9')) return -1;
+	i++;
+	while (i < len && (s[i] >= '0' && s[i] <= '9')) i++;
+	return i;
+}
+
+static int
+errors_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		i = pattern_next_candidate("ERROR ", 6, 0x0, 0, string, string_len, i);
+		if (i == string_len) break;
+		int end = errors_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "^%s*[%a_][%w_]*"
+static CompiledStrPattern ident_pattern = {
+	.code_size = 15,
+	.code = {
+		0x05e2, 0x073f, 0x0041, 0x061d, 0x05f5, 0x0000, 0x0038, 0x000a,
+		0x0041, 0x077d, 0x05f5, 0x0000, 0x0038, 0x0009, 0x0010,
+	},
+};
+
+static const unsigned char ident_set3[32] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x03,
+	0xfe, 0xff, 0xff, 0x87, 0xfe, 0xff, 0xff, 0x07,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static inline int
+ident_at(const unsigned char *s, int len, int i)
+{
+	if (i != 0) return -1;
+	while (i < len && ((s[i] >= 0x09 && s[i] <= 0x0d) || s[i] == 0x20)) i++;
+	if (i >= len || !((s[i] >= 'A' && s[i] <= 'Z') || s[i] == '_' || (s[i] >= 'a' && s[i] <= 'z'))) return -1;
+	i++;
+	while (i < len && (ident_set3[s[i] >> 3] >> (s[i] & 7) & 1)) i++;
+	return i;
+}
+
+static int
+ident_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		int end = ident_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+		break;
+	}
+	return -1;
+}
+
+// "%d%d%d%d%d"
+static CompiledStrPattern digits_pattern = {
+	.code_size = 6,
+	.code = {
+		0x064c, 0x064c, 0x064c, 0x064c, 0x064c, 0x0010,
+	},
+	.start_classes = 0x4,
+	.start_negated = 0,
+};
+
+static inline int
+digits_at(const unsigned char *s, int len, int i)
+{
+	if (i >= len || !(s[i] >= '0' && s[i] <= '9')) return -1;
+	i++;
+	if (i >= len || !(s[i] >= '0' && s[i] <= '9')) return -1;
+	i++;
+	if (i >= len || !(s[i] >= '0' && s[i] <= '9')) return -1;
+	i++;
+	if (i >= len || !(s[i] >= '0' && s[i] <= '9')) return -1;
+	i++;
+	if (i >= len || !(s[i] >= '0' && s[i] <= '9')) return -1;
+	i++;
+	return i;
+}
+
+static int
+digits_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		i = pattern_next_candidate(0, 0, 0x4, 0, string, string_len, i);
+		if (i == string_len) break;
+		int end = digits_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "[^a]b"
+static CompiledStrPattern not_a_pattern = {
+	.code_size = 7,
+	.code = {
+		0x0031, 0x0616, 0x0000, 0x0028, 0x000a, 0x0624, 0x0010,
+	},
+};
+
+static inline int
+not_a_at(const unsigned char *s, int len, int i)
+{
+	if (i >= len || !(0)) return -1;
+	i++;
+	if (i >= len || !(s[i] == 'b')) return -1;
+	i++;
+	return i;
+}
+
+static int
+not_a_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		while (i < string_len && !(0)) i++;
+		if (i == string_len) break;
+		int end = not_a_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "a?b*c$"
+static CompiledStrPattern abc_pattern = {
+	.code_size = 5,
+	.code = {
+		0x0613, 0x0627, 0x0634, 0x0242, 0x0010,
+	},
+};
+
+static inline int
+abc_at(const unsigned char *s, int len, int i)
+{
+	if (i < len && (s[i] == 'a')) i++;
+	while (i < len && (s[i] == 'b')) i++;
+	if (i >= len || !(s[i] == 'c')) return -1;
+	i++;
+	if (i != len) return -1;
+	return i;
+}
+
+static int
+abc_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		int end = abc_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "%.x"
+static CompiledStrPattern any_x_pattern = {
+	.code_size = 3,
+	.code = {
+		0x02e4, 0x0784, 0x0010,
+	},
+	.prefix_len = 2,
+	.prefix = ".x",
+};
+
+static inline int
+any_x_at(const unsigned char *s, int len, int i)
+{
+	if (i >= len || !(s[i] == '.')) return -1;
+	i++;
+	if (i >= len || !(s[i] == 'x')) return -1;
+	i++;
+	return i;
+}
+
+static int
+any_x_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		i = pattern_next_candidate(".x", 2, 0x0, 0, string, string_len, i);
+		if (i == string_len) break;
+		int end = any_x_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "%D+;"
+static CompiledStrPattern non_digits_pattern = {
+	.code_size = 4,
+	.code = {
+		0x044c, 0x044f, 0x03b4, 0x0010,
+	},
+	.start_classes = 0x4,
+	.start_negated = 1,
+};
+
+static inline int
+non_digits_at(const unsigned char *s, int len, int i)
+{
+	if (i >= len || !(s[i] <= '/' || s[i] >= ':')) return -1;
+	i++;
+	while (i < len && (s[i] <= '/' || s[i] >= ':')) i++;
+	if (i >= len || !(s[i] == ';')) return -1;
+	i++;
+	return i;
+}
+
+static int
+non_digits_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		i = pattern_next_candidate(0, 0, 0x4, 1, string, string_len, i);
+		if (i == string_len) break;
+		int end = non_digits_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "[%s.]*%p+"
+static CompiledStrPattern space_punct_pattern = {
+	.code_size = 9,
+	.code = {
+		0x0041, 0x073d, 0x02e5, 0x0000, 0x0038, 0x0009, 0x070c, 0x070f,
+		0x0010,
+	},
+};
+
+static const unsigned char space_punct_set1[32] = {
+	0x00, 0x00, 0x00, 0x00, 0xfe, 0xff, 0x00, 0xfc,
+	0x01, 0x00, 0x00, 0xf8, 0x01, 0x00, 0x00, 0x78,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static inline int
+space_punct_at(const unsigned char *s, int len, int i)
+{
+	while (i < len && ((s[i] >= 0x09 && s[i] <= 0x0d) || s[i] == 0x20 || s[i] == '.')) i++;
+	if (i >= len || !(space_punct_set1[s[i] >> 3] >> (s[i] & 7) & 1)) return -1;
+	i++;
+	while (i < len && (space_punct_set1[s[i] >> 3] >> (s[i] & 7) & 1)) i++;
+	return i;
+}
+
+static int
+space_punct_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		int end = space_punct_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "[%p%l]+[%d:]"
+static CompiledStrPattern punct_or_lower_pattern = {
+	.code_size = 15,
+	.code = {
+		0x0041, 0x070d, 0x06cd, 0x0000, 0x0038, 0x000a, 0x0058, 0x0009,
+		0x0041, 0x064d, 0x03a5, 0x0000, 0x0038, 0x000a, 0x0010,
+	},
+};
+
+static inline int
+punct_or_lower_at(const unsigned char *s, int len, int i)
+{
+	if (i >= len || !((s[i] >= '!' && s[i] <= '/') || (s[i] >= ':' && s[i] <= '@') || (s[i] >= '[' && s[i] <= '~'))) return -1;
+	i++;
+	while (i < len && ((s[i] >= '!' && s[i] <= '/') || (s[i] >= ':' && s[i] <= '@') || (s[i] >= '[' && s[i] <= '~'))) i++;
+	if (i >= len || !(s[i] >= '0' && s[i] <= ':')) return -1;
+	i++;
+	return i;
+}
+
+static int
+punct_or_lower_match(char *string, int string_len, int *match_len)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	for (int i = 0; i < string_len; i++) {
+		while (i < string_len && !((s[i] >= '!' && s[i] <= '/') || (s[i] >= ':' && s[i] <= '@') || (s[i] >= '[' && s[i] <= '~'))) i++;
+		if (i == string_len) break;
+		int end = punct_or_lower_at(s, string_len, i);
+		if (end >= 0) {
+			*match_len = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,92 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// str_search against a naive reference: random haystacks over small alphabets
+// (so there are lots of partial matches), periodic haystacks and needles that
+// push the SIMD paths into their Two-Way fallback, and needles cut from the
+// haystack at every alignment near the ends.
+
+static int
+naive_search (Str h, Str x)
+{
+	for (int i = 0; i <= h.len - x.len; i++)
+		if (!memcmp(h.ptr + i, x.ptr, x.len)) return i;
+	return -1;
+}
+
+static int errors = 0;
+
+static void
+check (Str h, Str x)
+{
+	int got = str_search(h, x), want = naive_search(h, x);
+	if (got != want) {
+		if (errors++ < 10) 
+			printf("haystack len %i needle '%.*s': got %i, expected %i\n", h.len, x.len, x.ptr, got, want);
+	}
+}
+
+int main (void)
+{
+	static char h[4096], x[300];
+	u64 state = 1;
+
+	// random, small alphabets; includes bytes >= 0x80
+	for (int iter = 0; iter < 20000; iter++) {
+		int alphabet = 1 + rand_pcg32(&state) % 4;
+		int base = iter & 1 ? 'a' : 0xfe;
+		int n = rand_pcg32(&state) % 300;
+		int m = 1 + rand_pcg32(&state) % 20;
+		for (int i = 0; i < n; i++) h[i] = base + rand_pcg32(&state) % alphabet;
+		for (int i = 0; i < m; i++) x[i] = base + rand_pcg32(&state) % alphabet;
+		check(mkstr(h, n), mkstr(x, m));
+		// a needle that is in the haystack
+		if (n > 0) {
+			int at = rand_pcg32(&state) % n;
+			int len = 1 + rand_pcg32(&state) % (n - at);
+			check(mkstr(h, n), mkstr(h + at, len));
+		}
+	}
+
+	// periodic haystack "abaabaab..." with near-miss needles, long enough
+	// to trigger the fallback
+	for (int period = 1; period <= 5; period++) {
+		for (int i = 0; i < COUNT_ARRAY(h); i++) h[i] = i % period == period-1 ? 'b' : 'a';
+		for (int m = 2; m < COUNT_ARRAY(x); m += 7) {
+			for (int i = 0; i < m; i++) x[i] = h[i];
+			check(mkstr(h, COUNT_ARRAY(h)), mkstr(x, m));
+			x[m-1] = 'c';
+			check(mkstr(h, COUNT_ARRAY(h)), mkstr(x, m));
+			x[m-1] = h[m-1];
+			x[m/2] = 'c';
+			check(mkstr(h, COUNT_ARRAY(h)), mkstr(x, m));
+			h[COUNT_ARRAY(h) - m + m/2] = 'c'; // now it's there, right at the end
+			check(mkstr(h, COUNT_ARRAY(h)), mkstr(x, m));
+			h[COUNT_ARRAY(h) - m + m/2] = (COUNT_ARRAY(h) - m + m/2) % period == period-1 ? 'b' : 'a';
+		}
+	}
+
+	// every needle length and position near both ends of the haystack
+	for (int i = 0; i < COUNT_ARRAY(h); i++) h[i] = 'a' + rand_pcg32(&state) % 26;
+	for (int n = 1; n <= 100; n++) {
+		for (int at = 0; at < n; at++) {
+			for (int m = 1; at + m <= n && m <= 40; m++) {
+				check(mkstr(h, n), mkstr(h + at, m));
+				check(mkstr(h + COUNT_ARRAY(h) - n, n), mkstr(h + COUNT_ARRAY(h) - n + at, m));
+			}
+		}
+	}
+
+	// edge cases
+	check(mkstr(h, 0), mkstr(x, 0));
+	check(mkstr(h, 10), mkstr(x, 0));
+	check(mkstr(h, 3), mkstr(h, 4));
+
+	printf("%i errors\n", errors);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
@@ -0,0 +1,91 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// Delimiter scanning: str_find_byte/str_find_any against a naive reference,
+// with small sets, large sets and sets of bytes >= 0x80, and str_tokenize 
+// against repeated str_split_any.
+
+static int errors = 0;
+
+static int
+naive_find_any (Str s, Str set)
+{
+	for (int i = 0; i < s.len; i++)
+		for (int j = 0; j < set.len; j++)
+			if (s.ptr[i] == set.ptr[j]) return i;
+	return -1;
+}
+
+static void
+check_tokenize (Arena *a, Str s, Str delims)
+{
+	int n = 0;
+	Str *fields = str_tokenize(a, s, delims, &n);
+
+	// same as popping fields, except that a trailing delimiter gives an empty field
+	Str rest = s;
+	int i = 0, ok = 1;
+	while (rest.len > 0) {
+		Str f = str_split_any(&rest, delims);
+		if (i >= n || fields[i].ptr != f.ptr || fields[i].len != f.len) ok = 0;
+		i++;
+	}
+	if (s.len > 0 && naive_find_any(mkstr(s.ptr + s.len - 1, 1), delims) == 0) {
+		if (i >= n || fields[i].len != 0) ok = 0;
+		i++;
+	}
+	if (i != n) ok = 0;
+	if (!ok && errors++ < 10) printf("str_tokenize: len %i, %i delims: wrong fields\n", s.len, delims.len);
+}
+
+int main (void)
+{
+	static char text[2000], set[40];
+	Arena arena = {0};
+	u64 state = 7;
+
+	for (int iter = 0; iter < 20000; iter++) {
+		int n = rand_pcg32(&state) % COUNT_ARRAY(text);
+		int m = 1 + rand_pcg32(&state) % (iter % 3 ? 4 : COUNT_ARRAY(set));
+		// sparse delimiters in a random bytes, sometimes with the top bit set
+		int high = iter & 1 ? 0x80 : 0;
+		for (int i = 0; i < n; i++) text[i] = 'A' + rand_pcg32(&state) % 26;
+		for (int i = 0; i < m; i++) set[i] = high + rand_pcg32(&state) % 128;
+		int ndelims = rand_pcg32(&state) % 20;
+		for (int i = 0; i < ndelims && n > 0; i++) text[rand_pcg32(&state) % n] = set[rand_pcg32(&state) % m];
+
+		Str s = mkstr(text, n), d = mkstr(set, m);
+		int got = str_find_any(s, d), want = naive_find_any(s, d);
+		if (got != want && errors++ < 10) printf("str_find_any: len %i, %i delims: got %i, expected %i\n", n, m, got, want);
+		got = str_find_byte(s, set[0]), want = naive_find_any(s, mkstr(set, 1));
+		if (got != want && errors++ < 10) printf("str_find_byte: len %i: got %i, expected %i\n", n, got, want);
+
+		check_tokenize(&arena, s, d);
+		if (iter % 1000 == 0) arena_clear(&arena, 0);
+	}
+
+	// more delimiters than str_tokenize's batch of positions
+	for (int i = 0; i < COUNT_ARRAY(text); i++) text[i] = i % 3 ? 'x' : ',';
+	check_tokenize(&arena, mkstr(text, COUNT_ARRAY(text)), cstr(","));
+	check_tokenize(&arena, mkstr(text, COUNT_ARRAY(text)), cstr(",;\t\"|"));
+
+	int n = 0;
+	Str *f = str_tokenize(&arena, cstr("a,,b,"), cstr(","), &n);
+	if (n != 4 || !str_equal(f[0], cstr("a")) || f[1].len || !str_equal(f[2], cstr("b")) || f[3].len) {
+		printf("str_tokenize(\"a,,b,\") is wrong\n");
+		errors++;
+	}
+	if (str_tokenize(&arena, cstr(""), cstr(","), &n) || n != 0) {
+		printf("str_tokenize(\"\") is wrong\n");
+		errors++;
+	}
+
+	arena_destroy(&arena);
+	printf("%i errors\n", errors);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
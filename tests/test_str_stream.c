@@ -0,0 +1,148 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// All the matches of random patterns in random strings, found with
+// str_pattern_next(), str_pattern_match_all() and streams fed random sized
+// pieces (two at once, sharing a DFA with a small cache, so that its states
+// are flushed under them), against pattern_match_ascii() on what's left
+// after each match.
+
+static int errors = 0;
+
+#define MAX_MATCHES 300
+
+static int
+reference (CompiledStrPattern *prog, int anchored, char *string, int len, int *starts, int *lens)
+{
+	int n = 0, at = 0;
+	while (at < len && n < MAX_MATCHES) {
+		int match_len = 0;
+		int r = pattern_match_ascii(string + at, len - at, prog, &match_len);
+		if (r < 0) break;
+		starts[n] = at + r;
+		lens[n++] = match_len;
+		at += r + match_len + (match_len == 0);
+		if (anchored) break;
+	}
+	return n;
+}
+
+// Feeds the next piece if it's wanted; returns 0 once the stream is done
+static int
+stream_step (PatternStream *s, char *copy, char *string, int len, int *fed, u64 *state, i64 *start, i64 *match_len)
+{
+	while (!pattern_stream_next(s, start, match_len)) {
+		if (*fed == len && s->last) return 0;
+		int piece = rand_pcg32(state) % 3 == 0 ? 0 : 1 + rand_pcg32(state) % 40;
+		if (piece > len - *fed) piece = len - *fed;
+		// a copy, that's gone once the stream has had it
+		memset(copy, '?', 64);
+		memcpy(copy, string + *fed, piece);
+		*fed += piece;
+		pattern_stream_input(s, copy, piece, *fed == len);
+	}
+	return 1;
+}
+
+int main (void)
+{
+	Arena arena = {0};
+	u64 state = 9;
+	static char *atoms[] = {"a", "b", "1", " ", "%a", "%d", "%s", "%.", "[ab]", "[%d ]"};
+	char *bytes = "aab1 c";
+	char pattern[64], string[400];
+	int starts[MAX_MATCHES], lens[MAX_MATCHES];
+
+	for (int i = 0; i < 6000; i++) {
+		int len = 0;
+		if (rand_pcg32(&state) % 8 == 0) pattern[len++] = '^';
+		int atom_count = 1 + rand_pcg32(&state) % 4;
+		for (int j = 0; j < atom_count; j++) {
+			len += snprintf(pattern + len, 16, "%s", atoms[rand_pcg32(&state) % COUNT_ARRAY(atoms)]);
+			u32 r = rand_pcg32(&state) % 8;
+			if (r < 3) pattern[len++] = "?*+"[r];
+		}
+		if (rand_pcg32(&state) % 8 == 0) pattern[len++] = '$';
+		pattern[len] = 0;
+
+		CompiledStrPattern prog = pattern_compile_ascii(pattern, len);
+		int anchored = pattern[0] == '^';
+		i64 checkpoint = arena_checkpoint(&arena);
+		PatternDfa *dfa = pattern_dfa_create(&arena, &prog, 1);
+
+		int string_len = rand_pcg32(&state) % COUNT_ARRAY(string);
+		for (int k = 0; k < string_len; k++) string[k] = bytes[rand_pcg32(&state) % 6];
+		int n = reference(&prog, anchored, string, string_len, starts, lens);
+		if (n == MAX_MATCHES) continue;
+
+		// the iterator
+		StrPatternIter it = str_pattern_iter(mkstr(string, string_len), &prog);
+		Str match;
+		int k = 0;
+		for (; str_pattern_next(&it, &match); k++) {
+			if (k >= n || match.ptr - string != starts[k] || match.len != lens[k]) break;
+		}
+		if ((k != n || str_pattern_next(&it, &match)) && errors++ < 10)
+			printf("\"%s\" in \"%.*s\": str_pattern_next wrong at match %i of %i\n", pattern, string_len, string, k, n);
+
+		// all at once
+		int count = -1;
+		Str *all = str_pattern_match_all(&arena, mkstr(string, string_len), &prog, &count);
+		int same = count == n;
+		for (int j = 0; same && j < n; j++) same = all[j].ptr - string == starts[j] && all[j].len == lens[j];
+		if (!same && errors++ < 10) printf("\"%s\": str_pattern_match_all has %i matches, not %i\n", pattern, count, n);
+
+		// two streams, taking turns
+		PatternStream s[2];
+		int fed[2] = {0, 0}, found[2] = {0, 0}, live[2] = {1, 1};
+		char copy[2][64];
+		pattern_stream_init(&s[0], &arena, dfa);
+		pattern_stream_init(&s[1], &arena, dfa);
+		while (live[0] || live[1]) {
+			for (int j = 0; j < 2; j++) {
+				i64 start = 0, match_len = 0;
+				if (!live[j]) continue;
+				if (!stream_step(&s[j], copy[j], string, string_len, &fed[j], &state, &start, &match_len)) {
+					live[j] = 0;
+					continue;
+				}
+				int f = found[j]++;
+				if ((f >= n || start != starts[f] || match_len != lens[f]) && errors++ < 10) {
+					printf("\"%s\" in \"%.*s\": stream match %i is %lli (%lli)\n", pattern, string_len, string, f, (long long)start, (long long)match_len);
+					live[j] = 0;
+				}
+			}
+		}
+		if ((found[0] != n || found[1] != n) && errors++ < 10)
+			printf("\"%s\" in \"%.*s\": streams found %i and %i matches, not %i\n", pattern, string_len, string, found[0], found[1], n);
+		arena_rollback(&arena, checkpoint);
+	}
+
+	// a match that goes on for many pieces
+	{
+		CompiledStrPattern prog = pattern_compile_ascii("x%d+y", 5);
+		PatternStream s;
+		pattern_stream_init(&s, &arena, pattern_dfa_create(&arena, &prog, 0));
+		char piece[100];
+		memset(piece, '1', sizeof(piece));
+		i64 start = 0, len = 0;
+		pattern_stream_input(&s, "  x", 3, 0);
+		if (pattern_stream_next(&s, &start, &len)) errors++;
+		for (int i = 0; i < 1000; i++) {
+			pattern_stream_input(&s, piece, sizeof(piece), 0);
+			if (pattern_stream_next(&s, &start, &len)) errors++;
+		}
+		pattern_stream_input(&s, "1y x1y", 6, 1);
+		if (!pattern_stream_next(&s, &start, &len) || start != 2 || len != 100003) errors++;
+		if (!pattern_stream_next(&s, &start, &len) || start != 100006 || len != 3) errors++;
+		if (pattern_stream_next(&s, &start, &len)) errors++;
+	}
+
+	arena_destroy(&arena);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}
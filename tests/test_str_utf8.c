@@ -0,0 +1,233 @@
+#define NONSTD_IMPLEMENTATION
+#define NONSTD_API static
+#include "../nonstd/nonstd.h"
+
+
+#include <stdio.h>
+
+// utf8_validate() against a decoder that follows the definition, on every
+// string of up to 2 bytes (and 3, from a lead byte of 0xe0 up), and on
+// random text with random damage, long enough for the SIMD code and at
+// every alignment. Then decoding, the iterator, and transcoding there and
+// back, on the same text.
+
+static int errors = 0;
+
+static int
+reference_validate (const unsigned char *s, int len)
+{
+	static const unsigned min[] = {0, 0, 0x80, 0x800, 0x10000};
+	int i = 0;
+	while (i < len) {
+		unsigned c = s[i], codepoint;
+		int n;
+		if (c < 0x80) {
+			i++;
+			continue;
+		}
+		if ((c & 0xe0) == 0xc0) n = 2, codepoint = c & 0x1f;
+		else if ((c & 0xf0) == 0xe0) n = 3, codepoint = c & 0x0f;
+		else if ((c & 0xf8) == 0xf0) n = 4, codepoint = c & 0x07;
+		else return i;
+		if (i + n > len) return i;
+		for (int k = 1; k < n; k++) {
+			if ((s[i+k] & 0xc0) != 0x80) return i;
+			codepoint = codepoint << 6 | (s[i+k] & 0x3f);
+		}
+		if (codepoint < min[n] || codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff)) return i;
+		i += n;
+	}
+	return len;
+}
+
+static void
+check_validate (char *s, int len)
+{
+	int got = utf8_validate(s, len), want = reference_validate((unsigned char *)s, len);
+	if (got != want && errors++ < 10) {
+		printf("utf8_validate of %i bytes:", len);
+		for (int i = 0; i < len && i < 40; i++) printf(" %02x", (unsigned char)s[i]);
+		printf(" gave %i, not %i\n", got, want);
+	}
+}
+
+static int
+reference_utf16 (const uint16_t *s, int len)
+{
+	for (int i = 0; i < len; i++) {
+		if (s[i] >= 0xdc00 && s[i] <= 0xdfff) return i;
+		if (s[i] >= 0xd800 && s[i] <= 0xdbff) {
+			if (i + 1 == len || s[i+1] < 0xdc00 || s[i+1] > 0xdfff) return i;
+			i++;
+		}
+	}
+	return len;
+}
+
+static int
+random_codepoint (u64 *state)
+{
+	u32 r = rand_pcg32(state) % 16;
+	if (r < 8) return 0x20 + rand_pcg32(state) % 0x5f;
+	if (r < 11) return 0x80 + rand_pcg32(state) % 0x780;
+	if (r < 14) {
+		int c = 0x800 + rand_pcg32(state) % 0xf800;
+		return c >= 0xd800 && c < 0xe000 ? c - 0x800 : c;
+	}
+	return 0x10000 + rand_pcg32(state) % 0x100000;
+}
+
+int main (void)
+{
+	Arena arena = {0};
+	u64 state = 5;
+	static char text[600];
+	static int codepoints[600];
+	static uint16_t utf16[600];
+
+	// short strings, all of them
+	unsigned char b[3];
+	for (int x = 0; x < 256; x++) {
+		b[0] = x;
+		check_validate((char *)b, 1);
+		for (int y = 0; y < 256; y++) {
+			b[1] = y;
+			check_validate((char *)b, 2);
+			for (int z = 0; x >= 0xe0 && z < 256; z++) {
+				b[2] = z;
+				check_validate((char *)b, 3);
+			}
+		}
+	}
+
+	// every codepoint, and the surrogates and beyond
+	for (int c = 0; c < 0x110100; c++) {
+		char buf[4];
+		int codepoint, n = utf8_encode(buf, c);
+		int scalar = c < 0xd800 || (c > 0xdfff && c < 0x110000);
+		if (n != (scalar ? 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000) : 0) && errors++ < 10)
+			printf("utf8_encode(%x) is %i bytes\n", c, n);
+		if (scalar && (utf8_decode(buf, n, &codepoint) != n || codepoint != c) && errors++ < 10)
+			printf("utf8_decode of U+%x is %x\n", c, codepoint);
+	}
+
+	for (int iter = 0; iter < 4000; iter++) {
+		int len = 0, count = 0, utf16_len = 0;
+		int target = rand_pcg32(&state) % 500;
+		while (len < target) {
+			int c = codepoints[count++] = random_codepoint(&state);
+			len += utf8_encode(text + len, c);
+			if (c >= 0x10000) {
+				utf16[utf16_len++] = 0xd800 | (c - 0x10000) >> 10;
+				utf16[utf16_len++] = 0xdc00 | (c & 0x3ff);
+			} else {
+				utf16[utf16_len++] = c;
+			}
+		}
+
+		// valid, there and back
+		int n = 0;
+		check_validate(text, len);
+		uint16_t *units16 = str_to_utf16(&arena, mkstr(text, len), &n);
+		if ((n != utf16_len || memcmp(units16, utf16, n * sizeof(*units16)) || units16[n]) && errors++ < 10)
+			printf("str_to_utf16 of %i characters: %i units\n", count, n);
+		uint32_t *units32 = str_to_utf32(&arena, mkstr(text, len), &n);
+		int same = n == count && !units32[n];
+		for (int i = 0; same && i < n; i++) same = units32[i] == (uint32_t)codepoints[i];
+		if (!same && errors++ < 10) printf("str_to_utf32 of %i characters: %i units\n", count, n);
+		Str back16 = str_from_utf16(&arena, utf16, utf16_len), back32 = str_from_utf32(&arena, units32, count);
+		if ((back16.len != len || memcmp(back16.ptr, text, len) || back16.ptr[len]) && errors++ < 10)
+			printf("str_from_utf16 of %i characters isn't what they came from\n", count);
+		if ((back32.len != len || memcmp(back32.ptr, text, len) || back32.ptr[len]) && errors++ < 10)
+			printf("str_from_utf32 of %i characters isn't what they came from\n", count);
+
+		// and with surrogates put in the wrong places, or cut off
+		for (int j = 0; j < 2 && utf16_len; j++) {
+			static uint16_t damaged[600];
+			int dlen = rand_pcg32(&state) % 2 ? utf16_len : (int)(rand_pcg32(&state) % utf16_len);
+			memcpy(damaged, utf16, utf16_len * sizeof(*damaged));
+			int changes = rand_pcg32(&state) % 3;
+			for (int m = 0; m < changes; m++) damaged[rand_pcg32(&state) % utf16_len] = 0xd800 + rand_pcg32(&state) % 0x800;
+			int want = reference_utf16(damaged, dlen);
+			Str got = str_from_utf16(&arena, damaged, dlen);
+			if ((want < dlen ? got.ptr || got.len != -1 - want : !got.ptr) && errors++ < 10)
+				printf("str_from_utf16 of %i units: %i, want %i\n", dlen, got.len, want);
+		}
+
+		StrUtf8Iter it = str_utf8_iter(mkstr(text, len));
+		int c, k = 0;
+		for (; str_utf8_next(&it, &c); k++)
+			if (k >= count || c != codepoints[k]) break;
+		if (k != count && errors++ < 10) printf("str_utf8_next went wrong at character %i of %i\n", k, count);
+
+		// damaged: bytes changed, or the end cut off, at any alignment
+		for (int j = 0; j < 4; j++) {
+			static char damaged[610];
+			int offset = rand_pcg32(&state) % 8, dlen = len;
+			memcpy(damaged + offset, text, len);
+			char *d = damaged + offset;
+			int changes = rand_pcg32(&state) % 3;
+			for (int m = 0; m < changes && len; m++) {
+				u32 r = rand_pcg32(&state);
+				d[r % len] = r >> 16 & 1 ? (char)(r >> 8) : (char)(0x80 + (r >> 8) % 0x40);
+			}
+			if (rand_pcg32(&state) % 4 == 0 && len) dlen = rand_pcg32(&state) % len;
+			check_validate(d, dlen);
+
+			// the iterator steps over all of it, and only the invalid parts give -1
+			int want = reference_validate((unsigned char *)d, dlen), at = 0;
+			it = str_utf8_iter(mkstr(d, dlen));
+			while (at = it.at, str_utf8_next(&it, &c)) {
+				char buf[4];
+				int valid = reference_validate((unsigned char *)d + at, it.at - at) == it.at - at;
+				if ((c < 0 ? valid : (utf8_encode(buf, c) != it.at - at || memcmp(buf, d + at, it.at - at))) && errors++ < 10)
+					printf("str_utf8_next gave %x for %i bytes at %i\n", c, it.at - at, at);
+				if (at < want && c < 0 && errors++ < 10) printf("str_utf8_next gave -1 at %i, before %i\n", at, want);
+			}
+			if (it.at != dlen && errors++ < 10) printf("str_utf8_next stopped at %i of %i\n", it.at, dlen);
+
+			units16 = str_to_utf16(&arena, mkstr(d, dlen), &n);
+			if (want < dlen && (units16 || n != -1 - want) && errors++ < 10)
+				printf("str_to_utf16 of invalid text: %i, not %i\n", n, -1 - want);
+		}
+		arena_clear(&arena, 0);
+	}
+
+	// by hand: the invalid parts are the "maximal subparts"
+	{
+		struct { char *s; int len; int lens[4]; } cases[] = {
+			{"\xe0\x80\x80", 3, {1, 1, 1}},
+			{"\xe2\x82" "A", 3, {2, 1}},
+			{"\xf0\x9f\x98", 3, {3}},
+			{"\xed\xa0\x80", 3, {1, 1, 1}},
+			{"\xf4\x90\x80\x80", 4, {1, 1, 1, 1}},
+			{"\xc0\xaf", 2, {1, 1}},
+			{"\xf0\x9f\x98\x80", 4, {4}},
+		};
+		for (int i = 0; i < COUNT_ARRAY(cases); i++) {
+			StrUtf8Iter it = str_utf8_iter(mkstr(cases[i].s, cases[i].len));
+			int c, k = 0, at = 0, parts = 0;
+			while (parts < 4 && cases[i].lens[parts]) parts++;
+			for (; at = it.at, str_utf8_next(&it, &c); k++)
+				if (k == parts || it.at - at != cases[i].lens[k]) break;
+			if (k != parts && errors++ < 10) printf("maximal subparts of case %i wrong at %i\n", i, k);
+		}
+
+		uint16_t lone[] = {'a', 0xd83d, 0xde00, 'b', 0xde00, 'c'};
+		Str s = str_from_utf16(&arena, lone, 6);
+		if (s.ptr || s.len != -1 - 4) errors++;
+		s = str_from_utf16(&arena, lone, 2);
+		if (s.ptr || s.len != -1 - 1) errors++;
+		s = str_from_utf16(&arena, lone, 4);
+		if (!str_equal(s, cstr("a\xf0\x9f\x98\x80" "b"))) errors++;
+		uint32_t big[] = {'x', 0x10ffff, 0x110000};
+		s = str_from_utf32(&arena, big, 3);
+		if (s.ptr || s.len != -1 - 2) errors++;
+		int n = -1;
+		if (!str_to_utf16(&arena, cstr(""), &n) || n != 0) errors++;
+	}
+
+	arena_destroy(&arena);
+	printf(errors ? "FAIL\n" : "OK\n");
+	return errors != 0;
+}